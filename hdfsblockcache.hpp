@@ -0,0 +1,390 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSBLOCKCACHE_HPP
+#define HDFSBLOCKCACHE_HPP
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hdfssubsplits.hpp"
+#include "hdfsbuffers.hpp"
+
+#define BLOCK_CACHE_BLOCK_SIZE (8 * 1024 * 1024)
+#define BLOCK_CACHE_FILE_PREFIX "h2hblock_"
+#define BLOCK_CACHE_TEMP_PREFIX "h2hblocktmp_"
+
+//Once over capacity, least recently used blocks are removed until this much of it is left
+#define BLOCK_CACHE_EVICT_TO 0.9
+
+struct BlockCacheStats
+{
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long long bytesHit;
+    unsigned long long bytesFilled;
+    unsigned long evicted;
+};
+
+/*
+ * Read-through cache of file blocks in a local directory, on an SSD ideally. Each
+ * block is a file named after its key, which the caller derives from whatever tells
+ * a version of a file apart, and its index; a hit refreshes the file's modification
+ * time, so the least recently used blocks are the oldest ones. All processes of the
+ * node using the directory share its capacity: each adds what it caches to the size
+ * it found on disk and once over capacity rescans the directory and evicts, so the
+ * cache may briefly exceed it by a few blocks.
+ */
+class blockcache
+{
+private:
+    struct CachedBlockFile
+    {
+        double lastUse;
+        unsigned long long size;
+        std::string path;
+
+        bool operator<(const CachedBlockFile & other) const
+        {
+            return lastUse < other.lastUse;
+        }
+    };
+
+    pthread_mutex_t lock;
+    std::string directory;
+    unsigned long long capacity;
+    unsigned long long used;
+    bool sized;
+    BlockCacheStats stats;
+    hdfsbufferpool blockBuffers;
+
+    //Sums up the cached blocks on disk and, with evict, removes the least recently used; the lock is held
+    void scan(bool evict)
+    {
+        std::vector<CachedBlockFile> files;
+        used = 0;
+        sized = true;
+
+        DIR * dir = opendir(directory.c_str());
+        if (!dir)
+            return;
+
+        struct dirent * entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (strncmp(entry->d_name, BLOCK_CACHE_FILE_PREFIX, strlen(BLOCK_CACHE_FILE_PREFIX)) != 0)
+                continue;
+
+            CachedBlockFile file;
+            file.path.assign(directory).append("/").append(entry->d_name);
+            struct stat filestat;
+            if (stat(file.path.c_str(), &filestat) != 0)
+                continue;
+            file.lastUse = filestat.st_mtim.tv_sec + filestat.st_mtim.tv_nsec / 1e9;
+            file.size = filestat.st_size;
+            used += file.size;
+            files.push_back(file);
+        }
+        closedir(dir);
+
+        if (!evict || used <= capacity)
+            return;
+
+        std::sort(files.begin(), files.end());
+        unsigned long long target = (unsigned long long)(capacity * BLOCK_CACHE_EVICT_TO);
+        for (unsigned i = 0; i < files.size() && used > target; i++)
+        {
+            //another process may have evicted it already
+            if (unlink(files[i].path.c_str()) == 0)
+                stats.evicted++;
+            used -= files[i].size;
+        }
+    }
+
+    static bool readFully(int fd, char * buffer, unsigned long length)
+    {
+        unsigned long done = 0;
+        while (done < length)
+        {
+            ssize_t bytesread = pread(fd, buffer + done, length - done, done);
+            if (bytesread <= 0)
+                return false;
+            done += bytesread;
+        }
+        return true;
+    }
+
+    static bool writeFully(int fd, const char * data, unsigned long length)
+    {
+        unsigned long done = 0;
+        while (done < length)
+        {
+            ssize_t written = write(fd, data + done, length - done);
+            if (written <= 0)
+                return false;
+            done += written;
+        }
+        return true;
+    }
+
+public:
+    blockcache() : capacity(0), used(0), sized(false)
+    {
+        pthread_mutex_init(&lock, NULL);
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ~blockcache()
+    {
+        pthread_mutex_destroy(&lock);
+    }
+
+    void configure(const char * _directory, unsigned capacitymb, bool hugepages)
+    {
+        directory.assign(_directory);
+        while (directory.size() > 1 && directory[directory.size() - 1] == '/')
+            directory.erase(directory.size() - 1);
+        capacity = (unsigned long long)capacitymb * 1024 * 1024;
+        used = 0;
+        sized = false;
+        memset(&stats, 0, sizeof(stats));
+        blockBuffers.configure(BLOCK_CACHE_BLOCK_SIZE, hugepages);
+    }
+
+    bool isEnabled() const
+    {
+        return directory.size() > 0 && capacity >= BLOCK_CACHE_BLOCK_SIZE;
+    }
+
+    //The readers' block buffers, slabs are reused by the readers of later sub-splits
+    hdfsbufferpool & getBlockBuffers()
+    {
+        return blockBuffers;
+    }
+
+    void getBlockPath(const std::string & key, unsigned long index, std::string & path) const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "_%lu", index);
+        path.assign(directory).append("/").append(BLOCK_CACHE_FILE_PREFIX).append(key).append(name);
+    }
+
+    //Copies a cached block of exactly length bytes into buffer
+    bool fetch(const std::string & key, unsigned long index, char * buffer, unsigned long length)
+    {
+        __sync_fetch_and_add(&stats.lookups, 1UL);
+
+        std::string path;
+        getBlockPath(key, index, path);
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat filestat;
+        bool found = fstat(fd, &filestat) == 0 && (unsigned long)filestat.st_size == length
+                && readFully(fd, buffer, length);
+        close(fd);
+        if (!found)
+            return false;
+
+        utime(path.c_str(), NULL);
+        __sync_fetch_and_add(&stats.hits, 1UL);
+        __sync_fetch_and_add(&stats.bytesHit, (unsigned long long)length);
+        return true;
+    }
+
+    //Readers only ever see a complete block, it is renamed into place once written
+    void store(const std::string & key, unsigned long index, const char * data, unsigned long length)
+    {
+        std::string path;
+        getBlockPath(key, index, path);
+
+        //threads reading neighbouring sub-splits may both have missed the block they share
+        struct stat filestat;
+        if (stat(path.c_str(), &filestat) == 0)
+            return;
+
+        std::string temppath(directory);
+        temppath.append("/").append(BLOCK_CACHE_TEMP_PREFIX).append("XXXXXX");
+        std::vector<char> tempname(temppath.begin(), temppath.end());
+        tempname.push_back('\0');
+        int fd = mkstemp(&tempname[0]);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Could not cache block %lu in %s\n", index, directory.c_str());
+            return;
+        }
+
+        //the node's other connector processes read and evict it too
+        bool written = fchmod(fd, 0644) == 0 && writeFully(fd, data, length);
+        written = close(fd) == 0 && written;
+        if (!written || rename(&tempname[0], path.c_str()) != 0)
+        {
+            unlink(&tempname[0]);
+            fprintf(stderr, "Could not cache block %lu in %s\n", index, directory.c_str());
+            return;
+        }
+
+        __sync_fetch_and_add(&stats.bytesFilled, (unsigned long long)length);
+
+        pthread_mutex_lock(&lock);
+        if (!sized)
+            scan(false);
+        else
+            used += length;
+        if (used > capacity)
+            scan(true);
+        pthread_mutex_unlock(&lock);
+    }
+
+    void report()
+    {
+        if (stats.lookups == 0)
+            return;
+        fprintf(stderr, "Block cache: %lu of %lu blocks read locally (%.1f%%), %llu bytes not fetched from HDFS, "
+                "%llu bytes cached, %lu blocks evicted\n", stats.hits, stats.lookups, stats.hits * 100.0 / stats.lookups,
+                stats.bytesHit, stats.bytesFilled, stats.evicted);
+    }
+};
+
+/*
+ * Reads a file through the block cache: whole aligned blocks are taken from the cache,
+ * or read from the underlying reader and cached, then handed out in pieces. The
+ * underlying reader is positioned for the rest of the range sought, so consecutive
+ * misses read on from where the last one stopped.
+ */
+class cachedrangereader : public hdfsrangereader
+{
+private:
+    hdfsrangereader * reader;
+    blockcache & cache;
+    std::string key;
+    unsigned long fileSize;
+    unsigned long position;
+    unsigned long rangeEnd;
+    unsigned long readerPosition;
+    bool readerPositioned;
+    pooledbuffer block;
+    unsigned long blockIndex;
+    unsigned long blockLength;
+    bool blockLoaded;
+
+    bool loadBlock(unsigned long index)
+    {
+        unsigned long blockstart = index * BLOCK_CACHE_BLOCK_SIZE;
+        unsigned long expected = std::min((unsigned long)BLOCK_CACHE_BLOCK_SIZE, fileSize - blockstart);
+
+        blockLoaded = false;
+        if (cache.fetch(key, index, block.data(), expected))
+        {
+            blockIndex = index;
+            blockLength = expected;
+            blockLoaded = true;
+            return true;
+        }
+
+        if (!readerPositioned || readerPosition != blockstart)
+        {
+            unsigned long blockend = blockstart + expected;
+            if (!reader->seek(blockstart, std::max(rangeEnd, blockend) - blockstart))
+                return false;
+            readerPositioned = true;
+            readerPosition = blockstart;
+        }
+
+        unsigned long got = 0;
+        while (got < expected)
+        {
+            long bytesread = reader->read(block.data() + got, expected - got);
+            if (bytesread < 0)
+            {
+                readerPositioned = false;
+                return false;
+            }
+            if (bytesread == 0)
+                break;
+            got += bytesread;
+        }
+        readerPosition += got;
+
+        //a file shorter than its status said is served as found, but not cached
+        if (got == expected)
+            cache.store(key, index, block.data(), got);
+
+        blockIndex = index;
+        blockLength = got;
+        blockLoaded = true;
+        return true;
+    }
+
+public:
+    cachedrangereader(hdfsrangereader * _reader, blockcache & _cache, const std::string & _key, unsigned long _fileSize)
+        : reader(_reader), cache(_cache), key(_key), fileSize(_fileSize), position(0), rangeEnd(0), readerPosition(0),
+          readerPositioned(false), block(_cache.getBlockBuffers()), blockIndex(0), blockLength(0), blockLoaded(false)
+    {
+    }
+
+    ~cachedrangereader()
+    {
+        delete reader;
+    }
+
+    bool isValid() const
+    {
+        return block.isValid();
+    }
+
+    bool seek(unsigned long offset, unsigned long length)
+    {
+        position = offset;
+        rangeEnd = length < fileSize - std::min(offset, fileSize) ? offset + length : fileSize;
+        return true;
+    }
+
+    long read(char * buffer, unsigned long length)
+    {
+        if (position >= fileSize || length == 0)
+            return 0;
+
+        unsigned long index = position / BLOCK_CACHE_BLOCK_SIZE;
+        if ((!blockLoaded || blockIndex != index) && !loadBlock(index))
+            return -1;
+
+        unsigned long inblock = position - index * BLOCK_CACHE_BLOCK_SIZE;
+        if (inblock >= blockLength)
+            return 0;
+
+        unsigned long count = std::min(length, blockLength - inblock);
+        memcpy(buffer, block.data() + inblock, count);
+        position += count;
+        return count;
+    }
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSBUFFERS_HPP
+#define HDFSBUFFERS_HPP
+
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <vector>
+
+/*
+ * Read buffers taken from a pool of equally sized slabs rather than the stack or the
+ * heap, so multi-MB -buffsize values are safe and a buffer's pages are faulted in
+ * once and then reused by every later read. Slabs of a huge page or more come from
+ * the reserved huge pages when there are any, else from huge page aligned memory
+ * the kernel is advised to back with transparent huge pages.
+ */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+class hdfsbufferpool
+{
+private:
+    pthread_mutex_t lock;
+    size_t slabSize;
+    size_t mappedSize;
+    bool hugePages;
+    std::vector<char *> freeSlabs;
+
+    hdfsbufferpool(const hdfsbufferpool &);
+    hdfsbufferpool & operator=(const hdfsbufferpool &);
+
+    static size_t roundUp(size_t size, size_t unit)
+    {
+        return (size + unit - 1) / unit * unit;
+    }
+
+    char * mapSlab()
+    {
+        if (!hugePages || mappedSize % HUGE_PAGE_SIZE)
+        {
+            void * slab = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            return slab == MAP_FAILED ? NULL : (char *)slab;
+        }
+
+#ifdef MAP_HUGETLB
+        void * reserved = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (reserved != MAP_FAILED)
+            return (char *)reserved;
+#endif
+
+        //over-map by a huge page and trim, transparent huge pages need aligned memory
+        void * mapped = mmap(NULL, mappedSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            return NULL;
+
+        char * start = (char *)mapped;
+        char * aligned = (char *)roundUp((size_t)start, HUGE_PAGE_SIZE);
+        size_t head = aligned - start;
+        if (head > 0)
+            munmap(start, head);
+        munmap(aligned + mappedSize, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, mappedSize, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+
+    void unmapFreeSlabs()
+    {
+        for (unsigned i = 0; i < freeSlabs.size(); i++)
+            munmap(freeSlabs[i], mappedSize);
+        freeSlabs.clear();
+    }
+
+public:
+    hdfsbufferpool() : slabSize(0), mappedSize(0), hugePages(true)
+    {
+        pthread_mutex_init(&lock, NULL);
+    }
+
+    ~hdfsbufferpool()
+    {
+        unmapFreeSlabs();
+        pthread_mutex_destroy(&lock);
+    }
+
+    //Slabs handed out earlier must have been released, a changed size drops the pooled ones
+    void configure(size_t slabsize, bool hugepages)
+    {
+        size_t pagesize = sysconf(_SC_PAGESIZE);
+        size_t mappedsize = hugepages && slabsize >= HUGE_PAGE_SIZE ? roundUp(slabsize, HUGE_PAGE_SIZE) : roundUp(slabsize, pagesize);
+
+        pthread_mutex_lock(&lock);
+        if (mappedsize != mappedSize || hugepages != hugePages)
+            unmapFreeSlabs();
+        slabSize = slabsize;
+        mappedSize = mappedsize;
+        hugePages = hugepages;
+        pthread_mutex_unlock(&lock);
+    }
+
+    size_t getSlabSize() const
+    {
+        return slabSize;
+    }
+
+    //Returns NULL if no memory could be mapped
+    char * acquire()
+    {
+        char * slab = NULL;
+
+        pthread_mutex_lock(&lock);
+        if (freeSlabs.size() > 0)
+        {
+            slab = freeSlabs.back();
+            freeSlabs.pop_back();
+        }
+        else if (mappedSize > 0)
+            slab = mapSlab();
+        pthread_mutex_unlock(&lock);
+
+        if (!slab && mappedSize > 0)
+            fprintf(stderr, "Could not map a read buffer of %lu bytes\n", (unsigned long)mappedSize);
+        return slab;
+    }
+
+    void release(char * slab)
+    {
+        if (!slab)
+            return;
+
+        pthread_mutex_lock(&lock);
+        freeSlabs.push_back(slab);
+        pthread_mutex_unlock(&lock);
+    }
+};
+
+//A slab of pool for the scope it is declared in
+class pooledbuffer
+{
+private:
+    hdfsbufferpool & pool;
+    char * slab;
+
+    pooledbuffer(const pooledbuffer &);
+    pooledbuffer & operator=(const pooledbuffer &);
+
+public:
+    pooledbuffer(hdfsbufferpool & _pool) : pool(_pool), slab(_pool.acquire()) {}
+
+    ~pooledbuffer()
+    {
+        pool.release(slab);
+    }
+
+    bool isValid() const
+    {
+        return slab != NULL;
+    }
+
+    char * data() const
+    {
+        return slab;
+    }
+
+    size_t size() const
+    {
+        return pool.getSlabSize();
+    }
+};
+
+#endif
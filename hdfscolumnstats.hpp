@@ -0,0 +1,648 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSCOLUMNSTATS_HPP
+#define HDFSCOLUMNSTATS_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+#include "hdfsrecordboundary.hpp"
+#include "hdfspartitioning.hpp"
+
+/*
+ * Column statistics sidecar, written to <filename>-stats/part_<node>_<count>.stats
+ * by the write path. It is a tab separated text file:
+ *
+ *   H2HSTATS  1  <FLAT|CSV>  <field spec>
+ *   BLOCK     <part name>  <offset>  <length>  <rows>  [<nulls>  <min>  <max>]...
+ *   PART      <part name>  0  <length>  <rows>  [<nulls>  <min>  <max>]...
+ *
+ * BLOCK offsets are record aligned so a reader can stream a block on its own.
+ */
+#define COLUMN_STATS_VERSION "1"
+#define DEFAULT_STATS_BLOCK_ROWS 10000
+
+struct ColumnStatsField
+{
+    std::string key;
+    unsigned field;
+    unsigned long offset;
+    unsigned long length;
+    bool numeric;
+};
+
+struct ColumnStatsValue
+{
+    unsigned long nulls;
+    bool hasValue;
+    std::string min;
+    std::string max;
+};
+
+/*
+ * Parses a comma separated list of fields, <field>[:n] for CSV (1-based field index)
+ * or <offset>:<length>[:n] for FLAT, the ':n' suffix compares values numerically.
+ */
+static bool parseColumnStatsFields(const char * spec, bool isFlat, std::vector<ColumnStatsField> & fields)
+{
+    std::string remaining(spec);
+    while (remaining.size() > 0)
+    {
+        size_t comma = remaining.find(',');
+        std::string key = remaining.substr(0, comma);
+        remaining = comma == std::string::npos ? "" : remaining.substr(comma + 1);
+
+        ColumnStatsField field;
+        field.field = 0;
+        field.offset = 0;
+        field.length = 0;
+        field.numeric = key.size() > 2 && key.compare(key.size() - 2, 2, ":n") == 0;
+        if (field.numeric)
+            key.erase(key.size() - 2);
+        field.key = key;
+
+        if (isFlat)
+        {
+            if (sscanf(key.c_str(), "%lu:%lu", &field.offset, &field.length) != 2 || field.length == 0)
+                return false;
+        }
+        else if ((field.field = atoi(key.c_str())) == 0)
+            return false;
+
+        fields.push_back(field);
+    }
+    return fields.size() > 0;
+}
+
+static int compareColumnStatsValues(const std::string & left, const std::string & right, bool numeric)
+{
+    if (numeric)
+    {
+        double leftvalue = strtod(left.c_str(), NULL);
+        double rightvalue = strtod(right.c_str(), NULL);
+        return leftvalue < rightvalue ? -1 : (leftvalue > rightvalue ? 1 : 0);
+    }
+    return left.compare(right);
+}
+
+static void escapeColumnStatsValue(const std::string & value, std::string & escaped)
+{
+    for (unsigned i = 0; i < value.size(); i++)
+    {
+        switch (value[i])
+        {
+        case '\t':
+            escaped.append("\\t");
+            break;
+        case '\n':
+            escaped.append("\\n");
+            break;
+        case '\r':
+            escaped.append("\\r");
+            break;
+        case '\\':
+            escaped.append("\\\\");
+            break;
+        default:
+            escaped.append(1, value[i]);
+        }
+    }
+}
+
+static void unescapeColumnStatsValue(const std::string & escaped, std::string & value)
+{
+    for (unsigned i = 0; i < escaped.size(); i++)
+    {
+        if (escaped[i] != '\\' || i + 1 == escaped.size())
+        {
+            value.append(1, escaped[i]);
+            continue;
+        }
+
+        switch (escaped[++i])
+        {
+        case 't':
+            value.append(1, '\t');
+            break;
+        case 'n':
+            value.append(1, '\n');
+            break;
+        case 'r':
+            value.append(1, '\r');
+            break;
+        default:
+            value.append(1, escaped[i]);
+        }
+    }
+}
+
+/*
+ * Receives the records of each part written, in order, and produces the content of
+ * one sidecar file. Row block boundaries are decided by the rowblockcollector.
+ */
+class rowblockobserver
+{
+protected:
+    std::string sidecar;
+    std::string partName;
+
+    void appendPosition(const char * kind, unsigned long offset, unsigned long length, unsigned long rows)
+    {
+        char numbers[64];
+        sidecar.append(kind).append("\t");
+        escapeColumnStatsValue(partName, sidecar);
+        sprintf(numbers, "\t%lu\t%lu\t%lu", offset, length, rows);
+        sidecar.append(numbers);
+    }
+
+public:
+    virtual ~rowblockobserver() {}
+
+    //Directory suffix and file extension of the sidecar, e.g. -stats and .stats
+    virtual const char * getSidecarDir() const = 0;
+    virtual const char * getSidecarExtension() const = 0;
+
+    virtual void startPart(const std::string & name)
+    {
+        partName = name;
+    }
+
+    virtual void addRecord(const char * data, unsigned long length) = 0;
+    virtual void endBlock(unsigned long offset, unsigned long length, unsigned long rows) = 0;
+    virtual void endPart(unsigned long length, unsigned long rows) = 0;
+
+    const std::string & getSidecar() const
+    {
+        return sidecar;
+    }
+};
+
+/*
+ * Cuts the data streamed through the write path into records and row blocks,
+ * and hands them to the sidecar observers.
+ */
+class rowblockcollector
+{
+private:
+    std::vector<rowblockobserver *> observers;
+    recordboundarytracker tracker;
+    unsigned long blockRows;
+    unsigned long blockBytes;
+
+    std::string record;
+    unsigned long partLength;
+    unsigned long partRows;
+    unsigned long blockOffset;
+    unsigned long blockRowCount;
+
+    void endBlock()
+    {
+        if (blockRowCount == 0)
+            return;
+
+        for (unsigned i = 0; i < observers.size(); i++)
+            observers[i]->endBlock(blockOffset, partLength - blockOffset, blockRowCount);
+        blockOffset = partLength;
+        blockRowCount = 0;
+    }
+
+public:
+    rowblockcollector(unsigned long reclen, const std::string & terminator, const std::string & quote, unsigned long blockrows)
+        : tracker(reclen, terminator, quote), blockRows(blockrows > 0 ? blockrows : DEFAULT_STATS_BLOCK_ROWS),
+          blockBytes(0), partLength(0), partRows(0), blockOffset(0), blockRowCount(0)
+    {
+    }
+
+    void setLengthPrefix(unsigned size, bool bigendian)
+    {
+        tracker.setLengthPrefix(size, bigendian);
+    }
+
+    //Row blocks also end once they hold blockbytes, 0 leaves them to the row count alone
+    void setBlockBytes(unsigned long blockbytes)
+    {
+        blockBytes = blockbytes;
+    }
+
+    ~rowblockcollector()
+    {
+        for (unsigned i = 0; i < observers.size(); i++)
+            delete observers[i];
+    }
+
+    //Takes ownership of the observer
+    void addObserver(rowblockobserver * observer)
+    {
+        observers.push_back(observer);
+    }
+
+    unsigned getObserverCount() const
+    {
+        return observers.size();
+    }
+
+    rowblockobserver * getObserver(unsigned index)
+    {
+        return observers[index];
+    }
+
+    void startPart(const std::string & name)
+    {
+        record.clear();
+        partLength = 0;
+        partRows = 0;
+        blockOffset = 0;
+        blockRowCount = 0;
+        for (unsigned i = 0; i < observers.size(); i++)
+            observers[i]->startPart(name);
+    }
+
+    //Consumes raw bytes of the current part, in order
+    void observe(const char * data, unsigned long length)
+    {
+        for (unsigned long taken = 0; taken < length;)
+        {
+            unsigned long piece = tracker.scan(data + taken, length - taken, true);
+            record.append(data + taken, piece);
+            taken += piece;
+
+            if (tracker.atRecordBoundary())
+            {
+                observeRecord(record.c_str(), record.size());
+                record.clear();
+            }
+        }
+    }
+
+    void observeRecord(const char * data, unsigned long length)
+    {
+        for (unsigned i = 0; i < observers.size(); i++)
+            observers[i]->addRecord(data, length);
+
+        partLength += length;
+        partRows++;
+        if (++blockRowCount >= blockRows || (blockBytes > 0 && partLength - blockOffset >= blockBytes))
+            endBlock();
+    }
+
+    void endPart()
+    {
+        //a last record may come without its terminator
+        if (record.size() > 0)
+        {
+            observeRecord(record.c_str(), record.size());
+            record.clear();
+        }
+
+        endBlock();
+        for (unsigned i = 0; i < observers.size(); i++)
+            observers[i]->endPart(partLength, partRows);
+    }
+};
+
+/*
+ * Computes per-part and per-row-block statistics of the designated fields.
+ */
+class columnstatsobserver : public rowblockobserver
+{
+private:
+    std::vector<ColumnStatsField> fields;
+    bool isFlat;
+    std::string separator;
+    std::string quote;
+    std::string terminator;
+
+    std::vector<ColumnStatsValue> partStats;
+    std::vector<ColumnStatsValue> blockStats;
+
+    void resetStats(std::vector<ColumnStatsValue> & stats)
+    {
+        stats.resize(fields.size());
+        for (unsigned i = 0; i < stats.size(); i++)
+        {
+            stats[i].nulls = 0;
+            stats[i].hasValue = false;
+            stats[i].min.clear();
+            stats[i].max.clear();
+        }
+    }
+
+    void updateStats(ColumnStatsValue & stats, const std::string & value, bool numeric)
+    {
+        if (value.size() == 0)
+        {
+            stats.nulls++;
+            return;
+        }
+
+        if (!stats.hasValue || compareColumnStatsValues(value, stats.min, numeric) < 0)
+            stats.min = value;
+        if (!stats.hasValue || compareColumnStatsValues(value, stats.max, numeric) > 0)
+            stats.max = value;
+        stats.hasValue = true;
+    }
+
+    void appendStats(std::vector<ColumnStatsValue> & stats)
+    {
+        char numbers[32];
+        for (unsigned i = 0; i < stats.size(); i++)
+        {
+            sprintf(numbers, "\t%lu\t", stats[i].nulls);
+            sidecar.append(numbers);
+            escapeColumnStatsValue(stats[i].min, sidecar);
+            sidecar.append("\t");
+            escapeColumnStatsValue(stats[i].max, sidecar);
+        }
+        sidecar.append("\n");
+    }
+
+public:
+    columnstatsobserver(const char * spec, const std::vector<ColumnStatsField> & _fields, bool isflat,
+            const std::string & _separator, const std::string & _quote, const std::string & _terminator)
+        : fields(_fields), isFlat(isflat), separator(_separator), quote(_quote), terminator(_terminator)
+    {
+        sidecar.assign("H2HSTATS\t" COLUMN_STATS_VERSION "\t");
+        sidecar.append(isFlat ? "FLAT" : "CSV").append("\t").append(spec).append("\n");
+    }
+
+    const char * getSidecarDir() const
+    {
+        return "-stats";
+    }
+
+    const char * getSidecarExtension() const
+    {
+        return ".stats";
+    }
+
+    void startPart(const std::string & name)
+    {
+        rowblockobserver::startPart(name);
+        resetStats(partStats);
+        resetStats(blockStats);
+    }
+
+    void addRecord(const char * data, unsigned long length)
+    {
+        std::string value;
+        for (unsigned i = 0; i < fields.size(); i++)
+        {
+            if (isFlat)
+                extractFlatField(data, length, fields[i].offset, fields[i].length, value);
+            else
+                extractCsvField(data, length, fields[i].field, separator, quote, terminator, value);
+
+            updateStats(partStats[i], value, fields[i].numeric);
+            updateStats(blockStats[i], value, fields[i].numeric);
+        }
+    }
+
+    void endBlock(unsigned long offset, unsigned long length, unsigned long rows)
+    {
+        appendPosition("BLOCK", offset, length, rows);
+        appendStats(blockStats);
+        resetStats(blockStats);
+    }
+
+    void endPart(unsigned long length, unsigned long rows)
+    {
+        appendPosition("PART", 0, length, rows);
+        appendStats(partStats);
+    }
+};
+
+static void splitSidecarLine(const std::string & line, std::vector<std::string> & columns)
+{
+    size_t start = 0;
+    while (true)
+    {
+        size_t tab = line.find('\t', start);
+        std::string column;
+        unescapeColumnStatsValue(line.substr(start, tab == std::string::npos ? std::string::npos : tab - start), column);
+        columns.push_back(column);
+        if (tab == std::string::npos)
+            break;
+        start = tab + 1;
+    }
+}
+
+static bool getSidecarLine(const std::string & sidecar, size_t & start, std::vector<std::string> & columns)
+{
+    if (start >= sidecar.size())
+        return false;
+
+    size_t eol = sidecar.find('\n', start);
+    columns.clear();
+    splitSidecarLine(sidecar.substr(start, eol == std::string::npos ? std::string::npos : eol - start), columns);
+    start = eol == std::string::npos ? sidecar.size() : eol + 1;
+    return true;
+}
+
+struct RowBlock
+{
+    unsigned long offset;
+    unsigned long length;
+    bool mayMatch;
+};
+
+/*
+ * Decides which parts of a -parts directory, and which row blocks of them, need to be read.
+ * Sidecars restrict it; a part or block survives only if every sidecar loaded says it may match.
+ */
+class rowblockfilter
+{
+private:
+    struct BlockEntry
+    {
+        unsigned long length;
+        bool mayMatch;
+    };
+
+    std::map<std::string, bool> partMatches;
+    std::map<std::string, std::map<unsigned long, BlockEntry> > partBlocks;
+
+public:
+    void restrictPart(const std::string & partname, bool matches)
+    {
+        std::map<std::string, bool>::iterator found = partMatches.find(partname);
+        if (found == partMatches.end())
+            partMatches[partname] = matches;
+        else
+            found->second = found->second && matches;
+    }
+
+    void restrictBlock(const std::string & partname, unsigned long offset, unsigned long length, bool matches)
+    {
+        std::map<unsigned long, BlockEntry> & blocks = partBlocks[partname];
+        std::map<unsigned long, BlockEntry>::iterator found = blocks.find(offset);
+        if (found == blocks.end())
+        {
+            BlockEntry block;
+            block.length = length;
+            block.mayMatch = matches;
+            blocks[offset] = block;
+        }
+        else
+            found->second.mayMatch = found->second.mayMatch && matches;
+    }
+
+    //Parts without sidecars can never be skipped
+    bool partMayMatch(const std::string & partname)
+    {
+        std::map<std::string, bool>::iterator found = partMatches.find(partname);
+        return found == partMatches.end() || found->second;
+    }
+
+    /*
+     * The record aligned blocks of a part, in order, whether they may match or not.
+     * A part its sidecars do not cover from start to end is a single block.
+     */
+    void getBlocks(const std::string & partname, unsigned long partlength, std::vector<RowBlock> & result)
+    {
+        std::map<std::string, std::map<unsigned long, BlockEntry> >::iterator found = partBlocks.find(partname);
+        unsigned long covered = 0;
+        if (found != partBlocks.end())
+        {
+            std::map<unsigned long, BlockEntry> & blocks = found->second;
+            for (std::map<unsigned long, BlockEntry>::iterator block = blocks.begin(); block != blocks.end(); block++)
+            {
+                if (block->first != covered)
+                    break;
+
+                RowBlock entry;
+                entry.offset = block->first;
+                entry.length = block->second.length;
+                entry.mayMatch = block->second.mayMatch;
+                result.push_back(entry);
+                covered += entry.length;
+            }
+        }
+
+        if (covered != partlength)
+        {
+            RowBlock whole;
+            whole.offset = 0;
+            whole.length = partlength;
+            whole.mayMatch = true;
+            result.clear();
+            result.push_back(whole);
+        }
+    }
+
+    //The record aligned byte ranges of a part which need to be read, all of it unless its sidecars cover it
+    void getRangesToRead(const std::string & partname, unsigned long partlength,
+            std::vector<std::pair<unsigned long, unsigned long> > & ranges)
+    {
+        std::vector<RowBlock> blocks;
+        getBlocks(partname, partlength, blocks);
+        for (unsigned i = 0; i < blocks.size(); i++)
+        {
+            if (!blocks[i].mayMatch)
+                continue;
+
+            if (ranges.size() > 0 && ranges.back().first + ranges.back().second == blocks[i].offset)
+                ranges.back().second += blocks[i].length;
+            else
+                ranges.push_back(std::make_pair(blocks[i].offset, blocks[i].length));
+        }
+    }
+};
+
+/*
+ * A range predicate on a field, evaluated against statistics sidecars: parts and
+ * row blocks which cannot hold rows within [rangeMin, rangeMax] are ruled out.
+ */
+class columnstatsrange
+{
+private:
+    std::string rangeField;
+    std::string rangeMin;
+    std::string rangeMax;
+    bool hasMin;
+    bool hasMax;
+
+    bool mayMatch(unsigned long nulls, unsigned long rows, const std::string & min, const std::string & max, bool numeric)
+    {
+        if (nulls >= rows)
+            return false;
+        if (hasMin && compareColumnStatsValues(max, rangeMin, numeric) < 0)
+            return false;
+        if (hasMax && compareColumnStatsValues(min, rangeMax, numeric) > 0)
+            return false;
+        return true;
+    }
+
+public:
+    columnstatsrange(const char * field, const char * min, bool hasmin, const char * max, bool hasmax)
+        : rangeField(field), rangeMin(min), rangeMax(max), hasMin(hasmin), hasMax(hasmax)
+    {
+    }
+
+    bool isActive() const
+    {
+        return rangeField.size() > 0 && (hasMin || hasMax);
+    }
+
+    //Loads one sidecar, returns false if it does not describe the filtered field
+    bool load(const std::string & sidecar, rowblockfilter & filter)
+    {
+        int fieldindex = -1;
+        bool numeric = false;
+
+        size_t start = 0;
+        std::vector<std::string> columns;
+        while (getSidecarLine(sidecar, start, columns))
+        {
+            if (columns[0] == "H2HSTATS" && columns.size() >= 4)
+            {
+                std::vector<ColumnStatsField> fields;
+                if (!parseColumnStatsFields(columns[3].c_str(), columns[2] == "FLAT", fields))
+                    return false;
+                for (unsigned i = 0; i < fields.size(); i++)
+                {
+                    if (fields[i].key == rangeField)
+                    {
+                        fieldindex = i;
+                        numeric = fields[i].numeric;
+                    }
+                }
+            }
+            else if (fieldindex >= 0 && columns.size() >= 5 + 3 * (unsigned)(fieldindex + 1))
+            {
+                unsigned valuecolumn = 5 + 3 * fieldindex;
+                bool matches = mayMatch(strtoul(columns[valuecolumn].c_str(), NULL, 10), strtoul(columns[4].c_str(), NULL, 10),
+                        columns[valuecolumn + 1], columns[valuecolumn + 2], numeric);
+
+                if (columns[0] == "PART")
+                    filter.restrictPart(columns[1], matches);
+                else if (columns[0] == "BLOCK")
+                    filter.restrictBlock(columns[1], strtoul(columns[2].c_str(), NULL, 10), strtoul(columns[3].c_str(), NULL, 10), matches);
+            }
+        }
+
+        return fieldindex >= 0;
+    }
+};
+
+#endif
@@ -16,19 +16,48 @@
  along with this program. If not, see <http://www.gnu.org/licenses/>.
  ############################################################################## */
 
+#ifndef HDFSCONNECTOR_HPP
+#define HDFSCONNECTOR_HPP
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+
+#include "hdfsrecordboundary.hpp"
+#include "hdfspartitioning.hpp"
+#include "hdfscolumnstats.hpp"
+#include "hdfskeyindex.hpp"
+#include "hdfsrecordoffsets.hpp"
+#include "hdfsrowsink.hpp"
+#include "hdfssplicesink.hpp"
+#include "hdfssubsplits.hpp"
+#include "hdfsretry.hpp"
+#include "hdfshedge.hpp"
+#include "hdfsblockcache.hpp"
+#include "hdfsbuffers.hpp"
 
 using namespace std;
 
 #define EOL "\n"
 #define RETURN_FAILURE -1
+#define HDFS_CHECKSUM_CHUNK_SIZE 512
+#define DEFAULT_WRITE_SEGMENT_SIZE (64 * 1024 * 1024)
+//Each write stream holds a whole segment in memory
+#define MAX_WRITE_STREAMS 32
 
 enum HDFSConnectorAction
 {
@@ -43,15 +72,25 @@ enum HDFSConnectorAction
 struct HdfsFileStatus
 {
    long accessTime;
-   int blockSize;
-   const char * group;
+   long blockSize;
+   string group;
    long length;
    long modificationTime;
-   const char * owner;
-   const char * pathSuffix;
-   const char * permission;
+   string owner;
+   string pathSuffix;
+   string permission;
    int replication;
-   const char * type; //"FILE" | "DIRECTORY"
+   string type; //"FILE" | "DIRECTORY" | "SYMLINK"
+};
+
+struct HdfsPartFile
+{
+    string path;
+    string name;
+    unsigned long length;
+    bool isPart;
+    unsigned long node;
+    unsigned long sequence;
 };
 
 template <class T>
@@ -71,6 +110,285 @@ static inline void createFilePartName(string * filepartname, const char * filena
     filepartname->append(template2string(clustercount));
 }
 
+/*
+ * Part files written with -maxpartsize are rolled over as part_<node>_<count>_<seq>
+ */
+static inline void createRolledFilePartName(string * filepartname, const char * filename, unsigned int nodeid, unsigned int clustercount, unsigned long sequence)
+{
+    createFilePartName(filepartname, filename, nodeid, clustercount);
+    filepartname->append("_");
+    filepartname->append(template2string(sequence));
+}
+
+//Hadoop tools ignore files prefixed by '.' or '_' such as _SUCCESS or in-flight segments
+static inline bool isHiddenFileName(const char * name)
+{
+    return name[0] == '.' || name[0] == '_';
+}
+
+static inline const char * getFileNameFromPath(const char * path)
+{
+    const char * lastdelimiter = strrchr(path, '/');
+    return lastdelimiter ? lastdelimiter + 1 : path;
+}
+
+static void initPartFile(HdfsPartFile & part, const char * path, unsigned long length)
+{
+    part.path.assign(path);
+    part.name.assign(getFileNameFromPath(path));
+    part.length = length;
+
+    //part_<node>_<count>[_<seq>]
+    unsigned long count = 0;
+    part.node = 0;
+    part.sequence = 0;
+    int fieldsread = sscanf(part.name.c_str(), "part_%lu_%lu_%lu", &part.node, &count, &part.sequence);
+    part.isPart = fieldsread >= 2;
+}
+
+static bool comparePartFiles(const HdfsPartFile & left, const HdfsPartFile & right)
+{
+    if (left.isPart != right.isPart)
+        return left.isPart;
+    if (left.isPart && left.node != right.node)
+        return left.node < right.node;
+    if (left.isPart && left.sequence != right.sequence)
+        return left.sequence < right.sequence;
+    return left.name < right.name;
+}
+
+/*
+ * Orders the part files of a directory as their logical concatenation and assigns
+ * this node the files which start within its 1/clustercount share of the total size.
+ * Order across nodes is preserved, and rolled parts keep the shares balanced.
+ */
+static void assignPartFiles(vector<HdfsPartFile> & parts, unsigned clustercount, unsigned nodeid, vector<HdfsPartFile> & assigned)
+{
+    sort(parts.begin(), parts.end(), comparePartFiles);
+
+    unsigned long long totalsize = 0;
+    for (unsigned i = 0; i < parts.size(); i++)
+        totalsize += parts[i].length;
+
+    unsigned long long startoffset = 0;
+    for (unsigned i = 0; i < parts.size(); i++)
+    {
+        unsigned owner = totalsize > 0 ? (unsigned)(startoffset * clustercount / totalsize) : 0;
+        if (owner == nodeid)
+            assigned.push_back(parts[i]);
+        startoffset += parts[i].length;
+    }
+}
+
+/*
+ * The metadata a stream-in needs before it reads: the target's status and, for a
+ * directory, its part files. With -sharedplan node 0 looks it up for all nodes,
+ * with -metacache a node keeps it across reads of an unchanged target.
+ */
+#define SPLIT_PLAN_HEADER "H2HPLAN"
+#define SPLIT_PLAN_VERSION 2
+#define DEFAULT_SPLIT_PLAN_TIMEOUT 120
+
+struct SplitPlan
+{
+    bool isDirectory;
+    unsigned long length;
+    unsigned long modificationTime;
+    vector<HdfsPartFile> parts;
+};
+
+static void serializeSplitPlan(const SplitPlan & plan, const char * filename, unsigned clustercount, string & text)
+{
+    string escaped;
+    escapeColumnStatsValue(filename, escaped);
+    text.append(SPLIT_PLAN_HEADER "\t").append(template2string(SPLIT_PLAN_VERSION)).append("\t").append(escaped);
+    text.append("\t").append(template2string(clustercount)).append("\n");
+    text.append("FILE\t").append(plan.isDirectory ? "D" : "F").append("\t").append(template2string(plan.length));
+    text.append("\t").append(template2string(plan.modificationTime)).append("\n");
+
+    for (unsigned i = 0; i < plan.parts.size(); i++)
+    {
+        escaped.clear();
+        escapeColumnStatsValue(plan.parts[i].path, escaped);
+        text.append("PART\t").append(template2string(plan.parts[i].length)).append("\t").append(escaped).append("\n");
+    }
+
+    //a plan is only complete with its END line
+    text.append("END\t").append(template2string(plan.parts.size())).append("\n");
+}
+
+static bool parseSplitPlan(const string & text, const char * filename, unsigned clustercount, SplitPlan & plan)
+{
+    plan.isDirectory = false;
+    plan.length = 0;
+    plan.modificationTime = 0;
+    plan.parts.clear();
+
+    bool headerfound = false;
+    bool filefound = false;
+    size_t pos = 0;
+    vector<string> fields;
+    while (getSidecarLine(text, pos, fields))
+    {
+        if (!headerfound)
+        {
+            string name;
+            if (fields.size() != 4 || fields[0] != SPLIT_PLAN_HEADER || atoi(fields[1].c_str()) != SPLIT_PLAN_VERSION)
+                return false;
+            unescapeColumnStatsValue(fields[2], name);
+            if (name != filename || (unsigned)atoi(fields[3].c_str()) != clustercount)
+                return false;
+            headerfound = true;
+        }
+        else if (fields.size() == 4 && fields[0] == "FILE")
+        {
+            plan.isDirectory = fields[1] == "D";
+            plan.length = strtoul(fields[2].c_str(), NULL, 10);
+            plan.modificationTime = strtoul(fields[3].c_str(), NULL, 10);
+            filefound = true;
+        }
+        else if (fields.size() == 3 && fields[0] == "PART")
+        {
+            string path;
+            unescapeColumnStatsValue(fields[2], path);
+            HdfsPartFile part;
+            initPartFile(part, path.c_str(), strtoul(fields[1].c_str(), NULL, 10));
+            plan.parts.push_back(part);
+        }
+        else if (fields.size() == 2 && fields[0] == "END")
+            return filefound && strtoul(fields[1].c_str(), NULL, 10) == plan.parts.size();
+        else
+            return false;
+    }
+    return false;
+}
+
+/*
+ * Where a -stream, the incremental read of an append-only file, got to: the record
+ * aligned offset up to which its runs have read the file, the window [runStart, runEnd)
+ * the latest run planned from there with the nodes which have read their share of it,
+ * and the file's length and modification time when that was planned. The offset only
+ * moves to runEnd once all nodes have, so the next run reads a window left unconfirmed
+ * again; run again, as a failed workunit is, that run reads the same window once more.
+ */
+#define INGEST_CHECKPOINT_HEADER "H2HCHECKPOINT"
+#define INGEST_CHECKPOINT_VERSION 1
+
+struct IngestCheckpoint
+{
+    string file;
+    unsigned long length;
+    unsigned long modificationTime;
+    unsigned long offset;
+    string run;
+    unsigned long runStart;
+    unsigned long runEnd;
+    vector<unsigned> runNodesDone;
+};
+
+static void serializeIngestCheckpoint(const IngestCheckpoint & checkpoint, const char * stream, string & text)
+{
+    string escaped;
+    escapeColumnStatsValue(stream, escaped);
+    text.append(INGEST_CHECKPOINT_HEADER "\t").append(template2string(INGEST_CHECKPOINT_VERSION)).append("\t").append(escaped).append("\n");
+
+    escaped.clear();
+    escapeColumnStatsValue(checkpoint.file, escaped);
+    text.append("FILE\t").append(escaped).append("\t").append(template2string(checkpoint.length));
+    text.append("\t").append(template2string(checkpoint.modificationTime)).append("\n");
+    text.append("OFFSET\t").append(template2string(checkpoint.offset)).append("\n");
+
+    escaped.clear();
+    escapeColumnStatsValue(checkpoint.run, escaped);
+    text.append("RUN\t").append(escaped).append("\t").append(template2string(checkpoint.runStart));
+    text.append("\t").append(template2string(checkpoint.runEnd)).append("\n");
+    text.append("DONE");
+    for (unsigned i = 0; i < checkpoint.runNodesDone.size(); i++)
+        text.append("\t").append(template2string(checkpoint.runNodesDone[i]));
+    text.append("\nEND\n");
+}
+
+static bool parseIngestCheckpoint(const string & text, const char * stream, IngestCheckpoint & checkpoint)
+{
+    bool headerfound = false;
+    unsigned linesfound = 0;
+    size_t pos = 0;
+    vector<string> fields;
+    while (getSidecarLine(text, pos, fields))
+    {
+        if (!headerfound)
+        {
+            string name;
+            if (fields.size() != 3 || fields[0] != INGEST_CHECKPOINT_HEADER || atoi(fields[1].c_str()) != INGEST_CHECKPOINT_VERSION)
+                return false;
+            unescapeColumnStatsValue(fields[2], name);
+            if (name != stream)
+                return false;
+            headerfound = true;
+        }
+        else if (fields.size() == 4 && fields[0] == "FILE")
+        {
+            checkpoint.file.clear();
+            unescapeColumnStatsValue(fields[1], checkpoint.file);
+            checkpoint.length = strtoul(fields[2].c_str(), NULL, 10);
+            checkpoint.modificationTime = strtoul(fields[3].c_str(), NULL, 10);
+            linesfound++;
+        }
+        else if (fields.size() == 2 && fields[0] == "OFFSET")
+        {
+            checkpoint.offset = strtoul(fields[1].c_str(), NULL, 10);
+            linesfound++;
+        }
+        else if (fields.size() == 4 && fields[0] == "RUN")
+        {
+            checkpoint.run.clear();
+            unescapeColumnStatsValue(fields[1], checkpoint.run);
+            checkpoint.runStart = strtoul(fields[2].c_str(), NULL, 10);
+            checkpoint.runEnd = strtoul(fields[3].c_str(), NULL, 10);
+            linesfound++;
+        }
+        else if (fields.size() >= 1 && fields[0] == "DONE")
+        {
+            checkpoint.runNodesDone.clear();
+            for (unsigned i = 1; i < fields.size(); i++)
+                checkpoint.runNodesDone.push_back(strtoul(fields[i].c_str(), NULL, 10));
+            linesfound++;
+        }
+        else if (fields.size() == 1 && fields[0] == "END")
+            return linesfound == 4;
+        else
+            return false;
+    }
+    return false;
+}
+
+#define FOLLOW_MIN_POLL_MS 100
+#define FOLLOW_MAX_POLL_MS 5000
+#define DEFAULT_FOLLOW_IDLE_TIMEOUT 300
+
+//What a poll of a file followed with -follow finds
+struct FollowStatus
+{
+    unsigned long length;
+    bool closeKnown;
+    bool closed;
+};
+
+/*
+ * Segments of a part written on concurrent streams are hidden files; later segments get
+ * concatenated onto segment 0, which only becomes the part once it is whole.
+ */
+static inline void createFilePartSegmentName(string * segmentname, const char * filename, unsigned int nodeid, unsigned int clustercount, unsigned long segment)
+{
+    segmentname->append(filename);
+    segmentname->append("-parts/.part_");
+    segmentname->append(template2string(nodeid));
+    segmentname->append("_");
+    segmentname->append(template2string(clustercount));
+    segmentname->append(".seg");
+    segmentname->append(template2string(segment));
+}
+
 static void expandEscapedChars(const char * source, string & escaped)
 {
     int si = 0;
@@ -121,54 +439,1386 @@ static void expandEscapedChars(const char * source, string & escaped)
                 break;
             }
         }
-        else
-            escaped.append(1, source[si]);
+        else
+            escaped.append(1, source[si]);
+
+        si++;
+    }
+}
+class hdfsconnector
+{
+protected:
+    HDFSConnectorAction action;
+    unsigned int bufferSize;
+    unsigned int flushThreshold;
+    unsigned clusterCount;
+    unsigned nodeID;
+    unsigned long recLen;
+    unsigned long maxLen;
+    const char * fileName;
+    const char * hadoopHost;
+    int hadoopPort;
+    string format;
+    string foptions;
+    string data;
+    const char * wuid;
+    const char * rowTag;
+    const char * separator;
+    string terminator;
+    bool outputTerminator;
+    string quote;
+    const char * headerText;
+    const char * footerText;
+    const char * hdfsuser;
+    const char * hdfsgroup;
+    const char * pipepath;
+    bool cleanmerge;
+    short filereplication;
+    unsigned short maxRetry;
+    int blockSize;
+    unsigned writeStreams;
+    unsigned long writeSegmentSize;
+    unsigned long maxPartSize;
+    const char * partitionName;
+    unsigned partitionField;
+    unsigned long partitionOffset;
+    unsigned long partitionLength;
+    unsigned maxOpenPartitions;
+    const char * statsFields;
+    unsigned long statsBlockRows;
+    const char * rangeField;
+    const char * rangeMin;
+    const char * rangeMax;
+    const char * indexField;
+    double indexFpp;
+    const char * lookupKeys;
+    const char * lookupKeyFile;
+    const char * jsonFields;
+    const char * jsonWidths;
+    const char * lengthPrefix;
+    unsigned lengthPrefixSize;
+    bool lengthPrefixBigEndian;
+    double sampleFraction;
+    const char * sampleMode;
+    unsigned long long sampleSeed;
+    unsigned long long rowLimit;
+    const char * limitShare;
+    unsigned long long limitReadKey;
+    const char * streamName;
+    const char * checkpointDir;
+    bool ingestWindowPlanned;
+    bool follow;
+    unsigned followIdle;
+    bool verbose;
+    bool zeroCopy;
+    unsigned readThreads;
+    unsigned long subSplitSize;
+    bool directReads;
+    double hedgeFactor;
+    unsigned hedgeDelay;
+    const char * sharedPlan;
+    unsigned planTimeout;
+    const char * metaCache;
+    unsigned metaCacheTtl;
+    const char * blockCacheDir;
+    unsigned blockCacheMb;
+    const char * shortCircuitPath;
+    unsigned long targetModificationTime;
+    ReadRetryStats readRetryStats;
+    hedgepolicy hedging;
+    blockcache blockCache;
+    bool hugePages;
+    hdfsbufferpool readBuffers;
+    filerowsink standardOutput;
+    splicerowsink * spliceOutput;
+    rowbatcher output;
+    rowlimit * outputLimit;
+public:
+    hdfsconnector() : standardOutput(stdout), spliceOutput(NULL), output(&standardOutput, 1024 * 100), outputLimit(NULL) {};
+
+    virtual ~hdfsconnector()
+    {
+        output.flush();
+        if (spliceOutput)
+            delete spliceOutput;
+        if (outputLimit)
+            delete outputLimit;
+    };
+
+    virtual bool connect() = 0;
+    virtual int  execute() = 0 ;
+    virtual int streamFileOffset() = 0;
+    virtual int writeFlatOffset() = 0;
+    virtual int mergeFile() = 0;
+
+    //Streamed in rows go to stdout unless an embedding caller provides its own sink
+    void setOutputSink(hdfsrowsink * sink)
+    {
+        output.setSink(sink ? sink : &standardOutput);
+    }
+
+    void writeOutput(const char * data, unsigned long length)
+    {
+        output.write(data, length);
+    }
+
+    void writeOutput(char data)
+    {
+        output.write(data);
+    }
+
+    //The rows of a share read to its end count towards a shared -limit too
+    bool flushOutput()
+    {
+        if (outputLimit)
+            outputLimit->publish();
+        return output.flush();
+    }
+
+    //This node is done with a shared -limit count, the last node to finish removes it
+    void finishRowLimit()
+    {
+        if (outputLimit)
+            outputLimit->finish();
+    }
+
+    //Once -limit rows are handed over, or the reader closed the output, reads stop early
+    bool isOutputStopped() const
+    {
+        return output.isStopped();
+    }
+
+    void reportReadStats()
+    {
+        if (readRetryStats.retries > 0)
+            fprintf(stderr, "Read retries: %lu, bytes requested again: %lu\n", readRetryStats.retries,
+                    readRetryStats.retriedBytes);
+        hedging.report();
+        blockCache.report();
+    }
+
+    //Connectors able to read a file on several threads at once return a new reader of it
+    virtual hdfsrangereader * openRangeReader(const char * location, unsigned long fileSize)
+    {
+        return NULL;
+    }
+
+    //With -blockcache FLAT and CSV are read as sub-splits too, their readers go through the cache
+    bool isSubSplitRead()
+    {
+        return (readThreads > 1 || isSampling() || isBlockCached()) && (strcmp(format.c_str(), "FLAT") == 0 || strcmp(format.c_str(), "CSV") == 0);
+    }
+
+    //Appended or followed files change under the read, what they add is read once
+    bool isBlockCached()
+    {
+        return blockCache.isEnabled() && action == HCA_STREAMIN && !isIncrementalRead() && !isFollowRead();
+    }
+
+    /*
+     * With -blockcache sub-splits are read through this node's local block cache. Blocks
+     * are keyed by cluster, location, the target's modification time and the file's
+     * length, so a file written again is fetched again; a target whose modification
+     * time is unknown is not cached.
+     */
+    hdfsrangereader * openSubSplitReader(const char * location, unsigned long fileSize)
+    {
+        hdfsrangereader * reader = openRangeReader(location, fileSize);
+        if (!reader || !isBlockCached() || targetModificationTime == 0)
+            return reader;
+
+        string version(hadoopHost);
+        version.append(":").append(template2string(hadoopPort)).append(":").append(location);
+        version.append(":").append(template2string(targetModificationTime)).append(":").append(template2string(fileSize));
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", hashIndexKey(version));
+
+        cachedrangereader * cached = new cachedrangereader(reader, blockCache, key, fileSize);
+        if (!cached->isValid())
+        {
+            delete cached;
+            return NULL;
+        }
+        return cached;
+    }
+
+    //Samples are taken by the sub-split readers, whatever -threads is
+    bool isSampling()
+    {
+        return sampleFraction < 1;
+    }
+
+    /*
+     * Streams the FLAT bytes, or the CSV or JSON records which start, within [start, end)
+     * of the file, cut into sub-splits which up to readThreads threads read.
+     */
+    int streamSubSplits(const char * location, unsigned long fileSize, unsigned long start, unsigned long end)
+    {
+        SubSplitOptions options;
+        options.csv = strcmp(format.c_str(), "CSV") == 0;
+        options.json = strcmp(format.c_str(), "JSON") == 0;
+        parseJsonProjection(jsonFields, jsonWidths, options.projection);
+        options.projection.separator = strlen(separator) > 0 ? separator : ",";
+        options.projection.quote = quote.size() > 0 ? quote[0] : '\0';
+        options.projection.terminator = terminator;
+        options.terminator = terminator;
+        options.quote = quote;
+        options.separator = separator;
+        options.outputTerminator = outputTerminator;
+        options.maxLen = maxLen;
+        options.bufferSize = bufferSize;
+        options.buffers = &readBuffers;
+        options.recLen = options.csv || options.json ? 0 : recLen;
+        options.sampleFraction = sampleFraction;
+        options.sampleRows = strcmp(sampleMode, "row") == 0;
+
+        //the parts of a directory each draw their own sample
+        options.sampleSeed = sampleSeed ^ hashIndexKey(getFileNameFromPath(location));
+        if (isSampling())
+            fprintf(stderr, "Sampling %g of %s by %s\n", sampleFraction, location, sampleMode);
+
+        subsplitreader reader(options);
+        reader.plan(start, end, subSplitSize, options.recLen);
+        if (reader.getSplitCount() == 0)
+            return EXIT_SUCCESS;
+
+        vector<hdfsrangereader *> readers;
+        while (readers.size() < readThreads && readers.size() < reader.getSplitCount())
+        {
+            hdfsrangereader * rangereader = openSubSplitReader(location, fileSize);
+            if (!rangereader)
+                break;
+            readers.push_back(rangereader);
+        }
+
+        if (readers.size() == 0)
+        {
+            fprintf(stderr, "Could not open %s for reading\n", location);
+            return RETURN_FAILURE;
+        }
+
+        fprintf(stderr, "Reading %lu-%lu of %s in %lu sub-split(s) on %lu thread(s)\n", start, end, location,
+                reader.getSplitCount(), (unsigned long)readers.size());
+
+        bool succeeded = reader.read(readers, output);
+
+        for (unsigned i = 0; i < readers.size(); i++)
+            delete readers[i];
+
+        return succeeded || isOutputStopped() ? EXIT_SUCCESS : RETURN_FAILURE;
+    }
+
+    /*
+     * Whether the scan of this node's CSV share, which begins a terminator length before
+     * start, begins within a quoted field. Found before streaming, so a terminator within
+     * a quoted field is not taken for the end of the record before the share.
+     */
+    bool isShareWithinQuote(const char * location, unsigned long fileSize, unsigned long start)
+    {
+        unsigned eolseqlen = terminator.size();
+        unsigned long position = start > eolseqlen ? start - eolseqlen : 0;
+        if (position == 0 || quote.size() == 0)
+            return false;
+
+        hdfsrangereader * reader = openRangeReader(location, fileSize);
+        if (!reader)
+        {
+            fprintf(stderr, "Could not open %s to find the quote state at %lu, assuming outside quotes\n", location, position);
+            return false;
+        }
+
+        pooledbuffer readbuffer(readBuffers);
+        bool within = readbuffer.isValid() && speculateCSVQuoteState(reader, position, quote[0], separator, terminator,
+                readbuffer.data(), bufferSize);
+        delete reader;
+        return within;
+    }
+
+    //JSON Lines are read as sub-splits whatever -threads is, this node's share is split like CSV
+    int streamJSONLines(const char * location, unsigned long fileSize, unsigned long start, unsigned long end)
+    {
+        fprintf(stderr, "Filesize: %lu, Offset: %lu, readlen: %lu\n", fileSize, start, end - start);
+        return start < end ? streamSubSplits(location, fileSize, start, end) : EXIT_SUCCESS;
+    }
+
+    int streamJSONLines(const char * location, unsigned long fileSize)
+    {
+        unsigned long offset = (fileSize / clusterCount) * nodeID;
+        return streamJSONLines(location, fileSize, offset,
+                nodeID == clusterCount - 1 ? fileSize : offset + fileSize / clusterCount);
+    }
+
+    //Fills in the target's type, length and modification time
+    virtual bool getTargetStatus(SplitPlan & plan) = 0;
+
+    //The target as listDirectory expects it
+    virtual const char * getTargetLocation()
+    {
+        return fileName;
+    }
+
+    //Looks up the target's status and, for a directory, its visible part files
+    bool computeSplitPlan(SplitPlan & plan)
+    {
+        if (!getTargetStatus(plan))
+            return false;
+
+        plan.parts.clear();
+        return !plan.isDirectory || listDirectory(getTargetLocation(), plan.parts) == EXIT_SUCCESS;
+    }
+
+    bool isSharedPlan()
+    {
+        return strlen(sharedPlan) > 0 && action == HCA_STREAMIN;
+    }
+
+    //Nodes other than 0 leave the NameNode alone and wait for node 0's plan
+    bool isSharedPlanFollower()
+    {
+        return isSharedPlan() && nodeID > 0;
+    }
+
+    bool isMetadataCached()
+    {
+        return strlen(metaCache) > 0 && action == HCA_STREAMIN;
+    }
+
+    static void appendFileNameSafe(string & path, const char * name)
+    {
+        for (const char * c = name; *c; c++)
+            path.append(1, isalnum(*c) || *c == '-' || *c == '.' ? *c : '_');
+    }
+
+    static void getPlanFilePath(const char * directory, const char * prefix, string & path)
+    {
+        path.assign(directory);
+        if (path.size() > 0 && path[path.size() - 1] != '/')
+            path.append("/");
+        path.append(prefix);
+    }
+
+    void getSharedPlanPath(string & path)
+    {
+        getPlanFilePath(sharedPlan, "h2hplan_", path);
+        appendFileNameSafe(path, wuid);
+        path.append("_");
+        appendFileNameSafe(path, fileName);
+    }
+
+    bool isLimitShared()
+    {
+        return strlen(limitShare) > 0 && rowLimit > 0 && action == HCA_STREAMIN;
+    }
+
+    //Different reads of a file in one workunit, told apart by their parameters, count apart
+    void getLimitSharePath(string & path)
+    {
+        getPlanFilePath(limitShare, "h2hlimit_", path);
+        appendFileNameSafe(path, wuid);
+        path.append("_");
+        appendFileNameSafe(path, fileName);
+        char key[18];
+        snprintf(key, sizeof(key), "_%016llx", limitReadKey);
+        path.append(key);
+    }
+
+    //Parameters all nodes of a read share, that is all of them but -nodeid
+    static unsigned long long getReadKey(int argc, char ** argv)
+    {
+        string params;
+        for (int i = 1; i < argc; i++)
+        {
+            if (strcmp(argv[i], "-nodeid") == 0)
+                i++;
+            else
+                params.append(argv[i]).append(1, '\0');
+        }
+        return hashIndexKey(params);
+    }
+
+    //Cached plans are per cluster and path, whoever reads them and on however many nodes
+    void getMetadataCachePath(string & path)
+    {
+        getPlanFilePath(metaCache, "h2hmeta_", path);
+        appendFileNameSafe(path, hadoopHost);
+        path.append("_").append(template2string(hadoopPort)).append("_");
+        appendFileNameSafe(path, fileName);
+    }
+
+    //Readers only ever see a complete file, it is renamed into place once written
+    static bool replacePlanFile(const string & path, const string & text)
+    {
+        string temppath(path);
+        temppath.append(".").append(template2string(getpid())).append(".tmp");
+        FILE * planfile = fopen(temppath.c_str(), "w");
+        if (!planfile)
+            return false;
+
+        bool written = fwrite(text.c_str(), 1, text.size(), planfile) == text.size();
+        written = fclose(planfile) == 0 && written;
+        if (!written || rename(temppath.c_str(), path.c_str()) != 0)
+        {
+            unlink(temppath.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    static bool readPlanFile(const string & path, string & text)
+    {
+        FILE * planfile = fopen(path.c_str(), "r");
+        if (!planfile)
+            return false;
+
+        char buffer[4096];
+        size_t bytesread;
+        while ((bytesread = fread(buffer, 1, sizeof(buffer), planfile)) > 0)
+            text.append(buffer, bytesread);
+        fclose(planfile);
+        return true;
+    }
+
+    bool writeSplitPlanFile(const SplitPlan & plan, const string & path, unsigned clustercount)
+    {
+        string text;
+        serializeSplitPlan(plan, fileName, clustercount, text);
+        return replacePlanFile(path, text);
+    }
+
+    bool readSplitPlanFile(const string & path, unsigned clustercount, SplitPlan & plan)
+    {
+        string text;
+        return readPlanFile(path, text) && parseSplitPlan(text, fileName, clustercount, plan);
+    }
+
+    bool isIncrementalRead()
+    {
+        return strlen(streamName) > 0 && action == HCA_STREAMIN;
+    }
+
+    void getCheckpointPath(string & path)
+    {
+        getPlanFilePath(checkpointDir, "h2hstream_", path);
+        appendFileNameSafe(path, streamName);
+    }
+
+    bool readIngestCheckpoint(const string & path, IngestCheckpoint & checkpoint)
+    {
+        string text;
+        return readPlanFile(path, text) && parseIngestCheckpoint(text, streamName, checkpoint);
+    }
+
+    //Where the last whole record before fileSize ends, reads of a file still growing end there
+    bool findWholeRecordsEnd(const char * location, unsigned long fileSize, unsigned long start, unsigned long & end)
+    {
+        if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            end = start + (fileSize - start) / recLen * recLen;
+            return true;
+        }
+
+        hdfsrangereader * reader = openRangeReader(location, fileSize);
+        if (!reader)
+            return false;
+
+        //JSON Lines end with a newline, JSON strings hold no raw ones
+        bool json = strcmp(format.c_str(), "JSON") == 0;
+        pooledbuffer readbuffer(readBuffers);
+        bool found = readbuffer.isValid() && findLastRecordEnd(reader, start, fileSize, json ? string("\n") : terminator,
+                json ? string("") : quote, separator, readbuffer.data(), bufferSize, end);
+        delete reader;
+        return found;
+    }
+
+    //Serializes the nodes' updates of a checkpoint, the file itself is replaced on each
+    static int lockIngestCheckpoint(const string & path)
+    {
+        string lockpath(path);
+        lockpath.append(".lock");
+        int lock = open(lockpath.c_str(), O_RDWR | O_CREAT, 0666);
+        if (lock >= 0 && flock(lock, LOCK_EX) != 0)
+        {
+            close(lock);
+            lock = -1;
+        }
+        if (lock < 0)
+            fprintf(stderr, "Could not lock checkpoint %s: %s\n", path.c_str(), strerror(errno));
+        return lock;
+    }
+
+    static void unlockIngestCheckpoint(int lock)
+    {
+        flock(lock, LOCK_UN);
+        close(lock);
+    }
+
+    /*
+     * The window [start, end) of the file this run of -stream reads, from the last
+     * confirmed offset to the end of the last whole record, a partial record at the end
+     * of the file is left to the next run. Node 0 plans it and checkpoints it as pending
+     * before reading, the other nodes wait for this run's checkpoint.
+     */
+    bool planIngestWindow(const char * location, const SplitPlan & plan, unsigned long & start, unsigned long & end)
+    {
+        string path;
+        getCheckpointPath(path);
+
+        IngestCheckpoint checkpoint;
+        if (nodeID > 0)
+        {
+            if (!waitForIngestCheckpoint(path, checkpoint))
+                return false;
+
+            start = checkpoint.runStart;
+            end = checkpoint.runEnd;
+            fprintf(stderr, "Stream %s: reading %lu-%lu of %s as checkpointed for this run\n", streamName, start, end, fileName);
+            ingestWindowPlanned = true;
+            return true;
+        }
+
+        int lock = lockIngestCheckpoint(path);
+        if (lock < 0)
+            return false;
+        ingestWindowPlanned = planIngestCheckpoint(location, plan, path, checkpoint);
+        unlockIngestCheckpoint(lock);
+
+        start = checkpoint.runStart;
+        end = checkpoint.runEnd;
+        return ingestWindowPlanned;
+    }
+
+    bool waitForIngestCheckpoint(const string & path, IngestCheckpoint & checkpoint)
+    {
+        bool found = readIngestCheckpoint(path, checkpoint);
+        unsigned long waitedms = 0;
+        unsigned long delayms = 100;
+        while (!found || checkpoint.run != wuid)
+        {
+            if (found && checkpoint.file != fileName)
+            {
+                fprintf(stderr, "Checkpoint %s of stream %s is of %s, not %s\n", path.c_str(), streamName,
+                        checkpoint.file.c_str(), fileName);
+                return false;
+            }
+
+            if (waitedms >= planTimeout * 1000UL)
+            {
+                fprintf(stderr, "No checkpoint of this run found in %s after %u secs\n", path.c_str(), planTimeout);
+                return false;
+            }
+
+            unsigned long sleepms = min(delayms, planTimeout * 1000UL - waitedms);
+            usleep(sleepms * 1000);
+            waitedms += sleepms;
+            delayms = min(delayms * 2, 2000UL);
+            found = readIngestCheckpoint(path, checkpoint);
+        }
+        return true;
+    }
+
+    //Node 0's part of planIngestWindow, the checkpoint is locked
+    bool planIngestCheckpoint(const char * location, const SplitPlan & plan, const string & path, IngestCheckpoint & checkpoint)
+    {
+        bool found = readIngestCheckpoint(path, checkpoint);
+        if (found && checkpoint.file != fileName)
+        {
+            fprintf(stderr, "Checkpoint %s of stream %s is of %s, not %s\n", path.c_str(), streamName,
+                    checkpoint.file.c_str(), fileName);
+            return false;
+        }
+
+        if (found && checkpoint.run == wuid)
+        {
+            fprintf(stderr, "Stream %s: reading %lu-%lu of %s as checkpointed for this run\n", streamName,
+                    checkpoint.runStart, checkpoint.runEnd, fileName);
+            return true;
+        }
+
+        unsigned long start = found ? checkpoint.offset : 0;
+        if (found && checkpoint.offset < checkpoint.runEnd)
+            fprintf(stderr, "Stream %s: %lu-%lu of %s, planned by run %s, was not read by all its nodes and is read again\n",
+                    streamName, checkpoint.runStart, checkpoint.runEnd, fileName, checkpoint.run.c_str());
+
+        if (found && (plan.length < checkpoint.length || plan.modificationTime < checkpoint.modificationTime))
+        {
+            fprintf(stderr, "%s is no longer the file checkpointed at %lu bytes, reading it from the start\n",
+                    fileName, checkpoint.length);
+            start = 0;
+        }
+
+        unsigned long end;
+        if (!findWholeRecordsEnd(location, plan.length, start, end))
+        {
+            fprintf(stderr, "Could not find the last record end of %s\n", fileName);
+            return false;
+        }
+
+        //the offset stays where the last confirmed window ended until all nodes have read this one
+        checkpoint.file = fileName;
+        checkpoint.length = plan.length;
+        checkpoint.modificationTime = plan.modificationTime;
+        checkpoint.offset = start;
+        checkpoint.run = wuid;
+        checkpoint.runStart = start;
+        checkpoint.runEnd = end;
+        checkpoint.runNodesDone.clear();
+
+        string text;
+        serializeIngestCheckpoint(checkpoint, streamName, text);
+        if (!replacePlanFile(path, text))
+        {
+            fprintf(stderr, "Could not write checkpoint %s\n", path.c_str());
+            return false;
+        }
+
+        fprintf(stderr, "Stream %s: reading %lu-%lu of %s, %lu bytes left to the next run\n", streamName, start, end,
+                fileName, plan.length - end);
+        return true;
+    }
+
+    /*
+     * Records that this node has handed over its share of this run's -stream window;
+     * once all nodes have, the checkpoint's offset moves on to the window's end.
+     */
+    void confirmIngestWindow()
+    {
+        if (!ingestWindowPlanned)
+            return;
+        ingestWindowPlanned = false;
+
+        string path;
+        getCheckpointPath(path);
+        int lock = lockIngestCheckpoint(path);
+        if (lock < 0)
+            return;
+
+        IngestCheckpoint checkpoint;
+        if (readIngestCheckpoint(path, checkpoint) && checkpoint.run == wuid && checkpoint.file == fileName)
+        {
+            vector<unsigned> & done = checkpoint.runNodesDone;
+            if (find(done.begin(), done.end(), nodeID) == done.end())
+                done.push_back(nodeID);
+            if (done.size() >= clusterCount && checkpoint.offset < checkpoint.runEnd)
+            {
+                checkpoint.offset = checkpoint.runEnd;
+                fprintf(stderr, "Stream %s: %lu-%lu of %s read by all nodes, the next run starts at %lu\n", streamName,
+                        checkpoint.runStart, checkpoint.runEnd, fileName, checkpoint.offset);
+            }
+
+            string text;
+            serializeIngestCheckpoint(checkpoint, streamName, text);
+            if (!replacePlanFile(path, text))
+                fprintf(stderr, "Could not write checkpoint %s\n", path.c_str());
+        }
+        unlockIngestCheckpoint(lock);
+    }
+
+    //This node's share of the window a run of -stream reads, split as a file of its own would be
+    int streamIngestWindow(const char * location, const SplitPlan & plan)
+    {
+        if (plan.isDirectory)
+        {
+            fprintf(stderr, "-stream reads an append-only file, %s is a directory\n", fileName);
+            return RETURN_FAILURE;
+        }
+
+        unsigned long start = 0;
+        unsigned long end = 0;
+        if (!planIngestWindow(location, plan, start, end))
+            return RETURN_FAILURE;
+
+        unsigned long sharestart;
+        unsigned long shareend;
+        if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            unsigned long records = (end - start) / recLen;
+            sharestart = start + records * nodeID / clusterCount * recLen;
+            shareend = start + records * (nodeID + 1) / clusterCount * recLen;
+        }
+        else
+        {
+            sharestart = start + (end - start) / clusterCount * nodeID;
+            shareend = nodeID == clusterCount - 1 ? end : sharestart + (end - start) / clusterCount;
+        }
+
+        //the sub-split readers resync at the first record end past a share's start
+        fprintf(stderr, "Filesize: %lu, Offset: %lu, readlen: %lu\n", plan.length, sharestart, shareend - sharestart);
+        return sharestart < shareend ? streamSubSplits(location, max(plan.length, end), sharestart, shareend) : EXIT_SUCCESS;
+    }
+
+    bool isFollowRead()
+    {
+        return follow && action == HCA_STREAMIN;
+    }
+
+    /*
+     * The length of the target readers can see and, where the connector can tell,
+     * whether it is still being written. Without that, a followed file is read until
+     * it is renamed or removed, or stops growing for -followidle seconds.
+     */
+    virtual bool getFollowStatus(FollowStatus & status)
+    {
+        SplitPlan plan;
+        if (!getTargetStatus(plan))
+            return false;
+
+        status.length = plan.length;
+        status.closeKnown = false;
+        status.closed = false;
+        return true;
+    }
+
+    /*
+     * With -follow, node 0 streams a file still being written as it grows: up to the
+     * end of its last whole record, then again whenever a poll finds it longer. Polls
+     * back off from FOLLOW_MIN_POLL_MS to FOLLOW_MAX_POLL_MS while it does not grow.
+     * Once the file is closed its last record is streamed too, even without a terminator.
+     */
+    int followFile(const char * location, const SplitPlan & plan)
+    {
+        if (plan.isDirectory)
+        {
+            fprintf(stderr, "-follow reads a file being written, %s is a directory\n", fileName);
+            return RETURN_FAILURE;
+        }
+
+        //the rows of a growing file come in the order they are written, from one node
+        if (nodeID > 0)
+        {
+            fprintf(stderr, "Node 0 follows %s, nothing to read on this node\n", fileName);
+            return EXIT_SUCCESS;
+        }
+
+        unsigned long position = 0;
+        unsigned long idlems = 0;
+        unsigned long delayms = FOLLOW_MIN_POLL_MS;
+        while (!isOutputStopped())
+        {
+            FollowStatus status;
+            if (!getFollowStatus(status))
+            {
+                fprintf(stderr, "%s can no longer be found after %lu bytes, it was renamed or removed\n", fileName, position);
+                break;
+            }
+
+            if (status.length < position)
+            {
+                fprintf(stderr, "%s shrank to %lu bytes after %lu were read, stopping\n", fileName, status.length, position);
+                break;
+            }
+
+            unsigned long end = position;
+            bool closed = status.closeKnown && status.closed;
+            if (closed && strcmp(format.c_str(), "FLAT") != 0)
+                end = status.length;
+            else if (status.length > position && !findWholeRecordsEnd(location, status.length, position, end))
+            {
+                fprintf(stderr, "Could not find the last record end of %s\n", fileName);
+                return RETURN_FAILURE;
+            }
+
+            if (end > position)
+            {
+                fprintf(stderr, "Following %s: reading %lu-%lu of %lu bytes\n", fileName, position, end, status.length);
+                if (streamSubSplits(location, status.length, position, end) != EXIT_SUCCESS)
+                    return RETURN_FAILURE;
+
+                //followed rows are handed over as they come rather than once a batch is full
+                if (!output.flush())
+                {
+                    fprintf(stderr, "Error: Could not hand over all streamed rows\n");
+                    return RETURN_FAILURE;
+                }
+
+                position = end;
+                idlems = 0;
+                delayms = FOLLOW_MIN_POLL_MS;
+            }
+
+            if (closed)
+            {
+                fprintf(stderr, "%s was closed at %lu bytes\n", fileName, status.length);
+                break;
+            }
+
+            if (followIdle > 0 && idlems >= followIdle * 1000UL)
+            {
+                fprintf(stderr, "%s did not grow for %u secs, stopping at %lu bytes\n", fileName, followIdle, position);
+                break;
+            }
+
+            usleep(delayms * 1000);
+            idlems += delayms;
+            delayms = min(delayms * 2, (unsigned long)FOLLOW_MAX_POLL_MS);
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    /*
+     * With -metacache a plan cached within the last -metacachettl seconds is used as is,
+     * an older one only while a status call finds the target's modification time and
+     * length unchanged. Anything else is looked up and cached again.
+     */
+    bool planTarget(SplitPlan & plan)
+    {
+        if (!isMetadataCached())
+            return computeSplitPlan(plan);
+
+        string path;
+        getMetadataCachePath(path);
+
+        SplitPlan cached;
+        struct stat cachestat;
+        bool found = stat(path.c_str(), &cachestat) == 0 && readSplitPlanFile(path, 0, cached);
+        if (found && metaCacheTtl > 0 && time(NULL) - cachestat.st_mtime < (time_t)metaCacheTtl)
+        {
+            fprintf(stderr, "Using cached metadata %s\n", path.c_str());
+            plan = cached;
+            return true;
+        }
+
+        if (!getTargetStatus(plan))
+            return false;
+
+        if (found && cached.isDirectory == plan.isDirectory && cached.modificationTime == plan.modificationTime
+                && cached.length == plan.length && plan.modificationTime > 0)
+        {
+            fprintf(stderr, "Using validated cached metadata %s\n", path.c_str());
+            plan = cached;
+            utime(path.c_str(), NULL);
+            return true;
+        }
+
+        plan.parts.clear();
+        if (plan.isDirectory && listDirectory(getTargetLocation(), plan.parts) != EXIT_SUCCESS)
+            return false;
+
+        if (!writeSplitPlanFile(plan, path, 0))
+            fprintf(stderr, "Could not cache metadata in %s\n", path.c_str());
+
+        return true;
+    }
+
+    /*
+     * Without -sharedplan each node looks up the target itself. With it node 0 does so
+     * for everyone and the others read its plan, planning on their own only when it
+     * does not show up within -plantimeout seconds.
+     */
+    bool findSplitPlan(SplitPlan & plan)
+    {
+        if (!isSharedPlan())
+            return planTarget(plan);
+
+        string path;
+        getSharedPlanPath(path);
+
+        if (nodeID == 0)
+        {
+            if (!planTarget(plan))
+                return false;
+            if (!writeSplitPlanFile(plan, path, clusterCount))
+                fprintf(stderr, "Could not publish split plan %s, other nodes will plan on their own\n", path.c_str());
+            return true;
+        }
+
+        unsigned long waitedms = 0;
+        unsigned long delayms = 100;
+        while (!readSplitPlanFile(path, clusterCount, plan))
+        {
+            if (waitedms >= planTimeout * 1000UL)
+            {
+                fprintf(stderr, "No split plan found in %s after %u secs, planning on this node\n", path.c_str(), planTimeout);
+                return planTarget(plan);
+            }
+
+            unsigned long sleepms = min(delayms, planTimeout * 1000UL - waitedms);
+            usleep(sleepms * 1000);
+            waitedms += sleepms;
+            delayms = min(delayms * 2, 2000UL);
+        }
+
+        fprintf(stderr, "Using split plan %s\n", path.c_str());
+        return true;
+    }
+
+    //Blocks cached with -blockcache belong to the version of the target planned for
+    bool getSplitPlan(SplitPlan & plan)
+    {
+        if (!findSplitPlan(plan))
+            return false;
+        targetModificationTime = plan.modificationTime;
+        return true;
+    }
+
+    //With -zerocopy, rows for a stdout pipe are spliced into it rather than written
+    void setupZeroCopyOutput()
+    {
+        if (spliceOutput)
+        {
+            output.setSink(&standardOutput);
+            delete spliceOutput;
+            spliceOutput = NULL;
+        }
+
+        if (!zeroCopy || action != HCA_STREAMIN || output.getSink() != &standardOutput)
+            return;
+
+        if (!splicerowsink::isPipe(STDOUT_FILENO))
+        {
+            fprintf(stderr, "stdout is not a pipe, zero copy output disabled\n");
+            return;
+        }
+
+        fflush(stdout);
+        spliceOutput = new splicerowsink(STDOUT_FILENO, bufferSize);
+        output.setSink(spliceOutput);
+    }
+
+    /*
+     * Rows of the output are told apart as it is laid out: FLAT by -reclen or its length
+     * prefix, CSV and projected JSON by their terminator outside quotes and JSON Lines
+     * passed through by their terminator alone, JSON strings hold no raw newlines.
+     * Returns false for output whose rows cannot be told apart.
+     */
+    bool getOutputRecordTracker(recordboundarytracker & tracker)
+    {
+        if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            if (recLen == 0 && !isVariableFlat())
+                return false;
+            tracker = recordboundarytracker(recLen, "", "");
+            tracker.setLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian);
+            return true;
+        }
+
+        if (strcmp(format.c_str(), "CSV") == 0)
+        {
+            if (!outputTerminator || terminator.size() == 0)
+                return false;
+            tracker = recordboundarytracker(0, terminator, quote);
+            return true;
+        }
+
+        if (strcmp(format.c_str(), "JSON") == 0)
+        {
+            JsonProjection projection;
+            if (!parseJsonProjection(jsonFields, jsonWidths, projection) || (projection.widths.empty() && terminator.size() == 0))
+                return false;
+
+            unsigned long width = 0;
+            for (unsigned i = 0; i < projection.widths.size(); i++)
+                width += projection.widths[i];
+            tracker = recordboundarytracker(width, width > 0 ? "" : terminator, projection.fields.empty() ? "" : quote);
+            return true;
+        }
+
+        return false;
+    }
+
+    //With -limit, the output counts its rows and stops once this node's share is handed over
+    void setupRowLimit()
+    {
+        output.setRowLimit(NULL);
+        if (outputLimit)
+        {
+            delete outputLimit;
+            outputLimit = NULL;
+        }
+
+        recordboundarytracker tracker(0, "", "");
+        if (rowLimit == 0 || action != HCA_STREAMIN || clusterCount <= 0 || !getOutputRecordTracker(tracker))
+            return;
+
+        string countpath;
+        if (isLimitShared())
+            getLimitSharePath(countpath);
+
+        outputLimit = new rowlimit(tracker, rowLimit, nodeID, clusterCount, countpath);
+        outputLimit->start(planTimeout);
+        output.setRowLimit(outputLimit);
+        fprintf(stderr, "Handing over at most %llu rows%s\n", rowLimit, outputLimit->isShared() ? " across all nodes" : " on this node's share");
+    }
+
+    //Opens a file relative to the target file name for writing
+    virtual hdfsoutputstream * openOutputStream(const char * relativepath, bool append) = 0;
+
+    //Removes a file relative to the target file name, true once it is gone or was not there
+    virtual bool removeOutputFile(const char * relativepath) = 0;
+
+    //Lists the visible files of a directory, locations are paths or urls depending on the connector
+    virtual int listDirectory(const char * location, vector<HdfsPartFile> & entries) = 0;
+    virtual int readFileToString(const char * location, string & content) = 0;
+
+    bool isSidecarWrite()
+    {
+        return strlen(statsFields) > 0 || strlen(indexField) > 0;
+    }
+
+    //FLAT records of varying length, each carrying a -lenprefix
+    bool isVariableFlat()
+    {
+        return lengthPrefixSize > 0 && strcmp(format.c_str(), "FLAT") == 0;
+    }
+
+    //Collects the statistics, key index and record offsets sidecars requested for the parts written
+    rowblockcollector * createSidecarCollector()
+    {
+        if (!isSidecarWrite() && !isVariableFlat())
+            return NULL;
+
+        bool isFlat = strcmp(format.c_str(), "FLAT") == 0;
+        rowblockcollector * sidecars = new rowblockcollector(isFlat ? recLen : 0, terminator, quote, statsBlockRows);
+
+        //variable length records can only be split where the offsets sidecar says one starts
+        if (isVariableFlat())
+        {
+            sidecars->setLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian);
+            sidecars->setBlockBytes(DEFAULT_RECORD_OFFSETS_BLOCK_BYTES);
+            sidecars->addObserver(new recordoffsetsobserver(formatRecordLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian)));
+        }
+
+        if (strlen(statsFields) > 0)
+        {
+            vector<ColumnStatsField> fields;
+            parseColumnStatsFields(statsFields, isFlat, fields);
+            sidecars->addObserver(new columnstatsobserver(statsFields, fields, isFlat, separator, quote, terminator));
+        }
+
+        if (strlen(indexField) > 0)
+        {
+            vector<ColumnStatsField> fields;
+            parseColumnStatsFields(indexField, isFlat, fields);
+            sidecars->addObserver(new keyindexobserver(fields[0], isFlat, separator, quote, terminator, indexFpp));
+        }
+
+        return sidecars;
+    }
+
+    /*
+     * Removes the sidecars of this node's part which this write does not store again. Left
+     * behind by an earlier write of the target, they would describe other data.
+     */
+    bool removeStaleSidecars()
+    {
+        static const char * const kinds[][2] = {{"-stats", ".stats"}, {"-index", ".index"}, {"-offsets", ".offsets"}};
+        bool written[] = {strlen(statsFields) > 0, strlen(indexField) > 0, isVariableFlat()};
+
+        bool removed = true;
+        for (unsigned i = 0; i < sizeof(written) / sizeof(written[0]); i++)
+        {
+            if (written[i])
+                continue;
+
+            string relativepath(kinds[i][0]);
+            relativepath.append("/part_").append(template2string(nodeID)).append("_").append(template2string(clusterCount));
+            relativepath.append(kinds[i][1]);
+            if (!removeOutputFile(relativepath.c_str()))
+            {
+                fprintf(stderr, "Failed to remove stale sidecar file %s%s!\n", fileName, relativepath.c_str());
+                removed = false;
+            }
+        }
+
+        return removed;
+    }
+
+    //Stores the sidecars of this node's parts, e.g. in <filename>-stats/part_<node>_<count>.stats
+    bool writeSidecars(rowblockcollector * sidecars)
+    {
+        for (unsigned i = 0; i < sidecars->getObserverCount(); i++)
+        {
+            rowblockobserver * observer = sidecars->getObserver(i);
+
+            string relativepath(observer->getSidecarDir());
+            relativepath.append("/part_").append(template2string(nodeID)).append("_").append(template2string(clusterCount));
+            relativepath.append(observer->getSidecarExtension());
+
+            hdfsoutputstream * stream = openOutputStream(relativepath.c_str(), false);
+            if (!stream)
+            {
+                fprintf(stderr, "Failed to open sidecar file %s%s for writing!\n", fileName, relativepath.c_str());
+                return false;
+            }
+
+            const string & sidecar = observer->getSidecar();
+            bool written = stream->write(sidecar.c_str(), sidecar.size());
+            if (!stream->close())
+                written = false;
+            delete stream;
+
+            if (!written)
+                return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * Loads the sidecars kept in the <suffix> directory next to a <filename>-parts directory
+     * into the filter. Without usable sidecars nothing gets skipped.
+     */
+    template <class PREDICATE> void loadSidecars(const char * partsdir, const char * suffix, PREDICATE & predicate, rowblockfilter & filter)
+    {
+        string sidecardir(partsdir);
+        while (sidecardir.size() > 0 && sidecardir[sidecardir.size() - 1] == '/')
+            sidecardir.erase(sidecardir.size() - 1);
+
+        size_t partssuffix = sidecardir.rfind("-parts");
+        if (partssuffix == string::npos || partssuffix + 6 != sidecardir.size())
+        {
+            fprintf(stderr, "No %s sidecars kept for %s, nothing will be skipped\n", suffix, partsdir);
+            return;
+        }
+        sidecardir.replace(partssuffix, 6, suffix);
+
+        vector<HdfsPartFile> sidecars;
+        if (listDirectory(sidecardir.c_str(), sidecars) != EXIT_SUCCESS)
+        {
+            fprintf(stderr, "Could not list sidecars in %s, nothing will be skipped\n", sidecardir.c_str());
+            return;
+        }
+
+        for (unsigned i = 0; i < sidecars.size(); i++)
+        {
+            string content;
+            if (readFileToString(sidecars[i].path.c_str(), content) != EXIT_SUCCESS || !predicate.load(content, filter))
+                fprintf(stderr, "Ignoring sidecar %s, it does not describe the requested read\n", sidecars[i].path.c_str());
+        }
+    }
+
+    bool loadLookupKeys(keyindexlookup & lookup)
+    {
+        string keys(lookupKeys);
+        while (keys.size() > 0)
+        {
+            size_t comma = keys.find(',');
+            lookup.addKey(keys.substr(0, comma));
+            keys = comma == string::npos ? "" : keys.substr(comma + 1);
+        }
+
+        if (strlen(lookupKeyFile) > 0)
+        {
+            FILE * keyfile = fopen(lookupKeyFile, "r");
+            if (!keyfile)
+            {
+                fprintf(stderr, "Could not open key file: %s\n", lookupKeyFile);
+                return false;
+            }
+
+            char line[4096];
+            while (fgets(line, sizeof(line), keyfile))
+            {
+                size_t length = strlen(line);
+                while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+                    line[--length] = '\0';
+                lookup.addKey(line);
+            }
+            fclose(keyfile);
+        }
+
+        return true;
+    }
+
+    //Returns false when no sidecar predicate was requested
+    bool loadRowBlockFilter(const char * partsdir, rowblockfilter & filter)
+    {
+        bool active = false;
+
+        columnstatsrange range(rangeField, rangeMin, strlen(rangeMin) > 0, rangeMax, strlen(rangeMax) > 0);
+        if (range.isActive())
+        {
+            loadSidecars(partsdir, "-stats", range, filter);
+            active = true;
+        }
+
+        keyindexlookup lookup(indexField);
+        if (loadLookupKeys(lookup) && lookup.isActive())
+        {
+            fprintf(stderr, "Looking up %lu key(s) on field %s\n", lookup.getKeyCount(), indexField);
+            loadSidecars(partsdir, "-index", lookup, filter);
+            active = true;
+        }
+
+        //offsets sidecars rule nothing out, they only tell where parts may be split
+        if (isVariableFlat())
+        {
+            recordoffsetslookup offsets(formatRecordLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian));
+            loadSidecars(partsdir, "-offsets", offsets, filter);
+        }
+
+        return active;
+    }
+
+    void skipUnmatchedParts(vector<HdfsPartFile> & parts, rowblockfilter & filter)
+    {
+        vector<HdfsPartFile> matching;
+        for (unsigned i = 0; i < parts.size(); i++)
+        {
+            if (filter.partMayMatch(parts[i].name))
+                matching.push_back(parts[i]);
+        }
+
+        fprintf(stderr, "Sidecars rule out %lu of %lu part(s)\n", (unsigned long)(parts.size() - matching.size()),
+                (unsigned long)parts.size());
+        parts.swap(matching);
+    }
+
+    /*
+     * This node's share of a -parts directory: its parts and the record aligned ranges of each
+     * to read. Parts go whole to the node their start falls to, but variable length FLAT parts
+     * are shared out block by block, at the record offsets kept by their sidecars.
+     */
+    void assignPartRanges(vector<HdfsPartFile> & parts, rowblockfilter & filter, vector<HdfsPartFile> & assigned,
+            vector<vector<pair<unsigned long, unsigned long> > > & ranges)
+    {
+        if (!isVariableFlat())
+        {
+            assignPartFiles(parts, clusterCount, nodeID, assigned);
+            ranges.resize(assigned.size());
+            for (unsigned i = 0; i < assigned.size(); i++)
+            {
+                if (assigned[i].length > 0)
+                    filter.getRangesToRead(assigned[i].name, assigned[i].length, ranges[i]);
+            }
+            return;
+        }
+
+        sort(parts.begin(), parts.end(), comparePartFiles);
+
+        unsigned long long totalsize = 0;
+        for (unsigned i = 0; i < parts.size(); i++)
+            totalsize += parts[i].length;
+
+        unsigned long long startoffset = 0;
+        for (unsigned i = 0; i < parts.size(); i++)
+        {
+            vector<RowBlock> blocks;
+            filter.getBlocks(parts[i].name, parts[i].length, blocks);
+
+            vector<pair<unsigned long, unsigned long> > partranges;
+            for (unsigned b = 0; b < blocks.size(); b++)
+            {
+                unsigned owner = (unsigned)((startoffset + blocks[b].offset) * clusterCount / totalsize);
+                if (owner != nodeID || !blocks[b].mayMatch)
+                    continue;
+
+                if (partranges.size() > 0 && partranges.back().first + partranges.back().second == blocks[b].offset)
+                    partranges.back().second += blocks[b].length;
+                else
+                    partranges.push_back(make_pair(blocks[b].offset, blocks[b].length));
+            }
+
+            if (partranges.size() > 0)
+            {
+                assigned.push_back(parts[i]);
+                ranges.push_back(partranges);
+            }
+            startoffset += parts[i].length;
+        }
+    }
+
+    bool isPartitionedWrite()
+    {
+        return strlen(partitionName) > 0;
+    }
+
+    /*
+     * Writes each record of the data pipe to <filename>/<col>=<value>/part_<node>_<count>,
+     * where value is taken from the partition column of the record.
+     */
+    int writePartitionedOffset()
+    {
+        FILE * source = fopen(pipepath, "rb");
+        if (!source)
+        {
+            fprintf(stderr, "Could not open data pipe: %s\n", pipepath);
+            return RETURN_FAILURE;
+        }
+
+        bool isFlat = strcmp(format.c_str(), "FLAT") == 0;
+        recordboundarytracker tracker(isFlat ? recLen : 0, terminator, quote);
+        if (isVariableFlat())
+            tracker.setLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian);
+        partitionstreamcache streams(maxOpenPartitions);
+
+        char buffer[124 * 100];
+        string record;
+        unsigned long recordCount = 0;
+        bool failed = false;
+
+        fprintf(stderr, "Writing %s partitioned by %s\n", fileName, partitionName);
+        if (isSidecarWrite())
+            fprintf(stderr, "Sidecars are not kept for partitioned writes, -statsfields and -indexfield ignored\n");
+
+        size_t bytesread;
+        while (!failed && (bytesread = fread(buffer, 1, sizeof(buffer), source)) > 0)
+        {
+            for (size_t taken = 0; taken < bytesread && !failed;)
+            {
+                unsigned long piece = tracker.scan(buffer + taken, bytesread - taken, true);
+                record.append(buffer + taken, piece);
+                taken += piece;
+
+                if (tracker.atRecordBoundary())
+                {
+                    failed = !writePartitionedRecord(streams, record);
+                    record.clear();
+                    recordCount++;
+                }
+            }
+        }
 
-        si++;
+        //a last record may come without its terminator
+        if (!failed && record.size() > 0)
+        {
+            failed = !writePartitionedRecord(streams, record);
+            recordCount++;
+        }
+
+        fclose(source);
+
+        unsigned long partitionCount = streams.partitionCount();
+        if (!streams.closeAll())
+            failed = true;
+
+        fprintf(stderr, "Wrote %lu record(s) into %lu partition(s)\n", recordCount, partitionCount);
+
+        return failed ? RETURN_FAILURE : EXIT_SUCCESS;
     }
-}
-class hdfsconnector
-{
-protected:
-    HDFSConnectorAction action;
-    unsigned int bufferSize;
-    unsigned int flushThreshold;
-    unsigned clusterCount;
-    unsigned nodeID;
-    unsigned long recLen;
-    unsigned long maxLen;
-    const char * fileName;
-    const char * hadoopHost;
-    int hadoopPort;
-    string format;
-    string foptions;
-    string data;
-    const char * wuid;
-    const char * rowTag;
-    const char * separator;
-    string terminator;
-    bool outputTerminator;
-    string quote;
-    const char * headerText;
-    const char * footerText;
-    const char * hdfsuser;
-    const char * hdfsgroup;
-    const char * pipepath;
-    bool cleanmerge;
-    short filereplication;
-    unsigned short maxRetry;
-    int blockSize;
-    bool verbose;
-public:
-    hdfsconnector() {};
 
-    virtual ~hdfsconnector(){};
+    bool writePartitionedRecord(partitionstreamcache & streams, const string & record)
+    {
+        string value;
+        if (strcmp(format.c_str(), "FLAT") == 0)
+            extractFlatField(record.c_str(), record.size(), partitionOffset, partitionLength, value);
+        else
+            extractCsvField(record.c_str(), record.size(), partitionField, separator, quote, terminator, value);
 
-    virtual bool connect() = 0;
-    virtual int  execute() = 0 ;
-    virtual int streamFileOffset() = 0;
-    virtual int writeFlatOffset() = 0;
-    virtual int mergeFile() = 0;
+        string partition;
+        escapePartitionValue(value, partition);
+
+        hdfsoutputstream * stream = streams.get(partition);
+        if (!stream)
+        {
+            string relativepath("/");
+            relativepath.append(partitionName).append("=").append(partition).append("/part_");
+            relativepath.append(template2string(nodeID)).append("_").append(template2string(clusterCount));
+
+            stream = openOutputStream(relativepath.c_str(), streams.wasEvicted(partition));
+            if (!stream)
+            {
+                fprintf(stderr, "Failed to open partition %s for writing!\n", relativepath.c_str());
+                return false;
+            }
+
+            if (!streams.add(partition, stream))
+                return false;
+        }
+
+        return stream->write(record.c_str(), record.size());
+    }
 
     virtual bool validateParameters()
     {
@@ -187,6 +1837,212 @@ public:
             validated = false;
         }
 
+        if (writeStreams == 0 || writeStreams > MAX_WRITE_STREAMS)
+        {
+            fprintf(stderr, "\n-writestreams must be between 1 and %d\n", MAX_WRITE_STREAMS);
+            validated = false;
+        }
+
+        //HDFS requires block sizes to be a multiple of the checksum chunk size
+        if (writeSegmentSize % HDFS_CHECKSUM_CHUNK_SIZE)
+        {
+            fprintf(stderr, "\nInvalid write segment size detected: %lu (must be a multiple of %d)\n",
+                    writeSegmentSize, HDFS_CHECKSUM_CHUNK_SIZE);
+            validated = false;
+        }
+
+        if (maxPartSize > 0 && (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE))
+        {
+            if (strcmp(format.c_str(), "FLAT") != 0 && strcmp(format.c_str(), "CSV") != 0)
+            {
+                fprintf(stderr, "\n-maxpartsize requires -format FLAT or CSV to locate record boundaries\n");
+                validated = false;
+            }
+            else if (strcmp(format.c_str(), "FLAT") == 0 && recLen == 0 && !isVariableFlat())
+            {
+                fprintf(stderr, "\n-maxpartsize on FLAT data requires -reclen or -lenprefix\n");
+                validated = false;
+            }
+        }
+
+        if (isPartitionedWrite() && (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE))
+        {
+            if (strcmp(format.c_str(), "CSV") == 0)
+            {
+                if (partitionField == 0)
+                {
+                    fprintf(stderr, "\n-partitionname on CSV data requires -partitionfield\n");
+                    validated = false;
+                }
+            }
+            else if (strcmp(format.c_str(), "FLAT") == 0)
+            {
+                if ((recLen == 0 && !isVariableFlat()) || partitionLength == 0 || (recLen > 0 && partitionOffset + partitionLength > recLen))
+                {
+                    fprintf(stderr, "\n-partitionname on FLAT data requires -reclen or -lenprefix and a -partitionrange within the records\n");
+                    validated = false;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "\n-partitionname requires -format FLAT or CSV\n");
+                validated = false;
+            }
+        }
+
+        if (isSidecarWrite() && (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE))
+        {
+            bool isFlat = strcmp(format.c_str(), "FLAT") == 0;
+            vector<ColumnStatsField> fields;
+            vector<ColumnStatsField> keyfields;
+            if (!isFlat && strcmp(format.c_str(), "CSV") != 0)
+            {
+                fprintf(stderr, "\n-statsfields and -indexfield require -format FLAT or CSV\n");
+                validated = false;
+            }
+            else if (isFlat && recLen == 0 && !isVariableFlat())
+            {
+                fprintf(stderr, "\n-statsfields and -indexfield on FLAT data require -reclen or -lenprefix\n");
+                validated = false;
+            }
+            else if (strlen(statsFields) > 0 && !parseColumnStatsFields(statsFields, isFlat, fields))
+            {
+                fprintf(stderr, "\nInvalid -statsfields %s, expected <field>[:n] for CSV or <offset>:<length>[:n] for FLAT\n", statsFields);
+                validated = false;
+            }
+            else if (strlen(indexField) > 0 && (!parseColumnStatsFields(indexField, isFlat, keyfields) || keyfields.size() != 1))
+            {
+                fprintf(stderr, "\nInvalid -indexfield %s, expected <field> for CSV or <offset>:<length> for FLAT\n", indexField);
+                validated = false;
+            }
+
+            if (indexFpp <= 0 || indexFpp >= 1)
+            {
+                fprintf(stderr, "\nInvalid -indexfpp %f, expected a probability between 0 and 1\n", indexFpp);
+                validated = false;
+            }
+        }
+
+        if (strlen(lengthPrefix) > 0)
+        {
+            unsigned prefixsize;
+            bool bigendian;
+            if (!parseRecordLengthPrefix(lengthPrefix, prefixsize, bigendian))
+            {
+                fprintf(stderr, "\nInvalid -lenprefix %s, expected 1, 2, 4 or 8 followed by le or be\n", lengthPrefix);
+                validated = false;
+            }
+            else if (strcmp(format.c_str(), "FLAT") != 0 || recLen > 0)
+            {
+                fprintf(stderr, "\n-lenprefix requires -format FLAT without -reclen\n");
+                validated = false;
+            }
+        }
+
+        if (isSampling() && action == HCA_STREAMIN)
+        {
+            if (sampleFraction <= 0)
+            {
+                fprintf(stderr, "\nInvalid -sample %f, expected a fraction greater than 0\n", sampleFraction);
+                validated = false;
+            }
+            else if (strcmp(sampleMode, "block") != 0 && strcmp(sampleMode, "row") != 0)
+            {
+                fprintf(stderr, "\nInvalid -samplemode %s, expected block or row\n", sampleMode);
+                validated = false;
+            }
+            else if ((strcmp(format.c_str(), "FLAT") != 0 || recLen == 0) && strcmp(format.c_str(), "CSV") != 0
+                    && strcmp(format.c_str(), "JSON") != 0)
+            {
+                fprintf(stderr, "\n-sample requires -format CSV, JSON or FLAT with -reclen\n");
+                validated = false;
+            }
+        }
+
+        if (strlen(jsonFields) > 0 || strlen(jsonWidths) > 0)
+        {
+            JsonProjection projection;
+            if (strcmp(format.c_str(), "JSON") != 0)
+            {
+                fprintf(stderr, "\n-jsonfields and -jsonwidths require -format JSON\n");
+                validated = false;
+            }
+            else if (!parseJsonProjection(jsonFields, jsonWidths, projection))
+            {
+                fprintf(stderr, "\nInvalid -jsonwidths %s, expected a positive width for each of -jsonfields %s\n",
+                        jsonWidths, jsonFields);
+                validated = false;
+            }
+        }
+
+        if (rowLimit > 0 && action == HCA_STREAMIN)
+        {
+            recordboundarytracker tracker(0, "", "");
+            if (!getOutputRecordTracker(tracker))
+            {
+                fprintf(stderr, "\n-limit requires -format CSV with output terminators, JSON, or FLAT with -reclen or -lenprefix\n");
+                validated = false;
+            }
+            else if (isLimitShared() && strlen(wuid) == 0)
+            {
+                fprintf(stderr, "\n-limitshare requires -wuid to tell the counts of different reads apart\n");
+                validated = false;
+            }
+        }
+
+        if (isIncrementalRead())
+        {
+            if (strlen(checkpointDir) == 0 || strlen(wuid) == 0)
+            {
+                fprintf(stderr, "\n-stream requires -checkpointdir, shared by all nodes, and -wuid to tell its runs apart\n");
+                validated = false;
+            }
+            else if ((strcmp(format.c_str(), "FLAT") != 0 || recLen == 0) && strcmp(format.c_str(), "CSV") != 0
+                    && strcmp(format.c_str(), "JSON") != 0)
+            {
+                fprintf(stderr, "\n-stream requires -format CSV, JSON or FLAT with -reclen\n");
+                validated = false;
+            }
+            else if (rowLimit > 0)
+            {
+                fprintf(stderr, "\n-stream cannot be combined with -limit, the rows past the limit would be checkpointed unread\n");
+                validated = false;
+            }
+        }
+
+        if (isFollowRead())
+        {
+            if ((strcmp(format.c_str(), "FLAT") != 0 || recLen == 0) && strcmp(format.c_str(), "CSV") != 0
+                    && strcmp(format.c_str(), "JSON") != 0)
+            {
+                fprintf(stderr, "\n-follow requires -format CSV, JSON or FLAT with -reclen\n");
+                validated = false;
+            }
+            else if (isIncrementalRead())
+            {
+                fprintf(stderr, "\n-follow cannot be combined with -stream\n");
+                validated = false;
+            }
+        }
+
+        if (readThreads == 0 || subSplitSize == 0)
+        {
+            fprintf(stderr, "\n-threads and -subsplitsize must be at least 1\n");
+            validated = false;
+        }
+
+        if (isSharedPlan() && strlen(wuid) == 0)
+        {
+            fprintf(stderr, "\n-sharedplan requires -wuid to tell the plans of different reads apart\n");
+            validated = false;
+        }
+
+        if (strlen(blockCacheDir) > 0 && blockCacheMb < BLOCK_CACHE_BLOCK_SIZE / (1024 * 1024))
+        {
+            fprintf(stderr, "\n-blockcache requires -blockcachemb of at least %d\n", BLOCK_CACHE_BLOCK_SIZE / (1024 * 1024));
+            validated = false;
+        }
+
         return validated;
     }
 
@@ -235,7 +2091,54 @@ public:
         filereplication = 1;
         maxRetry = 1;
         blockSize = 0;
+        writeStreams = 1;
+        writeSegmentSize = 0;
+        maxPartSize = 0;
+        partitionName = "";
+        partitionField = 0;
+        partitionOffset = 0;
+        partitionLength = 0;
+        maxOpenPartitions = DEFAULT_MAX_OPEN_PARTITIONS;
+        statsFields = "";
+        statsBlockRows = DEFAULT_STATS_BLOCK_ROWS;
+        rangeField = "";
+        rangeMin = "";
+        rangeMax = "";
+        indexField = "";
+        indexFpp = DEFAULT_KEY_INDEX_FPP;
+        lookupKeys = "";
+        lookupKeyFile = "";
+        jsonFields = "";
+        lengthPrefix = "";
+        sampleFraction = 1;
+        sampleMode = "block";
+        sampleSeed = DEFAULT_SAMPLE_SEED;
+        rowLimit = 0;
+        limitShare = "";
+        limitReadKey = getReadKey(argc, argv);
+        streamName = "";
+        ingestWindowPlanned = false;
+        checkpointDir = "";
+        follow = false;
+        followIdle = DEFAULT_FOLLOW_IDLE_TIMEOUT;
+        jsonWidths = "";
         verbose = false;
+        zeroCopy = false;
+        readThreads = 1;
+        subSplitSize = DEFAULT_SUBSPLIT_SIZE;
+        directReads = true;
+        hedgeFactor = 0;
+        hedgeDelay = DEFAULT_HEDGE_DELAY_MS;
+        hugePages = true;
+        sharedPlan = "";
+        planTimeout = DEFAULT_SPLIT_PLAN_TIMEOUT;
+        metaCache = "";
+        metaCacheTtl = 0;
+        blockCacheDir = "";
+        blockCacheMb = 0;
+        shortCircuitPath = "";
+        targetModificationTime = 0;
+        initReadRetryStats(readRetryStats);
 
         action = HCA_INVALID;
 
@@ -299,6 +2202,8 @@ public:
                 else if (strcmp(argv[currParam], "-format") == 0)
                 {
                     const char * tmp = argv[++currParam];
+                    format.clear();
+                    foptions.clear();
                     while (tmp && *tmp && *tmp != '(')
                         format.append(1, *tmp++);
                     fprintf(stderr, "Format: %s\n", format.c_str());
@@ -404,6 +2309,78 @@ public:
                 {
                     maxRetry = atoi(argv[++currParam]);
                 }
+                else if (strcmp(argv[currParam], "-threads") == 0)
+                {
+                    //a negative count would wrap, it is rejected as none
+                    int threads = atoi(argv[++currParam]);
+                    readThreads = threads > 0 ? threads : 0;
+                    fprintf(stderr, "threads: %d\n", threads);
+                }
+                else if (strcmp(argv[currParam], "-subsplitsize") == 0)
+                {
+                    subSplitSize = strtoul(argv[++currParam], NULL, 10);
+                    fprintf(stderr, "subsplitsize: %lu\n", subSplitSize);
+                }
+                else if (strcmp(argv[currParam], "-directreads") == 0)
+                {
+                    directReads = atoi(argv[++currParam]);
+                    fprintf(stderr, "directreads: %d\n", directReads);
+                }
+                else if (strcmp(argv[currParam], "-hugepages") == 0)
+                {
+                    hugePages = atoi(argv[++currParam]);
+                    fprintf(stderr, "hugepages: %d\n", hugePages);
+                }
+                else if (strcmp(argv[currParam], "-hedgefactor") == 0)
+                {
+                    hedgeFactor = atof(argv[++currParam]);
+                    fprintf(stderr, "hedgefactor: %.2f\n", hedgeFactor);
+                }
+                else if (strcmp(argv[currParam], "-hedgedelay") == 0)
+                {
+                    hedgeDelay = atoi(argv[++currParam]);
+                    fprintf(stderr, "hedgedelay: %u\n", hedgeDelay);
+                }
+                else if (strcmp(argv[currParam], "-sharedplan") == 0)
+                {
+                    sharedPlan = argv[++currParam];
+                    fprintf(stderr, "sharedplan: %s\n", sharedPlan);
+                }
+                else if (strcmp(argv[currParam], "-plantimeout") == 0)
+                {
+                    planTimeout = getUnsignedIntFromStr(argv[++currParam]);
+                    fprintf(stderr, "plantimeout: %u\n", planTimeout);
+                }
+                else if (strcmp(argv[currParam], "-metacache") == 0)
+                {
+                    metaCache = argv[++currParam];
+                    fprintf(stderr, "metacache: %s\n", metaCache);
+                }
+                else if (strcmp(argv[currParam], "-metacachettl") == 0)
+                {
+                    metaCacheTtl = getUnsignedIntFromStr(argv[++currParam]);
+                    fprintf(stderr, "metacachettl: %u\n", metaCacheTtl);
+                }
+                else if (strcmp(argv[currParam], "-blockcache") == 0)
+                {
+                    blockCacheDir = argv[++currParam];
+                    fprintf(stderr, "blockcache: %s\n", blockCacheDir);
+                }
+                else if (strcmp(argv[currParam], "-blockcachemb") == 0)
+                {
+                    blockCacheMb = getUnsignedIntFromStr(argv[++currParam]);
+                    fprintf(stderr, "blockcachemb: %u\n", blockCacheMb);
+                }
+                else if (strcmp(argv[currParam], "-shortcircuit") == 0)
+                {
+                    shortCircuitPath = argv[++currParam];
+                    fprintf(stderr, "shortcircuit: %s\n", shortCircuitPath);
+                }
+                else if (strcmp(argv[currParam], "-zerocopy") == 0)
+                {
+                    zeroCopy = atoi(argv[++currParam]);
+                    fprintf(stderr, "zerocopy: %d\n", zeroCopy);
+                }
                 else if (strcmp(argv[currParam], "-verbose") == 0)
                 {
                    verbose = atoi(argv[++currParam]);
@@ -412,6 +2389,152 @@ public:
                 {
                     blockSize = atoi(argv[++currParam]);
                 }
+                else if (strcmp(argv[currParam], "-writestreams") == 0)
+                {
+                    //a negative count would wrap, it is rejected as none
+                    int streams = atoi(argv[++currParam]);
+                    writeStreams = streams > 0 ? streams : 0;
+                    fprintf(stderr, "writestreams: %d\n", streams);
+                }
+                else if (strcmp(argv[currParam], "-writesegsize") == 0)
+                {
+                    writeSegmentSize = atol(argv[++currParam]);
+                    fprintf(stderr, "writesegsize: %lu\n", writeSegmentSize);
+                }
+                else if (strcmp(argv[currParam], "-maxpartsize") == 0)
+                {
+                    maxPartSize = atol(argv[++currParam]);
+                    fprintf(stderr, "maxpartsize: %lu\n", maxPartSize);
+                }
+                else if (strcmp(argv[currParam], "-partitionname") == 0)
+                {
+                    partitionName = argv[++currParam];
+                    fprintf(stderr, "partitionname: %s\n", partitionName);
+                }
+                else if (strcmp(argv[currParam], "-partitionfield") == 0)
+                {
+                    partitionField = atoi(argv[++currParam]);
+                    fprintf(stderr, "partitionfield: %d\n", partitionField);
+                }
+                else if (strcmp(argv[currParam], "-partitionrange") == 0)
+                {
+                    //<offset>:<length> of the partition column within FLAT records
+                    if (sscanf(argv[++currParam], "%lu:%lu", &partitionOffset, &partitionLength) != 2)
+                    {
+                        fprintf(stderr, "Error: invalid -partitionrange %s, expected <offset>:<length>\n", argv[currParam]);
+                        allvalid = false;
+                    }
+                    fprintf(stderr, "partitionrange: %lu:%lu\n", partitionOffset, partitionLength);
+                }
+                else if (strcmp(argv[currParam], "-maxopenpartitions") == 0)
+                {
+                    maxOpenPartitions = atoi(argv[++currParam]);
+                    fprintf(stderr, "maxopenpartitions: %d\n", maxOpenPartitions);
+                }
+                else if (strcmp(argv[currParam], "-statsfields") == 0)
+                {
+                    statsFields = argv[++currParam];
+                    fprintf(stderr, "statsfields: %s\n", statsFields);
+                }
+                else if (strcmp(argv[currParam], "-statsblockrows") == 0)
+                {
+                    statsBlockRows = atol(argv[++currParam]);
+                    fprintf(stderr, "statsblockrows: %lu\n", statsBlockRows);
+                }
+                else if (strcmp(argv[currParam], "-rangefield") == 0)
+                {
+                    rangeField = argv[++currParam];
+                    fprintf(stderr, "rangefield: %s\n", rangeField);
+                }
+                else if (strcmp(argv[currParam], "-rangemin") == 0)
+                {
+                    rangeMin = argv[++currParam];
+                    fprintf(stderr, "rangemin: %s\n", rangeMin);
+                }
+                else if (strcmp(argv[currParam], "-rangemax") == 0)
+                {
+                    rangeMax = argv[++currParam];
+                    fprintf(stderr, "rangemax: %s\n", rangeMax);
+                }
+                else if (strcmp(argv[currParam], "-indexfield") == 0)
+                {
+                    indexField = argv[++currParam];
+                    fprintf(stderr, "indexfield: %s\n", indexField);
+                }
+                else if (strcmp(argv[currParam], "-indexfpp") == 0)
+                {
+                    indexFpp = atof(argv[++currParam]);
+                    fprintf(stderr, "indexfpp: %f\n", indexFpp);
+                }
+                else if (strcmp(argv[currParam], "-keys") == 0)
+                {
+                    lookupKeys = argv[++currParam];
+                }
+                else if (strcmp(argv[currParam], "-keyfile") == 0)
+                {
+                    lookupKeyFile = argv[++currParam];
+                    fprintf(stderr, "keyfile: %s\n", lookupKeyFile);
+                }
+                else if (strcmp(argv[currParam], "-sample") == 0)
+                {
+                    sampleFraction = atof(argv[++currParam]);
+                    fprintf(stderr, "sample: %f\n", sampleFraction);
+                }
+                else if (strcmp(argv[currParam], "-samplemode") == 0)
+                {
+                    sampleMode = argv[++currParam];
+                    fprintf(stderr, "samplemode: %s\n", sampleMode);
+                }
+                else if (strcmp(argv[currParam], "-sampleseed") == 0)
+                {
+                    sampleSeed = strtoull(argv[++currParam], NULL, 10);
+                    fprintf(stderr, "sampleseed: %llu\n", sampleSeed);
+                }
+                else if (strcmp(argv[currParam], "-limit") == 0)
+                {
+                    rowLimit = strtoull(argv[++currParam], NULL, 10);
+                    fprintf(stderr, "limit: %llu\n", rowLimit);
+                }
+                else if (strcmp(argv[currParam], "-limitshare") == 0)
+                {
+                    limitShare = argv[++currParam];
+                    fprintf(stderr, "limitshare: %s\n", limitShare);
+                }
+                else if (strcmp(argv[currParam], "-stream") == 0)
+                {
+                    streamName = argv[++currParam];
+                    fprintf(stderr, "stream: %s\n", streamName);
+                }
+                else if (strcmp(argv[currParam], "-checkpointdir") == 0)
+                {
+                    checkpointDir = argv[++currParam];
+                    fprintf(stderr, "checkpointdir: %s\n", checkpointDir);
+                }
+                else if (strcmp(argv[currParam], "-follow") == 0)
+                {
+                    follow = atoi(argv[++currParam]);
+                    fprintf(stderr, "follow: %d\n", follow);
+                }
+                else if (strcmp(argv[currParam], "-followidle") == 0)
+                {
+                    followIdle = getUnsignedIntFromStr(argv[++currParam]);
+                    fprintf(stderr, "followidle: %u\n", followIdle);
+                }
+                else if (strcmp(argv[currParam], "-lenprefix") == 0)
+                {
+                    lengthPrefix = argv[++currParam];
+                    fprintf(stderr, "lenprefix: %s\n", lengthPrefix);
+                }
+                else if (strcmp(argv[currParam], "-jsonfields") == 0)
+                {
+                    jsonFields = argv[++currParam];
+                    fprintf(stderr, "jsonfields: %s\n", jsonFields);
+                }
+                else if (strcmp(argv[currParam], "-jsonwidths") == 0)
+                {
+                    jsonWidths = argv[++currParam];
+                    fprintf(stderr, "jsonwidths: %s\n", jsonWidths);
+                }
                 else
                 {
                     fprintf(stderr, "Error: Found invalid input param: %s \n", argv[currParam]);
@@ -425,7 +2548,18 @@ public:
             fprintf(stderr, "Error: found unexpected value while parsing input parameters\n");
             return false;
         }
+
+        output.setBatchSize(bufferSize);
+        setupZeroCopyOutput();
+        hedging.configure(hedgeFactor, hedgeDelay);
+        blockCache.configure(blockCacheDir, blockCacheMb, hugePages);
+        readBuffers.configure(bufferSize + 1, hugePages);
+        if (!parseRecordLengthPrefix(lengthPrefix, lengthPrefixSize, lengthPrefixBigEndian))
+            lengthPrefixSize = 0;
+        setupRowLimit();
+
         return allvalid;
     }
 };
 
+#endif
@@ -0,0 +1,72 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#include "hdfsconnectorapi.hpp"
+#include "hdfsdaemon.hpp"
+
+class callbackrowsink : public hdfsrowsink
+{
+private:
+    h2hrowbatchcallback callback;
+    void * context;
+
+public:
+    callbackrowsink(h2hrowbatchcallback _callback, void * _context) : callback(_callback), context(_context) {}
+
+    bool writeRows(const char * data, unsigned long length)
+    {
+        return callback(context, data, length) == 0;
+    }
+
+    bool flush()
+    {
+        return true;
+    }
+};
+
+int runHdfsConnector(int argc, char ** argv, hdfsrowsink * sink)
+{
+    int returnCode = EXIT_FAILURE;
+
+    hdfsconnector * connector = createHdfsConnector();
+
+    if (connector)
+    {
+        connector->setOutputSink(sink);
+        returnCode = runConnector(connector, argc, argv);
+        delete (connector);
+    }
+    else
+        fprintf(stderr, "\nError: Could not create connector");
+
+    return returnCode;
+}
+
+unsigned h2hGetApiVersion()
+{
+    return H2H_API_VERSION;
+}
+
+int h2hRunConnector(int argc, char ** argv, h2hrowbatchcallback callback, void * context)
+{
+    if (!callback)
+        return runHdfsConnector(argc, argv, NULL);
+
+    callbackrowsink sink(callback, context);
+    return runHdfsConnector(argc, argv, &sink);
+}
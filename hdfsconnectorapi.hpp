@@ -0,0 +1,51 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSCONNECTORAPI_HPP
+#define HDFSCONNECTORAPI_HPP
+
+#include "hdfsrowsink.hpp"
+
+/*
+ * Interface of the connector library, which the connector executables and embedding
+ * callers, such as an ECL plugin, share. The parameters are those of the executable,
+ * argv[0] included, the rows a -si request streams in are handed to the caller's sink
+ * in batches of the connector's buffer size instead of being written to stdout.
+ */
+#define H2H_API_VERSION 1
+
+class hdfsconnector;
+
+//Implemented by each connector type
+hdfsconnector * createHdfsConnector();
+
+int runHdfsConnector(int argc, char ** argv, hdfsrowsink * sink);
+
+/*
+ * C entry points for callers which load the library at run time. The callback returns
+ * 0 when it accepted the batch, anything else stops the request.
+ */
+typedef int (*h2hrowbatchcallback)(void * context, const char * data, unsigned long length);
+
+extern "C"
+{
+    unsigned h2hGetApiVersion();
+    int h2hRunConnector(int argc, char ** argv, h2hrowbatchcallback callback, void * context);
+}
+
+#endif
@@ -0,0 +1,461 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSDAEMON_HPP
+#define HDFSDAEMON_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "hdfsconnector.hpp"
+
+/*
+ * Connector daemon, started as: <connector> -daemon <socket path> [<workers>]
+ *
+ * The daemon pre-forks its workers before any HDFS access, each worker then keeps one
+ * connector, and with it the JVM, hdfsFS or curl handle it warmed up, for all requests
+ * it serves. A request is the usual parameter list sent by: <connector> -client <socket path> <params>
+ * together with the client's stdin, stdout and stderr, which the worker serves the
+ * request on. Requests are served one at a time per worker, a client which is not
+ * picked up by a worker in time runs the request itself.
+ */
+#define DAEMON_DEFAULT_WORKERS 4
+#define DAEMON_MAX_WORKERS 64
+#define DAEMON_READY_TIMEOUT_MS 2000
+#define DAEMON_REQUEST_MAGIC 0x48324844 //"H2HD"
+
+typedef hdfsconnector * (*connectorfactory)();
+
+struct DaemonRequestHeader
+{
+    unsigned magic;
+    unsigned argc;
+    unsigned length;
+};
+
+static int runConnector(hdfsconnector * connector, int argc, char ** argv)
+{
+    int returnCode = EXIT_FAILURE;
+
+    if (connector->parseInParams(argc, argv))
+    {
+        if (connector->validateParameters())
+        {
+            if (connector->connect())
+            {
+                returnCode = connector->execute();
+                connector->reportReadStats();
+            }
+        }
+    }
+
+    //rows still batched up are handed over whatever the outcome
+    if (!connector->flushOutput())
+    {
+        fprintf(stderr, "Error: Could not hand over all streamed rows\n");
+        returnCode = EXIT_FAILURE;
+    }
+    connector->finishRowLimit();
+
+    //a -stream window counts as read once every node has handed its share over
+    if (returnCode == EXIT_SUCCESS)
+        connector->confirmIngestWindow();
+
+    return returnCode;
+}
+
+static bool sendFully(int fd, const char * data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+static bool receiveFully(int fd, char * data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+static bool initDaemonAddress(const char * socketpath, struct sockaddr_un & address)
+{
+    if (strlen(socketpath) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Daemon socket path too long: %s\n", socketpath);
+        return false;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketpath);
+    return true;
+}
+
+/*
+ * Serves one request: receives its parameters and standard streams, runs it in place
+ * of this process' own standard streams and reports the return code.
+ */
+static void serveDaemonRequest(int connection, hdfsconnector * connector)
+{
+    //tell the client it has been picked up
+    if (!sendFully(connection, "R", 1))
+        return;
+
+    DaemonRequestHeader header;
+    int fds[3] = { -1, -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    while ((received = recvmsg(connection, &message, MSG_WAITALL)) < 0 && errno == EINTR);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(sizeof(fds)))
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    vector<char> arguments;
+    bool valid = received == (ssize_t)sizeof(header) && header.magic == DAEMON_REQUEST_MAGIC && fds[0] >= 0;
+    if (valid)
+    {
+        arguments.resize(header.length + 1, '\0');
+        valid = receiveFully(connection, &arguments[0], header.length);
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "Discarding incomplete daemon request\n");
+        for (unsigned i = 0; i < 3; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+        return;
+    }
+
+    vector<char *> argv;
+    argv.push_back((char *)"hdfsconnector");
+    for (size_t pos = 0; pos < header.length && argv.size() <= header.argc; pos += strlen(&arguments[pos]) + 1)
+        argv.push_back(&arguments[pos]);
+    argv.push_back(NULL);
+
+    //the connector reads and writes the standard streams, swap the client's in for the request
+    fflush(stdout);
+    fflush(stderr);
+    int saved[3];
+    for (int i = 0; i < 3; i++)
+    {
+        saved[i] = dup(i);
+        dup2(fds[i], i);
+        close(fds[i]);
+    }
+    clearerr(stdin);
+    clearerr(stdout);
+
+    int returnCode = runConnector(connector, argv.size() - 1, &argv[0]);
+
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++)
+    {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    clearerr(stdin);
+    clearerr(stdout);
+
+    fprintf(stderr, "Daemon worker %d served request for %s with return code %d\n", getpid(),
+            argv.size() > 2 ? argv[1] : "", returnCode);
+
+    sendFully(connection, (const char *)&returnCode, sizeof(returnCode));
+}
+
+static void runDaemonWorker(int listener, connectorfactory createConnector)
+{
+    hdfsconnector * connector = createConnector();
+    if (!connector)
+    {
+        fprintf(stderr, "\nError: Could not create connector\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    while (true)
+    {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(stderr, "Daemon worker %d could not accept requests: %s\n", getpid(), strerror(errno));
+            break;
+        }
+
+        serveDaemonRequest(connection, connector);
+        close(connection);
+    }
+
+    delete connector;
+    _exit(EXIT_FAILURE);
+}
+
+static volatile sig_atomic_t daemonStopping = 0;
+
+static void stopDaemon(int)
+{
+    daemonStopping = 1;
+}
+
+static int runConnectorDaemon(const char * socketpath, unsigned workers, connectorfactory createConnector)
+{
+    struct sockaddr_un address;
+    if (!initDaemonAddress(socketpath, address))
+        return EXIT_FAILURE;
+
+    //only one daemon per socket, the lock goes away with the daemon
+    string lockpath(socketpath);
+    lockpath.append(".lock");
+    int lock = open(lockpath.c_str(), O_RDWR | O_CREAT, 0600);
+    if (lock < 0 || flock(lock, LOCK_EX | LOCK_NB) != 0)
+    {
+        fprintf(stderr, "A connector daemon already serves %s\n", socketpath);
+        return EXIT_FAILURE;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketpath);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+    {
+        fprintf(stderr, "Could not listen on %s: %s\n", socketpath, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    chmod(socketpath, 0600);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = stopDaemon;
+    sigaction(SIGTERM, &stop, NULL);
+    sigaction(SIGINT, &stop, NULL);
+
+    fprintf(stderr, "Connector daemon %d serving %s with %u worker(s)\n", getpid(), socketpath, workers);
+
+    vector<pid_t> workerpids;
+    while (!daemonStopping)
+    {
+        //(re)start workers, a worker which crashed takes only its own request down
+        while (workerpids.size() < workers)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                signal(SIGTERM, SIG_DFL);
+                signal(SIGINT, SIG_DFL);
+                runDaemonWorker(listener, createConnector);
+            }
+            else if (pid < 0)
+            {
+                fprintf(stderr, "Could not start daemon worker: %s\n", strerror(errno));
+                sleep(1);
+                break;
+            }
+            workerpids.push_back(pid);
+        }
+
+        int status;
+        pid_t exited = waitpid(-1, &status, 0);
+        if (exited > 0)
+        {
+            fprintf(stderr, "Daemon worker %d exited with status %d\n", exited, status);
+            workerpids.erase(std::remove(workerpids.begin(), workerpids.end(), exited), workerpids.end());
+        }
+    }
+
+    fprintf(stderr, "Connector daemon %d stopping\n", getpid());
+    for (unsigned i = 0; i < workerpids.size(); i++)
+        kill(workerpids[i], SIGTERM);
+    for (unsigned i = 0; i < workerpids.size(); i++)
+        waitpid(workerpids[i], NULL, 0);
+
+    close(listener);
+    unlink(socketpath);
+    unlink(lockpath.c_str());
+    close(lock);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Hands the request and this process' standard streams to the daemon. Returns false,
+ * before anything was consumed, when no daemon worker picked the request up in time.
+ */
+static bool runConnectorClient(const char * socketpath, int argc, char ** argv, int & returnCode)
+{
+    struct sockaddr_un address;
+    if (!initDaemonAddress(socketpath, address))
+        return false;
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0)
+        return false;
+
+    if (connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "No connector daemon on %s, running request in process\n", socketpath);
+        close(connection);
+        return false;
+    }
+
+    struct pollfd ready;
+    ready.fd = connection;
+    ready.events = POLLIN;
+    char readyflag = 0;
+    if (poll(&ready, 1, DAEMON_READY_TIMEOUT_MS) != 1 || recv(connection, &readyflag, 1, 0) != 1 || readyflag != 'R')
+    {
+        fprintf(stderr, "Connector daemon on %s is busy, running request in process\n", socketpath);
+        close(connection);
+        return false;
+    }
+
+    string arguments;
+    for (int i = 0; i < argc; i++)
+        arguments.append(argv[i]).append(1, '\0');
+
+    DaemonRequestHeader header;
+    header.magic = DAEMON_REQUEST_MAGIC;
+    header.argc = argc;
+    header.length = arguments.size();
+
+    int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    returnCode = RETURN_FAILURE;
+    if (sendmsg(connection, &message, MSG_NOSIGNAL) != (ssize_t)sizeof(header) ||
+        !sendFully(connection, arguments.c_str(), arguments.size()) ||
+        !receiveFully(connection, (char *)&returnCode, sizeof(returnCode)))
+    {
+        //the streams may have been partly consumed by now, the request cannot be re-run here
+        fprintf(stderr, "Connector daemon on %s failed while serving the request\n", socketpath);
+        returnCode = RETURN_FAILURE;
+    }
+
+    close(connection);
+    return true;
+}
+
+/*
+ * Entry point shared by the connectors: runs as daemon, as daemon client, or
+ * serves the request directly.
+ */
+static int connectorMain(int argc, char ** argv, connectorfactory createConnector)
+{
+    int returnCode = EXIT_FAILURE;
+
+    if (argc >= 3 && strcmp(argv[1], "-daemon") == 0)
+    {
+        //no workers would leave the daemon spinning on nothing to reap, a negative count would wrap
+        int workers = argc >= 4 ? atoi(argv[3]) : DAEMON_DEFAULT_WORKERS;
+        if (workers < 1 || workers > DAEMON_MAX_WORKERS)
+        {
+            fprintf(stderr, "The connector daemon takes between 1 and %d workers, not %s\n", DAEMON_MAX_WORKERS, argv[3]);
+            return EXIT_FAILURE;
+        }
+        return runConnectorDaemon(argv[2], workers, createConnector);
+    }
+
+    if (argc >= 3 && strcmp(argv[1], "-client") == 0)
+    {
+        const char * socketpath = argv[2];
+
+        //keep the program name, drop the client parameters
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+
+        if (runConnectorClient(socketpath, argc - 1, argv + 1, returnCode))
+            return returnCode;
+    }
+
+    //a reader closing the pipe early shows as EPIPE, which stops the read, rather than killing the process
+    signal(SIGPIPE, SIG_IGN);
+
+    hdfsconnector * connector = createConnector();
+
+    if (connector)
+    {
+        returnCode = runConnector(connector, argc, argv);
+        delete (connector);
+    }
+    else
+        fprintf(stderr, "\nError: Could not create connector");
+
+    return returnCode;
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSHEDGE_HPP
+#define HDFSHEDGE_HPP
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+/*
+ * Hedged reads: a read of a range falling far behind this node's running averages,
+ * waiting for its first byte or for the rest of its bytes, gets a second request for
+ * the same range from another replica and the first one to finish is used. A
+ * straggling DataNode then costs one extra request instead of holding up the job.
+ */
+#define DEFAULT_HEDGE_DELAY_MS 500
+#define HEDGE_MIN_SAMPLES 3
+#define HEDGE_AVERAGE_WEIGHT 0.2
+
+struct HedgedReadStats
+{
+    unsigned long fired;
+    unsigned long won;
+};
+
+static double getElapsedMs(const struct timeval & start)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_usec - start.tv_usec) / 1000.0;
+}
+
+class hedgepolicy
+{
+private:
+    pthread_mutex_t lock;
+    double factor;
+    unsigned delayMs;
+    double avgFirstByteMs;
+    double avgBytesPerMs;
+    unsigned samples;
+    HedgedReadStats stats;
+
+public:
+    hedgepolicy() : factor(0), delayMs(DEFAULT_HEDGE_DELAY_MS), avgFirstByteMs(0), avgBytesPerMs(0), samples(0)
+    {
+        pthread_mutex_init(&lock, NULL);
+        stats.fired = 0;
+        stats.won = 0;
+    }
+
+    ~hedgepolicy()
+    {
+        pthread_mutex_destroy(&lock);
+    }
+
+    //A read is hedged once it takes factor times longer than usual, and at least delayms
+    void configure(double _factor, unsigned delayms)
+    {
+        factor = _factor;
+        delayMs = delayms;
+        stats.fired = 0;
+        stats.won = 0;
+    }
+
+    bool isEnabled() const
+    {
+        return factor > 0;
+    }
+
+    unsigned getDelayMs() const
+    {
+        return delayMs;
+    }
+
+    //firstbytems is negative while the read has not received anything yet
+    bool shouldHedge(double elapsedms, double firstbytems, unsigned long length)
+    {
+        if (!isEnabled() || elapsedms < delayMs)
+            return false;
+
+        pthread_mutex_lock(&lock);
+        bool hedge = false;
+        if (samples >= HEDGE_MIN_SAMPLES)
+        {
+            if (firstbytems < 0)
+                hedge = elapsedms > factor * avgFirstByteMs;
+            else if (avgBytesPerMs > 0)
+                hedge = elapsedms > factor * (avgFirstByteMs + length / avgBytesPerMs);
+        }
+        pthread_mutex_unlock(&lock);
+        return hedge;
+    }
+
+    void recordRead(double firstbytems, double totalms, unsigned long length)
+    {
+        if (firstbytems < 0 || length == 0)
+            return;
+
+        double transferms = totalms - firstbytems;
+        double bytesperms = length / (transferms > 1 ? transferms : 1);
+
+        pthread_mutex_lock(&lock);
+        if (samples == 0)
+        {
+            avgFirstByteMs = firstbytems;
+            avgBytesPerMs = bytesperms;
+        }
+        else
+        {
+            avgFirstByteMs += HEDGE_AVERAGE_WEIGHT * (firstbytems - avgFirstByteMs);
+            avgBytesPerMs += HEDGE_AVERAGE_WEIGHT * (bytesperms - avgBytesPerMs);
+        }
+        samples++;
+        pthread_mutex_unlock(&lock);
+    }
+
+    void recordHedge(bool won)
+    {
+        __sync_fetch_and_add(&stats.fired, 1UL);
+        if (won)
+            __sync_fetch_and_add(&stats.won, 1UL);
+    }
+
+    void report()
+    {
+        if (stats.fired > 0)
+            fprintf(stderr, "Hedged reads: %lu, won by the hedge: %lu\n", stats.fired, stats.won);
+    }
+};
+
+#endif
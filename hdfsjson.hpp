@@ -0,0 +1,240 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSJSON_HPP
+#define HDFSJSON_HPP
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+/*
+ * A pull reader of JSON text, just enough for WebHDFS responses and without 3rd
+ * party deps. Tokens are read in place: string and number tokens are spans of
+ * the text, nothing is allocated until a caller copies a string out. Separators
+ * are skipped, an object reads as alternating key and value tokens.
+ */
+enum JsonToken
+{
+    JSON_END,
+    JSON_ERROR,
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+};
+
+class jsonreader
+{
+private:
+    const char * pos;
+    const char * end;
+    const char * tokenStart;
+    const char * tokenText;
+    size_t tokenLength;
+    bool tokenEscaped;
+
+    bool isDelimiter(char c)
+    {
+        return c == ',' || c == ':' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    bool readLiteral(const char * literal)
+    {
+        size_t length = strlen(literal);
+        if ((size_t)(end - pos) < length || memcmp(pos, literal, length) != 0)
+            return false;
+        tokenText = pos;
+        tokenLength = length;
+        pos += length;
+        return true;
+    }
+
+    static int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+public:
+    jsonreader(const char * text, size_t length) : pos(text), end(text + length), tokenStart(text), tokenText(text),
+            tokenLength(0), tokenEscaped(false) {}
+
+    JsonToken next()
+    {
+        while (pos < end && isDelimiter(*pos))
+            pos++;
+
+        tokenStart = pos;
+        tokenLength = 0;
+        tokenEscaped = false;
+        if (pos >= end)
+            return JSON_END;
+
+        switch (*pos)
+        {
+        case '{':
+            pos++;
+            return JSON_OBJECT_START;
+        case '}':
+            pos++;
+            return JSON_OBJECT_END;
+        case '[':
+            pos++;
+            return JSON_ARRAY_START;
+        case ']':
+            pos++;
+            return JSON_ARRAY_END;
+        case '"':
+            tokenText = ++pos;
+            while (pos < end && *pos != '"')
+            {
+                if (*pos == '\\')
+                {
+                    tokenEscaped = true;
+                    pos++;
+                }
+                pos++;
+            }
+            if (pos >= end)
+                return JSON_ERROR;
+            tokenLength = pos++ - tokenText;
+            return JSON_STRING;
+        case 't':
+            return readLiteral("true") ? JSON_TRUE : JSON_ERROR;
+        case 'f':
+            return readLiteral("false") ? JSON_FALSE : JSON_ERROR;
+        case 'n':
+            return readLiteral("null") ? JSON_NULL : JSON_ERROR;
+        }
+
+        tokenText = pos;
+        while (pos < end && (isdigit(*pos) || *pos == '-' || *pos == '+' || *pos == '.' || *pos == 'e' || *pos == 'E'))
+            pos++;
+        tokenLength = pos - tokenText;
+        return tokenLength > 0 ? JSON_NUMBER : JSON_ERROR;
+    }
+
+    //Skips the rest of the value which the token just read starts
+    bool skipValue(JsonToken token)
+    {
+        int depth = 0;
+        while (true)
+        {
+            if (token == JSON_OBJECT_START || token == JSON_ARRAY_START)
+                depth++;
+            else if (token == JSON_OBJECT_END || token == JSON_ARRAY_END)
+                depth--;
+            else if (token == JSON_END || token == JSON_ERROR)
+                return false;
+
+            if (depth <= 0)
+                return depth == 0;
+            token = next();
+        }
+    }
+
+    //Where the token last read starts, a string's with its opening quote
+    const char * getTokenStart() const
+    {
+        return tokenStart;
+    }
+
+    //Just past the last token read, after skipValue just past the value
+    const char * getPosition() const
+    {
+        return pos;
+    }
+
+    bool tokenEquals(const char * text) const
+    {
+        return !tokenEscaped && strlen(text) == tokenLength && memcmp(tokenText, text, tokenLength) == 0;
+    }
+
+    long getLong() const
+    {
+        return strtol(tokenText, NULL, 10);
+    }
+
+    void getString(std::string & value) const
+    {
+        value.clear();
+        if (!tokenEscaped)
+        {
+            value.assign(tokenText, tokenLength);
+            return;
+        }
+
+        const char * tokenEnd = tokenText + tokenLength;
+        for (const char * c = tokenText; c < tokenEnd; c++)
+        {
+            if (*c != '\\' || c + 1 >= tokenEnd)
+            {
+                value.append(1, *c);
+                continue;
+            }
+
+            switch (*++c)
+            {
+            case 'b': value.append(1, '\b'); break;
+            case 'f': value.append(1, '\f'); break;
+            case 'n': value.append(1, '\n'); break;
+            case 'r': value.append(1, '\r'); break;
+            case 't': value.append(1, '\t'); break;
+            case 'u':
+            {
+                unsigned code = 0;
+                for (int i = 0; i < 4 && c + 1 < tokenEnd && hexValue(c[1]) >= 0; i++)
+                    code = code * 16 + hexValue(*++c);
+
+                //HDFS names are UTF-8, surrogate pairs are left as they are
+                if (code < 0x80)
+                    value.append(1, (char)code);
+                else if (code < 0x800)
+                {
+                    value.append(1, (char)(0xC0 | (code >> 6)));
+                    value.append(1, (char)(0x80 | (code & 0x3F)));
+                }
+                else
+                {
+                    value.append(1, (char)(0xE0 | (code >> 12)));
+                    value.append(1, (char)(0x80 | ((code >> 6) & 0x3F)));
+                    value.append(1, (char)(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default:
+                value.append(1, *c);
+            }
+        }
+    }
+};
+
+#endif
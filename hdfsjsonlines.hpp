@@ -0,0 +1,256 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSJSONLINES_HPP
+#define HDFSJSONLINES_HPP
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "hdfsjson.hpp"
+
+/*
+ * JSON Lines (NDJSON) records: one JSON object per line. A line ends at a newline
+ * outside a string, string and escape state is tracked so neither a newline within
+ * a string nor an escaped quote ends or flips it. The scan tests eight bytes at a time for the characters
+ * which matter, a newline, quote or backslash, so plain text is skipped a word at
+ * a time.
+ */
+#define JSON_LINE_WORD_ONES 0x0101010101010101ULL
+#define JSON_LINE_WORD_HIGHS 0x8080808080808080ULL
+
+static inline uint64_t jsonWordHasByte(uint64_t word, unsigned char byte)
+{
+    uint64_t matched = word ^ (JSON_LINE_WORD_ONES * byte);
+    return (matched - JSON_LINE_WORD_ONES) & ~matched & JSON_LINE_WORD_HIGHS;
+}
+
+static inline bool jsonWordIsPlain(const char * data)
+{
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    return !(jsonWordHasByte(word, '\n') | jsonWordHasByte(word, '"') | jsonWordHasByte(word, '\\'));
+}
+
+class jsonlinetracker
+{
+private:
+    bool inString;
+    bool escaped;
+    bool atBoundary;
+
+public:
+    jsonlinetracker() : inString(false), escaped(false), atBoundary(false) {}
+
+    //Consumes data up to and including the newline ending the current line, if there is one
+    unsigned long scan(const char * data, unsigned long length)
+    {
+        atBoundary = false;
+        unsigned long index = 0;
+        while (index < length)
+        {
+            if (!escaped)
+            {
+                while (index + sizeof(uint64_t) <= length && jsonWordIsPlain(data + index))
+                    index += sizeof(uint64_t);
+                if (index >= length)
+                    break;
+            }
+
+            char c = data[index++];
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = inString;
+            else if (c == '"')
+                inString = !inString;
+            else if (c == '\n' && !inString)
+            {
+                atBoundary = true;
+                break;
+            }
+        }
+        return index;
+    }
+
+    /*
+     * Consumes data up to and including the first newline, string state unknown. A
+     * read starting within a record takes any newline as its end, JSON Lines do not
+     * hold raw newlines in strings.
+     */
+    unsigned long resync(const char * data, unsigned long length)
+    {
+        const char * newline = (const char *)memchr(data, '\n', length);
+        atBoundary = newline != NULL;
+        inString = false;
+        escaped = false;
+        return newline ? newline - data + 1 : length;
+    }
+
+    bool atRecordBoundary() const
+    {
+        return atBoundary;
+    }
+};
+
+/*
+ * Top-level keys of each record handed to Thor as CSV columns, or as fixed width
+ * FLAT columns when widths are given. Strings are unescaped, nested objects and
+ * arrays are passed as their JSON text, missing keys and nulls are empty. With no
+ * keys the records pass through whole.
+ */
+struct JsonProjection
+{
+    std::vector<std::string> fields;
+    std::vector<unsigned> widths;
+    std::string separator;
+    char quote;
+    std::string terminator;
+};
+
+static void splitJsonList(const char * list, std::vector<std::string> & items)
+{
+    items.clear();
+    std::string remaining(list);
+    while (remaining.size() > 0)
+    {
+        size_t comma = remaining.find(',');
+        items.push_back(remaining.substr(0, comma));
+        remaining = comma == std::string::npos ? "" : remaining.substr(comma + 1);
+    }
+}
+
+static bool parseJsonProjection(const char * fields, const char * widths, JsonProjection & projection)
+{
+    splitJsonList(fields, projection.fields);
+
+    std::vector<std::string> widthlist;
+    splitJsonList(widths, widthlist);
+    projection.widths.clear();
+    for (unsigned i = 0; i < widthlist.size(); i++)
+    {
+        int width = atoi(widthlist[i].c_str());
+        if (width <= 0)
+            return false;
+        projection.widths.push_back(width);
+    }
+
+    return projection.widths.empty() || projection.widths.size() == projection.fields.size();
+}
+
+static void appendJsonColumn(const JsonProjection & projection, unsigned column, const std::string & value, std::string & out)
+{
+    if (projection.widths.size() > 0)
+    {
+        unsigned width = projection.widths[column];
+        out.append(value, 0, width);
+        if (value.size() < width)
+            out.append(width - value.size(), ' ');
+        return;
+    }
+
+    if (column > 0)
+        out.append(projection.separator);
+
+    bool quoted = projection.quote && (value.find(projection.separator) != std::string::npos
+            || value.find(projection.quote) != std::string::npos || value.find_first_of("\r\n") != std::string::npos);
+    if (!quoted)
+    {
+        out.append(value);
+        return;
+    }
+
+    out.append(1, projection.quote);
+    for (unsigned i = 0; i < value.size(); i++)
+    {
+        if (value[i] == projection.quote)
+            out.append(1, projection.quote);
+        out.append(1, value[i]);
+    }
+    out.append(1, projection.quote);
+}
+
+//Appends the projection of one line, without its newline, to out, false if it is not a JSON object
+static bool projectJsonLine(const char * line, unsigned long length, const JsonProjection & projection,
+        std::vector<std::string> & values, std::string & out)
+{
+    while (length > 0 && (line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t'))
+        length--;
+
+    unsigned long blank = 0;
+    while (blank < length && (line[blank] == ' ' || line[blank] == '\t'))
+        blank++;
+    if (blank == length)
+        return true;
+
+    if (projection.fields.empty())
+    {
+        out.append(line, length).append(projection.terminator);
+        return true;
+    }
+
+    values.resize(projection.fields.size());
+    for (unsigned i = 0; i < values.size(); i++)
+        values[i].clear();
+
+    jsonreader reader(line, length);
+    if (reader.next() != JSON_OBJECT_START)
+        return false;
+
+    std::string key;
+    JsonToken token;
+    while ((token = reader.next()) == JSON_STRING)
+    {
+        reader.getString(key);
+
+        unsigned column = 0;
+        while (column < projection.fields.size() && projection.fields[column] != key)
+            column++;
+
+        token = reader.next();
+        const char * valuestart = reader.getTokenStart();
+        if (token == JSON_OBJECT_START || token == JSON_ARRAY_START)
+        {
+            if (!reader.skipValue(token))
+                return false;
+            if (column < values.size())
+                values[column].assign(valuestart, reader.getPosition() - valuestart);
+        }
+        else if (token == JSON_STRING || token == JSON_NUMBER || token == JSON_TRUE || token == JSON_FALSE)
+        {
+            if (column < values.size())
+                reader.getString(values[column]);
+        }
+        else if (token != JSON_NULL)
+            return false;
+    }
+    if (token != JSON_OBJECT_END)
+        return false;
+
+    for (unsigned i = 0; i < values.size(); i++)
+        appendJsonColumn(projection, i, values[i], out);
+    if (projection.widths.empty())
+        out.append(projection.terminator);
+    return true;
+}
+
+#endif
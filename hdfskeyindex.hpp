@@ -0,0 +1,267 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSKEYINDEX_HPP
+#define HDFSKEYINDEX_HPP
+
+#include <math.h>
+#include <string>
+#include <vector>
+#include <set>
+
+#include "hdfscolumnstats.hpp"
+
+/*
+ * Key index sidecar, written to <filename>-index/part_<node>_<count>.index by the
+ * write path. It holds a Bloom filter of the key field for each row block:
+ *
+ *   H2HINDEX  1  <FLAT|CSV>  <key field>
+ *   BLOCK     <part name>  <offset>  <length>  <rows>  <hashes>  <bits>  <hex bitmap>
+ *   PART      <part name>  0  <length>  <rows>
+ */
+#define KEY_INDEX_VERSION "1"
+#define DEFAULT_KEY_INDEX_FPP 0.01
+
+static unsigned long long hashIndexKey(const std::string & key)
+{
+    //64 bit FNV-1a
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned i = 0; i < key.size(); i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * Double hashing over a single 64 bit hash, bit i of a key is h1 + i * h2.
+ */
+class bloomfilter
+{
+private:
+    std::vector<unsigned char> bits;
+    unsigned long bitCount;
+    unsigned hashCount;
+
+    unsigned long getBit(unsigned long long hash, unsigned i) const
+    {
+        unsigned long h1 = (unsigned long)(hash & 0xffffffffULL);
+        unsigned long h2 = (unsigned long)(hash >> 32) | 1;
+        return (unsigned long)((h1 + (unsigned long long)i * h2) % bitCount);
+    }
+
+public:
+    bloomfilter() : bitCount(0), hashCount(0) {}
+
+    //Sized for the number of keys and false positive probability
+    void init(unsigned long keys, double fpp)
+    {
+        if (keys == 0)
+            keys = 1;
+        bitCount = (unsigned long)ceil(-(double)keys * log(fpp) / (log(2.0) * log(2.0)));
+        if (bitCount < 64)
+            bitCount = 64;
+        hashCount = (unsigned)(0.5 + (double)bitCount / keys * log(2.0));
+        if (hashCount == 0)
+            hashCount = 1;
+        bits.assign((bitCount + 7) / 8, 0);
+    }
+
+    void add(unsigned long long hash)
+    {
+        for (unsigned i = 0; i < hashCount; i++)
+        {
+            unsigned long bit = getBit(hash, i);
+            bits[bit / 8] |= 1 << (bit % 8);
+        }
+    }
+
+    bool mayContain(unsigned long long hash) const
+    {
+        for (unsigned i = 0; i < hashCount; i++)
+        {
+            unsigned long bit = getBit(hash, i);
+            if (!(bits[bit / 8] & (1 << (bit % 8))))
+                return false;
+        }
+        return true;
+    }
+
+    void serialize(std::string & out) const
+    {
+        static const char * hexdigits = "0123456789abcdef";
+        char numbers[48];
+        sprintf(numbers, "%u\t%lu\t", hashCount, bitCount);
+        out.append(numbers);
+        for (unsigned i = 0; i < bits.size(); i++)
+        {
+            out.append(1, hexdigits[bits[i] >> 4]);
+            out.append(1, hexdigits[bits[i] & 0xf]);
+        }
+    }
+
+    bool deserialize(const std::string & hashes, const std::string & bitcount, const std::string & hex)
+    {
+        hashCount = atoi(hashes.c_str());
+        bitCount = strtoul(bitcount.c_str(), NULL, 10);
+        if (hashCount == 0 || bitCount == 0 || hex.size() != 2 * ((bitCount + 7) / 8))
+            return false;
+
+        bits.resize(hex.size() / 2);
+        for (unsigned i = 0; i < bits.size(); i++)
+            bits[i] = (unsigned char)strtoul(hex.substr(2 * i, 2).c_str(), NULL, 16);
+        return true;
+    }
+};
+
+/*
+ * Builds a Bloom filter of the key field for each row block written.
+ */
+class keyindexobserver : public rowblockobserver
+{
+private:
+    ColumnStatsField keyField;
+    bool isFlat;
+    std::string separator;
+    std::string quote;
+    std::string terminator;
+    double fpp;
+
+    std::vector<unsigned long long> blockHashes;
+
+public:
+    keyindexobserver(const ColumnStatsField & keyfield, bool isflat, const std::string & _separator,
+            const std::string & _quote, const std::string & _terminator, double _fpp)
+        : keyField(keyfield), isFlat(isflat), separator(_separator), quote(_quote), terminator(_terminator), fpp(_fpp)
+    {
+        sidecar.assign("H2HINDEX\t" KEY_INDEX_VERSION "\t");
+        sidecar.append(isFlat ? "FLAT" : "CSV").append("\t").append(keyField.key).append("\n");
+    }
+
+    const char * getSidecarDir() const
+    {
+        return "-index";
+    }
+
+    const char * getSidecarExtension() const
+    {
+        return ".index";
+    }
+
+    void startPart(const std::string & name)
+    {
+        rowblockobserver::startPart(name);
+        blockHashes.clear();
+    }
+
+    void addRecord(const char * data, unsigned long length)
+    {
+        std::string key;
+        if (isFlat)
+            extractFlatField(data, length, keyField.offset, keyField.length, key);
+        else
+            extractCsvField(data, length, keyField.field, separator, quote, terminator, key);
+
+        blockHashes.push_back(hashIndexKey(key));
+    }
+
+    void endBlock(unsigned long offset, unsigned long length, unsigned long rows)
+    {
+        //the filter is sized once the number of keys in the block is known
+        bloomfilter filter;
+        filter.init(blockHashes.size(), fpp);
+        for (unsigned i = 0; i < blockHashes.size(); i++)
+            filter.add(blockHashes[i]);
+        blockHashes.clear();
+
+        appendPosition("BLOCK", offset, length, rows);
+        sidecar.append("\t");
+        filter.serialize(sidecar);
+        sidecar.append("\n");
+    }
+
+    void endPart(unsigned long length, unsigned long rows)
+    {
+        appendPosition("PART", 0, length, rows);
+        sidecar.append("\n");
+    }
+};
+
+/*
+ * A key set lookup evaluated against key index sidecars: parts and row blocks
+ * whose Bloom filters contain none of the keys are ruled out.
+ */
+class keyindexlookup
+{
+private:
+    std::string keyField;
+    std::vector<unsigned long long> keyHashes;
+
+public:
+    keyindexlookup(const char * keyfield) : keyField(keyfield) {}
+
+    void addKey(const std::string & key)
+    {
+        keyHashes.push_back(hashIndexKey(key));
+    }
+
+    unsigned long getKeyCount() const
+    {
+        return keyHashes.size();
+    }
+
+    bool isActive() const
+    {
+        return keyField.size() > 0 && keyHashes.size() > 0;
+    }
+
+    //Loads one sidecar, returns false if it does not index the key field
+    bool load(const std::string & sidecar, rowblockfilter & filter)
+    {
+        bool indexed = false;
+        std::set<std::string> matchingParts;
+
+        size_t start = 0;
+        std::vector<std::string> columns;
+        while (getSidecarLine(sidecar, start, columns))
+        {
+            if (columns[0] == "H2HINDEX" && columns.size() >= 4)
+                indexed = columns[3] == keyField;
+            else if (!indexed)
+                continue;
+            else if (columns[0] == "BLOCK" && columns.size() >= 8)
+            {
+                bloomfilter blockfilter;
+                bool matches = !blockfilter.deserialize(columns[5], columns[6], columns[7]);
+                for (unsigned i = 0; i < keyHashes.size() && !matches; i++)
+                    matches = blockfilter.mayContain(keyHashes[i]);
+
+                if (matches)
+                    matchingParts.insert(columns[1]);
+                filter.restrictBlock(columns[1], strtoul(columns[2].c_str(), NULL, 10), strtoul(columns[3].c_str(), NULL, 10), matches);
+            }
+            else if (columns[0] == "PART")
+                filter.restrictPart(columns[1], matchingParts.find(columns[1]) != matchingParts.end());
+        }
+
+        return indexed;
+    }
+};
+
+#endif
@@ -0,0 +1,1374 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSNATIVECLIENT_HPP
+#define HDFSNATIVECLIENT_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hdfsprotobuf.hpp"
+#include "hdfsreplicas.hpp"
+
+/*
+ * Native HDFS client: Hadoop IPC (protocol version 9, protobuf RPC engine, no SASL)
+ * towards the NameNode ClientProtocol, and the DataTransferProtocol (version 28)
+ * READ_BLOCK operation towards DataNodes, with checksum verification. Replicas on
+ * this host may instead be read short-circuit: the DataNode hands the block and
+ * meta files over its domain socket and they are read directly.
+ */
+#define HADOOP_IPC_VERSION 9
+#define HADOOP_RPC_KIND_PROTOBUF 2
+#define HADOOP_RPC_CONNECTION_CONTEXT_CALL_ID -3
+#define HADOOP_CLIENT_PROTOCOL "org.apache.hadoop.hdfs.protocol.ClientProtocol"
+#define HADOOP_DATA_TRANSFER_VERSION 28
+#define HADOOP_OP_READ_BLOCK 81
+#define HADOOP_OP_REQUEST_SHORT_CIRCUIT_FDS 87
+#define HADOOP_SHORT_CIRCUIT_VERSION 1
+#define HADOOP_BLOCK_META_VERSION 1
+#define HADOOP_BLOCK_META_HEADER_SIZE 7
+#define HADOOP_STATUS_SUCCESS 0
+#define HADOOP_STATUS_CHECKSUM_OK 6
+#define HADOOP_CHECKSUM_NULL 0
+#define HADOOP_CHECKSUM_CRC32 1
+#define HADOOP_CHECKSUM_CRC32C 2
+#define HADOOP_MAX_RPC_RESPONSE (128 * 1024 * 1024)
+#define HADOOP_MAX_PACKET_SIZE (16 * 1024 * 1024)
+#define DEFAULT_NAMENODE_PORT 8020
+#define NATIVE_LOCAL_READ_SIZE (1024 * 1024)
+
+struct NativeFileStatus
+{
+    std::string name;
+    bool isDirectory;
+    unsigned long length;
+    unsigned long modificationTime;
+    unsigned long blockSize;
+};
+
+struct NativeDatanode
+{
+    std::string ipAddr;
+    std::string hostName;
+    unsigned xferPort;
+};
+
+struct NativeLocatedBlock
+{
+    std::string poolId;
+    unsigned long long blockId;
+    unsigned long long generationStamp;
+    unsigned long long numBytes;
+    unsigned long offset;
+    std::vector<NativeDatanode> locations;
+    std::string tokenIdentifier;
+    std::string tokenPassword;
+    std::string tokenKind;
+    std::string tokenService;
+};
+
+static int connectTcp(const char * host, unsigned port)
+{
+    char service[16];
+    sprintf(service, "%u", port);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo * addresses = NULL;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0)
+    {
+        fprintf(stderr, "Could not resolve %s:%u\n", host, port);
+        return -1;
+    }
+
+    int sock = -1;
+    for (struct addrinfo * address = addresses; address && sock < 0; address = address->ai_next)
+    {
+        sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (sock >= 0 && connect(sock, address->ai_addr, address->ai_addrlen) != 0)
+        {
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (sock < 0)
+        fprintf(stderr, "Could not connect to %s:%u: %s\n", host, port, strerror(errno));
+    else
+    {
+        int nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+
+    return sock;
+}
+
+//The DataNode's domain socket, _PORT in the configured path stands for its transfer port
+static int connectDomainSocket(const std::string & pathpattern, unsigned port)
+{
+    std::string path(pathpattern);
+    size_t portpos = path.find("_PORT");
+    if (portpos != std::string::npos)
+    {
+        char portstr[16];
+        sprintf(portstr, "%u", port);
+        path.replace(portpos, 5, portstr);
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Domain socket path too long: %s\n", path.c_str());
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        fprintf(stderr, "Could not connect to %s: %s\n", path.c_str(), strerror(errno));
+        close(sock);
+        sock = -1;
+    }
+    return sock;
+}
+
+//Receives the one byte message carrying count file descriptors
+static bool receiveFileDescriptors(int sock, int * fds, unsigned count)
+{
+    char byte;
+    struct iovec vector;
+    vector.iov_base = &byte;
+    vector.iov_len = 1;
+
+    std::vector<char> control(CMSG_SPACE(count * sizeof(int)));
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = &control[0];
+    message.msg_controllen = control.size();
+
+    ssize_t received;
+    do
+        received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+    while (received < 0 && errno == EINTR);
+
+    unsigned found = 0;
+    for (struct cmsghdr * header = received == 1 ? CMSG_FIRSTHDR(&message) : NULL; header;
+            header = CMSG_NXTHDR(&message, header))
+    {
+        if (header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+            continue;
+        unsigned available = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (unsigned i = 0; i < available; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+            if (found < count)
+                fds[found++] = fd;
+            else
+                close(fd);
+        }
+    }
+
+    if (found == count && !(message.msg_flags & MSG_CTRUNC))
+        return true;
+    for (unsigned i = 0; i < found; i++)
+        close(fds[i]);
+    return false;
+}
+
+static bool readFileFully(int fd, char * data, size_t length, unsigned long long offset)
+{
+    while (length > 0)
+    {
+        ssize_t bytesread = pread(fd, data, length, offset);
+        if (bytesread < 0 && errno == EINTR)
+            continue;
+        if (bytesread <= 0)
+            return false;
+        data += bytesread;
+        length -= bytesread;
+        offset += bytesread;
+    }
+    return true;
+}
+
+static bool writeSocket(int sock, const char * data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = send(sock, data, length, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool readSocket(int sock, char * data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t received = recv(sock, data, length, 0);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+static bool readSocketVarint(int sock, unsigned long long & value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        unsigned char byte;
+        if (!readSocket(sock, (char *)&byte, 1))
+            return false;
+        value |= (unsigned long long)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+//Reads a message written with writeDelimitedTo
+static bool readSocketDelimited(int sock, std::string & message)
+{
+    unsigned long long length;
+    if (!readSocketVarint(sock, length) || length > HADOOP_MAX_RPC_RESPONSE)
+        return false;
+    message.resize(length);
+    return length == 0 || readSocket(sock, &message[0], length);
+}
+
+static void appendBigEndian(std::string & out, unsigned long long value, unsigned bytes)
+{
+    for (unsigned i = bytes; i > 0; i--)
+        out.append(1, (char)((value >> (8 * (i - 1))) & 0xff));
+}
+
+static unsigned long long getBigEndian(const char * data, unsigned bytes)
+{
+    unsigned long long value = 0;
+    for (unsigned i = 0; i < bytes; i++)
+        value = (value << 8) | (unsigned char)data[i];
+    return value;
+}
+
+static bool readDelimitedField(const std::string & buffer, size_t & pos, std::string & message)
+{
+    pbreader reader(buffer.data() + pos, buffer.size() - pos);
+    const char * field;
+    size_t length;
+    if (!reader.readLengthDelimited(field, length))
+        return false;
+    message.assign(field, length);
+    pos = field + length - buffer.data();
+    return true;
+}
+
+static void parseFileStatus(pbreader status, NativeFileStatus & filestatus)
+{
+    filestatus.isDirectory = false;
+    filestatus.length = 0;
+    filestatus.modificationTime = 0;
+    filestatus.blockSize = 0;
+
+    unsigned field, wiretype;
+    while (status.next(field, wiretype))
+    {
+        if (field == 1 && wiretype == PB_WIRE_VARINT)
+            filestatus.isDirectory = status.readVarint() == 1; //IS_DIR
+        else if (field == 2 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            filestatus.name = status.readString();
+        else if (field == 3 && wiretype == PB_WIRE_VARINT)
+            filestatus.length = status.readVarint();
+        else if (field == 7 && wiretype == PB_WIRE_VARINT)
+            filestatus.modificationTime = status.readVarint();
+        else if (field == 11 && wiretype == PB_WIRE_VARINT)
+            filestatus.blockSize = status.readVarint();
+        else
+            status.skip(wiretype);
+    }
+}
+
+static void parseLocatedBlock(pbreader located, NativeLocatedBlock & block)
+{
+    block.blockId = 0;
+    block.generationStamp = 0;
+    block.numBytes = 0;
+    block.offset = 0;
+
+    unsigned field, wiretype;
+    while (located.next(field, wiretype))
+    {
+        if (field == 1 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+        {
+            pbreader extended = located.readMessage();
+            unsigned efield, ewiretype;
+            while (extended.next(efield, ewiretype))
+            {
+                if (efield == 1 && ewiretype == PB_WIRE_LENGTH_DELIMITED)
+                    block.poolId = extended.readString();
+                else if (efield == 2 && ewiretype == PB_WIRE_VARINT)
+                    block.blockId = extended.readVarint();
+                else if (efield == 3 && ewiretype == PB_WIRE_VARINT)
+                    block.generationStamp = extended.readVarint();
+                else if (efield == 4 && ewiretype == PB_WIRE_VARINT)
+                    block.numBytes = extended.readVarint();
+                else
+                    extended.skip(ewiretype);
+            }
+        }
+        else if (field == 2 && wiretype == PB_WIRE_VARINT)
+            block.offset = located.readVarint();
+        else if (field == 3 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+        {
+            NativeDatanode datanode;
+            datanode.xferPort = 0;
+
+            pbreader info = located.readMessage();
+            unsigned ifield, iwiretype;
+            while (info.next(ifield, iwiretype))
+            {
+                if (ifield != 1 || iwiretype != PB_WIRE_LENGTH_DELIMITED)
+                {
+                    info.skip(iwiretype);
+                    continue;
+                }
+
+                pbreader id = info.readMessage();
+                unsigned dfield, dwiretype;
+                while (id.next(dfield, dwiretype))
+                {
+                    if (dfield == 1 && dwiretype == PB_WIRE_LENGTH_DELIMITED)
+                        datanode.ipAddr = id.readString();
+                    else if (dfield == 2 && dwiretype == PB_WIRE_LENGTH_DELIMITED)
+                        datanode.hostName = id.readString();
+                    else if (dfield == 4 && dwiretype == PB_WIRE_VARINT)
+                        datanode.xferPort = (unsigned)id.readVarint();
+                    else
+                        id.skip(dwiretype);
+                }
+            }
+            block.locations.push_back(datanode);
+        }
+        else if (field == 5 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+        {
+            pbreader token = located.readMessage();
+            unsigned tfield, twiretype;
+            while (token.next(tfield, twiretype))
+            {
+                if (twiretype != PB_WIRE_LENGTH_DELIMITED)
+                    token.skip(twiretype);
+                else if (tfield == 1)
+                    block.tokenIdentifier = token.readString();
+                else if (tfield == 2)
+                    block.tokenPassword = token.readString();
+                else if (tfield == 3)
+                    block.tokenKind = token.readString();
+                else if (tfield == 4)
+                    block.tokenService = token.readString();
+                else
+                    token.skip(twiretype);
+            }
+        }
+        else
+            located.skip(wiretype);
+    }
+}
+
+/*
+ * One connection to the NameNode, calls are made one at a time.
+ */
+class namenodeclient
+{
+private:
+    int sock;
+    int callId;
+    std::string clientId;
+    std::string user;
+
+    void appendRpcHeader(std::string & packet, int callid)
+    {
+        pbwriter header;
+        header.writeUInt64(1, HADOOP_RPC_KIND_PROTOBUF);
+        header.writeUInt64(2, 0); //RPC_FINAL_PACKET
+        header.writeSInt32(3, callid);
+        header.writeString(4, clientId);
+        header.writeSInt32(5, -1); //no retry
+        header.appendDelimited(packet);
+    }
+
+    bool sendPacket(const std::string & packet)
+    {
+        std::string framed;
+        appendBigEndian(framed, packet.size(), 4);
+        framed.append(packet);
+        return writeSocket(sock, framed.data(), framed.size());
+    }
+
+public:
+    namenodeclient() : sock(-1), callId(0) {}
+
+    ~namenodeclient()
+    {
+        disconnect();
+    }
+
+    bool isConnected() const
+    {
+        return sock >= 0;
+    }
+
+    const std::string & getUser() const
+    {
+        return user;
+    }
+
+    void disconnect()
+    {
+        if (sock >= 0)
+            close(sock);
+        sock = -1;
+    }
+
+    bool connect(const char * host, unsigned port, const char * username)
+    {
+        disconnect();
+
+        sock = connectTcp(host, port);
+        if (sock < 0)
+            return false;
+
+        user.assign(username);
+        callId = 0;
+
+        //globally unique client id, 16 bytes
+        clientId.resize(16);
+        int random = open("/dev/urandom", O_RDONLY);
+        if (random < 0 || read(random, &clientId[0], 16) != 16)
+        {
+            for (unsigned i = 0; i < 16; i++)
+                clientId[i] = (char)rand();
+        }
+        if (random >= 0)
+            close(random);
+
+        //connection header: "hrpc", version, service class, auth protocol NONE
+        std::string preamble("hrpc");
+        preamble.append(1, (char)HADOOP_IPC_VERSION);
+        preamble.append(1, (char)0);
+        preamble.append(1, (char)0);
+
+        pbwriter userinfo;
+        userinfo.writeString(1, user);
+        pbwriter context;
+        context.writeMessage(2, userinfo);
+        context.writeString(3, HADOOP_CLIENT_PROTOCOL);
+
+        std::string packet;
+        appendRpcHeader(packet, HADOOP_RPC_CONNECTION_CONTEXT_CALL_ID);
+        context.appendDelimited(packet);
+
+        if (!writeSocket(sock, preamble.data(), preamble.size()) || !sendPacket(packet))
+        {
+            fprintf(stderr, "Could not set up the NameNode connection to %s:%u\n", host, port);
+            disconnect();
+            return false;
+        }
+
+        return true;
+    }
+
+    bool call(const char * method, const pbwriter & request, std::string & response)
+    {
+        if (sock < 0)
+            return false;
+
+        int callid = callId++;
+
+        pbwriter requestheader;
+        requestheader.writeString(1, method);
+        requestheader.writeString(2, HADOOP_CLIENT_PROTOCOL);
+        requestheader.writeUInt64(3, 1);
+
+        std::string packet;
+        appendRpcHeader(packet, callid);
+        requestheader.appendDelimited(packet);
+        request.appendDelimited(packet);
+
+        char lengthbytes[4];
+        if (!sendPacket(packet) || !readSocket(sock, lengthbytes, 4))
+        {
+            fprintf(stderr, "NameNode connection lost calling %s\n", method);
+            disconnect();
+            return false;
+        }
+
+        //a garbled length is refused before anything is allocated for it
+        unsigned long length = getBigEndian(lengthbytes, 4);
+        std::string reply;
+        if (length <= HADOOP_MAX_RPC_RESPONSE)
+            reply.resize(length);
+        if (length > HADOOP_MAX_RPC_RESPONSE || (length > 0 && !readSocket(sock, &reply[0], length)))
+        {
+            fprintf(stderr, "NameNode connection lost reading the %s response\n", method);
+            disconnect();
+            return false;
+        }
+
+        size_t pos = 0;
+        std::string header;
+        if (!readDelimitedField(reply, pos, header))
+        {
+            fprintf(stderr, "Malformed NameNode response to %s\n", method);
+            return false;
+        }
+
+        unsigned status = 0;
+        std::string exceptionclass;
+        std::string errormessage;
+        pbreader reader(header);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field == 2 && wiretype == PB_WIRE_VARINT)
+                status = (unsigned)reader.readVarint();
+            else if (field == 4 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+                exceptionclass = reader.readString();
+            else if (field == 5 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+                errormessage = reader.readString();
+            else
+                reader.skip(wiretype);
+        }
+
+        if (status != HADOOP_STATUS_SUCCESS)
+        {
+            fprintf(stderr, "NameNode call %s failed: %s %s\n", method, exceptionclass.c_str(), errormessage.c_str());
+            return false;
+        }
+
+        if (!readDelimitedField(reply, pos, response))
+        {
+            fprintf(stderr, "Malformed NameNode response to %s\n", method);
+            return false;
+        }
+
+        return true;
+    }
+
+    //exists is false, and true returned, when the path is not there
+    bool getFileInfo(const std::string & path, NativeFileStatus & status, bool & exists)
+    {
+        pbwriter request;
+        request.writeString(1, path);
+
+        std::string response;
+        if (!call("getFileInfo", request, response))
+            return false;
+
+        exists = false;
+        pbreader reader(response);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field == 1 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            {
+                parseFileStatus(reader.readMessage(), status);
+                exists = true;
+            }
+            else
+                reader.skip(wiretype);
+        }
+
+        return !reader.hasFailed();
+    }
+
+    bool getListing(const std::string & path, std::vector<NativeFileStatus> & entries)
+    {
+        std::string startafter;
+        unsigned long remaining = 1;
+
+        while (remaining > 0)
+        {
+            pbwriter request;
+            request.writeString(1, path);
+            request.writeString(2, startafter);
+            request.writeBool(3, false);
+
+            std::string response;
+            if (!call("getListing", request, response))
+                return false;
+
+            remaining = 0;
+            unsigned long received = 0;
+
+            pbreader reader(response);
+            unsigned field, wiretype;
+            while (reader.next(field, wiretype))
+            {
+                if (field != 1 || wiretype != PB_WIRE_LENGTH_DELIMITED)
+                {
+                    reader.skip(wiretype);
+                    continue;
+                }
+
+                pbreader listing = reader.readMessage();
+                unsigned lfield, lwiretype;
+                while (listing.next(lfield, lwiretype))
+                {
+                    if (lfield == 1 && lwiretype == PB_WIRE_LENGTH_DELIMITED)
+                    {
+                        NativeFileStatus entry;
+                        parseFileStatus(listing.readMessage(), entry);
+                        entries.push_back(entry);
+                        startafter = entry.name;
+                        received++;
+                    }
+                    else if (lfield == 2 && lwiretype == PB_WIRE_VARINT)
+                        remaining = listing.readVarint();
+                    else
+                        listing.skip(lwiretype);
+                }
+            }
+
+            //guard against a listing which does not make progress
+            if (received == 0)
+                break;
+        }
+
+        return true;
+    }
+
+    bool getBlockLocations(const std::string & path, unsigned long offset, unsigned long length,
+            std::vector<NativeLocatedBlock> & blocks, unsigned long & filelength)
+    {
+        pbwriter request;
+        request.writeString(1, path);
+        request.writeUInt64(2, offset);
+        request.writeUInt64(3, length);
+
+        std::string response;
+        if (!call("getBlockLocations", request, response))
+            return false;
+
+        filelength = 0;
+        pbreader reader(response);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field != 1 || wiretype != PB_WIRE_LENGTH_DELIMITED)
+            {
+                reader.skip(wiretype);
+                continue;
+            }
+
+            pbreader located = reader.readMessage();
+            unsigned lfield, lwiretype;
+            while (located.next(lfield, lwiretype))
+            {
+                if (lfield == 1 && lwiretype == PB_WIRE_VARINT)
+                    filelength = located.readVarint();
+                else if (lfield == 2 && lwiretype == PB_WIRE_LENGTH_DELIMITED)
+                {
+                    NativeLocatedBlock block;
+                    parseLocatedBlock(located.readMessage(), block);
+                    blocks.push_back(block);
+                }
+                else
+                    located.skip(lwiretype);
+            }
+        }
+
+        return !reader.hasFailed();
+    }
+
+    /*
+     * The length of a file readers can see, with what the NameNode knows of a last block
+     * still being written, and whether the file is still being written.
+     */
+    bool getVisibleLength(const std::string & path, unsigned long & length, bool & underconstruction)
+    {
+        pbwriter request;
+        request.writeString(1, path);
+        request.writeUInt64(2, 0);
+        request.writeUInt64(3, 1);
+
+        std::string response;
+        if (!call("getBlockLocations", request, response))
+            return false;
+
+        length = 0;
+        underconstruction = false;
+        pbreader reader(response);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field != 1 || wiretype != PB_WIRE_LENGTH_DELIMITED)
+            {
+                reader.skip(wiretype);
+                continue;
+            }
+
+            pbreader located = reader.readMessage();
+            unsigned lfield, lwiretype;
+            while (located.next(lfield, lwiretype))
+            {
+                if (lfield == 1 && lwiretype == PB_WIRE_VARINT)
+                    length = std::max(length, (unsigned long)located.readVarint());
+                else if (lfield == 3 && lwiretype == PB_WIRE_VARINT)
+                    underconstruction = located.readVarint() != 0;
+                else if (lfield == 4 && lwiretype == PB_WIRE_LENGTH_DELIMITED)
+                {
+                    NativeLocatedBlock lastblock;
+                    parseLocatedBlock(located.readMessage(), lastblock);
+                    length = std::max(length, (unsigned long)(lastblock.offset + lastblock.numBytes));
+                }
+                else
+                    located.skip(lwiretype);
+            }
+        }
+
+        return !reader.hasFailed();
+    }
+};
+
+/*
+ * Reads a byte range of one block from a DataNode, packet by packet,
+ * verifying each chunk against its checksum. A block opened locally is read
+ * from the block file in runs of whole chunks, checked against the meta file.
+ */
+class datanodeblockreader
+{
+private:
+    int sock;
+    int blockFd;
+    int metaFd;
+    unsigned checksumType;
+    unsigned long bytesPerChecksum;
+    unsigned long long rangeStart;
+    unsigned long long rangeEnd;
+    unsigned long long blockEnd;
+    unsigned long long localPosition;
+    std::string packet;
+    size_t packetPos;
+    size_t packetEnd;
+    bool lastPacket;
+
+    bool verifyChunks(const char * checksums, size_t checksumlength, const char * data, size_t datalength)
+    {
+        if (checksumType == HADOOP_CHECKSUM_NULL || bytesPerChecksum == 0)
+            return true;
+
+        for (size_t chunk = 0, offset = 0; offset < datalength; chunk++, offset += bytesPerChecksum)
+        {
+            size_t chunklength = datalength - offset < bytesPerChecksum ? datalength - offset : bytesPerChecksum;
+            if ((chunk + 1) * 4 > checksumlength)
+                return false;
+
+            unsigned expected = (unsigned)getBigEndian(checksums + chunk * 4, 4);
+            unsigned actual = checksumType == HADOOP_CHECKSUM_CRC32C ? computeCrc32c(data + offset, chunklength)
+                    : computeCrc32(data + offset, chunklength);
+            if (expected != actual)
+                return false;
+        }
+        return true;
+    }
+
+    //Sets packetPos/packetEnd to the bytes of a packet's data within the range
+    void setPacketRange(unsigned long long offsetinblock, size_t checksumlength, unsigned long datalength)
+    {
+        //the first packet starts at a chunk boundary before the requested offset
+        packetPos = checksumlength;
+        packetEnd = checksumlength + datalength;
+        if (offsetinblock < rangeStart)
+            packetPos += rangeStart - offsetinblock < datalength ? rangeStart - offsetinblock : datalength;
+        if (offsetinblock + datalength > rangeEnd)
+            packetEnd -= offsetinblock + datalength - rangeEnd < datalength ? offsetinblock + datalength - rangeEnd : datalength;
+        if (packetEnd < packetPos)
+            packetEnd = packetPos;
+    }
+
+    //Receives the next packet, sets packetPos/packetEnd to the bytes of it within the range
+    bool readPacket()
+    {
+        char lengths[6];
+        if (!readSocket(sock, lengths, 6))
+            return false;
+
+        unsigned long payloadlength = getBigEndian(lengths, 4);
+        unsigned headerlength = (unsigned)getBigEndian(lengths + 4, 2);
+        if (payloadlength < 4 || payloadlength > HADOOP_MAX_PACKET_SIZE)
+            return false;
+
+        std::string header;
+        header.resize(headerlength);
+        packet.resize(payloadlength - 4);
+        if ((headerlength > 0 && !readSocket(sock, &header[0], headerlength)) ||
+            (packet.size() > 0 && !readSocket(sock, &packet[0], packet.size())))
+            return false;
+
+        unsigned long long offsetinblock = 0;
+        unsigned long datalength = 0;
+        pbreader reader(header);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field == 1 && wiretype == PB_WIRE_FIXED64)
+                offsetinblock = reader.readFixed64();
+            else if (field == 3 && wiretype == PB_WIRE_VARINT)
+                lastPacket = reader.readVarint() != 0;
+            else if (field == 4 && wiretype == PB_WIRE_FIXED32)
+                datalength = reader.readFixed32();
+            else
+                reader.skip(wiretype);
+        }
+
+        if (reader.hasFailed() || datalength > packet.size())
+            return false;
+
+        size_t checksumlength = packet.size() - datalength;
+        const char * data = packet.data() + checksumlength;
+        if (!verifyChunks(packet.data(), checksumlength, data, datalength))
+        {
+            fprintf(stderr, "Checksum mismatch in block packet at offset %llu\n", offsetinblock);
+            return false;
+        }
+
+        setPacketRange(offsetinblock, checksumlength, datalength);
+        return true;
+    }
+
+    //Reads the next run of whole chunks from the local block file into packet, laid out as a packet is
+    bool readLocalPacket()
+    {
+        unsigned long long start = localPosition;
+        unsigned long long end = rangeEnd - start > NATIVE_LOCAL_READ_SIZE ? start + NATIVE_LOCAL_READ_SIZE : rangeEnd;
+        size_t checksumlength = 0;
+        if (checksumType != HADOOP_CHECKSUM_NULL)
+        {
+            //the last chunk is read whole to verify it, setPacketRange leaves out what is past the range
+            end = (end + bytesPerChecksum - 1) / bytesPerChecksum * bytesPerChecksum;
+            if (end > blockEnd)
+                end = blockEnd;
+            checksumlength = (size_t)((end - start + bytesPerChecksum - 1) / bytesPerChecksum * 4);
+        }
+
+        unsigned long datalength = (unsigned long)(end - start);
+        packet.resize(checksumlength + datalength);
+        if ((checksumlength > 0 && !readFileFully(metaFd, &packet[0], checksumlength,
+                HADOOP_BLOCK_META_HEADER_SIZE + start / bytesPerChecksum * 4)) ||
+            (datalength > 0 && !readFileFully(blockFd, &packet[0] + checksumlength, datalength, start)))
+            return false;
+
+        if (!verifyChunks(packet.data(), checksumlength, packet.data() + checksumlength, datalength))
+        {
+            fprintf(stderr, "Checksum mismatch in local block file at offset %llu\n", start);
+            return false;
+        }
+
+        setPacketRange(start, checksumlength, datalength);
+        localPosition = end;
+        lastPacket = localPosition >= rangeEnd;
+        return true;
+    }
+
+    static void buildBaseHeader(const NativeLocatedBlock & block, pbwriter & baseheader)
+    {
+        pbwriter extended;
+        extended.writeString(1, block.poolId);
+        extended.writeUInt64(2, block.blockId);
+        extended.writeUInt64(3, block.generationStamp);
+        extended.writeUInt64(4, block.numBytes);
+
+        pbwriter token;
+        token.writeString(1, block.tokenIdentifier);
+        token.writeString(2, block.tokenPassword);
+        token.writeString(3, block.tokenKind);
+        token.writeString(4, block.tokenService);
+
+        baseheader.writeMessage(1, extended);
+        baseheader.writeMessage(2, token);
+    }
+
+    //Parses a BlockOpResponseProto, with the checksum a READ_BLOCK response carries
+    bool checkResponse(const std::string & response, const char * datanode, unsigned long long blockid)
+    {
+        unsigned status = 1;
+        std::string message;
+        checksumType = HADOOP_CHECKSUM_NULL;
+        bytesPerChecksum = 0;
+
+        pbreader reader(response);
+        unsigned field, wiretype;
+        while (reader.next(field, wiretype))
+        {
+            if (field == 1 && wiretype == PB_WIRE_VARINT)
+                status = (unsigned)reader.readVarint();
+            else if (field == 4 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            {
+                pbreader checksuminfo = reader.readMessage();
+                unsigned cfield, cwiretype;
+                while (checksuminfo.next(cfield, cwiretype))
+                {
+                    if (cfield != 1 || cwiretype != PB_WIRE_LENGTH_DELIMITED)
+                    {
+                        checksuminfo.skip(cwiretype);
+                        continue;
+                    }
+
+                    pbreader checksum = checksuminfo.readMessage();
+                    unsigned sfield, swiretype;
+                    while (checksum.next(sfield, swiretype))
+                    {
+                        if (sfield == 1 && swiretype == PB_WIRE_VARINT)
+                            checksumType = (unsigned)checksum.readVarint();
+                        else if (sfield == 2 && swiretype == PB_WIRE_VARINT)
+                            bytesPerChecksum = (unsigned long)checksum.readVarint();
+                        else
+                            checksum.skip(swiretype);
+                    }
+                }
+            }
+            else if (field == 5 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+                message = reader.readString();
+            else
+                reader.skip(wiretype);
+        }
+
+        if (status != HADOOP_STATUS_SUCCESS)
+        {
+            fprintf(stderr, "DataNode %s refused block %llu: status %u %s\n", datanode, blockid, status, message.c_str());
+            return false;
+        }
+        return true;
+    }
+
+public:
+    datanodeblockreader() : sock(-1), blockFd(-1), metaFd(-1), checksumType(HADOOP_CHECKSUM_NULL), bytesPerChecksum(0),
+            rangeStart(0), rangeEnd(0), blockEnd(0), localPosition(0), packetPos(0), packetEnd(0), lastPacket(false) {}
+
+    ~datanodeblockreader()
+    {
+        close();
+    }
+
+    bool open(const NativeLocatedBlock & block, const NativeDatanode & datanode, unsigned long long offset,
+            unsigned long long length, const std::string & clientname)
+    {
+        close();
+
+        const char * host = datanode.ipAddr.size() > 0 ? datanode.ipAddr.c_str() : datanode.hostName.c_str();
+        sock = connectTcp(host, datanode.xferPort);
+        if (sock < 0)
+            return false;
+
+        pbwriter baseheader;
+        buildBaseHeader(block, baseheader);
+
+        pbwriter clientheader;
+        clientheader.writeMessage(1, baseheader);
+        clientheader.writeString(2, clientname);
+
+        pbwriter readblock;
+        readblock.writeMessage(1, clientheader);
+        readblock.writeUInt64(2, offset);
+        readblock.writeUInt64(3, length);
+        readblock.writeBool(4, true);
+
+        std::string request;
+        appendBigEndian(request, HADOOP_DATA_TRANSFER_VERSION, 2);
+        request.append(1, (char)HADOOP_OP_READ_BLOCK);
+        readblock.appendDelimited(request);
+
+        std::string response;
+        if (!writeSocket(sock, request.data(), request.size()) || !readSocketDelimited(sock, response))
+        {
+            fprintf(stderr, "Could not request block %llu from %s:%u\n", block.blockId, host, datanode.xferPort);
+            close();
+            return false;
+        }
+
+        char datanodename[300];
+        snprintf(datanodename, sizeof(datanodename), "%s:%u", host, datanode.xferPort);
+        if (!checkResponse(response, datanodename, block.blockId))
+        {
+            close();
+            return false;
+        }
+
+        if (checksumType > HADOOP_CHECKSUM_CRC32C)
+        {
+            fprintf(stderr, "Unsupported checksum type %u for block %llu\n", checksumType, block.blockId);
+            close();
+            return false;
+        }
+
+        rangeStart = offset;
+        rangeEnd = offset + length;
+        packetPos = packetEnd = 0;
+        lastPacket = false;
+
+        return true;
+    }
+
+    //Opens the block's files through the domain socket of the DataNode on this host
+    bool openLocal(const NativeLocatedBlock & block, const NativeDatanode & datanode, unsigned long long offset,
+            unsigned long long length, const std::string & socketpath)
+    {
+        close();
+
+        int domainsock = connectDomainSocket(socketpath, datanode.xferPort);
+        if (domainsock < 0)
+            return false;
+
+        pbwriter baseheader;
+        buildBaseHeader(block, baseheader);
+
+        pbwriter shortcircuit;
+        shortcircuit.writeMessage(1, baseheader);
+        shortcircuit.writeUInt64(2, HADOOP_SHORT_CIRCUIT_VERSION);
+
+        std::string request;
+        appendBigEndian(request, HADOOP_DATA_TRANSFER_VERSION, 2);
+        request.append(1, (char)HADOOP_OP_REQUEST_SHORT_CIRCUIT_FDS);
+        shortcircuit.appendDelimited(request);
+
+        std::string response;
+        int fds[2];
+        bool opened = writeSocket(domainsock, request.data(), request.size()) && readSocketDelimited(domainsock, response);
+        if (!opened)
+            fprintf(stderr, "Could not request local block %llu through %s\n", block.blockId, socketpath.c_str());
+        opened = opened && checkResponse(response, socketpath.c_str(), block.blockId);
+        if (opened && !receiveFileDescriptors(domainsock, fds, 2))
+        {
+            fprintf(stderr, "DataNode did not pass the files of block %llu\n", block.blockId);
+            opened = false;
+        }
+        ::close(domainsock);
+        if (!opened)
+            return false;
+
+        blockFd = fds[0];
+        metaFd = fds[1];
+
+        char header[HADOOP_BLOCK_META_HEADER_SIZE];
+        if (!readFileFully(metaFd, header, sizeof(header), 0) || getBigEndian(header, 2) != HADOOP_BLOCK_META_VERSION)
+        {
+            fprintf(stderr, "Unreadable meta file for local block %llu\n", block.blockId);
+            close();
+            return false;
+        }
+
+        checksumType = (unsigned char)header[2];
+        bytesPerChecksum = (unsigned long)getBigEndian(header + 3, 4);
+        if (checksumType > HADOOP_CHECKSUM_CRC32C || (checksumType != HADOOP_CHECKSUM_NULL && bytesPerChecksum == 0))
+        {
+            fprintf(stderr, "Unsupported checksum type %u for block %llu\n", checksumType, block.blockId);
+            close();
+            return false;
+        }
+
+        blockEnd = block.numBytes;
+        rangeStart = offset;
+        rangeEnd = offset + length < blockEnd ? offset + length : blockEnd;
+        localPosition = checksumType != HADOOP_CHECKSUM_NULL ? offset - offset % bytesPerChecksum : offset;
+        packetPos = packetEnd = 0;
+        lastPacket = localPosition >= rangeEnd;
+
+        return true;
+    }
+
+    bool isLocal() const
+    {
+        return blockFd >= 0;
+    }
+
+    //Returns the number of bytes read, 0 at the end of the range and -1 on error
+    long read(char * buffer, size_t length)
+    {
+        while (packetPos == packetEnd)
+        {
+            if (lastPacket || (sock < 0 && blockFd < 0))
+                return 0;
+
+            if (blockFd >= 0)
+            {
+                if (!readLocalPacket())
+                {
+                    fprintf(stderr, "Error reading local block file\n");
+                    close();
+                    return -1;
+                }
+                continue;
+            }
+
+            if (!readPacket())
+            {
+                fprintf(stderr, "Error reading block data\n");
+                close();
+                return -1;
+            }
+
+            if (lastPacket)
+            {
+                //acknowledge the checksums were verified
+                pbwriter readstatus;
+                readstatus.writeUInt64(1, HADOOP_STATUS_CHECKSUM_OK);
+                std::string ack;
+                readstatus.appendDelimited(ack);
+                writeSocket(sock, ack.data(), ack.size());
+            }
+        }
+
+        size_t available = packetEnd - packetPos;
+        if (available > length)
+            available = length;
+        memcpy(buffer, packet.data() + packetPos, available);
+        packetPos += available;
+        return (long)available;
+    }
+
+    void close()
+    {
+        if (sock >= 0)
+            ::close(sock);
+        if (blockFd >= 0)
+            ::close(blockFd);
+        if (metaFd >= 0)
+            ::close(metaFd);
+        sock = blockFd = metaFd = -1;
+    }
+};
+
+/*
+ * Sequential reads of an HDFS file from an offset, across blocks and with failover
+ * between the replicas of each block. Given the DataNodes' domain socket path, a
+ * replica on this host is read short-circuit first, until that fails once. A replica
+ * failing part way through a block, say on a checksum mismatch, is skipped and the
+ * read goes on from the same offset on the next one.
+ */
+#define NATIVE_TAIL_READ_SIZE (1024 * 1024)
+
+class nativehdfsinputstream
+{
+private:
+    namenodeclient & namenode;
+    std::string path;
+    std::string clientName;
+    std::vector<NativeLocatedBlock> blocks;
+    unsigned long fileLength;
+    unsigned long position;
+    unsigned long hintEnd;
+    datanodeblockreader reader;
+    bool readerOpen;
+    bool readerLocal;
+    std::string readerReplica;
+    unsigned long long failedBlockId;
+    std::vector<std::string> failedReplicas;
+    std::string shortCircuitPath;
+    std::vector<std::string> localNames;
+
+    static void getReplicaName(const NativeDatanode & datanode, std::string & name)
+    {
+        char port[16];
+        snprintf(port, sizeof(port), ":%u", datanode.xferPort);
+        name.assign(datanode.ipAddr).append(port);
+    }
+
+    bool isFailedReplica(const std::string & name) const
+    {
+        for (unsigned i = 0; i < failedReplicas.size(); i++)
+        {
+            if (failedReplicas[i] == name)
+                return true;
+        }
+        return false;
+    }
+
+    //Leaves the replica which failed the read out of the next openReader of the same block
+    void skipReaderReplica()
+    {
+        if (readerLocal)
+        {
+            fprintf(stderr, "Short-circuit read of block %llu failed, reading through the DataNode\n", failedBlockId);
+            shortCircuitPath.clear();
+        }
+        else
+        {
+            fprintf(stderr, "Read of block %llu from %s failed, reading on from another replica\n", failedBlockId,
+                    readerReplica.c_str());
+            failedReplicas.push_back(readerReplica);
+        }
+    }
+
+    const NativeLocatedBlock * findBlock(unsigned long offset)
+    {
+        for (unsigned i = 0; i < blocks.size(); i++)
+        {
+            if (offset >= blocks[i].offset && offset < blocks[i].offset + blocks[i].numBytes)
+                return &blocks[i];
+        }
+        return NULL;
+    }
+
+    bool openReader()
+    {
+        const NativeLocatedBlock * block = findBlock(position);
+        if (!block)
+        {
+            blocks.clear();
+            unsigned long fetchlength = hintEnd > position ? hintEnd - position : NATIVE_TAIL_READ_SIZE;
+            if (!namenode.getBlockLocations(path, position, fetchlength, blocks, fileLength) || !(block = findBlock(position)))
+            {
+                fprintf(stderr, "No block location for %s at offset %lu\n", path.c_str(), position);
+                return false;
+            }
+        }
+
+        if (block->blockId != failedBlockId)
+        {
+            failedReplicas.clear();
+            failedBlockId = block->blockId;
+        }
+
+        //read up to the end of the requested range, past it in modest steps
+        unsigned long blockend = block->offset + block->numBytes;
+        unsigned long readend = hintEnd > position ? hintEnd : position + NATIVE_TAIL_READ_SIZE;
+        if (readend > blockend)
+            readend = blockend;
+
+        for (unsigned i = 0; shortCircuitPath.size() > 0 && i < block->locations.size(); i++)
+        {
+            const NativeDatanode & datanode = block->locations[i];
+            if (!isLocalHost(localNames, datanode.hostName) && !isLocalHost(localNames, datanode.ipAddr))
+                continue;
+            if (reader.openLocal(*block, datanode, position - block->offset, readend - position, shortCircuitPath))
+            {
+                readerLocal = true;
+                return true;
+            }
+
+            fprintf(stderr, "Short-circuit read of block %llu failed, reading through the DataNode\n", block->blockId);
+            shortCircuitPath.clear();
+        }
+
+        for (unsigned i = 0; i < block->locations.size(); i++)
+        {
+            getReplicaName(block->locations[i], readerReplica);
+            if (isFailedReplica(readerReplica))
+                continue;
+            if (reader.open(*block, block->locations[i], position - block->offset, readend - position, clientName))
+            {
+                readerLocal = false;
+                return true;
+            }
+            failedReplicas.push_back(readerReplica);
+        }
+
+        fprintf(stderr, "Could not read block %llu of %s from any of its %lu replica(s)\n", block->blockId, path.c_str(),
+                (unsigned long)block->locations.size());
+        return false;
+    }
+
+public:
+    nativehdfsinputstream(namenodeclient & _namenode, const std::string & _path, unsigned long filelength,
+            const std::string & shortcircuitpath = std::string())
+        : namenode(_namenode), path(_path), fileLength(filelength), position(0), hintEnd(0), readerOpen(false),
+          readerLocal(false), failedBlockId(0), shortCircuitPath(shortcircuitpath)
+    {
+        clientName.assign("h2h_native_").append(namenode.getUser());
+        if (shortCircuitPath.size() > 0)
+            getLocalHostNames(localNames);
+    }
+
+    //Positions the stream, length is how much will likely be read from there
+    void seek(unsigned long offset, unsigned long length)
+    {
+        reader.close();
+        readerOpen = false;
+        failedReplicas.clear();
+        position = offset;
+        hintEnd = offset + length;
+    }
+
+    //Returns the number of bytes read, 0 at the end of the file and -1 on error
+    long read(char * buffer, size_t length)
+    {
+        while (position < fileLength)
+        {
+            if (!readerOpen)
+            {
+                if (!openReader())
+                    return -1;
+                readerOpen = true;
+            }
+
+            //a replica failing part way through is skipped, -1 only once none is left
+            long bytesread = reader.read(buffer, length);
+            if (bytesread < 0)
+            {
+                skipReaderReplica();
+                reader.close();
+                readerOpen = false;
+                continue;
+            }
+            if (bytesread > 0)
+            {
+                position += bytesread;
+                return bytesread;
+            }
+
+            reader.close();
+            readerOpen = false;
+        }
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,229 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSPARTITIONING_HPP
+#define HDFSPARTITIONING_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <list>
+#include <map>
+#include <set>
+
+#define HIVE_DEFAULT_PARTITION "__HIVE_DEFAULT_PARTITION__"
+#define DEFAULT_MAX_OPEN_PARTITIONS 16
+
+/*
+ * A file being written on HDFS, implemented by each connector.
+ */
+class hdfsoutputstream
+{
+public:
+    virtual ~hdfsoutputstream() {}
+
+    virtual bool write(const char * data, unsigned long length) = 0;
+    virtual bool close() = 0;
+};
+
+/*
+ * Extracts the 1-based field of a CSV record, honoring quoted fields.
+ * The record may include its terminator.
+ */
+static void extractCsvField(const char * record, unsigned long length, unsigned field, const std::string & separator,
+        const std::string & quote, const std::string & terminator, std::string & value)
+{
+    if (length >= terminator.size() && terminator.size() > 0
+            && memcmp(record + length - terminator.size(), terminator.c_str(), terminator.size()) == 0)
+        length -= terminator.size();
+
+    char quoteChar = quote.size() > 0 ? quote[0] : '\0';
+    const char * sep = separator.size() > 0 ? separator.c_str() : ",";
+    unsigned seplen = strlen(sep);
+
+    unsigned currentField = 1;
+    bool withinQuote = false;
+    value.clear();
+
+    for (unsigned long index = 0; index < length; index++)
+    {
+        char currChar = record[index];
+
+        if (quoteChar && currChar == quoteChar)
+        {
+            //a doubled quote within a quoted field is a literal quote
+            if (withinQuote && index + 1 < length && record[index + 1] == quoteChar)
+            {
+                if (currentField == field)
+                    value.append(1, quoteChar);
+                index++;
+            }
+            else
+                withinQuote = !withinQuote;
+            continue;
+        }
+
+        if (!withinQuote && index + seplen <= length && memcmp(record + index, sep, seplen) == 0)
+        {
+            if (currentField == field)
+                return;
+            currentField++;
+            index += seplen - 1;
+            continue;
+        }
+
+        if (currentField == field)
+            value.append(1, currChar);
+    }
+}
+
+//Extracts a fixed width FLAT field, without its trailing padding
+static void extractFlatField(const char * record, unsigned long length, unsigned long offset, unsigned long fieldlen,
+        std::string & value)
+{
+    value.clear();
+    if (offset >= length)
+        return;
+
+    if (offset + fieldlen > length)
+        fieldlen = length - offset;
+
+    while (fieldlen > 0 && (record[offset + fieldlen - 1] == ' ' || record[offset + fieldlen - 1] == '\0'))
+        fieldlen--;
+
+    value.assign(record + offset, fieldlen);
+}
+
+//Escapes a partition value for use as a directory name, the same way Hive does
+static void escapePartitionValue(const std::string & value, std::string & escaped)
+{
+    escaped.clear();
+    if (value.size() == 0)
+    {
+        escaped.assign(HIVE_DEFAULT_PARTITION);
+        return;
+    }
+
+    for (unsigned i = 0; i < value.size(); i++)
+    {
+        unsigned char currChar = value[i];
+        if (currChar < 0x20 || currChar >= 0x7f || strchr("\"#%'*/:=?\\{[]^ ", currChar))
+        {
+            char hex[4];
+            sprintf(hex, "%%%02X", currChar);
+            escaped.append(hex);
+        }
+        else
+            escaped.append(1, currChar);
+    }
+}
+
+/*
+ * The open output streams of a partitioned write, at most maxOpen of them.
+ * The least recently used stream is closed to make room for a new one,
+ * a partition which was closed this way must be re-opened for append.
+ */
+class partitionstreamcache
+{
+private:
+    struct PartitionStream
+    {
+        hdfsoutputstream * stream;
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    std::map<std::string, PartitionStream> streams;
+    std::list<std::string> lru;
+    std::set<std::string> evicted;
+    unsigned maxOpen;
+
+public:
+    partitionstreamcache(unsigned maxopen) : maxOpen(maxopen > 0 ? maxopen : 1) {}
+
+    ~partitionstreamcache()
+    {
+        closeAll();
+    }
+
+    hdfsoutputstream * get(const std::string & partition)
+    {
+        std::map<std::string, PartitionStream>::iterator found = streams.find(partition);
+        if (found == streams.end())
+            return NULL;
+
+        lru.splice(lru.begin(), lru, found->second.lruPosition);
+        return found->second.stream;
+    }
+
+    bool wasEvicted(const std::string & partition)
+    {
+        return evicted.find(partition) != evicted.end();
+    }
+
+    bool add(const std::string & partition, hdfsoutputstream * stream)
+    {
+        bool closed = true;
+        if (streams.size() >= maxOpen)
+        {
+            std::string victim = lru.back();
+            fprintf(stderr, "Closing partition %s to stay within %d open streams\n", victim.c_str(), maxOpen);
+
+            closed = streams[victim].stream->close();
+            delete streams[victim].stream;
+            streams.erase(victim);
+            lru.pop_back();
+            evicted.insert(victim);
+        }
+
+        lru.push_front(partition);
+        PartitionStream entry;
+        entry.stream = stream;
+        entry.lruPosition = lru.begin();
+        streams[partition] = entry;
+
+        return closed;
+    }
+
+    bool closeAll()
+    {
+        bool closed = true;
+        for (std::map<std::string, PartitionStream>::iterator it = streams.begin(); it != streams.end(); ++it)
+        {
+            if (!it->second.stream->close())
+                closed = false;
+            delete it->second.stream;
+        }
+        streams.clear();
+        lru.clear();
+
+        return closed;
+    }
+
+    unsigned long partitionCount() const
+    {
+        unsigned long count = streams.size();
+        for (std::set<std::string>::const_iterator it = evicted.begin(); it != evicted.end(); ++it)
+        {
+            if (streams.find(*it) == streams.end())
+                count++;
+        }
+        return count;
+    }
+};
+
+#endif
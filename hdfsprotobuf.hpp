@@ -0,0 +1,274 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSPROTOBUF_HPP
+#define HDFSPROTOBUF_HPP
+
+#include <string.h>
+#include <string>
+
+/*
+ * Just enough of the protobuf wire format for the HDFS RPC and data transfer messages
+ * the native connector exchanges, without a protobuf runtime or generated code.
+ */
+#define PB_WIRE_VARINT 0
+#define PB_WIRE_FIXED64 1
+#define PB_WIRE_LENGTH_DELIMITED 2
+#define PB_WIRE_FIXED32 5
+
+static void appendVarint(std::string & out, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        out.append(1, (char)((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.append(1, (char)value);
+}
+
+class pbwriter
+{
+private:
+    std::string buffer;
+
+    void writeTag(unsigned field, unsigned wiretype)
+    {
+        appendVarint(buffer, (field << 3) | wiretype);
+    }
+
+public:
+    void writeUInt64(unsigned field, unsigned long long value)
+    {
+        writeTag(field, PB_WIRE_VARINT);
+        appendVarint(buffer, value);
+    }
+
+    void writeBool(unsigned field, bool value)
+    {
+        writeUInt64(field, value ? 1 : 0);
+    }
+
+    void writeSInt32(unsigned field, int value)
+    {
+        writeTag(field, PB_WIRE_VARINT);
+        appendVarint(buffer, (unsigned)((value << 1) ^ (value >> 31)));
+    }
+
+    void writeBytes(unsigned field, const char * data, size_t length)
+    {
+        writeTag(field, PB_WIRE_LENGTH_DELIMITED);
+        appendVarint(buffer, length);
+        buffer.append(data, length);
+    }
+
+    void writeString(unsigned field, const std::string & value)
+    {
+        writeBytes(field, value.data(), value.size());
+    }
+
+    void writeMessage(unsigned field, const pbwriter & message)
+    {
+        writeString(field, message.str());
+    }
+
+    //Appends the message prefixed with its varint length, as writeDelimitedTo does
+    void appendDelimited(std::string & out) const
+    {
+        appendVarint(out, buffer.size());
+        out.append(buffer);
+    }
+
+    const std::string & str() const
+    {
+        return buffer;
+    }
+};
+
+class pbreader
+{
+private:
+    const char * data;
+    size_t length;
+    size_t pos;
+    bool failed;
+
+public:
+    pbreader(const char * _data, size_t _length) : data(_data), length(_length), pos(0), failed(false) {}
+    pbreader(const std::string & message) : data(message.data()), length(message.size()), pos(0), failed(false) {}
+
+    bool hasFailed() const
+    {
+        return failed;
+    }
+
+    unsigned long long readVarint()
+    {
+        unsigned long long value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            if (pos >= length)
+                break;
+            unsigned char byte = data[pos++];
+            value |= (unsigned long long)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        failed = true;
+        return 0;
+    }
+
+    int readSInt32()
+    {
+        unsigned value = (unsigned)readVarint();
+        return (int)(value >> 1) ^ -(int)(value & 1);
+    }
+
+    unsigned long long readFixed64()
+    {
+        unsigned long long value = 0;
+        if (pos + 8 > length)
+        {
+            failed = true;
+            return 0;
+        }
+        for (unsigned i = 0; i < 8; i++)
+            value |= (unsigned long long)(unsigned char)data[pos++] << (8 * i);
+        return value;
+    }
+
+    unsigned readFixed32()
+    {
+        unsigned value = 0;
+        if (pos + 4 > length)
+        {
+            failed = true;
+            return 0;
+        }
+        for (unsigned i = 0; i < 4; i++)
+            value |= (unsigned)(unsigned char)data[pos++] << (8 * i);
+        return value;
+    }
+
+    bool readLengthDelimited(const char * & field, size_t & fieldlength)
+    {
+        //a huge varint length must not wrap pos + fieldlength around
+        fieldlength = (size_t)readVarint();
+        if (failed || fieldlength > length - pos)
+        {
+            failed = true;
+            return false;
+        }
+        field = data + pos;
+        pos += fieldlength;
+        return true;
+    }
+
+    std::string readString()
+    {
+        const char * field;
+        size_t fieldlength;
+        if (!readLengthDelimited(field, fieldlength))
+            return std::string();
+        return std::string(field, fieldlength);
+    }
+
+    pbreader readMessage()
+    {
+        const char * field = data;
+        size_t fieldlength = 0;
+        readLengthDelimited(field, fieldlength);
+        return pbreader(field, fieldlength);
+    }
+
+    //Moves to the next field, false at the end of the message
+    bool next(unsigned & field, unsigned & wiretype)
+    {
+        if (failed || pos >= length)
+            return false;
+        unsigned long long tag = readVarint();
+        field = (unsigned)(tag >> 3);
+        wiretype = (unsigned)(tag & 7);
+        return !failed;
+    }
+
+    void skip(unsigned wiretype)
+    {
+        const char * field;
+        size_t fieldlength;
+        switch (wiretype)
+        {
+        case PB_WIRE_VARINT:
+            readVarint();
+            break;
+        case PB_WIRE_FIXED64:
+            readFixed64();
+            break;
+        case PB_WIRE_LENGTH_DELIMITED:
+            readLengthDelimited(field, fieldlength);
+            break;
+        case PB_WIRE_FIXED32:
+            readFixed32();
+            break;
+        default:
+            failed = true;
+        }
+    }
+};
+
+/*
+ * Checksums HDFS keeps per bytesPerChecksum chunk: CRC32 (zlib polynomial) and CRC32C (Castagnoli).
+ */
+class crctable
+{
+private:
+    unsigned table[256];
+
+public:
+    crctable(unsigned polynomial)
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            unsigned crc = i;
+            for (unsigned bit = 0; bit < 8; bit++)
+                crc = crc & 1 ? (crc >> 1) ^ polynomial : crc >> 1;
+            table[i] = crc;
+        }
+    }
+
+    unsigned compute(const char * data, size_t length) const
+    {
+        unsigned crc = 0xffffffff;
+        for (size_t i = 0; i < length; i++)
+            crc = table[(crc ^ (unsigned char)data[i]) & 0xff] ^ (crc >> 8);
+        return crc ^ 0xffffffff;
+    }
+};
+
+static unsigned computeCrc32(const char * data, size_t length)
+{
+    static const crctable crc32(0xedb88320);
+    return crc32.compute(data, length);
+}
+
+static unsigned computeCrc32c(const char * data, size_t length)
+{
+    static const crctable crc32c(0x82f63b78);
+    return crc32c.compute(data, length);
+}
+
+#endif
@@ -0,0 +1,335 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSRECORDBOUNDARY_HPP
+#define HDFSRECORDBOUNDARY_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+/*
+ * Variable length FLAT records start with the length of the bytes which follow,
+ * a 1, 2, 4 or 8 byte unsigned integer, e.g. -lenprefix 4le or -lenprefix 2be.
+ * Little endian, as ECL lays out its lengths, unless be is given.
+ */
+static bool parseRecordLengthPrefix(const char * spec, unsigned & size, bool & bigendian)
+{
+    char * suffix = NULL;
+    size = (unsigned)strtoul(spec, &suffix, 10);
+    bigendian = strcmp(suffix, "be") == 0;
+
+    if (size != 1 && size != 2 && size != 4 && size != 8)
+        return false;
+    return bigendian || strcmp(suffix, "le") == 0 || strcmp(suffix, "") == 0;
+}
+
+static std::string formatRecordLengthPrefix(unsigned size, bool bigendian)
+{
+    char spec[16];
+    sprintf(spec, "%u%s", size, bigendian ? "be" : "le");
+    return spec;
+}
+
+/*
+ * Tracks record boundaries of data streamed through the write path.
+ * FLAT records are recLen bytes long, or carry a length prefix when one is set,
+ * CSV records end with the terminator sequence when it is not found within a quoted field.
+ */
+class recordboundarytracker
+{
+private:
+    unsigned long recLen;
+    std::string terminator;
+    char quoteChar;
+    unsigned long recordBytes;
+    unsigned terminatorMatched;
+    bool withinQuote;
+    unsigned prefixSize;
+    bool prefixBigEndian;
+    unsigned long payloadLeft;
+
+    unsigned long scanLengthPrefixed(const char * buffer, unsigned long length, bool stopAtRecordEnd)
+    {
+        unsigned long index = 0;
+        while (index < length)
+        {
+            if (recordBytes < prefixSize)
+            {
+                unsigned long byte = (unsigned char)buffer[index++];
+                if (prefixBigEndian)
+                    payloadLeft = (payloadLeft << 8) | byte;
+                else
+                    payloadLeft |= byte << (8 * recordBytes);
+                recordBytes++;
+            }
+            else
+            {
+                unsigned long piece = payloadLeft < length - index ? payloadLeft : length - index;
+                index += piece;
+                recordBytes += piece;
+                payloadLeft -= piece;
+            }
+
+            if (recordBytes >= prefixSize && payloadLeft == 0)
+            {
+                recordBytes = 0;
+                if (stopAtRecordEnd)
+                    return index;
+            }
+        }
+
+        return length;
+    }
+
+public:
+    recordboundarytracker(unsigned long reclen, const std::string & eolseq, const std::string & quote)
+        : recLen(reclen), terminator(eolseq), recordBytes(0), terminatorMatched(0), withinQuote(false),
+          prefixSize(0), prefixBigEndian(false), payloadLeft(0)
+    {
+        quoteChar = quote.size() > 0 ? quote[0] : '\0';
+    }
+
+    //For a scan which starts part way through CSV data, within a quoted field or not
+    void setWithinQuote(bool within)
+    {
+        withinQuote = within;
+    }
+
+    //Records are then told apart by their length prefix, a size of 0 turns it off
+    void setLengthPrefix(unsigned size, bool bigendian)
+    {
+        prefixSize = size;
+        prefixBigEndian = bigendian;
+    }
+
+    bool atRecordBoundary() const
+    {
+        return recordBytes == 0;
+    }
+
+    /*
+     * Consumes up to length bytes, if stopAtRecordEnd is set, stops right after the
+     * first record end encountered. Returns the number of bytes consumed.
+     */
+    unsigned long scan(const char * buffer, unsigned long length, bool stopAtRecordEnd)
+    {
+        if (prefixSize > 0)
+            return scanLengthPrefixed(buffer, length, stopAtRecordEnd);
+
+        if (recLen > 0)
+        {
+            unsigned long consumed = length;
+            if (stopAtRecordEnd && recLen - recordBytes < length)
+                consumed = recLen - recordBytes;
+
+            recordBytes = (recordBytes + consumed) % recLen;
+            return consumed;
+        }
+
+        unsigned eolseqlen = terminator.size();
+        for (unsigned long index = 0; index < length; index++)
+        {
+            char currChar = buffer[index];
+            recordBytes++;
+
+            if (quoteChar && currChar == quoteChar)
+                withinQuote = !withinQuote;
+
+            if (eolseqlen == 0 || withinQuote)
+                continue;
+
+            if (currChar == terminator[terminatorMatched])
+                terminatorMatched++;
+            else
+                terminatorMatched = currChar == terminator[0] ? 1 : 0;
+
+            if (terminatorMatched == eolseqlen)
+            {
+                terminatorMatched = 0;
+                recordBytes = 0;
+                if (stopAtRecordEnd)
+                    return index + 1;
+            }
+        }
+
+        return length;
+    }
+};
+
+/*
+ * Speculates whether CSV data scanned from some offset starts within a quoted field,
+ * from the quotes which follow. A quoted field opens right after a separator or a
+ * terminator and closes right before one, so a quote followed by anything else opens
+ * a field and one preceded by anything else closes one. An escaped quote ("") closes
+ * and reopens the field, which keeps the count of quotes seen right.
+ */
+class quotestateresolver
+{
+private:
+    char quoteChar;
+    char separatorFirst;
+    char separatorLast;
+    char terminatorFirst;
+    char terminatorLast;
+    char previous;
+    bool hasPrevious;
+    bool pendingQuote;
+    unsigned long quotesSeen;
+    int resolved;
+
+    //Whether c next to a quote says nothing about it opening or closing a field
+    bool isNeutral(char c, char separator, char terminator) const
+    {
+        return c == quoteChar || c == separator || c == terminator || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+public:
+    quotestateresolver(char quote, const std::string & separator, const std::string & terminator)
+        : quoteChar(quote), previous('\0'), hasPrevious(false), pendingQuote(false), quotesSeen(0), resolved(-1)
+    {
+        separatorFirst = separator.size() > 0 ? separator[0] : ',';
+        separatorLast = separator.size() > 0 ? separator[separator.size() - 1] : ',';
+        terminatorFirst = terminator.size() > 0 ? terminator[0] : '\n';
+        terminatorLast = terminator.size() > 0 ? terminator[terminator.size() - 1] : '\n';
+    }
+
+    //The byte right before the scan start, when there is one
+    void setPrevious(char c)
+    {
+        previous = c;
+        hasPrevious = true;
+    }
+
+    bool isResolved() const
+    {
+        return resolved >= 0;
+    }
+
+    bool isWithinQuote() const
+    {
+        return resolved == 1;
+    }
+
+    unsigned long getQuotesSeen() const
+    {
+        return quotesSeen;
+    }
+
+    //Consumes the next bytes scanned, returns true once the state at the scan start is known
+    bool feed(const char * buffer, unsigned long length)
+    {
+        for (unsigned long index = 0; index < length && resolved < 0; index++)
+        {
+            char currChar = buffer[index];
+
+            //the quote before opens a field, so the scan start is within one if an odd number preceded it
+            if (pendingQuote && !isNeutral(currChar, separatorFirst, terminatorFirst))
+                resolved = (quotesSeen - 1) % 2 == 1 ? 1 : 0;
+            pendingQuote = false;
+
+            if (resolved < 0 && currChar == quoteChar)
+            {
+                //this quote closes a field, so the scan start is within one if an even number preceded it
+                if (hasPrevious && !isNeutral(previous, separatorLast, terminatorLast))
+                    resolved = quotesSeen % 2 == 0 ? 1 : 0;
+                quotesSeen++;
+                pendingQuote = true;
+            }
+
+            previous = currChar;
+            hasPrevious = true;
+        }
+
+        return resolved >= 0;
+    }
+};
+
+/*
+ * Decides where the write path rolls over to the next part file: at the first
+ * record boundary found once the current part holds at least maxPartSize bytes.
+ * A maxPartSize of 0 disables rolling.
+ */
+class partroller
+{
+private:
+    recordboundarytracker tracker;
+    unsigned long maxPartSize;
+    unsigned long partBytes;
+    unsigned long partSequence;
+    bool rollPending;
+
+public:
+    partroller(unsigned long maxpartsize, unsigned long reclen, const std::string & eolseq, const std::string & quote)
+        : tracker(reclen, eolseq, quote), maxPartSize(maxpartsize), partBytes(0), partSequence(0), rollPending(false)
+    {
+    }
+
+    bool isRolling() const
+    {
+        return maxPartSize > 0;
+    }
+
+    void setLengthPrefix(unsigned size, bool bigendian)
+    {
+        tracker.setLengthPrefix(size, bigendian);
+    }
+
+    unsigned long getPartSequence() const
+    {
+        return partSequence;
+    }
+
+    //True when the current part is complete, checked before writing more data
+    bool shouldRoll() const
+    {
+        return rollPending;
+    }
+
+    void rolled()
+    {
+        partSequence++;
+        partBytes = 0;
+        rollPending = false;
+    }
+
+    //Returns how many of the given bytes belong to the current part
+    unsigned long nextPiece(const char * buffer, unsigned long length)
+    {
+        if (maxPartSize == 0)
+            return length;
+
+        unsigned long piece;
+        if (partBytes < maxPartSize)
+        {
+            piece = maxPartSize - partBytes < length ? maxPartSize - partBytes : length;
+            tracker.scan(buffer, piece, false);
+        }
+        else
+            piece = tracker.scan(buffer, length, true);
+
+        partBytes += piece;
+        if (partBytes >= maxPartSize && tracker.atRecordBoundary())
+            rollPending = true;
+
+        return piece;
+    }
+};
+
+#endif
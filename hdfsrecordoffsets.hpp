@@ -0,0 +1,105 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSRECORDOFFSETS_HPP
+#define HDFSRECORDOFFSETS_HPP
+
+#include <string>
+#include <vector>
+
+#include "hdfscolumnstats.hpp"
+
+/*
+ * Record offsets sidecar, written to <filename>-offsets/part_<node>_<count>.offsets by
+ * the write path of variable length FLAT data. Its blocks start on a record, so a node
+ * reading the -parts directory can begin within a part without walking it from the start:
+ *
+ *   H2HOFFSETS  1  <length prefix>
+ *   BLOCK       <part name>  <offset>  <length>  <rows>
+ *   PART        <part name>  0  <length>  <rows>
+ */
+#define RECORD_OFFSETS_VERSION "1"
+#define DEFAULT_RECORD_OFFSETS_BLOCK_BYTES (4 * 1024 * 1024)
+
+class recordoffsetsobserver : public rowblockobserver
+{
+public:
+    recordoffsetsobserver(const std::string & prefixspec)
+    {
+        sidecar.assign("H2HOFFSETS\t" RECORD_OFFSETS_VERSION "\t").append(prefixspec).append("\n");
+    }
+
+    const char * getSidecarDir() const
+    {
+        return "-offsets";
+    }
+
+    const char * getSidecarExtension() const
+    {
+        return ".offsets";
+    }
+
+    void addRecord(const char * data, unsigned long length)
+    {
+    }
+
+    void endBlock(unsigned long offset, unsigned long length, unsigned long rows)
+    {
+        appendPosition("BLOCK", offset, length, rows);
+        sidecar.append("\n");
+    }
+
+    void endPart(unsigned long length, unsigned long rows)
+    {
+        appendPosition("PART", 0, length, rows);
+        sidecar.append("\n");
+    }
+};
+
+/*
+ * Hands the record aligned blocks of offsets sidecars to the filter, none is ruled out.
+ */
+class recordoffsetslookup
+{
+private:
+    std::string prefixSpec;
+
+public:
+    recordoffsetslookup(const std::string & prefixspec) : prefixSpec(prefixspec) {}
+
+    //Loads one sidecar, returns false if its records carry another length prefix
+    bool load(const std::string & sidecar, rowblockfilter & filter)
+    {
+        bool matching = false;
+
+        size_t start = 0;
+        std::vector<std::string> columns;
+        while (getSidecarLine(sidecar, start, columns))
+        {
+            if (columns[0] == "H2HOFFSETS" && columns.size() >= 3)
+                matching = columns[2] == prefixSpec;
+            else if (matching && columns[0] == "BLOCK" && columns.size() >= 5)
+                filter.restrictBlock(columns[1], strtoul(columns[2].c_str(), NULL, 10), strtoul(columns[3].c_str(), NULL, 10), true);
+        }
+
+        return matching;
+    }
+};
+
+#endif
@@ -0,0 +1,124 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSREPLICAS_HPP
+#define HDFSREPLICAS_HPP
+
+#include <string.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/*
+ * Replica choice for reads issued straight to DataNodes: a replica on this host
+ * first, then one in this host's rack, then the others in an order rotated per
+ * block and node so the cluster's reads spread over them.
+ */
+struct ReplicaLocation
+{
+    std::string host;
+    std::string rack;
+};
+
+//The names and addresses this host may appear under in block locations
+static void getLocalHostNames(std::vector<std::string> & names)
+{
+    names.push_back("localhost");
+
+    char hostname[256];
+    if (gethostname(hostname, sizeof(hostname)) == 0)
+    {
+        hostname[sizeof(hostname) - 1] = '\0';
+        names.push_back(hostname);
+        char * dot = strchr(hostname, '.');
+        if (dot)
+        {
+            *dot = '\0';
+            names.push_back(hostname);
+        }
+    }
+
+    struct ifaddrs * interfaces = NULL;
+    if (getifaddrs(&interfaces) == 0)
+    {
+        for (struct ifaddrs * entry = interfaces; entry; entry = entry->ifa_next)
+        {
+            if (!entry->ifa_addr || entry->ifa_addr->sa_family != AF_INET)
+                continue;
+            char address[INET_ADDRSTRLEN];
+            if (inet_ntop(AF_INET, &((struct sockaddr_in *)entry->ifa_addr)->sin_addr, address, sizeof(address)))
+                names.push_back(address);
+        }
+        freeifaddrs(interfaces);
+    }
+}
+
+static bool isLocalHost(const std::vector<std::string> & localnames, const std::string & host)
+{
+    for (unsigned i = 0; i < localnames.size(); i++)
+    {
+        if (localnames[i] == host)
+            return true;
+    }
+
+    //block locations may list fully qualified names where gethostname is short, or the other way round
+    size_t dot = host.find('.');
+    for (unsigned i = 0; dot != std::string::npos && i < localnames.size(); i++)
+    {
+        if (localnames[i].compare(0, std::string::npos, host, 0, dot) == 0)
+            return true;
+    }
+    return false;
+}
+
+//The rack of a topology path such as /rack1/host:port
+static void getTopologyRack(const std::string & topologypath, std::string & rack)
+{
+    size_t slash = topologypath.rfind('/');
+    rack.assign(topologypath, 0, slash == std::string::npos ? 0 : slash);
+}
+
+//Fills order with the indexes of replicas, most preferred first
+static void orderReplicas(const std::vector<ReplicaLocation> & replicas, const std::vector<std::string> & localnames,
+        const std::string & localrack, unsigned rotation, std::vector<unsigned> & order)
+{
+    std::vector<unsigned> local;
+    std::vector<unsigned> rack;
+    std::vector<unsigned> others;
+    for (unsigned i = 0; i < replicas.size(); i++)
+    {
+        if (isLocalHost(localnames, replicas[i].host))
+            local.push_back(i);
+        else if (localrack.size() > 0 && replicas[i].rack == localrack)
+            rack.push_back(i);
+        else
+            others.push_back(i);
+    }
+
+    order.assign(local.begin(), local.end());
+    for (unsigned i = 0; i < rack.size(); i++)
+        order.push_back(rack[(i + rotation) % rack.size()]);
+    for (unsigned i = 0; i < others.size(); i++)
+        order.push_back(others[(i + rotation) % others.size()]);
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#ifndef HDFSRETRY_HPP
+#define HDFSRETRY_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Reads which fail part way are resumed at the first byte not yet delivered rather
+ * than restarted, after a backoff which doubles per retry and is jittered so the
+ * nodes of a cluster do not retry against the same DataNode in lock step.
+ */
+#define READ_RETRY_BASE_DELAY_MS 100
+#define READ_RETRY_MAX_DELAY_MS 10000
+
+struct ReadRetryStats
+{
+    unsigned long retries;
+    unsigned long retriedBytes;
+};
+
+static void initReadRetryStats(ReadRetryStats & stats)
+{
+    stats.retries = 0;
+    stats.retriedBytes = 0;
+}
+
+class readretrypolicy
+{
+private:
+    unsigned maxRetries;
+    unsigned attempts;
+    unsigned seed;
+    ReadRetryStats * stats;
+
+public:
+    readretrypolicy(unsigned maxretries, ReadRetryStats * _stats) : maxRetries(maxretries), attempts(0), stats(_stats)
+    {
+        seed = (unsigned)time(NULL) ^ ((unsigned)getpid() << 16) ^ (unsigned)(size_t)this;
+    }
+
+    //Waits before the next attempt at the remaining bytes, false once the retries are used up
+    bool retry(unsigned long remainingbytes)
+    {
+        if (attempts >= maxRetries)
+            return false;
+
+        attempts++;
+        if (stats)
+        {
+            //sub-split readers share the stats of their connector
+            __sync_fetch_and_add(&stats->retries, 1UL);
+            __sync_fetch_and_add(&stats->retriedBytes, remainingbytes);
+        }
+
+        unsigned long delayms = READ_RETRY_BASE_DELAY_MS;
+        for (unsigned i = 1; i < attempts && delayms < READ_RETRY_MAX_DELAY_MS; i++)
+            delayms *= 2;
+        if (delayms > READ_RETRY_MAX_DELAY_MS)
+            delayms = READ_RETRY_MAX_DELAY_MS;
+
+        delayms = delayms / 2 + rand_r(&seed) % (delayms / 2 + 1);
+        fprintf(stderr, "Retrying read of %lu remaining bytes in %lu ms (retry %u of %u)\n", remainingbytes, delayms,
+                attempts, maxRetries);
+        usleep(delayms * 1000);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,314 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSROWLIMIT_HPP
+#define HDFSROWLIMIT_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+#include "hdfsrecordboundary.hpp"
+
+//Nodes sharing a row count add to it this many times over the course of their share
+#define ROW_LIMIT_PUBLISH_STEPS 4
+
+/*
+ * Stops a read once it has handed over its share of -limit rows. Rows are counted at
+ * the record ends of the output, so the last row handed over is a whole one.
+ *
+ * Without a shared count each node's share is its part of the limit. Nodes which share
+ * a count file may each hand over up to the whole limit, they add their rows to the
+ * count as they go and all stop once the count reaches the limit. Nodes only see each
+ * other's rows every few steps, so together they may overshoot the limit by a little.
+ *
+ * Every read counts in a file of its own generation. Node 0 names a fresh generation in
+ * the generation file and the other nodes wait for one they have not joined yet, so no
+ * node counts into what an earlier or crashed read left behind. The last node to join
+ * removes the generation file, the count file holds the total and how many nodes
+ * finished and the last node to finish removes it.
+ */
+class rowlimit
+{
+private:
+    recordboundarytracker tracker;
+    unsigned long long limit;
+    unsigned long long quota;
+    unsigned long long rows;
+    unsigned long long published;
+    unsigned long long publishStep;
+    std::string countPath;
+    unsigned nodeID;
+    unsigned clusterCount;
+    bool reached;
+
+    /*
+     * Adds rows and finished nodes to the shared count under its lock, starting it afresh
+     * with reset. Returns false when the count cannot be updated.
+     */
+    bool updateCount(unsigned long long addrows, unsigned addfinished, unsigned long long & total, unsigned & finished)
+    {
+        total = 0;
+        finished = 0;
+        int fd = open(countPath.c_str(), O_RDWR | O_CREAT, 0666);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Could not open row count %s: %s, going on without it\n", countPath.c_str(), strerror(errno));
+            countPath.clear();
+            return false;
+        }
+
+        bool updated = false;
+        if (flock(fd, LOCK_EX) == 0)
+        {
+            char text[64];
+            memset(text, 0, sizeof(text));
+            if (pread(fd, text, sizeof(text) - 1, 0) >= 0)
+            {
+                sscanf(text, "%llu %u", &total, &finished);
+                updated = true;
+            }
+
+            //both numbers only grow, so the new text always covers the old
+            total += addrows;
+            finished += addfinished;
+            int written = snprintf(text, sizeof(text), "%llu %u\n", total, finished);
+            updated = updated && pwrite(fd, text, written, 0) == written;
+
+            //the last node to finish removes the count while still holding its lock
+            if (updated && finished >= clusterCount)
+                unlink(countPath.c_str());
+            flock(fd, LOCK_UN);
+        }
+        close(fd);
+        return updated;
+    }
+
+    //A name no earlier read of the same count used
+    static void newGeneration(std::string & generation)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        char text[48];
+        snprintf(text, sizeof(text), "%lx%05lx%x", (unsigned long)now.tv_sec, (unsigned long)now.tv_usec, (unsigned)getpid());
+        generation.assign(text);
+    }
+
+    static bool readGenerationFile(int fd, std::string & text)
+    {
+        char buffer[4096];
+        off_t offset = 0;
+        ssize_t bytesread;
+        while ((bytesread = pread(fd, buffer, sizeof(buffer), offset)) > 0)
+        {
+            text.append(buffer, bytesread);
+            offset += bytesread;
+        }
+        return bytesread == 0;
+    }
+
+    /*
+     * Node 0 writes a fresh generation joined by itself alone, the other nodes add
+     * themselves to the generation in the file unless they are already in it, which
+     * leaves them waiting for the next one. The generation file lists the generation
+     * and the nodes which joined it, the last to join removes it. Returns whether the
+     * node joined a generation.
+     */
+    bool joinGeneration(const std::string & generationpath, std::string & generation)
+    {
+        int fd = open(generationpath.c_str(), nodeID == 0 ? O_RDWR | O_CREAT : O_RDWR, 0666);
+        if (fd < 0)
+            return false;
+
+        bool joined = false;
+        if (flock(fd, LOCK_EX) == 0)
+        {
+            std::string text;
+            if (nodeID == 0)
+            {
+                newGeneration(generation);
+                text.assign(generation).append(" 0");
+                joined = true;
+            }
+            else if (readGenerationFile(fd, text) && text.size() > 0 && text[text.size() - 1] == '\n')
+            {
+                text.erase(text.size() - 1);
+                size_t nodes = text.find(' ');
+                generation.assign(text, 0, nodes);
+                char node[16];
+                snprintf(node, sizeof(node), " %u", nodeID);
+                joined = nodes != std::string::npos && generation.size() > 0 && (text + " ").find(std::string(node) + " ") == std::string::npos;
+                if (joined)
+                    text.append(node);
+            }
+
+            unsigned nodesjoined = 0;
+            for (size_t pos = text.find(' '); pos != std::string::npos; pos = text.find(' ', pos + 1))
+                nodesjoined++;
+
+            if (joined && nodesjoined >= clusterCount)
+                unlink(generationpath.c_str());
+            else if (joined)
+            {
+                text.append("\n");
+                joined = ftruncate(fd, 0) == 0 && pwrite(fd, text.c_str(), text.size(), 0) == (ssize_t)text.size();
+            }
+            flock(fd, LOCK_UN);
+        }
+        close(fd);
+        return joined;
+    }
+
+public:
+    rowlimit(const recordboundarytracker & _tracker, unsigned long long _limit, unsigned nodeid,
+            unsigned clustercount, const std::string & countpath)
+        : tracker(_tracker), limit(_limit), rows(0), published(0), countPath(countpath), nodeID(nodeid),
+          clusterCount(clustercount), reached(false)
+    {
+        if (countPath.size() > 0)
+            quota = limit;
+        else
+            quota = limit / clustercount + (nodeid < limit % clustercount ? 1 : 0);
+
+        publishStep = limit / ((unsigned long long)clustercount * ROW_LIMIT_PUBLISH_STEPS);
+        if (publishStep == 0)
+            publishStep = 1;
+
+        reached = quota == 0;
+    }
+
+    bool isReached() const
+    {
+        return reached;
+    }
+
+    bool isShared() const
+    {
+        return countPath.size() > 0;
+    }
+
+    unsigned long long getRows() const
+    {
+        return rows;
+    }
+
+    /*
+     * Counts the rows within the next length bytes of output. Returns how many of the
+     * bytes to hand over, fewer than length once the limit is reached within them.
+     */
+    unsigned long admit(const char * data, unsigned long length)
+    {
+        if (reached)
+            return 0;
+
+        unsigned long admitted = 0;
+        while (admitted < length)
+        {
+            admitted += tracker.scan(data + admitted, length - admitted, true);
+            if (!tracker.atRecordBoundary())
+                break;
+
+            rows++;
+            if (rows >= quota || (rows - published >= publishStep && publish()))
+            {
+                reached = true;
+                break;
+            }
+        }
+
+        return admitted;
+    }
+
+    /*
+     * Adds the rows counted since the last call to the shared count, returns whether the
+     * count has reached the limit. Without a shared count, or when it cannot be updated,
+     * the node goes on with its own quota.
+     */
+    bool publish()
+    {
+        if (countPath.size() == 0 || rows == published)
+            return false;
+
+        unsigned long long total;
+        unsigned finished;
+        if (!updateCount(rows - published, 0, total, finished))
+            return false;
+
+        published = rows;
+        return total >= limit;
+    }
+
+    /*
+     * Joins this read's generation of the shared count, the nodes other than 0 wait up
+     * to timeoutsecs for node 0 to start it. Without it the node hands over its part
+     * of the limit only.
+     */
+    void start(unsigned timeoutsecs)
+    {
+        if (countPath.size() == 0)
+            return;
+
+        std::string generationpath(countPath);
+        generationpath.append(".gen");
+        std::string generation;
+        unsigned long waitedms = 0;
+        unsigned long delayms = 100;
+        while (!joinGeneration(generationpath, generation))
+        {
+            if (nodeID == 0 || waitedms >= timeoutsecs * 1000UL)
+            {
+                if (nodeID == 0)
+                    fprintf(stderr, "Could not start row count %s, handing over this node's share only\n", generationpath.c_str());
+                else
+                    fprintf(stderr, "No row count of this read found in %s after %u secs, handing over this node's share only\n",
+                            generationpath.c_str(), timeoutsecs);
+                countPath.clear();
+                quota = limit / clusterCount + (nodeID < limit % clusterCount ? 1 : 0);
+                reached = quota == 0;
+                return;
+            }
+
+            unsigned long sleepms = std::min(delayms, timeoutsecs * 1000UL - waitedms);
+            usleep(sleepms * 1000);
+            waitedms += sleepms;
+            delayms = std::min(delayms * 2, 2000UL);
+        }
+
+        countPath.append("_").append(generation);
+    }
+
+    //Adds this node's last rows and counts it as finished, the last node removes the count
+    void finish()
+    {
+        unsigned long long total;
+        unsigned finished;
+        if (countPath.size() > 0)
+            updateCount(rows - published, 1, total, finished);
+        published = rows;
+        countPath.clear();
+    }
+};
+
+#endif
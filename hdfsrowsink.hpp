@@ -0,0 +1,207 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSROWSINK_HPP
+#define HDFSROWSINK_HPP
+
+#include <errno.h>
+#include <stdio.h>
+#include <string>
+
+#include "hdfsrowlimit.hpp"
+
+/*
+ * Receives the rows a connector streams in, in order and in batches of whole
+ * connector buffers. A batch may start or end part way through a row.
+ */
+class hdfsrowsink
+{
+public:
+    virtual ~hdfsrowsink() {}
+
+    //A sink which batches rows itself is handed every write as it comes
+    virtual bool batchesRows() const
+    {
+        return false;
+    }
+
+    //Whether the last write failed because the reader went away rather than on an error
+    virtual bool isClosed() const
+    {
+        return false;
+    }
+
+    virtual bool writeRows(const char * data, unsigned long length) = 0;
+    virtual bool flush() = 0;
+};
+
+/*
+ * The executables' sink: rows are written to stdout, which the PIPE reads.
+ */
+class filerowsink : public hdfsrowsink
+{
+private:
+    FILE * file;
+    bool closed;
+
+public:
+    filerowsink(FILE * _file) : file(_file), closed(false) {}
+
+    bool isClosed() const
+    {
+        return closed;
+    }
+
+    bool writeRows(const char * data, unsigned long length)
+    {
+        if (fwrite(data, 1, length, file) == length)
+            return true;
+        closed = errno == EPIPE;
+        return false;
+    }
+
+    bool flush()
+    {
+        if (fflush(file) == 0)
+            return true;
+        closed = errno == EPIPE;
+        return false;
+    }
+};
+
+/*
+ * Collects the small writes of the record parsers into batches of batchSize
+ * bytes before they are handed to the sink. The output stops, and all further
+ * writes are dropped, once a row limit is reached or the sink fails. A reader
+ * which closes its end early, as ECL's CHOOSEN does, stops it without an error.
+ */
+class rowbatcher : public hdfsrowsink
+{
+private:
+    hdfsrowsink * sink;
+    std::string batch;
+    unsigned long batchSize;
+    bool failed;
+    bool stopped;
+    rowlimit * limit;
+
+    void writeToSink(const char * data, unsigned long length)
+    {
+        if (sink->writeRows(data, length))
+            return;
+
+        stopped = true;
+        if (sink->isClosed())
+            fprintf(stderr, "The reader closed the output, stopping the read\n");
+        else
+            failed = true;
+    }
+
+public:
+    rowbatcher(hdfsrowsink * _sink, unsigned long batchsize)
+        : sink(_sink), batchSize(batchsize), failed(false), stopped(false), limit(NULL) {}
+
+    hdfsrowsink * getSink() const
+    {
+        return sink;
+    }
+
+    void setSink(hdfsrowsink * _sink)
+    {
+        flush();
+        sink = _sink;
+    }
+
+    void setBatchSize(unsigned long batchsize)
+    {
+        batchSize = batchsize;
+        batch.reserve(batchSize);
+    }
+
+    //Rows are counted against the limit, if any, from here on, a new limit restarts a stopped output
+    void setRowLimit(rowlimit * _limit)
+    {
+        limit = _limit;
+        stopped = false;
+    }
+
+    bool isStopped() const
+    {
+        return stopped || (limit && limit->isReached());
+    }
+
+    void write(const char * data, unsigned long length)
+    {
+        if (isStopped())
+            return;
+        if (limit)
+            length = limit->admit(data, length);
+
+        //whole buffers go straight through when nothing is pending
+        if (batch.size() == 0 && (length >= batchSize || sink->batchesRows()))
+        {
+            writeToSink(data, length);
+            return;
+        }
+
+        batch.append(data, length);
+        if (batch.size() >= batchSize)
+            flushBatch();
+    }
+
+    void write(char data)
+    {
+        if (isStopped() || (limit && limit->admit(&data, 1) == 0))
+            return;
+
+        if (sink->batchesRows())
+        {
+            writeToSink(&data, 1);
+            return;
+        }
+
+        batch.append(1, data);
+        if (batch.size() >= batchSize)
+            flushBatch();
+    }
+
+    //Fails once the output is stopped, so readers writing here stop too
+    bool writeRows(const char * data, unsigned long length)
+    {
+        write(data, length);
+        return !isStopped();
+    }
+
+    void flushBatch()
+    {
+        if (batch.size() > 0 && !stopped)
+            writeToSink(batch.data(), batch.size());
+        batch.clear();
+    }
+
+    //Reports whether every write since the last flush reached the sink, or the reader closed it
+    bool flush()
+    {
+        flushBatch();
+        bool succeeded = (stopped || sink->flush() || sink->isClosed()) && !failed;
+        failed = false;
+        return succeeded;
+    }
+};
+
+#endif
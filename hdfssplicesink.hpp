@@ -0,0 +1,221 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSSPLICESINK_HPP
+#define HDFSSPLICESINK_HPP
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <vector>
+
+#include "hdfsrowsink.hpp"
+
+#define SPLICE_BLOCK_COUNT 4
+#define SPLICE_WAIT_US 200
+#define SPLICE_PIPE_MAX_SIZE_FILE "/proc/sys/fs/pipe-max-size"
+
+/*
+ * Hands rows to a pipe without the copy write() makes: rows are collected in page
+ * aligned blocks and each full block is gifted to the pipe with vmsplice. A gifted
+ * block is only filled again once the reader has consumed it, the pipe is enlarged
+ * to hold all blocks so the reader is not starved while one is being filled.
+ */
+class splicerowsink : public hdfsrowsink
+{
+private:
+    int fd;
+    unsigned long blockSize;
+    std::vector<char *> blocks;
+    std::vector<unsigned long long> blockEnds;
+    unsigned current;
+    unsigned long used;
+    unsigned long long queued;
+    bool failed;
+    bool closed;
+
+    //Bytes the reader has taken out of the pipe so far
+    unsigned long long getConsumed()
+    {
+        int unread = 0;
+        if (ioctl(fd, FIONREAD, &unread) != 0)
+            return queued;
+        return queued - unread;
+    }
+
+    bool waitUntilConsumed(unsigned long long position)
+    {
+        while (!failed && getConsumed() < position)
+        {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            pfd.revents = 0;
+            if (poll(&pfd, 1, 0) < 0 && errno != EINTR)
+                failed = true;
+            else if (pfd.revents & (POLLERR | POLLHUP))
+                failed = closed = true;
+            else
+                usleep(SPLICE_WAIT_US);
+        }
+        return !failed;
+    }
+
+    bool spliceBlock()
+    {
+        //only whole pages can be gifted, the last block of a stream is usually partial
+        unsigned flags = used == blockSize ? SPLICE_F_GIFT : 0;
+
+        struct iovec iov;
+        iov.iov_base = blocks[current];
+        iov.iov_len = used;
+        while (!failed && iov.iov_len > 0)
+        {
+            ssize_t spliced = vmsplice(fd, &iov, 1, flags);
+            if (spliced < 0 && errno == EINTR)
+                continue;
+            if (spliced <= 0)
+            {
+                closed = spliced < 0 && errno == EPIPE;
+                if (!closed)
+                    fprintf(stderr, "Error: vmsplice to stdout failed: %s\n", strerror(errno));
+                failed = true;
+                break;
+            }
+            iov.iov_base = (char *)iov.iov_base + spliced;
+            iov.iov_len -= spliced;
+        }
+
+        queued += used;
+        blockEnds[current] = queued;
+        used = 0;
+        current = (current + 1) % blocks.size();
+
+        //the pipe may still reference the pages of the block about to be refilled
+        return waitUntilConsumed(blockEnds[current]);
+    }
+
+public:
+    splicerowsink(int _fd, unsigned long blocksize) : fd(_fd), current(0), used(0), queued(0), failed(false), closed(false)
+    {
+        long pagesize = sysconf(_SC_PAGESIZE);
+        blockSize = (blocksize + pagesize - 1) / pagesize * pagesize;
+
+        for (unsigned i = 0; i < SPLICE_BLOCK_COUNT; i++)
+        {
+            void * block = mmap(NULL, blockSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (block == MAP_FAILED)
+            {
+                failed = true;
+                break;
+            }
+            blocks.push_back((char *)block);
+            blockEnds.push_back(0);
+        }
+
+        unsigned long pipesize = growPipe(fd, blockSize * SPLICE_BLOCK_COUNT);
+        fprintf(stderr, "Zero copy output: %u blocks of %lu bytes, pipe size %lu\n", SPLICE_BLOCK_COUNT, blockSize, pipesize);
+    }
+
+    ~splicerowsink()
+    {
+        //unmapping is safe while the pipe still holds pages, they are released once read
+        for (unsigned i = 0; i < blocks.size(); i++)
+            munmap(blocks[i], blockSize);
+    }
+
+    static bool isPipe(int fd)
+    {
+        struct stat info;
+        return fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+    }
+
+    //Raises the pipe capacity towards size, within the system limit, returns the resulting capacity
+    static unsigned long growPipe(int fd, unsigned long size)
+    {
+#ifdef F_SETPIPE_SZ
+        FILE * limitfile = fopen(SPLICE_PIPE_MAX_SIZE_FILE, "r");
+        if (limitfile)
+        {
+            unsigned long limit = 0;
+            if (fscanf(limitfile, "%lu", &limit) == 1 && limit > 0 && size > limit)
+                size = limit;
+            fclose(limitfile);
+        }
+
+        int current = fcntl(fd, F_GETPIPE_SZ);
+        if (current >= 0 && (unsigned long)current >= size)
+            return current;
+
+        int resized = fcntl(fd, F_SETPIPE_SZ, size);
+        if (resized >= 0)
+            return resized;
+
+        fprintf(stderr, "Could not raise the pipe size to %lu: %s\n", size, strerror(errno));
+        return current < 0 ? 0 : current;
+#else
+        return 0;
+#endif
+    }
+
+    bool batchesRows() const
+    {
+        return true;
+    }
+
+    bool isClosed() const
+    {
+        return closed;
+    }
+
+    bool writeRows(const char * data, unsigned long length)
+    {
+        if (failed)
+            return false;
+
+        while (length > 0)
+        {
+            unsigned long space = blockSize - used;
+            unsigned long copied = length < space ? length : space;
+            memcpy(blocks[current] + used, data, copied);
+            used += copied;
+            data += copied;
+            length -= copied;
+
+            if (used == blockSize && !spliceBlock())
+                return false;
+        }
+        return true;
+    }
+
+    bool flush()
+    {
+        if (used > 0)
+            spliceBlock();
+        return !failed;
+    }
+};
+
+#endif
@@ -0,0 +1,590 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#ifndef HDFSSUBSPLITS_HPP
+#define HDFSSUBSPLITS_HPP
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "hdfsrecordboundary.hpp"
+#include "hdfsrowsink.hpp"
+#include "hdfsbuffers.hpp"
+#include "hdfsjsonlines.hpp"
+
+#define DEFAULT_SUBSPLIT_SIZE (16 * 1024 * 1024)
+#define SUBSPLITS_PER_THREAD_IN_FLIGHT 2
+#define CSV_QUOTE_RESOLVE_WINDOW (1024 * 1024)
+#define DEFAULT_SAMPLE_SEED 1
+
+/*
+ * Sequential reads of one file, one reader per thread.
+ */
+class hdfsrangereader
+{
+public:
+    virtual ~hdfsrangereader() {}
+
+    //Positions the reader, length is how much will likely be read from there
+    virtual bool seek(unsigned long offset, unsigned long length) = 0;
+
+    //Returns the number of bytes read, 0 at the end of the file and -1 on error
+    virtual long read(char * buffer, unsigned long length) = 0;
+};
+
+struct SubSplitOptions
+{
+    bool csv;
+    bool json;
+    JsonProjection projection;
+    std::string terminator;
+    std::string quote;
+    std::string separator;
+    bool outputTerminator;
+    unsigned long maxLen;
+    unsigned long bufferSize;
+    hdfsbufferpool * buffers;
+    unsigned long recLen;
+    double sampleFraction;
+    bool sampleRows;
+    unsigned long long sampleSeed;
+};
+
+//A value spread evenly over [0, 1), always the same for a seed and an offset (SplitMix64's mix)
+static double getSampleValue(unsigned long long seed, unsigned long long offset)
+{
+    unsigned long long mixed = seed * 0x9E3779B97F4A7C15ULL + offset;
+    mixed = (mixed ^ (mixed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    mixed = (mixed ^ (mixed >> 27)) * 0x94D049BB133111EBULL;
+    mixed ^= mixed >> 31;
+    return (mixed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * With -samplemode row, keeps every Nth record of a sub-split, N being the inverse of
+ * the sample fraction, starting from a record picked by the seed. Keeps all otherwise.
+ */
+class rowsampler
+{
+private:
+    unsigned long every;
+    unsigned long skip;
+
+public:
+    rowsampler(const SubSplitOptions & options, unsigned long start) : every(1), skip(0)
+    {
+        if (options.sampleRows && options.sampleFraction < 1)
+        {
+            every = (unsigned long)(1 / options.sampleFraction + 0.5);
+            skip = (unsigned long)(getSampleValue(options.sampleSeed, start) * every);
+        }
+    }
+
+    bool isSampling() const
+    {
+        return every > 1;
+    }
+
+    //Whether the next record is kept
+    bool keepNext()
+    {
+        if (skip > 0)
+        {
+            skip--;
+            return false;
+        }
+        skip = every - 1;
+        return true;
+    }
+};
+
+/*
+ * Appends the FLAT bytes [start, end) to out.
+ */
+static bool readFlatSubSplit(hdfsrangereader * reader, const SubSplitOptions & options, unsigned long start,
+        unsigned long end, std::string & out)
+{
+    if (!reader->seek(start, end - start))
+        return false;
+
+    unsigned long first = out.size();
+    unsigned long position = start;
+    while (position < end)
+    {
+        unsigned long previous = out.size();
+        out.resize(previous + end - position);
+        long bytesread = reader->read(&out[previous], end - position);
+        if (bytesread <= 0)
+        {
+            out.resize(previous);
+            return false;
+        }
+        out.resize(previous + bytesread);
+        position += bytesread;
+    }
+
+    rowsampler sampler(options, start);
+    if (sampler.isSampling() && options.recLen > 0)
+    {
+        unsigned long kept = first;
+        for (unsigned long offset = first; offset + options.recLen <= out.size(); offset += options.recLen)
+        {
+            if (!sampler.keepNext())
+                continue;
+            memmove(&out[kept], &out[offset], options.recLen);
+            kept += options.recLen;
+        }
+        out.resize(kept);
+    }
+    return true;
+}
+
+/*
+ * Whether the CSV data scanned from position on starts within a quoted field, speculated
+ * from up to CSV_QUOTE_RESOLVE_WINDOW bytes past it. Left undecided, it is taken to start
+ * outside of quotes, as a quoted field would have to span all of the window.
+ */
+static bool speculateCSVQuoteState(hdfsrangereader * reader, unsigned long position, char quote,
+        const std::string & separator, const std::string & terminator, char * buffer, unsigned long buffersize)
+{
+    unsigned long from = position > 0 ? position - 1 : 0;
+    if (!reader->seek(from, CSV_QUOTE_RESOLVE_WINDOW + 1))
+        return false;
+
+    quotestateresolver resolver(quote, separator, terminator);
+    unsigned long scanned = 0;
+    while (scanned < CSV_QUOTE_RESOLVE_WINDOW)
+    {
+        long bytesread = reader->read(buffer, buffersize);
+        if (bytesread <= 0)
+            break;
+
+        unsigned long index = 0;
+        if (from < position)
+        {
+            resolver.setPrevious(buffer[0]);
+            index = 1;
+            from = position;
+        }
+
+        scanned += bytesread - index;
+        if (resolver.feed(buffer + index, bytesread - index))
+            break;
+    }
+
+    if (!resolver.isResolved())
+    {
+        if (resolver.getQuotesSeen() > 0)
+            fprintf(stderr, "Quote state at %lu undecided after %lu bytes, assuming outside quotes\n", position, scanned);
+        return false;
+    }
+
+    if (resolver.isWithinQuote())
+        fprintf(stderr, "Split at %lu starts within a quoted field\n", position);
+    return resolver.isWithinQuote();
+}
+
+/*
+ * Finds where the last record ending by end ends, scanning back from end in growing
+ * windows. start must be a record start outside quotes, the quote state at the start
+ * of a window past it is speculated. recordend is start when no record ends in between.
+ */
+static bool findLastRecordEnd(hdfsrangereader * reader, unsigned long start, unsigned long end, const std::string & terminator,
+        const std::string & quote, const std::string & separator, char * buffer, unsigned long buffersize, unsigned long & recordend)
+{
+    recordend = start;
+    unsigned long window = CSV_QUOTE_RESOLVE_WINDOW;
+    while (true)
+    {
+        unsigned long from = end - start > window ? end - window : start;
+
+        recordboundarytracker boundaries(0, terminator, quote);
+        if (from > start && quote.size() > 0)
+            boundaries.setWithinQuote(speculateCSVQuoteState(reader, from, quote[0], separator, terminator, buffer, buffersize));
+
+        if (!reader->seek(from, end - from))
+            return false;
+
+        bool found = false;
+        unsigned long position = from;
+        while (position < end)
+        {
+            long bytesread = reader->read(buffer, end - position < buffersize ? end - position : buffersize);
+            if (bytesread <= 0)
+                return false;
+
+            unsigned long index = 0;
+            while (index < (unsigned long)bytesread)
+            {
+                index += boundaries.scan(buffer + index, bytesread - index, true);
+                if (boundaries.atRecordBoundary())
+                {
+                    recordend = position + index;
+                    found = true;
+                }
+            }
+            position += bytesread;
+        }
+
+        if (found || from == start)
+            return true;
+        window *= 2;
+    }
+}
+
+/*
+ * Appends the CSV records which start within [start, end) to out. As on the single
+ * threaded path, the read starts a terminator length early, and all before the
+ * first record end is skipped, unless start is the beginning of the file.
+ */
+static bool readCSVSubSplit(hdfsrangereader * reader, const SubSplitOptions & options, unsigned long start,
+        unsigned long end, std::string & out)
+{
+    unsigned eolseqlen = options.terminator.size();
+    unsigned long position = start > eolseqlen ? start - eolseqlen : 0;
+    bool started = start == 0;
+
+    recordboundarytracker boundaries(0, options.terminator, options.quote);
+    pooledbuffer slab(*options.buffers);
+    if (!slab.isValid())
+        return false;
+    char * buffer = slab.data();
+
+    //a terminator within a quoted field must not be taken for the end of the record before start
+    if (!started && options.quote.size() > 0)
+        boundaries.setWithinQuote(speculateCSVQuoteState(reader, position, options.quote[0], options.separator,
+                options.terminator, buffer, options.bufferSize));
+
+    if (!reader->seek(position, end - position))
+        return false;
+
+    rowsampler sampler(options, start);
+    unsigned long recordStart = out.size();
+
+    while (true)
+    {
+        long bytesread = reader->read(buffer, options.bufferSize);
+        if (bytesread < 0)
+            return false;
+        if (bytesread == 0)
+        {
+            //the file's last record need not end with a terminator
+            if (started && !boundaries.atRecordBoundary() && !sampler.keepNext())
+                out.resize(recordStart);
+            return true;
+        }
+
+        unsigned long index = 0;
+        while (index < (unsigned long)bytesread)
+        {
+            //no record starts within the range once it is scanned up to a record start or its end
+            if (position >= end && (!started || boundaries.atRecordBoundary()))
+                return true;
+
+            unsigned long available = bytesread - index;
+            if (!started && end - position < available)
+                available = end - position;
+
+            unsigned long consumed = boundaries.scan(&buffer[index], available, true);
+            if (started)
+                out.append(&buffer[index], consumed);
+
+            index += consumed;
+            position += consumed;
+
+            if (!boundaries.atRecordBoundary())
+                continue;
+
+            if (!started)
+                started = true;
+            else if (!sampler.keepNext())
+                out.resize(recordStart);
+            else if (!options.outputTerminator)
+                out.resize(out.size() - eolseqlen);
+            recordStart = out.size();
+        }
+
+        if (!started && options.maxLen > 0 && position > start + options.maxLen * 10)
+        {
+            fprintf(stderr, "\nFirst EOL was not found within the first %lu bytes", position - start);
+            return false;
+        }
+    }
+}
+
+/*
+ * Appends the projections of the JSON Lines records which start within [start, end)
+ * to out. The read starts a byte early so a record starting right at start is kept,
+ * all before the first newline is skipped unless start is the beginning of the file.
+ */
+static bool readJSONSubSplit(hdfsrangereader * reader, const SubSplitOptions & options, unsigned long start,
+        unsigned long end, std::string & out)
+{
+    unsigned long position = start > 0 ? start - 1 : 0;
+    bool started = start == 0;
+
+    if (!reader->seek(position, end - position))
+        return false;
+
+    jsonlinetracker lines;
+    pooledbuffer slab(*options.buffers);
+    if (!slab.isValid())
+        return false;
+    char * buffer = slab.data();
+
+    std::string record;
+    unsigned long recordStart = position;
+    std::vector<std::string> values;
+    rowsampler sampler(options, start);
+
+    while (true)
+    {
+        long bytesread = reader->read(buffer, options.bufferSize);
+        if (bytesread < 0)
+            return false;
+        if (bytesread == 0)
+            break;
+
+        unsigned long index = 0;
+        while (index < (unsigned long)bytesread)
+        {
+            if (position >= end && (!started || lines.atRecordBoundary()))
+                return true;
+
+            unsigned long available = bytesread - index;
+            if (!started && end - position < available)
+                available = end - position;
+
+            unsigned long consumed = started ? lines.scan(buffer + index, available) : lines.resync(buffer + index, available);
+            if (started)
+                record.append(buffer + index, consumed);
+
+            index += consumed;
+            position += consumed;
+
+            if (!lines.atRecordBoundary())
+                continue;
+
+            if (started && sampler.keepNext() && !projectJsonLine(record.data(), record.size() - 1, options.projection, values, out))
+            {
+                fprintf(stderr, "\nMalformed JSON record at offset %lu\n", recordStart);
+                return false;
+            }
+            started = true;
+            record.clear();
+            recordStart = position;
+        }
+
+        if (!started && options.maxLen > 0 && position > start + options.maxLen * 10)
+        {
+            fprintf(stderr, "\nFirst newline was not found within the first %lu bytes", position - start);
+            return false;
+        }
+    }
+
+    //the file's last record need not end with a newline
+    if (started && record.size() > 0 && sampler.keepNext()
+            && !projectJsonLine(record.data(), record.size(), options.projection, values, out))
+    {
+        fprintf(stderr, "\nMalformed JSON record at offset %lu\n", recordStart);
+        return false;
+    }
+    return true;
+}
+
+struct SubSplit
+{
+    unsigned long start;
+    unsigned long end;
+    std::string output;
+    bool done;
+};
+
+/*
+ * A node's range cut into sub-splits which a pool of threads reads. Idle threads take
+ * the next unread sub-split, so a slow sub-split does not hold up the others, while
+ * the calling thread hands the outputs over in order. Threads stay at most a few
+ * sub-splits ahead of the output, which bounds the memory held.
+ */
+class subsplitreader
+{
+private:
+    SubSplitOptions options;
+    std::vector<SubSplit> splits;
+    unsigned long nextSplit;
+    unsigned long emitted;
+    unsigned long window;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    struct WorkerArg
+    {
+        subsplitreader * owner;
+        hdfsrangereader * reader;
+    };
+
+    static void * workerThread(void * arg)
+    {
+        WorkerArg * worker = (WorkerArg *)arg;
+        worker->owner->work(worker->reader);
+        return NULL;
+    }
+
+    void work(hdfsrangereader * reader)
+    {
+        while (true)
+        {
+            pthread_mutex_lock(&lock);
+            while (!failed && nextSplit < splits.size() && nextSplit >= emitted + window)
+                pthread_cond_wait(&changed, &lock);
+
+            if (failed || nextSplit >= splits.size())
+            {
+                pthread_mutex_unlock(&lock);
+                return;
+            }
+            SubSplit & split = splits[nextSplit++];
+            pthread_mutex_unlock(&lock);
+
+            std::string output;
+            bool succeeded;
+            if (options.json)
+                succeeded = readJSONSubSplit(reader, options, split.start, split.end, output);
+            else if (options.csv)
+                succeeded = readCSVSubSplit(reader, options, split.start, split.end, output);
+            else
+                succeeded = readFlatSubSplit(reader, options, split.start, split.end, output);
+
+            pthread_mutex_lock(&lock);
+            if (succeeded)
+            {
+                split.output.swap(output);
+                split.done = true;
+            }
+            else
+            {
+                fprintf(stderr, "Error reading sub-split %lu-%lu\n", split.start, split.end);
+                failed = true;
+            }
+            pthread_cond_broadcast(&changed);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+
+public:
+    subsplitreader(const SubSplitOptions & _options) : options(_options), nextSplit(0), emitted(0), window(0), failed(false)
+    {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&changed, NULL);
+    }
+
+    ~subsplitreader()
+    {
+        pthread_cond_destroy(&changed);
+        pthread_mutex_destroy(&lock);
+    }
+
+    /*
+     * Cuts [start, end) into sub-splits of about splitsize bytes, FLAT ones hold whole records.
+     * Sampled by block, only the sub-splits the seed picks are kept.
+     */
+    void plan(unsigned long start, unsigned long end, unsigned long splitsize, unsigned long reclen)
+    {
+        assert(splitsize > 0);
+        if (reclen > 0)
+            splitsize = splitsize < reclen ? reclen : splitsize / reclen * reclen;
+
+        for (unsigned long offset = start; offset < end; offset += splitsize)
+        {
+            //-samplemode block reads a seeded subset of the sub-splits, each resyncs to records on its own
+            if (!options.sampleRows && options.sampleFraction < 1
+                    && getSampleValue(options.sampleSeed, offset) >= options.sampleFraction)
+                continue;
+
+            SubSplit split;
+            split.start = offset;
+            split.end = end - offset > splitsize ? offset + splitsize : end;
+            split.done = false;
+            splits.push_back(split);
+        }
+    }
+
+    unsigned long getSplitCount() const
+    {
+        return splits.size();
+    }
+
+    //Reads all sub-splits with one thread per reader, handing each output to the sink in order
+    bool read(const std::vector<hdfsrangereader *> & readers, hdfsrowsink & sink)
+    {
+        window = readers.size() * SUBSPLITS_PER_THREAD_IN_FLIGHT;
+
+        std::vector<pthread_t> threads(readers.size());
+        std::vector<WorkerArg> args(readers.size());
+        unsigned started = 0;
+        for (; started < readers.size(); started++)
+        {
+            args[started].owner = this;
+            args[started].reader = readers[started];
+            if (pthread_create(&threads[started], NULL, workerThread, &args[started]) != 0)
+                break;
+        }
+
+        pthread_mutex_lock(&lock);
+        if (started == 0)
+            failed = true;
+
+        while (!failed && emitted < splits.size())
+        {
+            SubSplit & split = splits[emitted];
+            if (!split.done)
+            {
+                pthread_cond_wait(&changed, &lock);
+                continue;
+            }
+
+            std::string output;
+            output.swap(split.output);
+            pthread_mutex_unlock(&lock);
+
+            bool written = sink.writeRows(output.data(), output.size());
+
+            pthread_mutex_lock(&lock);
+            if (!written)
+                failed = true;
+            emitted++;
+            pthread_cond_broadcast(&changed);
+        }
+        bool succeeded = !failed;
+        failed = true;
+        pthread_cond_broadcast(&changed);
+        pthread_mutex_unlock(&lock);
+
+        for (unsigned i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+
+        return succeeded;
+    }
+};
+
+#endif
@@ -230,7 +230,10 @@ int libhdfsconnector::readXMLOffset(const char * filename, unsigned long seekPos
         return EXIT_FAILURE;
     }
 
-    unsigned char buffer[bufferSize + 1];
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    unsigned char * buffer = (unsigned char *)readbuffer.data();
 
     bool firstRowfound = false;
 
@@ -253,10 +256,10 @@ int libhdfsconnector::readXMLOffset(const char * filename, unsigned long seekPos
 
     fprintf(stderr, "--Start looking <%s>: %ld--\n", elementname.c_str(), currentPos);
 
-    fprintf(stdout, "%s", xmlizedxpath.c_str());
+    writeOutput(xmlizedxpath.c_str(), xmlizedxpath.size());
 
     unsigned long bytesLeft = readlen;
-    while (hdfsAvailable(fs, readFile) && bytesLeft > 0)
+    while (hdfsAvailable(fs, readFile) && bytesLeft > 0 && !isOutputStopped())
     {
         tSize numOfBytesRead = hdfsRead(fs, readFile, (void*) buffer, bufferSize);
         if (numOfBytesRead <= 0)
@@ -336,14 +339,14 @@ int libhdfsconnector::readXMLOffset(const char * filename, unsigned long seekPos
 
                 if (stopAtNextClosingTag && strcmp(currentTag.c_str(), closeRowTag.c_str()) == 0)
                 {
-                    fprintf(stdout, "%s", currentTag.c_str());
+                    writeOutput(currentTag.c_str(), currentTag.size());
                     fprintf(stderr, "--stop piping at %s %lu--\n", currentTag.c_str(), currentPos);
                     bytesLeft = 0;
                     break;
                 }
 
                 if (firstRowfound)
-                    fprintf(stdout, "%s", currentTag.c_str());
+                    writeOutput(currentTag.c_str(), currentTag.size());
                 else
                     fprintf(stderr, "skipping tag %s\n", currentTag.c_str());
 
@@ -354,7 +357,7 @@ int libhdfsconnector::readXMLOffset(const char * filename, unsigned long seekPos
             }
 
             if (firstRowfound)
-                fprintf(stdout, "%c", currChar);
+                writeOutput(currChar);
 
             buffIndex++;
             currentPos++;
@@ -377,14 +380,14 @@ int libhdfsconnector::readXMLOffset(const char * filename, unsigned long seekPos
     xmlizedxpath.clear();
 
     xpath2xml(&xmlizedxpath, rowTag, false);
-    fprintf(stdout, "%s", xmlizedxpath.c_str());
+    writeOutput(xmlizedxpath.c_str(), xmlizedxpath.size());
 
     return EXIT_SUCCESS;
 }
 
 int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long seekPos, unsigned long readlen,
         const char * eolseq, unsigned long bufferSize, bool outputTerminator, unsigned long recLen,
-        unsigned long maxLen, const char * quote, int maxretries)
+        unsigned long maxLen, const char * quote, int maxretries, bool withinQuote)
 {
     fprintf(stderr, "CSV terminator: \'%s\' and quote: \'%c\'\n", eolseq, quote[0]);
     unsigned long recsFound = 0;
@@ -406,8 +409,10 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
         return EXIT_FAILURE;
     }
 
-    bool withinQuote = false;
-    unsigned char buffer[bufferSize + 1];
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    unsigned char * buffer = (unsigned char *)readbuffer.data();
 
     bool stopAtNextEOL = false;
     bool firstEOLfound = seekPos == 0 ? true : false;
@@ -417,12 +422,21 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
     fprintf(stderr, "--Start looking: %ld--\n", currentPos);
 
     unsigned long bytesLeft = readlen;
+    readretrypolicy retries(maxretries, &readRetryStats);
 
-    while (hdfsAvailable(fs, readFile) && bytesLeft > 0)
+    while (hdfsAvailable(fs, readFile) && bytesLeft > 0 && !isOutputStopped())
     {
-        tSize num_read_bytes = hdfsRead(fs, readFile, (void*) buffer, bufferSize);
+        tSize num_read_bytes = resumableRead(filename, readFile, (void*) buffer, bufferSize, bytesLeft, retries);
+
+        if (num_read_bytes < 0)
+        {
+            fprintf(stderr, "\n--Failed reading at: %ld--\n", currentPos);
+            if (readFile)
+                hdfsCloseFile(fs, readFile);
+            return EXIT_FAILURE;
+        }
 
-        if (num_read_bytes <= 0)
+        if (num_read_bytes == 0)
         {
             fprintf(stderr, "\n--Hard Stop at: %ld--\n", currentPos);
             break;
@@ -490,7 +504,7 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
                     if (outputTerminator)
                     {
                         //if (currentPos > seekPos) //Don't output first EOL
-                        fprintf(stdout, "%s", eolseq);
+                        writeOutput(eolseq, strlen(eolseq));
 
                         bufferIndex += eolseqlen;
                         currentPos += eolseqlen;
@@ -523,7 +537,7 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
             //don't pipe until we're beyond the first EOL (if offset = 0 start piping ASAP)
             if (firstEOLfound)
             {
-                fprintf(stdout, "%c", currChar);
+                writeOutput(currChar);
                 bytesLeft--;
             }
             else
@@ -542,7 +556,7 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
 
             // ok, so if bytesLeft <= 0 at this point, we need to keep piping
             // IF the last char read was not an EOL char
-            if (bytesLeft <= 0 && currChar != eolseq[0])
+            if (bytesLeft <= 0 && (currChar != eolseq[0] || withinQuote))
             {
                 if (!firstEOLfound)
                 {
@@ -565,6 +579,35 @@ int libhdfsconnector::streamCSVFileOffset(const char * filename, unsigned long s
     return EXIT_SUCCESS;
 }
 
+/*
+ * Reads from readFile, reopening it at the position the failed read started from
+ * while retries last. Rows already streamed out are never read again.
+ */
+tSize libhdfsconnector::resumableRead(const char * filename, hdfsFile & readFile, void * buffer, tSize length,
+        unsigned long remaining, readretrypolicy & retries)
+{
+    tOffset position = hdfsTell(fs, readFile);
+    while (true)
+    {
+        tSize bytesread = readFile ? hdfsRead(fs, readFile, buffer, length) : -1;
+        if (bytesread >= 0)
+            return bytesread;
+
+        fprintf(stderr, "Error reading %s at %ld\n", filename, (long)position);
+        if (position < 0 || !retries.retry(remaining))
+            return -1;
+
+        if (readFile)
+            hdfsCloseFile(fs, readFile);
+        readFile = hdfsOpenFile(fs, filename, O_RDONLY, 0, 0, 0);
+        if (readFile && hdfsSeek(fs, readFile, position))
+        {
+            hdfsCloseFile(fs, readFile);
+            readFile = NULL;
+        }
+    }
+}
+
 int libhdfsconnector::streamFlatFileOffset(const char * filename, unsigned long seekPos, unsigned long readlen,unsigned long bufferSize, int maxretries)
 {
     hdfsFile readFile = hdfsOpenFile(fs, filename, O_RDONLY, 0, 0, 0);
@@ -580,21 +623,33 @@ int libhdfsconnector::streamFlatFileOffset(const char * filename, unsigned long
         return EXIT_FAILURE;
     }
 
-    unsigned char buffer[bufferSize + 1];
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    unsigned char * buffer = (unsigned char *)readbuffer.data();
 
     unsigned long currentPos = seekPos;
 
     fprintf(stderr, "\n--Start piping: %ld--\n", currentPos);
 
     unsigned long bytesLeft = readlen;
-    while (hdfsAvailable(fs, readFile) && bytesLeft > 0)
+    readretrypolicy retries(maxretries, &readRetryStats);
+    while (hdfsAvailable(fs, readFile) && bytesLeft > 0 && !isOutputStopped())
     {
-        tSize num_read_bytes = hdfsRead(fs, readFile, buffer, bytesLeft < bufferSize ? bytesLeft : bufferSize);
-        if (num_read_bytes <= 0)
+        tSize num_read_bytes = resumableRead(filename, readFile, buffer, bytesLeft < bufferSize ? bytesLeft : bufferSize,
+                bytesLeft, retries);
+        if (num_read_bytes < 0)
+        {
+            fprintf(stderr, "--\nFailed reading at: %ld--\n", currentPos);
+            if (readFile)
+                hdfsCloseFile(fs, readFile);
+            return EXIT_FAILURE;
+        }
+        if (num_read_bytes == 0)
             break;
         bytesLeft -= num_read_bytes;
-        for (int i = 0; i < num_read_bytes; i++, currentPos++)
-            fprintf(stdout, "%c", buffer[i]);
+        currentPos += num_read_bytes;
+        writeOutput((const char *) buffer, num_read_bytes);
     }
 
     fprintf(stderr, "--\nStop Streaming: %ld--\n", currentPos);
@@ -633,15 +688,20 @@ int libhdfsconnector::streamInFile(const char * rfile, int bufferSize)
         return RETURN_FAILURE;
     }
 
-    unsigned char buff[bufferSize + 1];
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+    {
+        hdfsCloseFile(fs, readFile);
+        return RETURN_FAILURE;
+    }
+    unsigned char * buff = (unsigned char *)readbuffer.data();
     buff[bufferSize] = '\0';
 
     for (unsigned long bytes_read = 0; bytes_read < fileTotalSize;)
     {
         unsigned long read_length = hdfsRead(fs, readFile, buff, bufferSize);
         bytes_read += read_length;
-        for (unsigned long i = 0; i < read_length; i++)
-            fprintf(stdout, "%c", buff[i]);
+        writeOutput((const char *) buff, read_length);
     }
 
     hdfsCloseFile(fs, readFile);
@@ -649,63 +709,292 @@ int libhdfsconnector::streamInFile(const char * rfile, int bufferSize)
     return 0;
 }
 
-int libhdfsconnector::streamFileOffset()
+int libhdfsconnector::listDirectory(const char * path, vector<HdfsPartFile> & parts)
 {
-    int returnCode = RETURN_FAILURE;
+    int numEntries = 0;
+    hdfsFileInfo * entries = hdfsListDirectory(fs, path, &numEntries);
+    if (!entries && numEntries != 0)
+    {
+        fprintf(stderr, "Error: hdfsListDirectory for %s - FAILED!\n", path);
+        return RETURN_FAILURE;
+    }
 
-    fprintf(stderr, "\nStreaming in %s...\n", fileName);
+    for (int i = 0; i < numEntries; i++)
+    {
+        if (entries[i].mKind != kObjectKindFile || isHiddenFileName(getFileNameFromPath(entries[i].mName)))
+            continue;
+
+        HdfsPartFile part;
+        initPartFile(part, entries[i].mName, entries[i].mSize);
+        parts.push_back(part);
+    }
+    if (entries)
+        hdfsFreeFileInfo(entries, numEntries);
 
-    unsigned long fileSize = getFileSize(fileName);
-    if (fileSize != RETURN_FAILURE)
+    return EXIT_SUCCESS;
+}
+
+int libhdfsconnector::readFileToString(const char * path, string & content)
+{
+    hdfsFile readFile = hdfsOpenFile(fs, path, O_RDONLY, 0, 0, 0);
+    if (!readFile)
     {
-        if (strcmp(format.c_str(), "FLAT") == 0)
+        fprintf(stderr, "Failed to open %s for reading!\n", path);
+        return RETURN_FAILURE;
+    }
+
+    char buffer[124 * 100];
+    tSize bytesread;
+    while ((bytesread = hdfsRead(fs, readFile, buffer, sizeof(buffer))) > 0)
+        content.append(buffer, bytesread);
+
+    hdfsCloseFile(fs, readFile);
+
+    return bytesread < 0 ? RETURN_FAILURE : EXIT_SUCCESS;
+}
+
+bool libhdfsconnector::getTargetStatus(SplitPlan & plan)
+{
+    hdfsFileInfo *fileInfo = hdfsGetPathInfo(fs, fileName);
+    if (!fileInfo)
+    {
+        fprintf(stderr, "Error: hdfsGetPathInfo for %s - FAILED!\n", fileName);
+        return false;
+    }
+
+    plan.isDirectory = fileInfo->mKind == kObjectKindDirectory;
+    plan.length = fileInfo->mSize;
+    plan.modificationTime = fileInfo->mLastMod;
+    hdfsFreeFileInfo(fileInfo, 1);
+
+    return true;
+}
+
+/*
+ * The NameNode's length leaves out the last block while it is written, a stream opened
+ * on the file sees what the DataNodes hold of it, hdfsAvailable reports how much more.
+ */
+bool libhdfsconnector::getFollowStatus(FollowStatus & status)
+{
+    SplitPlan plan;
+    if (!getTargetStatus(plan))
+        return false;
+
+    status.length = plan.length;
+    status.closeKnown = false;
+    status.closed = false;
+
+    hdfsFile readFile = hdfsOpenFile(fs, fileName, O_RDONLY, 0, 0, 0);
+    if (readFile)
+    {
+        if (hdfsSeek(fs, readFile, plan.length) == 0)
         {
-            unsigned long recstoread = getRecordCount(fileSize, clusterCount, recLen, nodeID);
+            int available = hdfsAvailable(fs, readFile);
+            if (available > 0)
+                status.length += available;
+        }
+        hdfsCloseFile(fs, readFile);
+    }
 
-            if (recstoread != RETURN_FAILURE)
-            {
-                unsigned long offset = nodeID * (fileSize / clusterCount / recLen) * recLen;
+    return true;
+}
 
-                if ((fileSize / recLen) % clusterCount > 0)
-                {
-                    if ((fileSize / recLen) % clusterCount > nodeID)
-                        offset += nodeID * recLen;
-                    else
-                        offset += ((fileSize / recLen) % clusterCount) * recLen;
-                }
+int libhdfsconnector::streamPartFiles(vector<HdfsPartFile> & parts)
+{
+
+    rowblockfilter filter;
+    if (loadRowBlockFilter(fileName, filter))
+        skipUnmatchedParts(parts, filter);
+
+    vector<HdfsPartFile> assigned;
+    vector<vector<pair<unsigned long, unsigned long> > > assignedranges;
+    assignPartRanges(parts, filter, assigned, assignedranges);
 
-                fprintf(stderr, "fileSize: %lu offset: %lu size bytes: %lu, recstoread:%lu\n", fileSize, offset,
-                        recstoread * recLen, recstoread);
-                if (offset < fileSize)
-                    returnCode = streamFlatFileOffset(fileName, offset, recstoread * recLen, bufferSize, 1);
+    fprintf(stderr, "Streaming %lu of %lu file(s) in directory %s\n", (unsigned long)assigned.size(),
+            (unsigned long)parts.size(), fileName);
+
+    int returnCode = EXIT_SUCCESS;
+    for (unsigned i = 0; i < assigned.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); i++)
+    {
+        const char * partpath = assigned[i].path.c_str();
+        fprintf(stderr, "Streaming part %s (%lu bytes)\n", partpath, assigned[i].length);
+
+        //row blocks the sidecars rule out are skipped, the rest is read in record aligned ranges
+        vector<pair<unsigned long, unsigned long> > & ranges = assignedranges[i];
+
+        //samples are drawn, and cached blocks read, by the sub-split readers; ranges start on records so they resync at once
+        if (isSubSplitRead() && (isSampling() || isBlockCached()))
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamSubSplits(partpath, assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            if (!isVariableFlat() && (recLen == 0 || assigned[i].length % recLen))
+            {
+                fprintf(stderr, "filesize (%lu) not multiple of record length(%lu)", assigned[i].length, recLen);
+                returnCode = RETURN_FAILURE;
             }
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamFlatFileOffset(partpath, ranges[r].first, ranges[r].second, bufferSize, maxRetry);
         }
         else if (strcmp(format.c_str(), "CSV") == 0)
         {
-            fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
-                    (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
-
-            returnCode = streamCSVFileOffset(fileName, (fileSize / clusterCount) * nodeID,
-                    fileSize / clusterCount, terminator.c_str(), bufferSize, outputTerminator, recLen, maxLen,
-                    quote.c_str(), 1);
+            //ranges start and end on record boundaries, with terminators kept they pass through verbatim
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+            {
+                if (outputTerminator)
+                    returnCode = streamFlatFileOffset(partpath, ranges[r].first, ranges[r].second, bufferSize, maxRetry);
+                else
+                    returnCode = streamCSVFileOffset(partpath, ranges[r].first, ranges[r].second, terminator.c_str(), bufferSize,
+                            outputTerminator, recLen, maxLen, quote.c_str(), maxRetry, false);
+            }
         }
-        else if (strcmp(format.c_str(), "XML") == 0)
+        else if (strcmp(format.c_str(), "JSON") == 0)
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamJSONLines(partpath, assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else
+        {
+            fprintf(stderr, "Format %s not supported when streaming a directory", format.c_str());
+            returnCode = RETURN_FAILURE;
+        }
+    }
+
+    return returnCode;
+}
+
+int libhdfsconnector::streamFileOffset()
+{
+    int returnCode = RETURN_FAILURE;
+
+    fprintf(stderr, "\nStreaming in %s...\n", fileName);
+
+    SplitPlan plan;
+    if (!getSplitPlan(plan))
+    {
+        fprintf(stderr, "Could not determine HDFS file size: %s", fileName);
+        return returnCode;
+    }
+
+    //-stream reads only what was appended to the file since its last run
+    if (isIncrementalRead())
+        return streamIngestWindow(fileName, plan);
+
+    //-follow reads a file still being written as it grows
+    if (isFollowRead())
+        return followFile(fileName, plan);
+
+    //a -parts directory, possibly of rolled part files, is streamed as their concatenation
+    if (plan.isDirectory)
+        return streamPartFiles(plan.parts);
+
+    unsigned long fileSize = plan.length;
+
+    //record starts are only known from the offsets sidecars of a -parts directory, past node 0's
+    if (isVariableFlat())
+    {
+        fprintf(stderr, "No record offsets kept for variable length FLAT file %s, node 0 streams all of it\n", fileName);
+        if (nodeID == 0 && fileSize > 0)
+            returnCode = streamFlatFileOffset(fileName, 0, fileSize, bufferSize, maxRetry);
+        else
+            returnCode = EXIT_SUCCESS;
+    }
+    else if (strcmp(format.c_str(), "FLAT") == 0)
+    {
+        unsigned long recstoread = getRecordCount(fileSize, clusterCount, recLen, nodeID);
+
+        if (recstoread != RETURN_FAILURE)
         {
-            fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
-                    (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
+            unsigned long offset = nodeID * (fileSize / clusterCount / recLen) * recLen;
 
-            returnCode = readXMLOffset(fileName, (fileSize / clusterCount) * nodeID,
-                    fileSize / clusterCount, rowTag, headerText, footerText, bufferSize);
+            if ((fileSize / recLen) % clusterCount > 0)
+            {
+                if ((fileSize / recLen) % clusterCount > nodeID)
+                    offset += nodeID * recLen;
+                else
+                    offset += ((fileSize / recLen) % clusterCount) * recLen;
+            }
+
+            fprintf(stderr, "fileSize: %lu offset: %lu size bytes: %lu, recstoread:%lu\n", fileSize, offset,
+                    recstoread * recLen, recstoread);
+            if (offset < fileSize && isSubSplitRead())
+                returnCode = streamSubSplits(fileName, fileSize, offset, offset + recstoread * recLen);
+            else if (offset < fileSize)
+                returnCode = streamFlatFileOffset(fileName, offset, recstoread * recLen, bufferSize, maxRetry);
         }
+    }
+    else if (strcmp(format.c_str(), "CSV") == 0)
+    {
+        fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
+                (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
+
+        //the records starting within this node's share, the last node's share ends with the file
+        unsigned long offset = (fileSize / clusterCount) * nodeID;
+        if (isSubSplitRead())
+            returnCode = streamSubSplits(fileName, fileSize, offset,
+                    nodeID == clusterCount - 1 ? fileSize : offset + fileSize / clusterCount);
         else
-            fprintf(stderr, "Unknown format type: %s(%s)", format.c_str(), foptions.c_str());
+            returnCode = streamCSVFileOffset(fileName, offset,
+                    fileSize / clusterCount, terminator.c_str(), bufferSize, outputTerminator, recLen, maxLen,
+                    quote.c_str(), maxRetry, isShareWithinQuote(fileName, fileSize, offset));
+    }
+    else if (strcmp(format.c_str(), "JSON") == 0)
+        returnCode = streamJSONLines(fileName, fileSize);
+    else if (strcmp(format.c_str(), "XML") == 0)
+    {
+        fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
+                (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
+
+        returnCode = readXMLOffset(fileName, (fileSize / clusterCount) * nodeID,
+                fileSize / clusterCount, rowTag, headerText, footerText, bufferSize);
     }
     else
-        fprintf(stderr, "Could not determine HDFS file size: %s", fileName);
+        fprintf(stderr, "Unknown format type: %s(%s)", format.c_str(), foptions.c_str());
 
     return returnCode;
 }
 
+hdfsrangereader * libhdfsconnector::openRangeReader(const char * path, unsigned long fileSize)
+{
+#ifdef HADOOP_GT_21
+    bool positional = hedging.isEnabled();
+#else
+    bool positional = false;
+#endif
+    libhdfsrangereader * reader = new libhdfsrangereader(fs, path, maxRetry, &readRetryStats, positional);
+    if (!reader->isOpen())
+    {
+        fprintf(stderr, "Failed to open %s for reading!\n", path);
+        delete reader;
+        return NULL;
+    }
+    return reader;
+}
+
+void libhdfsconnector::getNodePartNames(unsigned node, vector<string> & partnames)
+{
+    string filepartname;
+    createFilePartName(&filepartname, fileName, node, clusterCount);
+
+    if (hdfsExists(fs, filepartname.c_str()) == 0)
+    {
+        partnames.push_back(filepartname);
+        return;
+    }
+
+    //parts written with -maxpartsize are rolled over as part_<node>_<count>_<seq>
+    for (unsigned long sequence = 0;; sequence++)
+    {
+        filepartname.clear();
+        createRolledFilePartName(&filepartname, fileName, node, clusterCount, sequence);
+        if (hdfsExists(fs, filepartname.c_str()) != 0)
+            break;
+        partnames.push_back(filepartname);
+    }
+}
+
 int libhdfsconnector::mergeFile()
 {
     if (nodeID == 0)
@@ -738,22 +1027,36 @@ int libhdfsconnector::mergeFile()
 
             unsigned bytesWrittenSinceLastFlush = 0;
 
-            string filepartname;
+            vector<string> partnames;
+            getNodePartNames(node, partnames);
 
-            createFilePartName(&filepartname, fileName, node, clusterCount);
+            if (partnames.size() == 0)
+            {
+                string filepartname;
+                createFilePartName(&filepartname, fileName, node, clusterCount);
+                fprintf(stderr, "Could not merge, part %s was not located\n", filepartname.c_str());
+                return EXIT_FAILURE;
+            }
 
-            if (hdfsExists(fs, filepartname.c_str()) == 0)
+            for (unsigned partindex = 0; partindex < partnames.size(); partindex++)
             {
+                const char * filepartname = partnames[partindex].c_str();
 
-                fprintf(stderr, "Opening readfile  %s\n", filepartname.c_str());
-                hdfsFile readFile = hdfsOpenFile(fs, filepartname.c_str(), O_RDONLY, 0, 0, 0);
+                fprintf(stderr, "Opening readfile  %s\n", filepartname);
+                hdfsFile readFile = hdfsOpenFile(fs, filepartname, O_RDONLY, 0, 0, 0);
                 if (!readFile)
                 {
                     fprintf(stderr, "Failed to open %s for reading!\n", fileName);
                     return EXIT_FAILURE;
                 }
 
-                unsigned char buffer[bufferSize + 1];
+                pooledbuffer readbuffer(readBuffers);
+                if (!readbuffer.isValid())
+                {
+                    hdfsCloseFile(fs, readFile);
+                    return EXIT_FAILURE;
+                }
+                unsigned char * buffer = (unsigned char *)readbuffer.data();
 
                 while (hdfsAvailable(fs, readFile))
                 {
@@ -792,23 +1095,18 @@ int libhdfsconnector::mergeFile()
                     return EXIT_FAILURE;
                 }
 
-                fprintf(stderr, "Closing readfile  %s\n", filepartname.c_str());
+                fprintf(stderr, "Closing readfile  %s\n", filepartname);
                 hdfsCloseFile(fs, readFile);
 
                 if (cleanmerge)
                 {
 #ifdef HADOOP_GT_21
-                    hdfsDelete(fs, filepartname.c_str(), 0);
+                    hdfsDelete(fs, filepartname, 0);
 #else
-                    hdfsDelete(fs, filepartname.c_str());
+                    hdfsDelete(fs, filepartname);
 #endif
                 }
             }
-            else
-            {
-                fprintf(stderr, "Could not merge, part %s was not located\n", filepartname.c_str());
-                return EXIT_FAILURE;
-            }
 
             fprintf(stderr, "Closing writefile %s\n", fileName);
             if (hdfsCloseFile(fs, writeFile) != 0)
@@ -838,9 +1136,22 @@ int libhdfsconnector::writeFlatOffset()
         return RETURN_FAILURE;
     }
 
+    if (isPartitionedWrite())
+        return writePartitionedOffset();
+
+    if (writeStreams > 1)
+        fprintf(stderr, "Warning: -writestreams requires HDFS concat which LIBHDFS does not expose, writing on a single stream.\n");
+
+    partroller roller(maxPartSize, strcmp(format.c_str(), "FLAT") == 0 ? recLen : 0, terminator, quote);
+    if (isVariableFlat())
+        roller.setLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian);
+
     string filepartname;
 
-    createFilePartName(&filepartname, fileName, nodeID, clusterCount);
+    if (roller.isRolling())
+        createRolledFilePartName(&filepartname, fileName, nodeID, clusterCount, roller.getPartSequence());
+    else
+        createFilePartName(&filepartname, fileName, nodeID, clusterCount);
 
     hdfsFile writeFile = hdfsOpenFile(fs, filepartname.c_str(), O_CREAT | O_WRONLY, 0, 1, 0);
 
@@ -852,6 +1163,10 @@ int libhdfsconnector::writeFlatOffset()
 
     fprintf(stderr, "Opened HDFS file %s for writing successfully...\n", filepartname.c_str());
 
+    rowblockcollector * sidecars = createSidecarCollector();
+    if (sidecars)
+        sidecars->startPart(getFileNameFromPath(filepartname.c_str()));
+
     fprintf(stderr, "Opening pipe:  %s \n", pipepath);
 
     ifstream in;
@@ -872,8 +1187,45 @@ int libhdfsconnector::writeFlatOffset()
         in.read(char_ptr, sizeof(char_ptr));
         bytesread = in.gcount();
         totalbytesread += bytesread;
-        tSize num_written_bytes = hdfsWrite(fs, writeFile, (void*) char_ptr, bytesread);
-        totalbyteswritten += num_written_bytes;
+
+        for (size_t taken = 0; taken < bytesread;)
+        {
+            if (roller.shouldRoll())
+            {
+                if (hdfsFlush(fs, writeFile) || hdfsCloseFile(fs, writeFile))
+                {
+                    fprintf(stderr, "Failed to close %s\n", filepartname.c_str());
+                    delete sidecars;
+                    return EXIT_FAILURE;
+                }
+
+                roller.rolled();
+                filepartname.clear();
+                createRolledFilePartName(&filepartname, fileName, nodeID, clusterCount, roller.getPartSequence());
+
+                writeFile = hdfsOpenFile(fs, filepartname.c_str(), O_CREAT | O_WRONLY, 0, 1, 0);
+                if (!writeFile)
+                {
+                    fprintf(stderr, "Failed to open %s for writing!\n", filepartname.c_str());
+                    delete sidecars;
+                    return EXIT_FAILURE;
+                }
+                fprintf(stderr, "\nRolled over to %s\n", filepartname.c_str());
+
+                if (sidecars)
+                {
+                    sidecars->endPart();
+                    sidecars->startPart(getFileNameFromPath(filepartname.c_str()));
+                }
+            }
+
+            unsigned long piece = roller.nextPiece(char_ptr + taken, bytesread - taken);
+            if (sidecars)
+                sidecars->observe(char_ptr + taken, piece);
+            tSize num_written_bytes = hdfsWrite(fs, writeFile, (void*) (char_ptr + taken), piece);
+            totalbyteswritten += num_written_bytes;
+            taken += piece;
+        }
 
         //Need to figure out how often this should be done
         //if(totalbyteswritten % )
@@ -881,6 +1233,7 @@ int libhdfsconnector::writeFlatOffset()
             if (hdfsFlush(fs, writeFile))
             {
                 fprintf(stderr, "Failed to 'flush' %s\n", filepartname.c_str());
+                delete sidecars;
                 return EXIT_FAILURE;
             }
         }
@@ -890,6 +1243,7 @@ int libhdfsconnector::writeFlatOffset()
     if (hdfsFlush(fs, writeFile))
     {
         fprintf(stderr, "Failed to 'flush' %s\n", filepartname.c_str());
+        delete sidecars;
         return EXIT_FAILURE;
     }
 
@@ -898,12 +1252,79 @@ int libhdfsconnector::writeFlatOffset()
     int clos = hdfsCloseFile(fs, writeFile);
     fprintf(stderr, "hdfsCloseFile result: %d", clos);
 
-    return EXIT_SUCCESS;
+    int retval = removeStaleSidecars() ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (sidecars)
+    {
+        sidecars->endPart();
+        if (!writeSidecars(sidecars))
+            retval = EXIT_FAILURE;
+        delete sidecars;
+    }
+
+    return retval;
+}
+
+hdfsoutputstream * libhdfsconnector::openOutputStream(const char * relativepath, bool append)
+{
+    string path(fileName);
+    path.append(relativepath);
+
+    //re-opening a file written earlier in this run, e.g. a partition closed to free a stream
+    hdfsFile writeFile = hdfsOpenFile(fs, path.c_str(), append ? O_WRONLY | O_APPEND : O_CREAT | O_WRONLY, 0, 1, 0);
+    if (!writeFile)
+        return NULL;
+
+    fprintf(stderr, "Opened HDFS file %s for %s\n", path.c_str(), append ? "append" : "writing");
+
+    return new libhdfsoutputstream(fs, writeFile, path.c_str());
+}
+
+bool libhdfsconnector::removeOutputFile(const char * relativepath)
+{
+    string path(fileName);
+    path.append(relativepath);
+
+    if (hdfsExists(fs, path.c_str()) != 0)
+        return true;
+
+#ifdef HADOOP_GT_21
+    return hdfsDelete(fs, path.c_str(), 0) == 0;
+#else
+    return hdfsDelete(fs, path.c_str()) == 0;
+#endif
 }
 
 bool libhdfsconnector::connect ()
 {
+    //a daemon worker connects once per request, keep the hdfsFS while it targets the same cluster and user
+    string connection(hadoopHost);
+    connection.append(":").append(template2string(hadoopPort)).append(":").append(hdfsuser);
+    connection.append(":").append(template2string(hedging.isEnabled() ? hedging.getDelayMs() : 0));
+    if (fs && connection == connectedTo)
+        return true;
+
+    if (fs)
+        hdfsDisconnect(fs);
+
     fs = NULL;
+    connectedTo.assign(connection);
+#ifdef HADOOP_GT_21
+    if (hedging.isEnabled())
+    {
+        //DFSClient hedges positional reads against another replica itself once given threads for it
+        struct hdfsBuilder * builder = hdfsNewBuilder();
+        hdfsBuilderSetNameNode(builder, hadoopHost);
+        hdfsBuilderSetNameNodePort(builder, hadoopPort);
+        if (strlen(hdfsuser) > 0)
+            hdfsBuilderSetUserName(builder, hdfsuser);
+        hdfsBuilderConfSetStr(builder, "dfs.client.hedged.read.threadpool.size",
+                template2string(readThreads > 1 ? readThreads : 2).c_str());
+        hdfsBuilderConfSetStr(builder, "dfs.client.hedged.read.threshold.millis",
+                template2string(hedging.getDelayMs()).c_str());
+        fs = hdfsBuilderConnect(builder);
+    }
+    else
+#endif
     if (strlen(hdfsuser) > 0)
         fs = hdfsConnectAsUser(hadoopHost, hadoopPort, hdfsuser);
     else
@@ -940,31 +1361,7 @@ int libhdfsconnector::execute ()
     return returnCode;
 };
 
-int main(int argc, char **argv)
+hdfsconnector * createHdfsConnector()
 {
-    int returnCode = EXIT_FAILURE;
-
-    libhdfsconnector * connector = new libhdfsconnector();
-
-    if (connector)
-    {
-        if (connector->parseInParams(argc, argv))
-        {
-            if (connector->validateParameters())
-            {
-                if (connector->connect())
-                {
-                    returnCode = connector->execute();
-                }
-            }
-
-            if (connector)
-                delete (connector);
-        }
-    }
-    else
-        fprintf(stderr, "\nError: Could not create libhdfs connector");
-
-
-    return returnCode;
+    return new libhdfsconnector();
 }
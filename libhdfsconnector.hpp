@@ -24,6 +24,127 @@
 #include "hdfs.h"
 
 #include "hdfsconnector.hpp"
+#include "hdfsconnectorapi.hpp"
+
+class libhdfsoutputstream : public hdfsoutputstream
+{
+private:
+    hdfsFS fs;
+    hdfsFile file;
+    string path;
+
+public:
+    libhdfsoutputstream(hdfsFS _fs, hdfsFile _file, const char * _path) : fs(_fs), file(_file), path(_path) {}
+
+    ~libhdfsoutputstream()
+    {
+        close();
+    }
+
+    bool write(const char * data, unsigned long length)
+    {
+        while (file && length > 0)
+        {
+            tSize num_written_bytes = hdfsWrite(fs, file, (void*) data, length);
+            if (num_written_bytes <= 0)
+            {
+                fprintf(stderr, "Failed to write to %s\n", path.c_str());
+                return false;
+            }
+            data += num_written_bytes;
+            length -= num_written_bytes;
+        }
+        return file != NULL;
+    }
+
+    bool close()
+    {
+        if (!file)
+            return true;
+
+        int clos = hdfsCloseFile(fs, file);
+        file = NULL;
+        if (clos != 0)
+            fprintf(stderr, "Could not close %s\n", path.c_str());
+        return clos == 0;
+    }
+};
+
+/*
+ * Reads of one file on its own hdfsFile handle, for the threads of a sub-split read.
+ * Positional reads are the ones DFSClient hedges when hedged reads are configured.
+ */
+class libhdfsrangereader : public hdfsrangereader
+{
+private:
+    hdfsFS fs;
+    hdfsFile file;
+    string path;
+    unsigned long position;
+    unsigned long rangeEnd;
+    unsigned maxRetries;
+    ReadRetryStats * retryStats;
+    bool positional;
+
+public:
+    libhdfsrangereader(hdfsFS _fs, const char * _path, unsigned maxretries, ReadRetryStats * retrystats, bool _positional)
+        : fs(_fs), path(_path), position(0), rangeEnd(0), maxRetries(maxretries), retryStats(retrystats),
+          positional(_positional)
+    {
+        file = hdfsOpenFile(fs, path.c_str(), O_RDONLY, 0, 0, 0);
+    }
+
+    ~libhdfsrangereader()
+    {
+        if (file)
+            hdfsCloseFile(fs, file);
+    }
+
+    bool isOpen() const
+    {
+        return file != NULL;
+    }
+
+    bool seek(unsigned long offset, unsigned long length)
+    {
+        position = offset;
+        rangeEnd = offset + length;
+        return file && hdfsSeek(fs, file, offset) == 0;
+    }
+
+    long read(char * buffer, unsigned long length)
+    {
+        readretrypolicy retries(maxRetries, retryStats);
+        while (true)
+        {
+            tSize bytesread = -1;
+            if (file && positional)
+                bytesread = hdfsPread(fs, file, position, buffer, length);
+            else if (file)
+                bytesread = hdfsRead(fs, file, buffer, length);
+
+            if (bytesread >= 0)
+            {
+                position += bytesread;
+                return bytesread;
+            }
+
+            fprintf(stderr, "Error reading %s at %lu\n", path.c_str(), position);
+            if (!retries.retry(rangeEnd > position ? rangeEnd - position : length))
+                return -1;
+
+            //the stream is reopened where the bytes handed out so far end
+            if (file)
+                hdfsCloseFile(fs, file);
+            file = hdfsOpenFile(fs, path.c_str(), O_RDONLY, 0, 0, 0);
+            if (file && hdfsSeek(fs, file, position))
+            {
+                hdfsCloseFile(fs, file);
+                file = NULL;
+            }
+        }
+    }
+};
 
 class libhdfsconnector : public hdfsconnector
 {
@@ -31,10 +152,11 @@ class libhdfsconnector : public hdfsconnector
 private:
 
     hdfsFS fs;
+    string connectedTo;
 
  public:
 
-    libhdfsconnector() : hdfsconnector()
+    libhdfsconnector() : hdfsconnector(), fs(NULL)
     {
             fprintf(stderr, "\nCreating LIBHDFS based connector.\n");
     }
@@ -48,6 +170,8 @@ private:
     hdfsFS getHdfsFS();
     tOffset getBlockSize(const char * filename);
     long getFileSize(const char * filename);
+    tSize resumableRead(const char * filename, hdfsFile & readFile, void * buffer, tSize length, unsigned long remaining,
+            readretrypolicy & retries);
     long getRecordCount(long fsize, int clustersize, int reclen, int nodeid);
     void ouputhosts(const char * rfile);
     void outputFileInfo(hdfsFileInfo * fileInfo);
@@ -68,7 +192,8 @@ private:
             unsigned long recLen,
             unsigned long maxLen,
             const char * quote,
-            int maxretries);
+            int maxretries,
+            bool withinQuote);
 
     int streamFlatFileOffset(
             const char * filename,
@@ -83,9 +208,25 @@ private:
 
     int writeFlatOffset();
 
+    hdfsoutputstream * openOutputStream(const char * relativepath, bool append);
+
+    bool removeOutputFile(const char * relativepath);
+
     int streamFileOffset();
 
+    hdfsrangereader * openRangeReader(const char * path, unsigned long fileSize);
+
+    int listDirectory(const char * path, vector<HdfsPartFile> & parts);
+
+    int readFileToString(const char * path, string & content);
+
+    bool getTargetStatus(SplitPlan & plan);
+
+    bool getFollowStatus(FollowStatus & status);
+    int streamPartFiles(vector<HdfsPartFile> & parts);
+
 private:
+    void getNodePartNames(unsigned node, vector<string> & partnames);
     void getLastXMLElement(string * element, const char * xpath);
     void getLastXPathElement(string * element, const char * xpath);
     void getFirstXPathElement(string * element, const char * xpath);
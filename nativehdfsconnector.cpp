@@ -0,0 +1,493 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#include "nativehdfsconnector.hpp"
+
+bool nativehdfsconnector::getFileStatus(const char * filename, NativeFileStatus & status)
+{
+    bool exists = false;
+    if (!namenode.getFileInfo(filename, status, exists))
+    {
+        fprintf(stderr, "Error: getFileInfo for %s - FAILED!\n", filename);
+        return false;
+    }
+
+    if (!exists)
+        fprintf(stderr, "Error: %s does not exist\n", filename);
+
+    return exists;
+}
+
+long nativehdfsconnector::getRecordCount(long fsize, int clustersize, int reclen, int nodeid)
+{
+    if (reclen <= 0)
+    {
+        fprintf(stderr, "Invalid record length detected (%d)", reclen);
+        return RETURN_FAILURE;
+    }
+
+    long readSize = fsize / reclen / clustersize;
+    if (fsize % reclen)
+    {
+        fprintf(stderr, "filesize (%lu) not multiple of record length(%d)", fsize, reclen);
+        return RETURN_FAILURE;
+    }
+    if ((fsize / reclen) % clustersize >= nodeid + 1)
+    {
+        readSize += 1;
+        fprintf(stderr, "\nThis node will pipe one extra rec\n");
+    }
+    return readSize;
+}
+
+int nativehdfsconnector::streamCSVFileOffset(const char * filename, unsigned long fileSize, unsigned long seekPos,
+        unsigned long readlen, bool outputTerminator, bool withinQuote)
+{
+    fprintf(stderr, "CSV terminator: \'%s\' and quote: \'%s\'\n", terminator.c_str(), quote.c_str());
+
+    //this node streams the records which start before endPos
+    unsigned long endPos = seekPos + readlen;
+    unsigned eolseqlen = terminator.size();
+
+    //read back sizeof(EOL) in case the seekpos happens to be a the first char after an EOL
+    unsigned long currentPos = seekPos > eolseqlen ? seekPos - eolseqlen : 0;
+    bool firstEOLfound = seekPos == 0;
+
+    nativehdfsinputstream input(namenode, filename, fileSize, shortCircuitPath);
+    input.seek(currentPos, endPos - currentPos);
+
+    recordboundarytracker boundaries(0, terminator, quote);
+    boundaries.setWithinQuote(withinQuote);
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    char * buffer = readbuffer.data();
+    string record;
+    unsigned long recsFound = 0;
+    bool done = false;
+
+    fprintf(stderr, "--Start looking: %ld--\n", currentPos);
+
+    while (!done && !isOutputStopped())
+    {
+        long bytesread = input.read(buffer, bufferSize);
+        if (bytesread < 0)
+            return EXIT_FAILURE;
+        if (bytesread == 0)
+            break;
+
+        unsigned long index = 0;
+        while (index < (unsigned long)bytesread)
+        {
+            if (firstEOLfound && boundaries.atRecordBoundary() && currentPos >= endPos)
+            {
+                done = true;
+                break;
+            }
+
+            unsigned long consumed = boundaries.scan(buffer + index, bytesread - index, true);
+            if (firstEOLfound)
+                record.append(buffer + index, consumed);
+
+            index += consumed;
+            currentPos += consumed;
+
+            if (!boundaries.atRecordBoundary())
+                continue;
+
+            if (!firstEOLfound)
+            {
+                fprintf(stderr, "\n--Start reading: %ld--\n", currentPos);
+                firstEOLfound = true;
+                continue;
+            }
+
+            writeOutput(record.data(), outputTerminator ? record.size() : record.size() - eolseqlen);
+            record.clear();
+            recsFound++;
+        }
+
+        if (!firstEOLfound && maxLen > 0 && currentPos > seekPos + maxLen * 10)
+        {
+            fprintf(stderr, "\nFirst EOL was not found within the first %lu bytes", currentPos - seekPos);
+            return EXIT_FAILURE;
+        }
+    }
+
+    //the last record of the file may not be terminated
+    if (record.size() > 0)
+    {
+        writeOutput(record.data(), record.size());
+        recsFound++;
+    }
+
+    fprintf(stderr, "\nCurrentPos: %ld, RecsFound: %ld\n", currentPos, recsFound);
+
+    return EXIT_SUCCESS;
+}
+
+int nativehdfsconnector::streamFlatFileOffset(const char * filename, unsigned long fileSize, unsigned long seekPos,
+        unsigned long readlen)
+{
+    nativehdfsinputstream input(namenode, filename, fileSize, shortCircuitPath);
+    input.seek(seekPos, readlen);
+
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    char * buffer = readbuffer.data();
+    unsigned long currentPos = seekPos;
+
+    fprintf(stderr, "\n--Start piping: %ld--\n", currentPos);
+
+    unsigned long bytesLeft = readlen;
+    while (bytesLeft > 0 && !isOutputStopped())
+    {
+        long bytesread = input.read(buffer, bytesLeft < bufferSize ? bytesLeft : bufferSize);
+        if (bytesread < 0)
+            return EXIT_FAILURE;
+        if (bytesread == 0)
+            break;
+
+        writeOutput(buffer, bytesread);
+        bytesLeft -= bytesread;
+        currentPos += bytesread;
+    }
+
+    fprintf(stderr, "--\nStop Streaming: %ld--\n", currentPos);
+
+    return EXIT_SUCCESS;
+}
+
+int nativehdfsconnector::listDirectory(const char * path, vector<HdfsPartFile> & parts)
+{
+    vector<NativeFileStatus> entries;
+    if (!namenode.getListing(path, entries))
+    {
+        fprintf(stderr, "Error: getListing for %s - FAILED!\n", path);
+        return RETURN_FAILURE;
+    }
+
+    string directory(path);
+    if (directory.size() > 0 && directory[directory.size() - 1] != '/')
+        directory.append("/");
+
+    for (unsigned i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].isDirectory || isHiddenFileName(entries[i].name.c_str()))
+            continue;
+
+        HdfsPartFile part;
+        initPartFile(part, (directory + entries[i].name).c_str(), entries[i].length);
+        parts.push_back(part);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int nativehdfsconnector::readFileToString(const char * path, string & content)
+{
+    NativeFileStatus status;
+    if (!getFileStatus(path, status))
+        return RETURN_FAILURE;
+
+    nativehdfsinputstream input(namenode, path, status.length, shortCircuitPath);
+    input.seek(0, status.length);
+
+    char buffer[124 * 100];
+    long bytesread;
+    while ((bytesread = input.read(buffer, sizeof(buffer))) > 0)
+        content.append(buffer, bytesread);
+
+    return bytesread < 0 ? RETURN_FAILURE : EXIT_SUCCESS;
+}
+
+bool nativehdfsconnector::getTargetStatus(SplitPlan & plan)
+{
+    NativeFileStatus status;
+    if (!getFileStatus(fileName, status))
+        return false;
+
+    plan.isDirectory = status.isDirectory;
+    plan.length = status.length;
+    plan.modificationTime = status.modificationTime;
+
+    return true;
+}
+
+//The NameNode tells whether the file is still being written, and how long its last block is so far
+bool nativehdfsconnector::getFollowStatus(FollowStatus & status)
+{
+    bool underconstruction = false;
+    if (!namenode.getVisibleLength(fileName, status.length, underconstruction))
+        return false;
+
+    status.closeKnown = true;
+    status.closed = !underconstruction;
+    return true;
+}
+
+int nativehdfsconnector::streamPartFiles(vector<HdfsPartFile> & parts)
+{
+
+    rowblockfilter filter;
+    if (loadRowBlockFilter(fileName, filter))
+        skipUnmatchedParts(parts, filter);
+
+    vector<HdfsPartFile> assigned;
+    vector<vector<pair<unsigned long, unsigned long> > > assignedranges;
+    assignPartRanges(parts, filter, assigned, assignedranges);
+
+    fprintf(stderr, "Streaming %lu of %lu file(s) in directory %s\n", (unsigned long)assigned.size(),
+            (unsigned long)parts.size(), fileName);
+
+    int returnCode = EXIT_SUCCESS;
+    for (unsigned i = 0; i < assigned.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); i++)
+    {
+        const char * partpath = assigned[i].path.c_str();
+        fprintf(stderr, "Streaming part %s (%lu bytes)\n", partpath, assigned[i].length);
+
+        //row blocks the sidecars rule out are skipped, the rest is read in record aligned ranges
+        vector<pair<unsigned long, unsigned long> > & ranges = assignedranges[i];
+
+        //samples are drawn, and cached blocks read, by the sub-split readers; ranges start on records so they resync at once
+        if (isSubSplitRead() && (isSampling() || isBlockCached()))
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamSubSplits(partpath, assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            if (!isVariableFlat() && (recLen == 0 || assigned[i].length % recLen))
+            {
+                fprintf(stderr, "filesize (%lu) not multiple of record length(%lu)", assigned[i].length, recLen);
+                returnCode = RETURN_FAILURE;
+            }
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamFlatFileOffset(partpath, assigned[i].length, ranges[r].first, ranges[r].second);
+        }
+        else if (strcmp(format.c_str(), "CSV") == 0)
+        {
+            //ranges start and end on record boundaries, with terminators kept they pass through verbatim
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+            {
+                if (outputTerminator)
+                    returnCode = streamFlatFileOffset(partpath, assigned[i].length, ranges[r].first, ranges[r].second);
+                else
+                    returnCode = streamCSVFileOffset(partpath, assigned[i].length, ranges[r].first, ranges[r].second,
+                            outputTerminator, false);
+            }
+        }
+        else if (strcmp(format.c_str(), "JSON") == 0)
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamJSONLines(partpath, assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else
+        {
+            fprintf(stderr, "Format %s not supported when streaming a directory", format.c_str());
+            returnCode = RETURN_FAILURE;
+        }
+    }
+
+    return returnCode;
+}
+
+int nativehdfsconnector::streamFileOffset()
+{
+    int returnCode = RETURN_FAILURE;
+
+    fprintf(stderr, "\nStreaming in %s...\n", fileName);
+
+    SplitPlan plan;
+    if (!getSplitPlan(plan))
+    {
+        fprintf(stderr, "Could not determine HDFS file size: %s", fileName);
+        return returnCode;
+    }
+
+    //-stream reads only what was appended to the file since its last run
+    if (isIncrementalRead())
+        return streamIngestWindow(fileName, plan);
+
+    //-follow reads a file still being written as it grows
+    if (isFollowRead())
+        return followFile(fileName, plan);
+
+    //a -parts directory, possibly of rolled part files, is streamed as their concatenation
+    if (plan.isDirectory)
+        return streamPartFiles(plan.parts);
+
+    unsigned long fileSize = plan.length;
+    //record starts are only known from the offsets sidecars of a -parts directory, past node 0's
+    if (isVariableFlat())
+    {
+        fprintf(stderr, "No record offsets kept for variable length FLAT file %s, node 0 streams all of it\n", fileName);
+        if (nodeID == 0 && fileSize > 0)
+            returnCode = streamFlatFileOffset(fileName, fileSize, 0, fileSize);
+        else
+            returnCode = EXIT_SUCCESS;
+    }
+    else if (strcmp(format.c_str(), "FLAT") == 0)
+    {
+        long recstoread = getRecordCount(fileSize, clusterCount, recLen, nodeID);
+
+        if (recstoread != RETURN_FAILURE)
+        {
+            unsigned long offset = nodeID * (fileSize / clusterCount / recLen) * recLen;
+
+            if ((fileSize / recLen) % clusterCount > 0)
+            {
+                if ((fileSize / recLen) % clusterCount > nodeID)
+                    offset += nodeID * recLen;
+                else
+                    offset += ((fileSize / recLen) % clusterCount) * recLen;
+            }
+
+            fprintf(stderr, "fileSize: %lu offset: %lu size bytes: %lu, recstoread:%lu\n", fileSize, offset,
+                    recstoread * recLen, recstoread);
+            if (offset < fileSize && isSubSplitRead())
+                returnCode = streamSubSplits(fileName, fileSize, offset, offset + recstoread * recLen);
+            else if (offset < fileSize)
+                returnCode = streamFlatFileOffset(fileName, fileSize, offset, recstoread * recLen);
+            else
+                returnCode = EXIT_SUCCESS;
+        }
+    }
+    else if (strcmp(format.c_str(), "CSV") == 0)
+    {
+        unsigned long offset = (fileSize / clusterCount) * nodeID;
+        unsigned long readlen = nodeID == clusterCount - 1 ? fileSize - offset : fileSize / clusterCount;
+
+        fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize, offset, readlen);
+
+        if (isSubSplitRead())
+            returnCode = streamSubSplits(fileName, fileSize, offset, offset + readlen);
+        else
+            returnCode = streamCSVFileOffset(fileName, fileSize, offset, readlen, outputTerminator,
+                    isShareWithinQuote(fileName, fileSize, offset));
+    }
+    else if (strcmp(format.c_str(), "JSON") == 0)
+        returnCode = streamJSONLines(fileName, fileSize);
+    else
+        fprintf(stderr, "Format %s is not supported by the native HDFS connector", format.c_str());
+
+    return returnCode;
+}
+
+hdfsrangereader * nativehdfsconnector::openRangeReader(const char * path, unsigned long fileSize)
+{
+    nativehdfsrangereader * reader = new nativehdfsrangereader(nameNodeHost.c_str(), nameNodePort, nameNodeUser.c_str(),
+            path, fileSize, shortCircuitPath);
+    if (!reader->isOpen())
+    {
+        delete reader;
+        return NULL;
+    }
+    return reader;
+}
+
+int nativehdfsconnector::mergeFile()
+{
+    fprintf(stderr, "Merging files is not supported by the native HDFS connector.\n");
+    return EXIT_FAILURE;
+}
+
+int nativehdfsconnector::writeFlatOffset()
+{
+    fprintf(stderr, "Writing files is not supported by the native HDFS connector.\n");
+    return EXIT_FAILURE;
+}
+
+hdfsoutputstream * nativehdfsconnector::openOutputStream(const char * relativepath, bool append)
+{
+    fprintf(stderr, "Writing files is not supported by the native HDFS connector.\n");
+    return NULL;
+}
+
+bool nativehdfsconnector::removeOutputFile(const char * relativepath)
+{
+    fprintf(stderr, "Writing files is not supported by the native HDFS connector.\n");
+    return false;
+}
+
+bool nativehdfsconnector::connect ()
+{
+    string host(hadoopHost);
+    if (host.compare(0, 7, "hdfs://") == 0)
+        host.erase(0, 7);
+
+    if (host.size() == 0 || host == "default")
+    {
+        fprintf(stderr, "Error: The native HDFS connector requires the NameNode host (-host)\n");
+        return false;
+    }
+
+    unsigned port = hadoopPort > 0 ? hadoopPort : DEFAULT_NAMENODE_PORT;
+
+    string user(hdfsuser);
+    if (user.size() == 0 && getenv("USER"))
+        user.assign(getenv("USER"));
+    if (user.size() == 0)
+        user.assign("hpcc");
+
+    //a daemon worker connects once per request, keep the connection while it targets the same cluster and user
+    string connection(host);
+    connection.append(":").append(template2string(port)).append(":").append(user);
+    if (namenode.isConnected() && connection == connectedTo)
+        return true;
+
+    connectedTo.assign(connection);
+    nameNodeHost.assign(host);
+    nameNodePort = port;
+    nameNodeUser.assign(user);
+    if (!namenode.connect(host.c_str(), port, user.c_str()))
+    {
+        fprintf(stderr, "Error: Could not connect to the HDFS NameNode on %s:%u\n", host.c_str(), port);
+        return false;
+    }
+    return true;
+};
+
+int nativehdfsconnector::execute ()
+{
+    int returnCode = EXIT_FAILURE;
+
+    if (action == HCA_STREAMIN)
+    {
+       returnCode = streamFileOffset();
+    }
+    else if (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE)
+    {
+        returnCode = writeFlatOffset();
+    }
+    else if (action == HCA_MERGEFILE)
+    {
+        returnCode = mergeFile();
+    }
+    else
+    {
+        fprintf(stderr, "\nNo action type detected, exiting.");
+    }
+    return returnCode;
+};
+
+hdfsconnector * createHdfsConnector()
+{
+    return new nativehdfsconnector();
+}
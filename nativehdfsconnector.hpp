@@ -0,0 +1,135 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <fstream>
+
+#include "hdfsconnector.hpp"
+#include "hdfsnativeclient.hpp"
+#include "hdfsconnectorapi.hpp"
+
+/*
+ * Reads of one file on its own NameNode and DataNode connections, for the threads of a sub-split read.
+ */
+class nativehdfsrangereader : public hdfsrangereader
+{
+private:
+    namenodeclient namenode;
+    nativehdfsinputstream * input;
+
+public:
+    nativehdfsrangereader(const char * host, unsigned port, const char * user, const char * path, unsigned long fileSize,
+            const char * shortcircuitpath)
+        : input(NULL)
+    {
+        if (namenode.connect(host, port, user))
+            input = new nativehdfsinputstream(namenode, path, fileSize, shortcircuitpath);
+    }
+
+    ~nativehdfsrangereader()
+    {
+        delete input;
+    }
+
+    bool isOpen() const
+    {
+        return input != NULL;
+    }
+
+    bool seek(unsigned long offset, unsigned long length)
+    {
+        input->seek(offset, length);
+        return true;
+    }
+
+    long read(char * buffer, unsigned long length)
+    {
+        return input->read(buffer, length);
+    }
+};
+
+/*
+ * Reads HDFS through the NameNode and DataNode wire protocols, without a JVM or libhdfs.
+ * Only the read path is supported, files are written through the webhdfs or libhdfs connector.
+ */
+class nativehdfsconnector : public hdfsconnector
+{
+
+private:
+
+    namenodeclient namenode;
+    string connectedTo;
+    string nameNodeHost;
+    unsigned nameNodePort;
+    string nameNodeUser;
+
+ public:
+
+    nativehdfsconnector() : hdfsconnector(), nameNodePort(0)
+    {
+            fprintf(stderr, "\nCreating native HDFS protocol based connector.\n");
+    }
+
+    ~nativehdfsconnector() {};
+
+    bool getFileStatus(const char * filename, NativeFileStatus & status);
+    long getRecordCount(long fsize, int clustersize, int reclen, int nodeid);
+
+    bool connect ();
+    int  execute ();
+
+    int streamCSVFileOffset(
+            const char * filename,
+            unsigned long fileSize,
+            unsigned long seekPos,
+            unsigned long readlen,
+            bool outputTerminator,
+            bool withinQuote);
+
+    int streamFlatFileOffset(
+            const char * filename,
+            unsigned long fileSize,
+            unsigned long seekPos,
+            unsigned long readlen);
+
+    int mergeFile();
+
+    int writeFlatOffset();
+
+    hdfsoutputstream * openOutputStream(const char * relativepath, bool append);
+
+    bool removeOutputFile(const char * relativepath);
+
+    int streamFileOffset();
+
+    hdfsrangereader * openRangeReader(const char * path, unsigned long fileSize);
+
+    int listDirectory(const char * path, vector<HdfsPartFile> & parts);
+
+    int readFileToString(const char * path, string & content);
+
+    bool getTargetStatus(SplitPlan & plan);
+
+    bool getFollowStatus(FollowStatus & status);
+
+    int streamPartFiles(vector<HdfsPartFile> & parts);
+};
@@ -0,0 +1,740 @@
+/*##############################################################################
+
+ Copyright (C) 2012 HPCC Systems.
+
+ All rights reserved. This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Affero General Public License as
+ published by the Free Software Foundation, either version 3 of the
+ License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU Affero General Public License for more details.
+
+ You should have received a copy of the GNU Affero General Public License
+ along with this program. If not, see <http://www.gnu.org/licenses/>.
+ ############################################################################## */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "hdfsnativeclient.hpp"
+
+/*
+ * The native client against a NameNode and a DataNode mocked in this process: each
+ * speaks just enough of its protocol for the calls the client makes. The file is
+ * split in blocks of TEST_BLOCK_SIZE, each on a replica that refuses connections
+ * and then on the mock DataNode, which also serves them short-circuit from block
+ * and meta files in a temporary directory.
+ */
+#define TEST_BLOCK_SIZE 4096
+#define TEST_BYTES_PER_CHECKSUM 512
+#define TEST_FILE_SIZE 10000
+#define TEST_FIRST_BLOCK_ID 1000
+#define TEST_FILE "/data/file.csv"
+#define TEST_OPEN_FILE "/data/open.csv"
+#define TEST_DIRECTORY "/data/dir"
+#define TEST_DIRECTORY_ENTRIES 3
+
+struct MockCluster
+{
+    std::string data;
+    std::string directory;
+    std::string socketPattern;
+    unsigned nameNodePort;
+    unsigned dataNodePort;
+    unsigned deadPort;
+    volatile long corruptBlock;
+    volatile unsigned long networkReads;
+    volatile unsigned long localReads;
+};
+
+static MockCluster cluster;
+static unsigned failures = 0;
+
+#define CHECK(condition) checkCondition(condition, #condition, __LINE__)
+
+static void checkCondition(bool condition, const char * text, int line)
+{
+    if (condition)
+        return;
+    fprintf(stderr, "FAILED line %d: %s\n", line, text);
+    failures++;
+}
+
+static int listenTcp(unsigned & port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0
+            || getsockname(listener, (struct sockaddr *)&address, &length) != 0)
+    {
+        perror("mock listener");
+        exit(EXIT_FAILURE);
+    }
+    port = ntohs(address.sin_port);
+    return listener;
+}
+
+static void appendFixed(std::string & out, unsigned long long value, unsigned bytes)
+{
+    for (unsigned i = 0; i < bytes; i++)
+        out.append(1, (char)((value >> (8 * i)) & 0xff));
+}
+
+static void writeFileStatus(pbwriter & status, const std::string & name, bool isdirectory, unsigned long length)
+{
+    status.writeUInt64(1, isdirectory ? 1 : 2);
+    status.writeString(2, name);
+    status.writeUInt64(3, length);
+    status.writeUInt64(7, 1700000000000ULL);
+    status.writeUInt64(11, isdirectory ? 0 : TEST_BLOCK_SIZE);
+}
+
+static void writeDatanode(pbwriter & location, const char * ipaddr, const char * hostname, unsigned port)
+{
+    pbwriter id;
+    id.writeString(1, ipaddr);
+    id.writeString(2, hostname);
+    id.writeUInt64(4, port);
+    location.writeMessage(1, id);
+}
+
+static void writeLocatedBlock(pbwriter & located, unsigned long offset)
+{
+    pbwriter extended;
+    extended.writeString(1, "BP-test");
+    extended.writeUInt64(2, TEST_FIRST_BLOCK_ID + offset / TEST_BLOCK_SIZE);
+    extended.writeUInt64(3, 1);
+    extended.writeUInt64(4, std::min((unsigned long)TEST_BLOCK_SIZE, cluster.data.size() - offset));
+
+    //127.0.0.2 is on the loopback but not an address of this host, so the dead replica is not taken as local
+    pbwriter dead;
+    writeDatanode(dead, "127.0.0.2", "deadnode", cluster.deadPort);
+    pbwriter live;
+    writeDatanode(live, "127.0.0.1", "localhost", cluster.dataNodePort);
+
+    located.writeMessage(1, extended);
+    located.writeUInt64(2, offset);
+    located.writeMessage(3, dead);
+    located.writeMessage(3, live);
+    located.writeMessage(5, pbwriter());
+}
+
+static bool answerNameNodeCall(const std::string & method, const std::string & request, pbwriter & response)
+{
+    std::string path;
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+    std::string startafter;
+
+    pbreader reader(request);
+    unsigned field, wiretype;
+    while (reader.next(field, wiretype))
+    {
+        if (field == 1 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            path = reader.readString();
+        else if (field == 2 && wiretype == PB_WIRE_VARINT)
+            offset = reader.readVarint();
+        else if (field == 2 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            startafter = reader.readString();
+        else if (field == 3 && wiretype == PB_WIRE_VARINT)
+            length = reader.readVarint();
+        else
+            reader.skip(wiretype);
+    }
+
+    if (method == "getFileInfo")
+    {
+        pbwriter status;
+        if (path == TEST_FILE || path == TEST_OPEN_FILE)
+            writeFileStatus(status, path.substr(path.rfind('/') + 1), false, cluster.data.size());
+        else if (path == TEST_DIRECTORY)
+            writeFileStatus(status, "dir", true, 0);
+        else
+            return true;
+        response.writeMessage(1, status);
+        return true;
+    }
+
+    if (method == "getListing")
+    {
+        //one entry a call, so the client has to page through the listing
+        std::vector<std::string> rest;
+        for (unsigned i = 0; i < TEST_DIRECTORY_ENTRIES; i++)
+        {
+            char name[32];
+            sprintf(name, "part_%u_%u", i, TEST_DIRECTORY_ENTRIES);
+            if (name > startafter)
+                rest.push_back(name);
+        }
+
+        pbwriter listing;
+        if (rest.size() > 0)
+        {
+            pbwriter status;
+            writeFileStatus(status, rest[0], false, 10);
+            listing.writeMessage(1, status);
+        }
+        listing.writeUInt64(2, rest.size() > 0 ? rest.size() - 1 : 0);
+        response.writeMessage(1, listing);
+        return true;
+    }
+
+    if (method == "getBlockLocations")
+    {
+        pbwriter located;
+        located.writeUInt64(1, cluster.data.size());
+        for (unsigned long block = 0; block < cluster.data.size(); block += TEST_BLOCK_SIZE)
+        {
+            if (block + TEST_BLOCK_SIZE <= offset || block >= offset + length)
+                continue;
+            pbwriter blockmessage;
+            writeLocatedBlock(blockmessage, block);
+            located.writeMessage(2, blockmessage);
+        }
+        located.writeBool(3, path == TEST_OPEN_FILE);
+        response.writeMessage(1, located);
+        return true;
+    }
+
+    return false;
+}
+
+static void * serveNameNode(void * arg)
+{
+    int sock = (int)(long)arg;
+    char preamble[7];
+    if (!readSocket(sock, preamble, sizeof(preamble)) || memcmp(preamble, "hrpc", 4) != 0)
+    {
+        close(sock);
+        return NULL;
+    }
+
+    char lengthbytes[4];
+    while (readSocket(sock, lengthbytes, 4))
+    {
+        std::string packet;
+        packet.resize(getBigEndian(lengthbytes, 4));
+        if (packet.size() > 0 && !readSocket(sock, &packet[0], packet.size()))
+            break;
+
+        size_t pos = 0;
+        std::string rpcheader;
+        readDelimitedField(packet, pos, rpcheader);
+        int callid = 0;
+        pbreader header(rpcheader);
+        unsigned field, wiretype;
+        while (header.next(field, wiretype))
+        {
+            if (field == 3 && wiretype == PB_WIRE_VARINT)
+                callid = header.readSInt32();
+            else
+                header.skip(wiretype);
+        }
+        if (callid == HADOOP_RPC_CONNECTION_CONTEXT_CALL_ID)
+            continue;
+
+        std::string requestheader;
+        std::string request;
+        readDelimitedField(packet, pos, requestheader);
+        readDelimitedField(packet, pos, request);
+        pbreader methodreader(requestheader);
+        std::string method;
+        while (methodreader.next(field, wiretype))
+        {
+            if (field == 1 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+                method = methodreader.readString();
+            else
+                methodreader.skip(wiretype);
+        }
+
+        pbwriter response;
+        bool answered = answerNameNodeCall(method, request, response);
+
+        pbwriter responseheader;
+        responseheader.writeUInt64(1, (unsigned)callid);
+        responseheader.writeUInt64(2, answered ? HADOOP_STATUS_SUCCESS : 1);
+        if (!answered)
+            responseheader.writeString(4, "java.lang.UnsupportedOperationException");
+
+        std::string reply;
+        responseheader.appendDelimited(reply);
+        if (answered)
+            response.appendDelimited(reply);
+        std::string framed;
+        appendBigEndian(framed, reply.size(), 4);
+        framed.append(reply);
+        if (!writeSocket(sock, framed.data(), framed.size()))
+            break;
+    }
+
+    close(sock);
+    return NULL;
+}
+
+//The block id of the ExtendedBlockProto levels deep in field 1 of the request
+static unsigned long long getRequestBlockId(const std::string & message, unsigned levels)
+{
+    pbreader reader(message);
+    unsigned field, wiretype;
+    while (reader.next(field, wiretype))
+    {
+        if (levels > 0 && field == 1 && wiretype == PB_WIRE_LENGTH_DELIMITED)
+            return getRequestBlockId(reader.readString(), levels - 1);
+        else if (levels == 0 && field == 2 && wiretype == PB_WIRE_VARINT)
+            return reader.readVarint();
+        else
+            reader.skip(wiretype);
+    }
+    return 0;
+}
+
+static void getBlockChecksums(const std::string & block, bool corrupt, std::string & checksums)
+{
+    for (size_t chunk = 0; chunk < block.size(); chunk += TEST_BYTES_PER_CHECKSUM)
+    {
+        size_t chunklength = std::min((size_t)TEST_BYTES_PER_CHECKSUM, block.size() - chunk);
+        appendBigEndian(checksums, computeCrc32c(block.data() + chunk, chunklength), 4);
+    }
+    if (corrupt && checksums.size() > 0)
+        checksums[checksums.size() / 2] ^= 0x5a;
+}
+
+static void * serveDataNode(void * arg)
+{
+    int sock = (int)(long)arg;
+    char op[3];
+    std::string request;
+    if (!readSocket(sock, op, sizeof(op)) || getBigEndian(op, 2) != HADOOP_DATA_TRANSFER_VERSION
+            || op[2] != HADOOP_OP_READ_BLOCK || !readSocketDelimited(sock, request))
+    {
+        close(sock);
+        return NULL;
+    }
+
+    unsigned long long offset = 0;
+    unsigned long long length = 0;
+    pbreader reader(request);
+    unsigned field, wiretype;
+    while (reader.next(field, wiretype))
+    {
+        if (field == 2 && wiretype == PB_WIRE_VARINT)
+            offset = reader.readVarint();
+        else if (field == 3 && wiretype == PB_WIRE_VARINT)
+            length = reader.readVarint();
+        else
+            reader.skip(wiretype);
+    }
+
+    //OpReadBlockProto, ClientOperationHeaderProto, BaseHeaderProto
+    long blockindex = (long)(getRequestBlockId(request, 3) - TEST_FIRST_BLOCK_ID);
+    std::string block = cluster.data.substr(std::min(cluster.data.size(), (size_t)blockindex * TEST_BLOCK_SIZE),
+            TEST_BLOCK_SIZE);
+    std::string checksums;
+    getBlockChecksums(block, blockindex == cluster.corruptBlock, checksums);
+    __sync_fetch_and_add(&cluster.networkReads, 1UL);
+
+    pbwriter checksum;
+    checksum.writeUInt64(1, HADOOP_CHECKSUM_CRC32C);
+    checksum.writeUInt64(2, TEST_BYTES_PER_CHECKSUM);
+    pbwriter checksuminfo;
+    checksuminfo.writeMessage(1, checksum);
+    pbwriter response;
+    response.writeUInt64(1, HADOOP_STATUS_SUCCESS);
+    response.writeMessage(4, checksuminfo);
+    std::string reply;
+    response.appendDelimited(reply);
+    writeSocket(sock, reply.data(), reply.size());
+
+    //whole chunks covering the range, two a packet, then an empty last packet
+    unsigned long long position = offset / TEST_BYTES_PER_CHECKSUM * TEST_BYTES_PER_CHECKSUM;
+    unsigned long long end = (offset + length + TEST_BYTES_PER_CHECKSUM - 1) / TEST_BYTES_PER_CHECKSUM * TEST_BYTES_PER_CHECKSUM;
+    end = std::min((unsigned long long)block.size(), end);
+    for (unsigned long long seqno = 0; ; seqno++)
+    {
+        size_t datalength = position < end ? std::min(end - position, 2ULL * TEST_BYTES_PER_CHECKSUM) : 0;
+        size_t firstchunk = position / TEST_BYTES_PER_CHECKSUM;
+        size_t chunks = (datalength + TEST_BYTES_PER_CHECKSUM - 1) / TEST_BYTES_PER_CHECKSUM;
+
+        std::string header;
+        appendVarint(header, (1 << 3) | PB_WIRE_FIXED64);
+        appendFixed(header, position, 8);
+        appendVarint(header, (2 << 3) | PB_WIRE_FIXED64);
+        appendFixed(header, seqno, 8);
+        appendVarint(header, (3 << 3) | PB_WIRE_VARINT);
+        appendVarint(header, datalength == 0 ? 1 : 0);
+        appendVarint(header, (4 << 3) | PB_WIRE_FIXED32);
+        appendFixed(header, datalength, 4);
+
+        std::string packet;
+        appendBigEndian(packet, 4 + chunks * 4 + datalength, 4);
+        appendBigEndian(packet, header.size(), 2);
+        packet.append(header).append(checksums, firstchunk * 4, chunks * 4).append(block, position, datalength);
+        if (!writeSocket(sock, packet.data(), packet.size()) || datalength == 0)
+            break;
+        position += datalength;
+    }
+
+    std::string ack;
+    readSocketDelimited(sock, ack);
+    close(sock);
+    return NULL;
+}
+
+static void getBlockFilePath(unsigned long long blockid, bool meta, std::string & path)
+{
+    char name[64];
+    sprintf(name, "/blk_%llu%s", blockid, meta ? ".meta" : "");
+    path.assign(cluster.directory).append(name);
+}
+
+static void * serveShortCircuit(void * arg)
+{
+    int sock = (int)(long)arg;
+    char op[3];
+    std::string request;
+    if (!readSocket(sock, op, sizeof(op)) || getBigEndian(op, 2) != HADOOP_DATA_TRANSFER_VERSION
+            || op[2] != HADOOP_OP_REQUEST_SHORT_CIRCUIT_FDS || !readSocketDelimited(sock, request))
+    {
+        close(sock);
+        return NULL;
+    }
+
+    //OpRequestShortCircuitAccessProto, BaseHeaderProto
+    unsigned long long blockid = getRequestBlockId(request, 2);
+    std::string blockpath, metapath;
+    getBlockFilePath(blockid, false, blockpath);
+    getBlockFilePath(blockid, true, metapath);
+    int fds[2];
+    fds[0] = open(blockpath.c_str(), O_RDONLY);
+    fds[1] = open(metapath.c_str(), O_RDONLY);
+
+    pbwriter response;
+    response.writeUInt64(1, fds[0] >= 0 && fds[1] >= 0 ? HADOOP_STATUS_SUCCESS : 1);
+    std::string reply;
+    response.appendDelimited(reply);
+    writeSocket(sock, reply.data(), reply.size());
+
+    if (fds[0] >= 0 && fds[1] >= 0)
+    {
+        char byte = 0;
+        struct iovec vector;
+        vector.iov_base = &byte;
+        vector.iov_len = 1;
+        char control[CMSG_SPACE(sizeof(fds))];
+        memset(control, 0, sizeof(control));
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        struct cmsghdr * header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(header), fds, sizeof(fds));
+        if (sendmsg(sock, &message, MSG_NOSIGNAL) == 1)
+            __sync_fetch_and_add(&cluster.localReads, 1UL);
+    }
+
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    close(sock);
+    return NULL;
+}
+
+struct MockServer
+{
+    int listener;
+    void * (*serve)(void *);
+};
+
+static void * acceptConnections(void * arg)
+{
+    MockServer * server = (MockServer *)arg;
+    int connection;
+    while ((connection = accept(server->listener, NULL, NULL)) >= 0)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, server->serve, (void *)(long)connection) == 0)
+            pthread_detach(thread);
+        else
+            close(connection);
+    }
+    return NULL;
+}
+
+static void startServer(MockServer & server)
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, acceptConnections, &server) != 0)
+    {
+        perror("mock server thread");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(thread);
+}
+
+static bool writeFile(const std::string & path, const std::string & content)
+{
+    FILE * file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(content.data(), 1, content.size(), file) == content.size();
+    return fclose(file) == 0 && written;
+}
+
+//The block and meta files the mock DataNode passes for short-circuit reads
+static void writeBlockFiles()
+{
+    for (unsigned long offset = 0; offset < cluster.data.size(); offset += TEST_BLOCK_SIZE)
+    {
+        unsigned long long blockid = TEST_FIRST_BLOCK_ID + offset / TEST_BLOCK_SIZE;
+        std::string block = cluster.data.substr(offset, TEST_BLOCK_SIZE);
+        std::string meta;
+        appendBigEndian(meta, HADOOP_BLOCK_META_VERSION, 2);
+        appendBigEndian(meta, HADOOP_CHECKSUM_CRC32C, 1);
+        appendBigEndian(meta, TEST_BYTES_PER_CHECKSUM, 4);
+        getBlockChecksums(block, false, meta);
+
+        std::string blockpath, metapath;
+        getBlockFilePath(blockid, false, blockpath);
+        getBlockFilePath(blockid, true, metapath);
+        if (!writeFile(blockpath, block) || !writeFile(metapath, meta))
+        {
+            perror("mock block files");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void startCluster()
+{
+    for (unsigned i = 0; i < TEST_FILE_SIZE; i++)
+        cluster.data.append(1, (char)('a' + (i * 7 + i / 13) % 26));
+    cluster.corruptBlock = -1;
+    cluster.networkReads = 0;
+    cluster.localReads = 0;
+
+    char directory[] = "/tmp/h2hnativetestXXXXXX";
+    if (!mkdtemp(directory))
+    {
+        perror("mock directory");
+        exit(EXIT_FAILURE);
+    }
+    cluster.directory.assign(directory);
+    writeBlockFiles();
+
+    //a port nothing listens on, for the replica that is down
+    int dead = listenTcp(cluster.deadPort);
+    close(dead);
+
+    static MockServer namenode;
+    static MockServer datanode;
+    static MockServer shortcircuit;
+    namenode.listener = listenTcp(cluster.nameNodePort);
+    namenode.serve = serveNameNode;
+    datanode.listener = listenTcp(cluster.dataNodePort);
+    datanode.serve = serveDataNode;
+
+    cluster.socketPattern.assign(cluster.directory).append("/dn_socket._PORT");
+    char port[16];
+    sprintf(port, "%u", cluster.dataNodePort);
+    std::string socketpath(cluster.directory);
+    socketpath.append("/dn_socket.").append(port);
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketpath.c_str(), sizeof(address.sun_path) - 1);
+    shortcircuit.listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (shortcircuit.listener < 0 || bind(shortcircuit.listener, (struct sockaddr *)&address, sizeof(address)) != 0
+            || listen(shortcircuit.listener, 16) != 0)
+    {
+        perror("mock domain socket");
+        exit(EXIT_FAILURE);
+    }
+    shortcircuit.serve = serveShortCircuit;
+
+    startServer(namenode);
+    startServer(datanode);
+    startServer(shortcircuit);
+}
+
+static void stopCluster()
+{
+    std::string path;
+    for (unsigned long offset = 0; offset < cluster.data.size(); offset += TEST_BLOCK_SIZE)
+    {
+        getBlockFilePath(TEST_FIRST_BLOCK_ID + offset / TEST_BLOCK_SIZE, false, path);
+        unlink(path.c_str());
+        getBlockFilePath(TEST_FIRST_BLOCK_ID + offset / TEST_BLOCK_SIZE, true, path);
+        unlink(path.c_str());
+    }
+    char port[16];
+    sprintf(port, "%u", cluster.dataNodePort);
+    path.assign(cluster.directory).append("/dn_socket.").append(port);
+    unlink(path.c_str());
+    rmdir(cluster.directory.c_str());
+}
+
+//Reads length bytes from offset in small pieces, returns false on a read error
+static bool readRange(nativehdfsinputstream & input, unsigned long offset, unsigned long length, std::string & content)
+{
+    content.clear();
+    input.seek(offset, length);
+    char buffer[700];
+    while (content.size() < length)
+    {
+        long bytesread = input.read(buffer, std::min((unsigned long)sizeof(buffer), length - content.size()));
+        if (bytesread < 0)
+            return false;
+        if (bytesread == 0)
+            break;
+        content.append(buffer, bytesread);
+    }
+    return true;
+}
+
+static void testNameNodeCalls(namenodeclient & namenode)
+{
+    NativeFileStatus status;
+    bool exists = false;
+    CHECK(namenode.getFileInfo(TEST_FILE, status, exists));
+    CHECK(exists && !status.isDirectory);
+    CHECK(status.length == TEST_FILE_SIZE && status.blockSize == TEST_BLOCK_SIZE);
+    CHECK(status.modificationTime == 1700000000000ULL);
+
+    CHECK(namenode.getFileInfo("/data/missing.csv", status, exists));
+    CHECK(!exists);
+
+    CHECK(namenode.getFileInfo(TEST_DIRECTORY, status, exists));
+    CHECK(exists && status.isDirectory);
+
+    std::vector<NativeFileStatus> entries;
+    CHECK(namenode.getListing(TEST_DIRECTORY, entries));
+    CHECK(entries.size() == TEST_DIRECTORY_ENTRIES);
+    CHECK(entries.size() > 0 && entries[0].name == "part_0_3" && entries.back().name == "part_2_3");
+
+    std::vector<NativeLocatedBlock> blocks;
+    unsigned long filelength = 0;
+    CHECK(namenode.getBlockLocations(TEST_FILE, 5000, 4000, blocks, filelength));
+    CHECK(filelength == TEST_FILE_SIZE);
+    CHECK(blocks.size() == 2);
+    CHECK(blocks.size() == 2 && blocks[0].offset == TEST_BLOCK_SIZE && blocks[1].offset == 2 * TEST_BLOCK_SIZE);
+    CHECK(blocks.size() == 2 && blocks[1].numBytes == TEST_FILE_SIZE - 2 * TEST_BLOCK_SIZE);
+    CHECK(blocks.size() == 2 && blocks[0].locations.size() == 2 && blocks[0].locations[1].xferPort == cluster.dataNodePort);
+
+    unsigned long length = 0;
+    bool underconstruction = false;
+    CHECK(namenode.getVisibleLength(TEST_FILE, length, underconstruction));
+    CHECK(length == TEST_FILE_SIZE && !underconstruction);
+    CHECK(namenode.getVisibleLength(TEST_OPEN_FILE, length, underconstruction));
+    CHECK(underconstruction);
+
+    std::string response;
+    CHECK(!namenode.call("delete", pbwriter(), response));
+    CHECK(namenode.isConnected());
+}
+
+static void testBlockReads(namenodeclient & namenode)
+{
+    nativehdfsinputstream input(namenode, TEST_FILE, TEST_FILE_SIZE);
+    std::string content;
+
+    unsigned long networkreads = cluster.networkReads;
+    CHECK(readRange(input, 0, TEST_FILE_SIZE, content));
+    CHECK(content == cluster.data);
+    CHECK(cluster.networkReads - networkreads == 3);
+
+    //neither end on a chunk boundary, across a block boundary
+    CHECK(readRange(input, 1000, 5000, content));
+    CHECK(content == cluster.data.substr(1000, 5000));
+
+    CHECK(readRange(input, TEST_FILE_SIZE - 10, 100, content));
+    CHECK(content == cluster.data.substr(TEST_FILE_SIZE - 10));
+
+    cluster.corruptBlock = 1;
+    CHECK(!readRange(input, 0, TEST_FILE_SIZE, content));
+    cluster.corruptBlock = -1;
+    CHECK(readRange(input, 0, TEST_FILE_SIZE, content));
+    CHECK(content == cluster.data);
+}
+
+static void testShortCircuitReads(namenodeclient & namenode)
+{
+    nativehdfsinputstream input(namenode, TEST_FILE, TEST_FILE_SIZE, cluster.socketPattern);
+    std::string content;
+
+    unsigned long networkreads = cluster.networkReads;
+    unsigned long localreads = cluster.localReads;
+    CHECK(readRange(input, 0, TEST_FILE_SIZE, content));
+    CHECK(content == cluster.data);
+    CHECK(readRange(input, 1000, 5000, content));
+    CHECK(content == cluster.data.substr(1000, 5000));
+    CHECK(readRange(input, 4100, 3, content));
+    CHECK(content == cluster.data.substr(4100, 3));
+    CHECK(cluster.localReads - localreads == 6);
+    CHECK(cluster.networkReads == networkreads);
+
+    //a block file that no longer matches its meta file is read on through the DataNode
+    std::string blockpath;
+    getBlockFilePath(TEST_FIRST_BLOCK_ID + 1, false, blockpath);
+    std::string damaged = cluster.data.substr(TEST_BLOCK_SIZE, TEST_BLOCK_SIZE);
+    damaged[100] ^= 0x5a;
+    CHECK(writeFile(blockpath, damaged));
+    CHECK(readRange(input, TEST_BLOCK_SIZE, 200, content));
+    CHECK(content == cluster.data.substr(TEST_BLOCK_SIZE, 200));
+    CHECK(cluster.networkReads - networkreads == 1);
+    CHECK(writeFile(blockpath, cluster.data.substr(TEST_BLOCK_SIZE, TEST_BLOCK_SIZE)));
+    networkreads = cluster.networkReads;
+
+    //no domain socket there, so the DataNode serves the reads
+    nativehdfsinputstream fallback(namenode, TEST_FILE, TEST_FILE_SIZE, cluster.directory + "/none._PORT");
+    CHECK(readRange(fallback, 0, TEST_FILE_SIZE, content));
+    CHECK(content == cluster.data);
+    CHECK(cluster.networkReads - networkreads == 3);
+}
+
+int main(int argc, char * argv[])
+{
+    signal(SIGPIPE, SIG_IGN);
+    startCluster();
+
+    namenodeclient namenode;
+    CHECK(namenode.connect("127.0.0.1", cluster.nameNodePort, "tester"));
+    if (namenode.isConnected())
+    {
+        testNameNodeCalls(namenode);
+        testBlockReads(namenode);
+        testShortCircuitReads(namenode);
+    }
+
+    stopCluster();
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%u check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    fprintf(stderr, "All checks passed\n");
+    return EXIT_SUCCESS;
+}
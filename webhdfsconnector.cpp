@@ -61,25 +61,12 @@ int webhdfsconnector::reachWebHDFS()
     return retval;
 }
 
-unsigned long webhdfsconnector::getFileSize(const char * fileurl)
-{
-    HdfsFileStatus filestat;
-
-    if (getFileStatus(fileurl, &filestat) != RETURN_FAILURE)
-        return filestat.length;
-    else
-        return 0;
-}
-
-unsigned long webhdfsconnector::getFileSize()
-{
-    return targetfilestatus.length;
-}
-
 int webhdfsconnector::getFileStatus(const char * fileurl, HdfsFileStatus * filestat)
 {
     int retval = RETURN_FAILURE;
 
+    initFileStatus(*filestat);
+
     if (!curl)
     {
         fprintf(stderr, "Could not connect to WebHDFS\n");
@@ -87,19 +74,9 @@ int webhdfsconnector::getFileStatus(const char * fileurl, HdfsFileStatus * files
     }
 
     string filestatusstr;
-    string requestheader;
-
-    string getFileStatus;
-    getFileStatus.append(fileurl);
 
-    if (hasUserName())
-    {
-        getFileStatus.append("?user.name=");
-        getFileStatus.append(username);
-        getFileStatus.append("&op=GETFILESTATUS");
-    }
-    else
-        getFileStatus.append("?op=GETFILESTATUS");
+    string getFileStatus(fileurl);
+    appendOperation(getFileStatus, "GETFILESTATUS");
 
     curl_easy_reset(curl);
 
@@ -108,61 +85,29 @@ int webhdfsconnector::getFileStatus(const char * fileurl, HdfsFileStatus * files
     curl_easy_setopt(curl, CURLOPT_URL, getFileStatus.c_str());
     curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
-
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &filestatusstr);
 
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
-    curl_easy_setopt(curl, CURLOPT_WRITEHEADER, &requestheader);
-
     CURLcode res = curl_easy_perform(curl);
 
-    if (res == CURLE_OK)
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+    if (res == CURLE_OK && responsecode == 200)
     {
-        try
-        {
-            /*
-             * Not using JSON parser to avoid 3rd party deps
-             */
-
-            filestat->accessTime = -1;
-            filestat->blockSize = -1;
-            filestat->group = "";
-            filestat->length = -1;
-            filestat->modificationTime = -1;
-            filestat->owner = "";
-            filestat->pathSuffix = "";
-            filestat->permission = "";
-            filestat->replication = -1;
-            filestat->type = "";
-
-            fprintf(stderr, "%s.\n", filestatusstr.c_str());
-
-            if (filestatusstr.find("FileStatus") >=0 )
-            {
-                int lenpos = filestatusstr.find("length");
-                if (lenpos >= 0)
-                {
-                    int colpos = filestatusstr.find_first_of(':', lenpos);
-                    if (colpos > lenpos)
-                    {
-                        int compos = filestatusstr.find_first_of(',', colpos);
-                        if (compos > colpos)
-                        {
-                            filestat->length = atol(filestatusstr.substr(colpos+1,compos-1).c_str());
-                        }
-                    }
-                }
-            }
+        fprintf(stderr, "%s.\n", filestatusstr.c_str());
 
+        vector<HdfsFileStatus> statuses;
+        long remainingentries;
+        if (readFileStatuses(filestatusstr, statuses, remainingentries) && statuses.size() == 1)
+        {
+            *filestat = statuses[0];
             retval = EXIT_SUCCESS;
         }
-        catch (...) {}
-
-        if (retval != EXIT_SUCCESS)
+        else
             fprintf(stderr, "Error fetching HDFS file status.\n");
     }
     else
-        fprintf(stderr, "Error fetching HDFS file status. Error code: %d.\n", res);
+        fprintf(stderr, "Error fetching HDFS file status. Error code: %d, HTTP code: %ld.\n", res, responsecode);
     return retval;
 }
 
@@ -177,30 +122,29 @@ int webhdfsconnector::streamFlatFileOffset(unsigned long seekPos, unsigned long
     }
 
     curl_easy_reset(curl);
-    string readfileurl;
-    string requestheader;
-
-    readfileurl.append(targetfileurl).append("?");
-    if (hasUserName())
-        readfileurl.append("user.name=").append(username).append("&");
-
-    readfileurl.append("op=OPEN&offset=");
-    readfileurl.append(template2string(seekPos));
-    readfileurl.append("&length=");
-    readfileurl.append(template2string(readlen));
 
-    fprintf(stderr, "Reading file data: %s\n", readfileurl.c_str());
+    WebHdfsDelivery delivery;
+    delivery.connector = this;
+    delivery.delivered = 0;
 
     CURLcode res;
-    int failed_attempts = 0;
-    double dlsize = 0;
+    string datanode;
+    readretrypolicy retries(maxretries, &readRetryStats);
     double tottime = 0;
     double dlspeed = 0;
 
     do
     {
+        //a failed read resumes where the rows already piped out end, they must not be sent again
+        string readfileurl;
+        getReadUrl(targetfileurl.c_str(), seekPos + delivery.delivered, readlen - delivery.delivered, readfileurl, datanode);
+
+        fprintf(stderr, "Reading file data: %s\n", readfileurl.c_str());
+
         curl_easy_setopt(curl, CURLOPT_URL, readfileurl.c_str());
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToDeliveryCallBackCurl);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &delivery);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
         curl_easy_setopt(curl, CURLOPT_VERBOSE, true);
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
         curl_easy_setopt(curl, CURLOPT_MAXREDIRS, s_libcurlmaxredirs); //Default as reported by libcurl
@@ -213,25 +157,30 @@ int webhdfsconnector::streamFlatFileOffset(unsigned long seekPos, unsigned long
 
         if (res == CURLE_OK)
         {
-            curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &dlsize);
             curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &tottime);
             curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD, &dlspeed);
         }
+        else if (isOutputStopped())
+        {
+            fprintf(stderr, "Output stopped, cancelled the read of %s\n", readfileurl.c_str());
+        }
         else
         {
-            failed_attempts++;
             fprintf(stderr, "Error attempting to read from HDFS file: \n\t%s. Error code %d \n", readfileurl.c_str(), res);
+            if (datanode.size() > 0)
+                dataNodes->markFailed(datanode);
         }
     }
-    while(res != CURLE_OK && failed_attempts <= maxretries);
+    while (res != CURLE_OK && delivery.delivered < readlen && !isOutputStopped()
+            && (datanode.size() > 0 || retries.retry(readlen - delivery.delivered)));
 
-    if (res == CURLE_OK)
+    if (res == CURLE_OK || delivery.delivered == readlen || isOutputStopped())
     {
         retval = EXIT_SUCCESS;
         fprintf(stderr, "\nPipe in FLAT file results:\n");
         fprintf(stderr, "Read time: %.3f secs\t ", tottime);
         fprintf(stderr, "Read speed: %.0f bytes/sec\n", dlspeed);
-        fprintf(stderr, "Read size: %.0f bytes\n", dlsize);
+        fprintf(stderr, "Read size: %lu bytes\n", delivery.delivered);
     }
 
     return retval;
@@ -239,7 +188,7 @@ int webhdfsconnector::streamFlatFileOffset(unsigned long seekPos, unsigned long
 
 int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
         unsigned long readlen, const char * eolseq, unsigned long bufferSize, bool outputTerminator,
-        unsigned long recLen, unsigned long maxLen, const char * quote, int maxretries)
+        unsigned long recLen, unsigned long maxLen, const char * quote, int maxretries, bool withinQuote)
 {
     fprintf(stderr, "CSV terminator: \'%s\' and quote: \'%c\'\n", eolseq, quote[0]);
     unsigned long recsFound = 0;
@@ -248,10 +197,10 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
     if (seekPos > eolseqlen)
         seekPos -= eolseqlen; //read back sizeof(EOL) in case the seekpos happens to be a the first char after an EOL
 
-    bool withinQuote = false;
-
-    string bufferstr ="";
-    bufferstr.resize(bufferSize);
+    pooledbuffer readbuffer(readBuffers);
+    if (!readbuffer.isValid())
+        return EXIT_FAILURE;
+    char * buffer = readbuffer.data();
 
     bool stopAtNextEOL = false;
     bool firstEOLfound = seekPos == 0;
@@ -262,7 +211,8 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
 
     unsigned long bytesLeft = readlen;
 
-    const char * buffer;
+    //the buffered reads below are many small requests, each would otherwise take a NameNode redirect
+    prepareDirectReads(targetfileurl.c_str());
 
     curl_easy_reset(curl);
 
@@ -272,13 +222,11 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
                                                    //however the default seems to be 0 in
                                                    //at least one platform (CentOS), therefore
                                                    //Explicitly setting default to 50.
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &bufferstr);
 
-    while(bytesLeft > 0)
+    while(bytesLeft > 0 && !isOutputStopped())
     {
-        bufferstr.clear();
-        double num_read_bytes = readTargetFileOffsetToBuffer(currentPos, bytesLeft > bufferSize ? bufferSize : bytesLeft, maxretries);
+        double num_read_bytes = readTargetFileOffsetToBuffer(currentPos, bytesLeft > bufferSize ? bufferSize : bytesLeft, maxretries,
+                buffer);
 
         if (num_read_bytes <= 0)
         {
@@ -286,8 +234,6 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
             break;
         }
 
-        buffer = bufferstr.c_str();
-
         for (int bufferIndex = 0; bufferIndex < num_read_bytes; bufferIndex++, currentPos++)
         {
             char currChar = buffer[bufferIndex];
@@ -320,17 +266,16 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
                         //looks like we have to do a remote read, but before we do, let's make sure the substring matches
                         if (strncmp(eolseq, tmpstr.c_str(), tmpstr.size())==0)
                         {
-                            string tmpbuffer = "";
-                            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &tmpbuffer);
+                            char tmpbuffer[16];
                             //TODO have to make a read... of eolseqlen - tmpstr.size is it worth it?
                             //read from the current position scanned on the file (currentPos) + number of char looked ahead for eol (eoli - bufferIndex)
                             //up to the necessary chars to determine if we're currently scanning the EOL sequence (eolseqlen - tmpstr.size()
 
-                            extraNumOfBytesRead = readTargetFileOffsetToBuffer(currentPos + (eoli - bufferIndex), eolseqlen - tmpstr.size(), maxretries);
+                            unsigned long lookahead = eolseqlen - tmpstr.size();
+                            extraNumOfBytesRead = readTargetFileOffsetToBuffer(currentPos + (eoli - bufferIndex),
+                                    lookahead < sizeof(tmpbuffer) ? lookahead : sizeof(tmpbuffer), maxretries, tmpbuffer);
                             for(int y = 0; y < extraNumOfBytesRead; y++)
-                                tmpstr.append(1, tmpbuffer.at(y));
-
-                            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &bufferstr);
+                                tmpstr.append(1, tmpbuffer[y]);
                         }
                     }
 
@@ -354,7 +299,7 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
 
                     if (outputTerminator)
                     {
-                        fprintf(stdout, "%s", eolseq);
+                        writeOutput(eolseq, strlen(eolseq));
 
                         bufferIndex += eolseqlen;
                         currentPos += eolseqlen;
@@ -380,7 +325,7 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
             //don't pipe until we're beyond the first EOL (if offset = 0 start piping ASAP)
             if (firstEOLfound)
             {
-                fprintf(stdout, "%c", currChar);
+                writeOutput(currChar);
                 bytesLeft--;
             }
             else
@@ -399,7 +344,7 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
 
             // If bytesLeft <= 0 at this point, but he haven't encountered
             // the last EOL, need to continue piping untlil EOL is encountered.
-            if (bytesLeft <= 0  && currChar != eolseq[0])
+            if (bytesLeft <= 0  && (currChar != eolseq[0] || withinQuote))
             {
                 if(!firstEOLfound)
                 {
@@ -414,7 +359,8 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
                 }
 
                 fprintf(stderr, "\n--Looking for Last EOL: %ld --\n", currentPos);
-                bytesLeft = maxLen; //not sure how much longer until next EOL read up max record len;
+                //not sure how much longer until next EOL read up max record len, or readlen if unknown;
+                bytesLeft = maxLen > 0 ? maxLen : readlen;
                 stopAtNextEOL = true;
             }
         }
@@ -431,65 +377,159 @@ int webhdfsconnector::streamCSVFileOffset(unsigned long seekPos,
     return EXIT_SUCCESS;
 }
 
-double webhdfsconnector::readTargetFileOffsetToBuffer(unsigned long seekPos, unsigned long readlen, int maxretries)
+double webhdfsconnector::readTargetFileOffsetToBuffer(unsigned long seekPos, unsigned long readlen, int maxretries,
+        char * buffer)
 {
-    double returnval = 0;
-
     if (!curl)
     {
         fprintf(stderr, "Could not connect to WebHDFS");
-        return returnval;
+        return 0;
     }
 
-    char readfileurl [1024];
-    if (hasUserName())
-        sprintf(readfileurl, "%s?user.name=%s&op=OPEN&offset=%lu&length=%lu",targetfileurl.c_str(), username.c_str(), seekPos,readlen);
-    else
-        sprintf(readfileurl, "%s?op=OPEN&offset=%lu&length=%lu",targetfileurl.c_str(), seekPos,readlen);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
 
-    curl_easy_setopt(curl, CURLOPT_URL, readfileurl);
+    unsigned long received = 0;
 
     CURLcode res;
-    int failed_attempts = 0;
+    string datanode;
+    readretrypolicy retries(maxretries, &readRetryStats);
     do
     {
-        res = curl_easy_perform(curl);
+        //bytes a failed attempt did receive are kept, the next one asks for the rest
+        string readfileurl;
+        getReadUrl(targetfileurl.c_str(), seekPos + received, readlen - received, readfileurl, datanode);
 
-        if (res == CURLE_OK)
+        curl_easy_setopt(curl, CURLOPT_URL, readfileurl.c_str());
+
+        CurlSlabBuffer chunk;
+        chunk.data = buffer + received;
+        chunk.capacity = readlen - received;
+        chunk.length = 0;
+        res = performHedgedRead(curl, dataNodes, datanode, &hedging, readBuffers, seekPos + received, readlen - received,
+                chunk);
+        received += chunk.length;
+
+        if (res == CURLE_WRITE_ERROR)
         {
-            double dlsize;
-            curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &dlsize);
-            if (dlsize > readlen)
-                fprintf(stderr, "Warning: received incorrect number of bytes from HDFS.\n");
-            else
-                returnval = dlsize;
+            fprintf(stderr, "Warning: received incorrect number of bytes from HDFS.\n");
+            return 0;
         }
-        else
+
+        if (res != CURLE_OK)
         {
-            failed_attempts++;
-            fprintf(stderr, "Error attempting to read from HDFS file: \n\t%s\n\tError code: %d", readfileurl, res);
+            fprintf(stderr, "Error attempting to read from HDFS file: \n\t%s\n\tError code: %d\n", readfileurl.c_str(), res);
+            if (datanode.size() > 0)
+                dataNodes->markFailed(datanode);
         }
     }
-    while(res != CURLE_OK && failed_attempts <= maxretries);
+    while (res != CURLE_OK && received < readlen && (datanode.size() > 0 || retries.retry(readlen - received)));
+
+    return res == CURLE_OK || received == readlen ? received : 0;
+}
+
+void webhdfsconnector::prepareDirectReads(const char * fileurl)
+{
+    if (!directReads || !curl || dataNodesUrl == fileurl)
+        return;
+
+    delete dataNodes;
+    dataNodes = NULL;
+    dataNodesUrl.assign(fileurl);
+
+    //an OPEN not followed shows the url the DataNodes serve the file under
+    string openurl(fileurl);
+    appendOperation(openurl, "OPEN");
+    openurl.append("&offset=0&length=1");
+
+    string header;
+    string body;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, openurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEHEADER, &header);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+
+    string location;
+    CURLcode res = curl_easy_perform(curl);
+    if (res != CURLE_OK || !getRedirectLocation(header, location))
+    {
+        fprintf(stderr, "No DataNode redirect for %s, reading through the NameNode\n", fileurl);
+        return;
+    }
+
+    //releases before GETFILEBLOCKLOCATIONS, and HttpFS gateways, fail here
+    string locationsurl(fileurl);
+    appendOperation(locationsurl, "GETFILEBLOCKLOCATIONS");
+
+    string json;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, locationsurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &json);
+
+    vector<WebHdfsBlock> blocks;
+    res = curl_easy_perform(curl);
+    if (res != CURLE_OK || !readBlockLocations(json, blocks) || blocks.empty())
+    {
+        fprintf(stderr, "No block locations for %s, reading through the NameNode\n", fileurl);
+        return;
+    }
+
+    dataNodes = new webhdfsdatanodes(location, blocks, nodeID);
+    if (!dataNodes->isUsable())
+    {
+        fprintf(stderr, "Unexpected DataNode redirect %s, reading through the NameNode\n", location.c_str());
+        delete dataNodes;
+        dataNodes = NULL;
+        return;
+    }
+
+    fprintf(stderr, "Reading %s from the DataNodes of its %lu block(s)\n", fileurl, (unsigned long)blocks.size());
+}
 
-    return returnval;
+//A replica's DataNode once prepareDirectReads found them for fileurl, the NameNode otherwise
+void webhdfsconnector::getReadUrl(const char * fileurl, unsigned long offset, unsigned long length, string & url,
+        string & datanode)
+{
+    datanode.clear();
+    if (dataNodes && dataNodesUrl == fileurl && dataNodes->getReadUrl(offset, length, url, datanode))
+        return;
+
+    url.assign(fileurl);
+    appendOperation(url, "OPEN");
+    url.append("&offset=").append(template2string(offset));
+    url.append("&length=").append(template2string(length));
 }
 
 unsigned long webhdfsconnector::getTotalFilePartsSize(unsigned clustercount)
 {
     unsigned long totalSize = 0;
 
+    //one listing of the parts directory rather than a status call per part
+    string partsurl(targetfileurl);
+    partsurl.append("-parts");
+
+    vector<HdfsFileStatus> statuses;
+    if (listStatus(partsurl.c_str(), statuses) != EXIT_SUCCESS)
+        return 0;
+
     for (unsigned node = 0; node < clustercount; node++)
     {
-        char filepartname[1024];
-        memset(&filepartname[0], 0, sizeof(filepartname));
-        sprintf(filepartname,"%s-parts/part_%d_%d", targetfileurl.c_str(), node, clustercount);
+        char partname[64];
+        sprintf(partname, "part_%d_%d", node, clustercount);
 
-        unsigned long partFileSize = getFileSize(filepartname);
+        long partFileSize = 0;
+        for (unsigned i = 0; i < statuses.size(); i++)
+        {
+            if (strcmp(statuses[i].pathSuffix.c_str(), partname) == 0)
+                partFileSize = statuses[i].length;
+        }
 
         if (partFileSize <= 0)
         {
-            fprintf(stderr,"Error: Could not find part file: %s", filepartname);
+            fprintf(stderr,"Error: Could not find part file: %s/%s", partsurl.c_str(), partname);
             return 0;
         }
 
@@ -577,265 +617,1025 @@ unsigned long webhdfsconnector::appendBufferOffset(long blocksize, short replica
     return retval;
 }
 
-bool webhdfsconnector::connect ()
+void webhdfsconnector::appendOperation(string & url, const char * op)
 {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
+    if (hasUserName())
+        url.append("?user.name=").append(username).append("&op=").append(op);
+    else
+        url.append("?op=").append(op);
+}
 
-    if (!curl)
+int webhdfsconnector::createFileFromBuffer(CURL * handle, const char * fileurl, const char * buffer,
+        unsigned long length, unsigned long blocksize)
+{
+    int retval = RETURN_FAILURE;
+
+    string createurl(fileurl);
+    appendOperation(createurl, "CREATE");
+    createurl.append("&overwrite=true&replication=").append(template2string(filereplication));
+    if (blocksize > 0)
+        createurl.append("&blocksize=").append(template2string(blocksize));
+
+    curl_easy_reset(handle);
+
+    string header;
+    string responsebody;
+    curl_easy_setopt(handle, CURLOPT_URL, createurl.c_str());
+    curl_easy_setopt(handle, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE, (curl_off_t)0);
+    curl_easy_setopt(handle, CURLOPT_READFUNCTION, continueCallBackCurl);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, false);
+    curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(handle, CURLOPT_HEADERDATA, &header);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &responsebody);
+
+    CURLcode res = curl_easy_perform(handle);
+
+    string location;
+    if (res != CURLE_OK || !getRedirectLocation(header, location))
     {
-        fprintf(stderr, "Could not connect to WebHDFS\n");
-        return false;
+        fprintf(stderr, "Error setting up file: %s. Curl error code: %d\n", createurl.c_str(), res);
+        return retval;
     }
 
-    baseurl.clear();
-    targetfileurl.clear();
-    hasusername = false;
+    CurlReadBuffer source = {buffer, length, 0};
+    responsebody.clear();
 
-    baseurl.append(hadoopHost);
-    baseurl.append(":");
-    baseurl.append(template2string(hadoopPort));
-    baseurl.append(WEBHDFS_VER_PATH);
+    curl_easy_setopt(handle, CURLOPT_URL, location.c_str());
+    curl_easy_setopt(handle, CURLOPT_READFUNCTION, readMemoryCallBackCurl);
+    curl_easy_setopt(handle, CURLOPT_READDATA, &source);
+    curl_easy_setopt(handle, CURLOPT_INFILESIZE_LARGE, (curl_off_t)length);
 
-    targetfileurl.assign(baseurl.c_str());
-    baseurl.append("/");
-    if (fileName[0] != '/')
-        targetfileurl.append("/");
+    res = curl_easy_perform(handle);
 
-    targetfileurl.append(fileName);
+    long responsecode = 0;
+    curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &responsecode);
 
-    if (strlen(hdfsuser)>0)
-    {
-        username.assign(hdfsuser);
-        hasusername = true;
-    }
+    if (res == CURLE_OK && responsecode == 201)
+        retval = EXIT_SUCCESS;
+    else
+        fprintf(stderr, "Error transferring file: %s. Curl error code: %d, HTTP code: %ld %s\n", fileurl, res,
+                responsecode, responsebody.c_str());
 
-    webhdfsreached = (reachWebHDFS() == EXIT_SUCCESS);
+    return retval;
+}
 
-    if (webhdfsreached)
-        getFileStatus(targetfileurl.c_str(), &targetfilestatus);
+int webhdfsconnector::appendFromBuffer(const char * fileurl, const char * buffer, unsigned long length)
+{
+    int retval = RETURN_FAILURE;
 
-    return webhdfsreached;
-};
+    string appendurl(fileurl);
+    appendOperation(appendurl, "APPEND");
 
-int webhdfsconnector::execute ()
-{
-    int returnCode = EXIT_FAILURE;
+    curl_easy_reset(curl);
 
-    if (action == HCA_STREAMIN)
-    {
-       returnCode = streamFileOffset();
-    }
-    else if (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE)
-    {
-        returnCode = writeFlatOffset();
-    }
-    else if (action == HCA_MERGEFILE)
+    string header;
+    string responsebody;
+    curl_easy_setopt(curl, CURLOPT_URL, appendurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, false);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &header);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responsebody);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    string location;
+    if (res != CURLE_OK || !getRedirectLocation(header, location))
     {
-        returnCode = mergeFile();
+        fprintf(stderr, "Error appending to file: %s. Curl error code: %d\n", appendurl.c_str(), res);
+        return retval;
     }
+
+    CurlReadBuffer source = {buffer, length, 0};
+    responsebody.clear();
+
+    curl_easy_setopt(curl, CURLOPT_URL, location.c_str());
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, NULL);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, readMemoryCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &source);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)length);
+
+    res = curl_easy_perform(curl);
+
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+    if (res == CURLE_OK && responsecode == 200)
+        retval = EXIT_SUCCESS;
     else
-    {
-        fprintf(stderr, "\nNo action type detected, exiting.");
-    }
-    return returnCode;
-};
+        fprintf(stderr, "Error appending to file: %s. Curl error code: %d, HTTP code: %ld %s\n", fileurl, res,
+                responsecode, responsebody.c_str());
 
-int webhdfsconnector::streamInFile(const char * rfile, int bufferSize)
+    return retval;
+}
+
+void webhdfsconnector::getRelativeUrl(const char * relativepath, string & fileurl)
 {
-    return 0;
+    //partition values are %XX escaped, which must be escaped again within the URL
+    fileurl.assign(targetfileurl);
+    for (const char * pathchar = relativepath; *pathchar; pathchar++)
+    {
+        if (*pathchar == '%')
+            fileurl.append("%25");
+        else
+            fileurl.append(1, *pathchar);
+    }
 }
 
-int webhdfsconnector::mergeFile()
+hdfsoutputstream * webhdfsconnector::openOutputStream(const char * relativepath, bool append)
 {
-    fprintf(stderr, "Merging of file parts not supported by WEBHDFS version of HDFSConnector!\n");
-    return RETURN_FAILURE;
+    string fileurl;
+    getRelativeUrl(relativepath, fileurl);
+
+    fprintf(stderr, "Opening HDFS file %s for %s\n", fileurl.c_str(), append ? "append" : "writing");
+
+    return new webhdfsoutputstream(this, fileurl.c_str(), flushThreshold, append);
 }
 
-int webhdfsconnector::writeFlatOffset()
+int webhdfsconnector::deleteFile(const char * fileurl)
 {
+    //curl -i -X DELETE "http://<HOST>:<PORT>/webhdfs/v1/<PATH>?op=DELETE"
+    //a file which is not there is reported as not deleted, with a 200 all the same
     int retval = RETURN_FAILURE;
 
-     if (strlen(pipepath) <= 0)
-     {
-         fprintf(stderr, "Bad data pipe or file name found");
-         return retval;
-     }
-
-     if (!curl)
-     {
-         fprintf(stderr, "Could not connect to WebHDFS");
-         return retval;
-     }
-
-     curl_easy_reset(curl);
-
-     char openfileurl [1024];
-     if (hasUserName())
-         sprintf(openfileurl, "%s-parts/part_%d_%d?user.name=%s&op=CREATE&replication=%d&overwrite=true",targetfileurl.c_str(),nodeID, clusterCount,username.c_str(), 1);
-     else
-         sprintf(openfileurl, "%s-parts/part_%d_%d?op=CREATE&replication=%d&overwrite=true",targetfileurl.c_str(),nodeID, clusterCount, 1);
-
-     _IO_FILE * datafileorpipe;
-     datafileorpipe = fopen(pipepath, "rb");
-
-     fprintf(stderr, "Setting up new HDFS file: %s\n", openfileurl);
-
-     curl_easy_setopt(curl, CURLOPT_READFUNCTION, continueCallBackCurl);
-     curl_easy_setopt(curl, CURLOPT_READDATA, datafileorpipe);
-     curl_easy_setopt(curl, CURLOPT_URL, openfileurl);
-     curl_easy_setopt(curl, CURLOPT_PUT, true);
-     curl_easy_setopt(curl, CURLOPT_VERBOSE, true);
-     curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, false);
-
-     string header;
-     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
-     curl_easy_setopt(curl,   CURLOPT_WRITEHEADER, &header);
-
-     CURLcode res = curl_easy_perform(curl);
-
-     if (res == CURLE_OK)
-     {
-         size_t found;
-         found = header.find_first_of("307 TEMPORARY_REDIRECT");
- //        HTTP/1.1 100 Continue\\r\\n\\r\\nHTTP/1.1 307 TEMPORARY_REDIRECT\\r\\nContent-Type: application/json\\r\\nExpires: Thu, 01-Jan-1970 00:00:00 GMT\\r\\nSet-Cookie: hadoop.auth=\\"u=hadoop&p=hadoop&t=simple&e=1345504538799&s=
-         if (found!=string::npos)
-         {
-             found=header.find("Location:",found+22);
-             if (found!=string::npos)
-             {
-                 size_t  eolfound =header.find(EOL,found);
-                 string tmp = header.substr(found+10,eolfound-(found+10) - strlen(EOL));
-                 fprintf(stderr, "Redirect location: %s\n", tmp.c_str());
-
-                 curl_easy_setopt(curl, CURLOPT_URL, tmp.c_str());
-                 curl_easy_setopt(curl, CURLOPT_UPLOAD, true);
-                 curl_easy_setopt(curl, CURLOPT_READFUNCTION, readFileCallBackCurl);
-                 curl_easy_setopt(curl, CURLOPT_READDATA, datafileorpipe);
-
-                 string errorbody;
-                 curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
-                 curl_easy_setopt(curl,   CURLOPT_WRITEDATA, &errorbody);
-
-                 res = curl_easy_perform(curl);
-                 if (res == CURLE_OK)
-                 {
-                     if (errorbody.length() > 0)
-                         fprintf(stderr, "Error transferring file: %s\n", errorbody.c_str());
-                     else
-                         retval = EXIT_SUCCESS;
-                 }
-                 else
-                 {
-                     fprintf(stderr, "Error transferring file. Curl error code: %d\n", res);
-                 }
-             }
-         }
-     }
-     else
-     {
-         fprintf(stderr, "Error setting up file: %s.\n", openfileurl);
-     }
-
-     return retval;
+    string deleteurl(fileurl);
+    appendOperation(deleteurl, "DELETE");
+
+    curl_easy_reset(curl);
+
+    string responsebody;
+    curl_easy_setopt(curl, CURLOPT_URL, deleteurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responsebody);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+    if (res == CURLE_OK && responsecode == 200)
+        retval = EXIT_SUCCESS;
+    else
+        fprintf(stderr, "Error deleting %s. Curl error code: %d, HTTP code: %ld %s\n", fileurl, res,
+                responsecode, responsebody.c_str());
+
+    return retval;
 }
 
-int webhdfsconnector::streamFileOffset()
+bool webhdfsconnector::removeOutputFile(const char * relativepath)
 {
-    int returnCode = RETURN_FAILURE;
-
-    fprintf(stderr, "\nStreaming in %s...\n", fileName);
+    string fileurl;
+    getRelativeUrl(relativepath, fileurl);
+    return deleteFile(fileurl.c_str()) == EXIT_SUCCESS;
+}
 
-    unsigned long fileSize = getFileSize();
+int webhdfsconnector::concatFiles(const char * targeturl, const char * sources)
+{
+    //curl -i -X POST "http://<HOST>:<PORT>/webhdfs/v1/<PATH>?op=CONCAT&sources=<PATHS>"
+    int retval = RETURN_FAILURE;
 
-    if (fileSize != RETURN_FAILURE)
-    {
-        if (strcmp(format.c_str(), "FLAT") == 0)
-        {
-            unsigned long recstoread = getRecordCount(fileSize, clusterCount, recLen, nodeID);
-            if (recstoread != RETURN_FAILURE)
-            {
-                unsigned long totRecsInFile = fileSize / recLen;
-                unsigned long offset = nodeID * (totRecsInFile / clusterCount) * recLen;
-                unsigned long leftOverRecs = totRecsInFile % clusterCount;
+    string concaturl(targeturl);
+    appendOperation(concaturl, "CONCAT");
+    concaturl.append("&sources=").append(sources);
 
-                if (leftOverRecs > 0)
-                {
-                    if (leftOverRecs > nodeID)
-                        offset += nodeID * recLen;
-                    else
-                        offset += leftOverRecs * recLen;
-                }
+    curl_easy_reset(curl);
 
-                fprintf(stderr, "fileSize: %lu offset: %lu size bytes: %lu, recstoread:%lu\n", fileSize, offset,
-                        recstoread * recLen, recstoread);
+    string responsebody;
+    curl_easy_setopt(curl, CURLOPT_URL, concaturl.c_str());
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responsebody);
 
-                if (offset < fileSize)
-                    returnCode = streamFlatFileOffset(offset, recstoread * recLen, maxRetry);
-            }
-            else
-                fprintf(stderr, "Could not determine number of records to read");
-        }
+    CURLcode res = curl_easy_perform(curl);
 
-        else if (strcmp(format.c_str(), "CSV") == 0)
-        {
-            fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
-                    (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
 
-            returnCode = streamCSVFileOffset((fileSize / clusterCount) * nodeID,
-                    fileSize / clusterCount, terminator.c_str(), bufferSize, outputTerminator, recLen, maxLen,
-                    quote.c_str(), maxRetry);
-        }
-        else
-            fprintf(stderr, "Unknown format type: %s(%s)", format.c_str(), foptions.c_str());
-    }
+    if (res == CURLE_OK && responsecode == 200)
+        retval = EXIT_SUCCESS;
     else
-        fprintf(stderr, "Could not determine HDFS file size: %s", fileName);
+        fprintf(stderr, "Error concatenating into %s. Curl error code: %d, HTTP code: %ld %s\n", targeturl, res,
+                responsecode, responsebody.c_str());
 
-    return returnCode;
+    return retval;
 }
 
-long webhdfsconnector::getRecordCount(long fsize, int clustersize, int reclen, int nodeid)
+int webhdfsconnector::renameFile(const char * fileurl, const char * destination)
 {
-    long readSize = fsize / reclen / clustersize;
-    if (fsize % reclen)
-    {
-        fprintf(stderr, "filesize (%lu) not multiple of record length(%d)", fsize, reclen);
-        return RETURN_FAILURE;
-    }
+    //curl -i -X PUT "http://<HOST>:<PORT>/webhdfs/v1/<PATH>?op=RENAME&destination=<PATH>"
+    //a rename which did not happen, for instance onto an existing file, is a 200 with false
+    int retval = RETURN_FAILURE;
 
-    if ((fsize / reclen) % clustersize > nodeid)
-    {
-        readSize++;
-        fprintf(stderr, "\nThis node will pipe one extra rec\n");
-    }
-    return readSize;
+    string renameurl(fileurl);
+    appendOperation(renameurl, "RENAME");
+    renameurl.append("&destination=").append(destination);
+
+    curl_easy_reset(curl);
+
+    string responsebody;
+    curl_easy_setopt(curl, CURLOPT_URL, renameurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responsebody);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+    if (res == CURLE_OK && responsecode == 200 && responsebody.find("true") != string::npos)
+        retval = EXIT_SUCCESS;
+    else
+        fprintf(stderr, "Error renaming %s to %s. Curl error code: %d, HTTP code: %ld %s\n", fileurl, destination, res,
+                responsecode, responsebody.c_str());
+
+    return retval;
 }
 
-int main(int argc, char **argv)
+static void * uploadSegmentsThread(void * arg)
 {
-    int returnCode = EXIT_FAILURE;
+    WebHdfsSegmentedUpload * upload = (WebHdfsSegmentedUpload *)arg;
+    upload->connector->uploadSegments(upload);
+    return NULL;
+}
 
-    webhdfsconnector * connector = new webhdfsconnector();
+void webhdfsconnector::uploadSegments(WebHdfsSegmentedUpload * upload)
+{
+    CURL * handle = curl_easy_init();
+    char * buffer = (char *)malloc(writeSegmentSize);
 
-    if (connector)
+    if (!handle || !buffer)
     {
-       if (connector->parseInParams(argc, argv))
-       {
-           if (connector->validateParameters())
-           {
-               if (connector->connect())
-               {
-                   returnCode = connector->execute();
-               }
-           }
-
-           if (connector)
-               delete (connector);
-       }
+        fprintf(stderr, "Could not allocate upload stream resources\n");
+        pthread_mutex_lock(&upload->sourceLock);
+        upload->failed = true;
+        pthread_mutex_unlock(&upload->sourceLock);
     }
     else
-        fprintf(stderr, "\nError: Could not create webhdfs connector");
-
-    return returnCode;
+    {
+        while (true)
+        {
+            //Segments are cut from the source in order, uploads proceed concurrently
+            pthread_mutex_lock(&upload->sourceLock);
+            if (upload->sourceExhausted || upload->failed)
+            {
+                pthread_mutex_unlock(&upload->sourceLock);
+                break;
+            }
+
+            unsigned long segment = upload->nextSegment++;
+            size_t length = fread(buffer, 1, writeSegmentSize, upload->source);
+            if (length < writeSegmentSize)
+                upload->sourceExhausted = true;
+
+            if (upload->sidecars)
+                upload->sidecars->observe(buffer, length);
+
+            //an empty trailing segment is not uploaded, but an empty part still is
+            if (length == 0 && segment > 0)
+            {
+                pthread_mutex_unlock(&upload->sourceLock);
+                break;
+            }
+            upload->segmentCount = segment + 1;
+            pthread_mutex_unlock(&upload->sourceLock);
+
+            string segmenturl;
+            createFilePartSegmentName(&segmenturl, targetfileurl.c_str(), nodeID, clusterCount, segment);
+
+            if (createFileFromBuffer(handle, segmenturl.c_str(), buffer, length, writeSegmentSize) != EXIT_SUCCESS)
+            {
+                pthread_mutex_lock(&upload->sourceLock);
+                upload->failed = true;
+                pthread_mutex_unlock(&upload->sourceLock);
+                break;
+            }
+
+            fprintf(stderr, "Uploaded segment %lu (%lu bytes)\n", segment, (unsigned long)length);
+        }
+    }
+
+    if (buffer)
+        free(buffer);
+    if (handle)
+        curl_easy_cleanup(handle);
+}
+
+//Removes the segments of a failed upload from first on, with segment 0 holding those concatenated before
+void webhdfsconnector::removeSegments(unsigned long first, unsigned long count)
+{
+    string headurl;
+    createFilePartSegmentName(&headurl, targetfileurl.c_str(), nodeID, clusterCount, 0);
+    deleteFile(headurl.c_str());
+
+    for (unsigned long segment = first > 0 ? first : 1; segment < count; segment++)
+    {
+        string segmenturl;
+        createFilePartSegmentName(&segmenturl, targetfileurl.c_str(), nodeID, clusterCount, segment);
+        deleteFile(segmenturl.c_str());
+    }
+}
+
+int webhdfsconnector::writeFlatOffsetMultiStream()
+{
+    if (writeSegmentSize == 0)
+    {
+        writeSegmentSize = blockSize > 0 ? blockSize : DEFAULT_WRITE_SEGMENT_SIZE;
+        writeSegmentSize -= writeSegmentSize % HDFS_CHECKSUM_CHUNK_SIZE;
+    }
+
+    fprintf(stderr, "Writing part on %d streams of %lu byte segments\n", writeStreams, writeSegmentSize);
+
+    WebHdfsSegmentedUpload upload;
+    upload.connector = this;
+    upload.source = fopen(pipepath, "rb");
+    upload.sidecars = createSidecarCollector();
+    upload.nextSegment = 0;
+    upload.segmentCount = 0;
+    upload.sourceExhausted = false;
+    upload.failed = false;
+
+    if (!upload.source)
+    {
+        fprintf(stderr, "Could not open data pipe: %s\n", pipepath);
+        delete upload.sidecars;
+        return RETURN_FAILURE;
+    }
+
+    //Stitch the segments onto segment 0 in order, it then replaces the part file
+    string parturl;
+    createFilePartName(&parturl, targetfileurl.c_str(), nodeID, clusterCount);
+    string headurl;
+    createFilePartSegmentName(&headurl, targetfileurl.c_str(), nodeID, clusterCount, 0);
+
+    if (upload.sidecars)
+        upload.sidecars->startPart(getFileNameFromPath(parturl.c_str()));
+
+    pthread_mutex_init(&upload.sourceLock, NULL);
+
+    vector<pthread_t> uploaders;
+    for (unsigned stream = 0; stream < writeStreams; stream++)
+    {
+        pthread_t uploader;
+        if (pthread_create(&uploader, NULL, uploadSegmentsThread, &upload) == 0)
+            uploaders.push_back(uploader);
+        else
+            fprintf(stderr, "Could not start upload stream %d\n", stream);
+    }
+
+    if (uploaders.size() == 0)
+        upload.failed = true;
+
+    for (unsigned stream = 0; stream < uploaders.size(); stream++)
+        pthread_join(uploaders[stream], NULL);
+
+    pthread_mutex_destroy(&upload.sourceLock);
+    fclose(upload.source);
+
+    if (upload.failed)
+    {
+        fprintf(stderr, "Error: could not upload all segments of part %d\n", nodeID);
+        removeSegments(0, upload.segmentCount);
+        delete upload.sidecars;
+        return RETURN_FAILURE;
+    }
+
+    string hdfspath;
+    if (fileName[0] != '/')
+        hdfspath.append("/");
+    hdfspath.append(fileName);
+
+    for (unsigned long segment = 1; segment < upload.segmentCount;)
+    {
+        //a failed concat leaves all of its sources in place
+        unsigned long first = segment;
+        string sources;
+        for (unsigned batched = 0; batched < WEBHDFS_MAX_CONCAT_SOURCES && segment < upload.segmentCount; batched++, segment++)
+        {
+            if (batched > 0)
+                sources.append(",");
+            createFilePartSegmentName(&sources, hdfspath.c_str(), nodeID, clusterCount, segment);
+        }
+
+        if (concatFiles(headurl.c_str(), sources.c_str()) != EXIT_SUCCESS)
+        {
+            removeSegments(first, upload.segmentCount);
+            delete upload.sidecars;
+            return RETURN_FAILURE;
+        }
+    }
+
+    //HDFS does not rename onto an existing file, the part written before goes first
+    string partpath;
+    createFilePartName(&partpath, hdfspath.c_str(), nodeID, clusterCount);
+    if (deleteFile(parturl.c_str()) != EXIT_SUCCESS || renameFile(headurl.c_str(), partpath.c_str()) != EXIT_SUCCESS)
+    {
+        removeSegments(upload.segmentCount, upload.segmentCount);
+        delete upload.sidecars;
+        return RETURN_FAILURE;
+    }
+
+    fprintf(stderr, "Wrote %s from %lu segment(s)\n", parturl.c_str(), upload.segmentCount);
+
+    int retval = removeStaleSidecars() ? EXIT_SUCCESS : RETURN_FAILURE;
+    if (upload.sidecars)
+    {
+        upload.sidecars->endPart();
+        if (!writeSidecars(upload.sidecars))
+            retval = RETURN_FAILURE;
+        delete upload.sidecars;
+    }
+
+    return retval;
+}
+
+bool webhdfsconnector::connect ()
+{
+    //a daemon worker connects once per request, its curl handle and connections stay warm
+    if (!curl)
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        curl = curl_easy_init();
+    }
+
+    if (!curl)
+    {
+        fprintf(stderr, "Could not connect to WebHDFS\n");
+        return false;
+    }
+
+    baseurl.clear();
+    targetfileurl.clear();
+    hasusername = false;
+
+    baseurl.append(hadoopHost);
+    baseurl.append(":");
+    baseurl.append(template2string(hadoopPort));
+    baseurl.append(WEBHDFS_VER_PATH);
+
+    targetfileurl.assign(baseurl.c_str());
+    baseurl.append("/");
+    if (fileName[0] != '/')
+        targetfileurl.append("/");
+
+    targetfileurl.append(fileName);
+
+    if (strlen(hdfsuser)>0)
+    {
+        username.assign(hdfsuser);
+        hasusername = true;
+    }
+
+    targetfilestatus.type = "";
+
+    //block locations are looked up afresh for each request, files may have been rewritten since
+    delete dataNodes;
+    dataNodes = NULL;
+    dataNodesUrl.clear();
+
+    //followers of a shared plan get the target's status from node 0, cached metadata may not need it at all
+    if (isSharedPlanFollower() || isMetadataCached())
+    {
+        webhdfsreached = true;
+        return webhdfsreached;
+    }
+
+    webhdfsreached = (reachWebHDFS() == EXIT_SUCCESS);
+
+    if (webhdfsreached)
+        getFileStatus(targetfileurl.c_str(), &targetfilestatus);
+
+    return webhdfsreached;
+};
+
+int webhdfsconnector::execute ()
+{
+    int returnCode = EXIT_FAILURE;
+
+    if (action == HCA_STREAMIN)
+    {
+       returnCode = streamFileOffset();
+    }
+    else if (action == HCA_STREAMOUT || action == HCA_STREAMOUTPIPE)
+    {
+        returnCode = writeFlatOffset();
+    }
+    else if (action == HCA_MERGEFILE)
+    {
+        returnCode = mergeFile();
+    }
+    else
+    {
+        fprintf(stderr, "\nNo action type detected, exiting.");
+    }
+    return returnCode;
+};
+
+int webhdfsconnector::streamInFile(const char * rfile, int bufferSize)
+{
+    return 0;
+}
+
+int webhdfsconnector::mergeFile()
+{
+    fprintf(stderr, "Merging of file parts not supported by WEBHDFS version of HDFSConnector!\n");
+    return RETURN_FAILURE;
+}
+
+int webhdfsconnector::uploadPart(const char * parturl, WebHdfsPartSource * partsource)
+{
+    int retval = RETURN_FAILURE;
+
+    curl_easy_reset(curl);
+
+    string openfileurl(parturl);
+    appendOperation(openfileurl, "CREATE");
+    openfileurl.append("&replication=1&overwrite=true");
+
+    fprintf(stderr, "Setting up new HDFS file: %s\n", openfileurl.c_str());
+
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, continueCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_READDATA, partsource);
+    curl_easy_setopt(curl, CURLOPT_URL, openfileurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, true);
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, true);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, false);
+
+    string header;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl,   CURLOPT_WRITEHEADER, &header);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    string location;
+    if (res == CURLE_OK && getRedirectLocation(header, location))
+    {
+        fprintf(stderr, "Redirect location: %s\n", location.c_str());
+
+        curl_easy_setopt(curl, CURLOPT_URL, location.c_str());
+        curl_easy_setopt(curl, CURLOPT_UPLOAD, true);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, readPartSourceCallBackCurl);
+        curl_easy_setopt(curl, CURLOPT_READDATA, partsource);
+
+        string errorbody;
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+        curl_easy_setopt(curl,   CURLOPT_WRITEDATA, &errorbody);
+
+        res = curl_easy_perform(curl);
+        if (res == CURLE_OK)
+        {
+            if (errorbody.length() > 0)
+                fprintf(stderr, "Error transferring file: %s\n", errorbody.c_str());
+            else
+                retval = EXIT_SUCCESS;
+        }
+        else
+        {
+            fprintf(stderr, "Error transferring file. Curl error code: %d\n", res);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error setting up file: %s.\n", openfileurl.c_str());
+    }
+
+    return retval;
+}
+
+int webhdfsconnector::writeFlatOffset()
+{
+    int retval = RETURN_FAILURE;
+
+    if (strlen(pipepath) <= 0)
+    {
+        fprintf(stderr, "Bad data pipe or file name found");
+        return retval;
+    }
+
+    if (!curl)
+    {
+        fprintf(stderr, "Could not connect to WebHDFS");
+        return retval;
+    }
+
+    if (isPartitionedWrite())
+        return writePartitionedOffset();
+
+    if (writeStreams > 1)
+    {
+        if (maxPartSize == 0)
+            return writeFlatOffsetMultiStream();
+        fprintf(stderr, "Warning: -writestreams is ignored when rolling parts with -maxpartsize.\n");
+    }
+
+    partroller roller(maxPartSize, strcmp(format.c_str(), "FLAT") == 0 ? recLen : 0, terminator, quote);
+    if (isVariableFlat())
+        roller.setLengthPrefix(lengthPrefixSize, lengthPrefixBigEndian);
+
+    WebHdfsPartSource partsource;
+    partsource.source = fopen(pipepath, "rb");
+    partsource.roller = &roller;
+    partsource.sidecars = createSidecarCollector();
+    partsource.pendingPos = 0;
+    partsource.pendingLen = 0;
+
+    if (!partsource.source)
+    {
+        fprintf(stderr, "Could not open data pipe: %s\n", pipepath);
+        delete partsource.sidecars;
+        return retval;
+    }
+
+    while (true)
+    {
+        string parturl;
+        if (roller.isRolling())
+            createRolledFilePartName(&parturl, targetfileurl.c_str(), nodeID, clusterCount, roller.getPartSequence());
+        else
+            createFilePartName(&parturl, targetfileurl.c_str(), nodeID, clusterCount);
+
+        if (partsource.sidecars)
+            partsource.sidecars->startPart(getFileNameFromPath(parturl.c_str()));
+
+        retval = uploadPart(parturl.c_str(), &partsource);
+
+        if (partsource.sidecars)
+            partsource.sidecars->endPart();
+
+        //the upload of a rolling part ends at the record boundary past -maxpartsize
+        if (retval != EXIT_SUCCESS || !roller.shouldRoll())
+            break;
+
+        roller.rolled();
+
+        if (partsource.pendingPos == partsource.pendingLen)
+        {
+            partsource.pendingLen = fread(partsource.pending, 1, sizeof(partsource.pending), partsource.source);
+            partsource.pendingPos = 0;
+            if (partsource.pendingLen == 0)
+                break;
+        }
+        fprintf(stderr, "Rolling over to part sequence %lu\n", roller.getPartSequence());
+    }
+
+    fclose(partsource.source);
+
+    if (retval == EXIT_SUCCESS && !removeStaleSidecars())
+        retval = RETURN_FAILURE;
+
+    if (partsource.sidecars)
+    {
+        if (retval == EXIT_SUCCESS && !writeSidecars(partsource.sidecars))
+            retval = RETURN_FAILURE;
+        delete partsource.sidecars;
+    }
+
+    return retval;
+}
+
+/*
+ * Lists a directory in LISTSTATUS_BATCH pages, a single request unless it holds more
+ * entries than the NameNode's dfs.ls.limit. NameNodes without batches get a LISTSTATUS.
+ */
+int webhdfsconnector::listStatus(const char * dirurl, vector<HdfsFileStatus> & statuses)
+{
+    string startafter;
+    while (true)
+    {
+        string liststatusurl(dirurl);
+        appendOperation(liststatusurl, listBatchUnsupported ? "LISTSTATUS" : "LISTSTATUS_BATCH");
+        if (!listBatchUnsupported && startafter.size() > 0)
+        {
+            char * escaped = curl_easy_escape(curl, startafter.c_str(), startafter.size());
+            liststatusurl.append("&startAfter=").append(escaped);
+            curl_free(escaped);
+        }
+
+        curl_easy_reset(curl);
+
+        string liststatusstr;
+        curl_easy_setopt(curl, CURLOPT_URL, liststatusurl.c_str());
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &liststatusstr);
+
+        CURLcode res = curl_easy_perform(curl);
+
+        long responsecode = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+        if (res == CURLE_OK && responsecode == 400 && !listBatchUnsupported && startafter.size() == 0)
+        {
+            fprintf(stderr, "LISTSTATUS_BATCH not supported, listing %s in one request\n", dirurl);
+            listBatchUnsupported = true;
+            continue;
+        }
+
+        if (res != CURLE_OK || responsecode != 200)
+        {
+            fprintf(stderr, "Error listing directory: %s. Curl error code: %d, HTTP code: %ld\n", liststatusurl.c_str(),
+                    res, responsecode);
+            return RETURN_FAILURE;
+        }
+
+        size_t listed = statuses.size();
+        long remainingentries = 0;
+        if (!readFileStatuses(liststatusstr, statuses, remainingentries))
+        {
+            fprintf(stderr, "Error parsing directory listing: %s\n", liststatusurl.c_str());
+            return RETURN_FAILURE;
+        }
+
+        if (listBatchUnsupported || remainingentries <= 0 || statuses.size() == listed)
+            return EXIT_SUCCESS;
+
+        startafter.assign(statuses.back().pathSuffix);
+    }
+}
+
+int webhdfsconnector::listDirectory(const char * dirurl, vector<HdfsPartFile> & entries)
+{
+    vector<HdfsFileStatus> statuses;
+    if (listStatus(dirurl, statuses) != EXIT_SUCCESS)
+        return RETURN_FAILURE;
+
+    for (unsigned i = 0; i < statuses.size(); i++)
+    {
+        const char * pathsuffix = statuses[i].pathSuffix.c_str();
+        if (strcmp(statuses[i].type.c_str(), "FILE") == 0 && strlen(pathsuffix) > 0 && !isHiddenFileName(pathsuffix))
+        {
+            string entryurl(dirurl);
+            entryurl.append("/").append(pathsuffix);
+
+            HdfsPartFile part;
+            initPartFile(part, entryurl.c_str(), statuses[i].length);
+            entries.push_back(part);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int webhdfsconnector::readFileToString(const char * fileurl, string & content)
+{
+    string openurl(fileurl);
+    appendOperation(openurl, "OPEN");
+
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, openurl.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, s_libcurlmaxredirs);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeToStrCallBackCurl);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &content);
+
+    CURLcode res = curl_easy_perform(curl);
+
+    long responsecode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responsecode);
+
+    if (res != CURLE_OK || responsecode != 200)
+    {
+        fprintf(stderr, "Error reading file: %s. Curl error code: %d, HTTP code: %ld\n", openurl.c_str(), res, responsecode);
+        return RETURN_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+bool webhdfsconnector::getTargetStatus(SplitPlan & plan)
+{
+    if (targetfilestatus.type.empty() && getFileStatus(targetfileurl.c_str(), &targetfilestatus) == RETURN_FAILURE)
+        return false;
+
+    plan.isDirectory = targetfilestatus.type == "DIRECTORY";
+    plan.length = targetfilestatus.length;
+    plan.modificationTime = targetfilestatus.modificationTime > 0 ? targetfilestatus.modificationTime : 0;
+
+    return true;
+}
+
+//The status kept from connecting is of the file as it was then, a followed file is looked up again
+bool webhdfsconnector::getFollowStatus(FollowStatus & status)
+{
+    HdfsFileStatus filestatus;
+    if (getFileStatus(targetfileurl.c_str(), &filestatus) == RETURN_FAILURE)
+        return false;
+
+    status.length = filestatus.length;
+    status.closeKnown = false;
+    status.closed = false;
+    return true;
+}
+
+const char * webhdfsconnector::getTargetLocation()
+{
+    return targetfileurl.c_str();
+}
+
+int webhdfsconnector::streamPartFiles(vector<HdfsPartFile> & parts)
+{
+
+    rowblockfilter filter;
+    if (loadRowBlockFilter(targetfileurl.c_str(), filter))
+        skipUnmatchedParts(parts, filter);
+
+    vector<HdfsPartFile> assigned;
+    vector<vector<pair<unsigned long, unsigned long> > > assignedranges;
+    assignPartRanges(parts, filter, assigned, assignedranges);
+
+    fprintf(stderr, "Streaming %lu of %lu file(s) in directory %s\n", (unsigned long)assigned.size(),
+            (unsigned long)parts.size(), fileName);
+
+    //The read paths operate on targetfileurl, point it at each assigned part in turn
+    string directoryurl(targetfileurl);
+
+    int returnCode = EXIT_SUCCESS;
+    for (unsigned i = 0; i < assigned.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); i++)
+    {
+        targetfileurl.assign(assigned[i].path);
+        fprintf(stderr, "Streaming part %s (%lu bytes)\n", targetfileurl.c_str(), assigned[i].length);
+
+        if (assigned[i].length == 0)
+            continue;
+
+        //row blocks the sidecars rule out are skipped, the rest is read in record aligned ranges
+        vector<pair<unsigned long, unsigned long> > & ranges = assignedranges[i];
+
+        //samples are drawn, and cached blocks read, by the sub-split readers; ranges start on records so they resync at once
+        if (isSubSplitRead() && (isSampling() || isBlockCached()))
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamSubSplits(targetfileurl.c_str(), assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else if (strcmp(format.c_str(), "FLAT") == 0)
+        {
+            if (!isVariableFlat() && (recLen == 0 || assigned[i].length % recLen))
+            {
+                fprintf(stderr, "filesize (%lu) not multiple of record length(%lu)", assigned[i].length, recLen);
+                returnCode = RETURN_FAILURE;
+            }
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamFlatFileOffset(ranges[r].first, ranges[r].second, maxRetry);
+        }
+        else if (strcmp(format.c_str(), "CSV") == 0)
+        {
+            //ranges start and end on record boundaries, with terminators kept they pass through verbatim
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+            {
+                if (outputTerminator)
+                    returnCode = streamFlatFileOffset(ranges[r].first, ranges[r].second, maxRetry);
+                else
+                    returnCode = streamCSVFileOffset(ranges[r].first, ranges[r].second, terminator.c_str(), bufferSize,
+                            outputTerminator, recLen, maxLen, quote.c_str(), maxRetry, false);
+            }
+        }
+        else if (strcmp(format.c_str(), "JSON") == 0)
+        {
+            for (unsigned r = 0; r < ranges.size() && returnCode == EXIT_SUCCESS && !isOutputStopped(); r++)
+                returnCode = streamJSONLines(targetfileurl.c_str(), assigned[i].length, ranges[r].first, ranges[r].first + ranges[r].second);
+        }
+        else
+        {
+            fprintf(stderr, "Format %s not supported when streaming a directory", format.c_str());
+            returnCode = RETURN_FAILURE;
+        }
+    }
+
+    targetfileurl.assign(directoryurl);
+
+    return returnCode;
+}
+
+int webhdfsconnector::streamFileOffset()
+{
+    int returnCode = RETURN_FAILURE;
+
+    fprintf(stderr, "\nStreaming in %s...\n", fileName);
+
+    SplitPlan plan;
+    if (!getSplitPlan(plan))
+    {
+        fprintf(stderr, "Could not determine HDFS file size: %s", fileName);
+        return returnCode;
+    }
+
+    //-stream reads only what was appended to the file since its last run
+    if (isIncrementalRead())
+        return streamIngestWindow(targetfileurl.c_str(), plan);
+
+    //-follow reads a file still being written as it grows
+    if (isFollowRead())
+        return followFile(targetfileurl.c_str(), plan);
+
+    //a -parts directory, possibly of rolled part files, is streamed as their concatenation
+    if (plan.isDirectory)
+        return streamPartFiles(plan.parts);
+
+    unsigned long fileSize = plan.length;
+
+    //record starts are only known from the offsets sidecars of a -parts directory, past node 0's
+    if (isVariableFlat())
+    {
+        fprintf(stderr, "No record offsets kept for variable length FLAT file %s, node 0 streams all of it\n", fileName);
+        if (nodeID == 0 && fileSize > 0)
+            returnCode = streamFlatFileOffset(0, fileSize, maxRetry);
+        else
+            returnCode = EXIT_SUCCESS;
+    }
+    else if (strcmp(format.c_str(), "FLAT") == 0)
+    {
+        unsigned long recstoread = getRecordCount(fileSize, clusterCount, recLen, nodeID);
+        if (recstoread != RETURN_FAILURE)
+        {
+            unsigned long totRecsInFile = fileSize / recLen;
+            unsigned long offset = nodeID * (totRecsInFile / clusterCount) * recLen;
+            unsigned long leftOverRecs = totRecsInFile % clusterCount;
+
+            if (leftOverRecs > 0)
+            {
+                if (leftOverRecs > nodeID)
+                    offset += nodeID * recLen;
+                else
+                    offset += leftOverRecs * recLen;
+            }
+
+            fprintf(stderr, "fileSize: %lu offset: %lu size bytes: %lu, recstoread:%lu\n", fileSize, offset,
+                    recstoread * recLen, recstoread);
+
+            if (offset < fileSize && isSubSplitRead())
+                returnCode = streamSubSplits(targetfileurl.c_str(), fileSize, offset, offset + recstoread * recLen);
+            else if (offset < fileSize)
+                returnCode = streamFlatFileOffset(offset, recstoread * recLen, maxRetry);
+        }
+        else
+            fprintf(stderr, "Could not determine number of records to read");
+    }
+
+    else if (strcmp(format.c_str(), "CSV") == 0)
+    {
+        fprintf(stderr, "Filesize: %ld, Offset: %ld, readlen: %ld\n", fileSize,
+                (fileSize / clusterCount) * nodeID, fileSize / clusterCount);
+
+        //the records starting within this node's share, the last node's share ends with the file
+        unsigned long offset = (fileSize / clusterCount) * nodeID;
+        if (isSubSplitRead())
+            returnCode = streamSubSplits(targetfileurl.c_str(), fileSize, offset,
+                    nodeID == clusterCount - 1 ? fileSize : offset + fileSize / clusterCount);
+        else
+            returnCode = streamCSVFileOffset(offset,
+                    fileSize / clusterCount, terminator.c_str(), bufferSize, outputTerminator, recLen, maxLen,
+                    quote.c_str(), maxRetry, isShareWithinQuote(targetfileurl.c_str(), fileSize, offset));
+    }
+    else if (strcmp(format.c_str(), "JSON") == 0)
+        returnCode = streamJSONLines(targetfileurl.c_str(), fileSize);
+    else
+        fprintf(stderr, "Unknown format type: %s(%s)", format.c_str(), foptions.c_str());
+
+    return returnCode;
+}
+
+hdfsrangereader * webhdfsconnector::openRangeReader(const char * fileurl, unsigned long fileSize)
+{
+    prepareDirectReads(fileurl);
+
+    rangeBuffers.configure(WEBHDFS_RANGE_READ_SIZE, hugePages);
+
+    webhdfsrangereader * reader = new webhdfsrangereader(fileurl, hasUserName() ? username : string(""), fileSize,
+            s_libcurlmaxredirs, maxRetry, &readRetryStats, dataNodesUrl == fileurl ? dataNodes : NULL, &hedging,
+            rangeBuffers);
+    if (!reader->isOpen())
+    {
+        delete reader;
+        return NULL;
+    }
+    return reader;
+}
+
+long webhdfsconnector::getRecordCount(long fsize, int clustersize, int reclen, int nodeid)
+{
+    long readSize = fsize / reclen / clustersize;
+    if (fsize % reclen)
+    {
+        fprintf(stderr, "filesize (%lu) not multiple of record length(%d)", fsize, reclen);
+        return RETURN_FAILURE;
+    }
+
+    if ((fsize / reclen) % clustersize > nodeid)
+    {
+        readSize++;
+        fprintf(stderr, "\nThis node will pipe one extra rec\n");
+    }
+    return readSize;
+}
+
+hdfsconnector * createHdfsConnector()
+{
+    return new webhdfsconnector();
 }
@@ -18,12 +18,24 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include <sstream>
 #include <curl/curl.h>
 
 #include "hdfsconnector.hpp"
+#include "hdfsjson.hpp"
+#include "hdfsreplicas.hpp"
+#include "hdfsconnectorapi.hpp"
 
 #define WEBHDFS_VER_PATH "/webhdfs/v1"
+#define WEBHDFS_MAX_CONCAT_SOURCES 32
+
+struct CurlReadBuffer
+{
+    const char * data;
+    size_t length;
+    size_t position;
+};
 
 static size_t readStringCallBackCurl(void *ptr, size_t size, size_t nmemb, void *stream)
 {
@@ -53,6 +65,18 @@ static size_t readBufferCallBackCurl(void *ptr, size_t size, size_t nmemb, void
     return retcode;
 }
 
+static size_t readMemoryCallBackCurl(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    CurlReadBuffer * source = (CurlReadBuffer *)stream;
+    size_t remaining = source->length - source->position;
+    size_t tocopy = size * nmemb < remaining ? size * nmemb : remaining;
+
+    memcpy(ptr, source->data + source->position, tocopy);
+    source->position += tocopy;
+
+    return tocopy;
+}
+
 static size_t continueCallBackCurl(void *ptr, size_t size, size_t nmemb, void *stream)
 {
     return 0;
@@ -91,12 +115,700 @@ static size_t writeToStdOutCallBackCurl( void *ptr, size_t size, size_t nmemb, v
     return size*nmemb;
 }
 
+static size_t writeToOutputCallBackCurl( void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    ((hdfsconnector *)stream)->writeOutput((const char *)ptr, size*nmemb);
+    return size*nmemb;
+}
+
+//A read into a pooled slab, bytes beyond its capacity fail the transfer
+struct CurlSlabBuffer
+{
+    char * data;
+    unsigned long capacity;
+    unsigned long length;
+};
+
+static size_t writeToSlabCallBackCurl( void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    CurlSlabBuffer * slab = (CurlSlabBuffer *)stream;
+    size_t received = size*nmemb;
+    if (received > slab->capacity - slab->length)
+        return 0;
+
+    memcpy(slab->data + slab->length, ptr, received);
+    slab->length += received;
+    return received;
+}
+
+//Rows read for stdout, counted so a failed read can resume after them
+struct WebHdfsDelivery
+{
+    hdfsconnector * connector;
+    unsigned long delivered;
+};
+
+static size_t writeToDeliveryCallBackCurl( void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    WebHdfsDelivery * delivery = (WebHdfsDelivery *)stream;
+    delivery->connector->writeOutput((const char *)ptr, size*nmemb);
+    delivery->delivered += size*nmemb;
+
+    //taking less than was received aborts the transfer, nothing more is wanted once the output stopped
+    return delivery->connector->isOutputStopped() ? 0 : size*nmemb;
+}
+
 static size_t writeToStdErrCallBackCurl( void *ptr, size_t size, size_t nmemb, void *stream)
 {
     fprintf(stderr, "%s", (char*)ptr);
     return size*nmemb;
 }
 
+/*
+ * Extracts the Location header of the last response found in the given header block,
+ * WebHDFS answers CREATE/APPEND/OPEN requests with a redirect to the target DataNode.
+ */
+static bool getRedirectLocation(const string & header, string & location)
+{
+    size_t found = header.rfind("\nLocation:");
+    if (found == string::npos)
+        found = header.rfind("\nlocation:");
+    if (found == string::npos)
+        return false;
+
+    found += strlen("\nLocation:");
+    while (found < header.size() && header[found] == ' ')
+        found++;
+
+    size_t eolfound = header.find_first_of("\r\n", found);
+    location.assign(header, found, eolfound == string::npos ? string::npos : eolfound - found);
+
+    return location.size() > 0;
+}
+
+static void initFileStatus(HdfsFileStatus & status)
+{
+    status.accessTime = -1;
+    status.blockSize = -1;
+    status.group = "";
+    status.length = -1;
+    status.modificationTime = -1;
+    status.owner = "";
+    status.pathSuffix = "";
+    status.permission = "";
+    status.replication = -1;
+    status.type = "";
+}
+
+//Reads the fields of a FileStatus object whose opening brace was just read
+static bool readFileStatus(jsonreader & reader, HdfsFileStatus & status)
+{
+    initFileStatus(status);
+
+    JsonToken token;
+    while ((token = reader.next()) == JSON_STRING)
+    {
+        long * longfield = NULL;
+        int * intfield = NULL;
+        string * stringfield = NULL;
+
+        if (reader.tokenEquals("accessTime"))
+            longfield = &status.accessTime;
+        else if (reader.tokenEquals("blockSize"))
+            longfield = &status.blockSize;
+        else if (reader.tokenEquals("group"))
+            stringfield = &status.group;
+        else if (reader.tokenEquals("length"))
+            longfield = &status.length;
+        else if (reader.tokenEquals("modificationTime"))
+            longfield = &status.modificationTime;
+        else if (reader.tokenEquals("owner"))
+            stringfield = &status.owner;
+        else if (reader.tokenEquals("pathSuffix"))
+            stringfield = &status.pathSuffix;
+        else if (reader.tokenEquals("permission"))
+            stringfield = &status.permission;
+        else if (reader.tokenEquals("replication"))
+            intfield = &status.replication;
+        else if (reader.tokenEquals("type"))
+            stringfield = &status.type;
+
+        token = reader.next();
+        if (token == JSON_NUMBER && longfield)
+            *longfield = reader.getLong();
+        else if (token == JSON_NUMBER && intfield)
+            *intfield = (int)reader.getLong();
+        else if (token == JSON_STRING && stringfield)
+            reader.getString(*stringfield);
+        else if (!reader.skipValue(token))
+            return false;
+    }
+
+    return token == JSON_OBJECT_END;
+}
+
+/*
+ * Collects the FileStatus objects of a GETFILESTATUS, LISTSTATUS or LISTSTATUS_BATCH
+ * response, and the number of entries a batch leaves for the next request.
+ */
+static bool readFileStatuses(const string & json, vector<HdfsFileStatus> & statuses, long & remainingentries)
+{
+    jsonreader reader(json.c_str(), json.size());
+    remainingentries = 0;
+
+    JsonToken token;
+    while ((token = reader.next()) != JSON_END)
+    {
+        if (token == JSON_ERROR)
+            return false;
+
+        if (token == JSON_STRING && reader.tokenEquals("FileStatus"))
+        {
+            token = reader.next();
+            bool isArray = token == JSON_ARRAY_START;
+            if (isArray)
+                token = reader.next();
+
+            while (token == JSON_OBJECT_START)
+            {
+                statuses.push_back(HdfsFileStatus());
+                if (!readFileStatus(reader, statuses.back()))
+                    return false;
+                token = isArray ? reader.next() : JSON_ARRAY_END;
+            }
+
+            if (token != JSON_ARRAY_END)
+                return false;
+        }
+        else if (token == JSON_STRING && reader.tokenEquals("remainingEntries"))
+        {
+            if (reader.next() == JSON_NUMBER)
+                remainingentries = reader.getLong();
+        }
+    }
+
+    return true;
+}
+
+struct WebHdfsBlock
+{
+    unsigned long offset;
+    unsigned long length;
+    vector<ReplicaLocation> replicas;
+};
+
+//Reads the replicas of each block from a GETFILEBLOCKLOCATIONS response
+static bool readBlockLocations(const string & json, vector<WebHdfsBlock> & blocks)
+{
+    jsonreader reader(json.c_str(), json.size());
+
+    JsonToken token;
+    while ((token = reader.next()) != JSON_END)
+    {
+        if (token == JSON_ERROR)
+            return false;
+        if (token != JSON_STRING || !reader.tokenEquals("BlockLocation"))
+            continue;
+        if (reader.next() != JSON_ARRAY_START)
+            return false;
+
+        while ((token = reader.next()) == JSON_OBJECT_START)
+        {
+            WebHdfsBlock block;
+            block.offset = 0;
+            block.length = 0;
+            vector<string> hosts;
+            vector<string> topologypaths;
+
+            while ((token = reader.next()) == JSON_STRING)
+            {
+                unsigned long * longfield = NULL;
+                vector<string> * listfield = NULL;
+                if (reader.tokenEquals("offset"))
+                    longfield = &block.offset;
+                else if (reader.tokenEquals("length"))
+                    longfield = &block.length;
+                else if (reader.tokenEquals("hosts"))
+                    listfield = &hosts;
+                else if (reader.tokenEquals("topologyPaths"))
+                    listfield = &topologypaths;
+
+                token = reader.next();
+                if (longfield && token == JSON_NUMBER)
+                    *longfield = reader.getLong();
+                else if (listfield && token == JSON_ARRAY_START)
+                {
+                    while ((token = reader.next()) == JSON_STRING)
+                    {
+                        listfield->push_back("");
+                        reader.getString(listfield->back());
+                    }
+                    if (token != JSON_ARRAY_END)
+                        return false;
+                }
+                else if (!reader.skipValue(token))
+                    return false;
+            }
+            if (token != JSON_OBJECT_END)
+                return false;
+
+            //topologyPaths lists the racks of the hosts in the same order
+            for (unsigned i = 0; i < hosts.size(); i++)
+            {
+                ReplicaLocation replica;
+                replica.host = hosts[i];
+                if (i < topologypaths.size())
+                    getTopologyRack(topologypaths[i], replica.rack);
+                block.replicas.push_back(replica);
+            }
+            blocks.push_back(block);
+        }
+        if (token != JSON_ARRAY_END)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Read urls pointing straight at a DataNode holding the block read, rather than
+ * at the NameNode for a redirect per request. The url a DataNode serves the file
+ * under is learnt from one redirect, the other DataNodes are taken to serve
+ * WebHDFS on the same port. Hosts a read failed on are not picked again.
+ */
+class webhdfsdatanodes
+{
+private:
+    pthread_mutex_t lock;
+    string scheme;
+    string pathAndQuery;
+    vector<WebHdfsBlock> blocks;
+    vector<string> localNames;
+    string localRack;
+    vector<string> failedHosts;
+    unsigned rotation;
+
+    bool isFailed(const string & host)
+    {
+        for (unsigned i = 0; i < failedHosts.size(); i++)
+        {
+            if (failedHosts[i] == host)
+                return true;
+        }
+        return false;
+    }
+
+    //Drops the offset, length and noredirect parameters, each read sets its own
+    void stripReadParameters(string & query)
+    {
+        string kept;
+        size_t start = 0;
+        while (start < query.size())
+        {
+            size_t end = query.find('&', start);
+            if (end == string::npos)
+                end = query.size();
+            string parameter(query, start, end - start);
+            if (parameter.compare(0, 7, "offset=") != 0 && parameter.compare(0, 7, "length=") != 0
+                    && parameter.compare(0, 11, "noredirect=") != 0 && parameter.size() > 0)
+                kept.append(kept.empty() ? "" : "&").append(parameter);
+            start = end + 1;
+        }
+        query.assign(kept);
+    }
+
+public:
+    webhdfsdatanodes(const string & redirect, const vector<WebHdfsBlock> & _blocks, unsigned _rotation)
+        : blocks(_blocks), rotation(_rotation)
+    {
+        pthread_mutex_init(&lock, NULL);
+
+        //http://datanode:port/webhdfs/v1/path?op=OPEN&namenoderpcaddress=...&offset=0
+        size_t hoststart = redirect.find("://");
+        size_t querystart = redirect.find('?');
+        if (hoststart != string::npos && querystart != string::npos)
+        {
+            hoststart += 3;
+            size_t hostend = redirect.find_first_of(":/", hoststart);
+            if (hostend != string::npos && hostend < querystart)
+            {
+                scheme.assign(redirect, 0, hoststart);
+                string query(redirect, querystart + 1, string::npos);
+                stripReadParameters(query);
+                pathAndQuery.assign(redirect, hostend, querystart + 1 - hostend).append(query);
+            }
+        }
+
+        getLocalHostNames(localNames);
+        for (unsigned b = 0; b < blocks.size() && localRack.empty(); b++)
+        {
+            for (unsigned r = 0; r < blocks[b].replicas.size() && localRack.empty(); r++)
+            {
+                if (isLocalHost(localNames, blocks[b].replicas[r].host))
+                    localRack.assign(blocks[b].replicas[r].rack);
+            }
+        }
+    }
+
+    ~webhdfsdatanodes()
+    {
+        pthread_mutex_destroy(&lock);
+    }
+
+    bool isUsable() const
+    {
+        return scheme.size() > 0;
+    }
+
+    //Returns false when no replica of the block holding offset is left to read from
+    bool getReadUrl(unsigned long offset, unsigned long length, string & url, string & host)
+    {
+        return getReplicaUrl(offset, length, "", url, host);
+    }
+
+    //A replica other than the one avoided, for a second request of the same range
+    bool getHedgeUrl(unsigned long offset, unsigned long length, const string & avoid, string & url, string & host)
+    {
+        return getReplicaUrl(offset, length, avoid, url, host);
+    }
+
+    bool getReplicaUrl(unsigned long offset, unsigned long length, const string & avoid, string & url, string & host)
+    {
+        bool found = false;
+
+        pthread_mutex_lock(&lock);
+        for (unsigned b = 0; b < blocks.size(); b++)
+        {
+            if (offset < blocks[b].offset || offset - blocks[b].offset >= blocks[b].length)
+                continue;
+
+            vector<unsigned> order;
+            orderReplicas(blocks[b].replicas, localNames, localRack, rotation + b, order);
+            for (unsigned i = 0; i < order.size() && !found; i++)
+            {
+                const string & candidate = blocks[b].replicas[order[i]].host;
+                if (candidate != avoid && !isFailed(candidate))
+                {
+                    host.assign(candidate);
+                    found = true;
+                }
+            }
+            break;
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (found)
+        {
+            url.assign(scheme).append(host).append(pathAndQuery);
+            url.append("&offset=").append(template2string(offset)).append("&length=").append(template2string(length));
+        }
+        return found;
+    }
+
+    void markFailed(const string & host)
+    {
+        pthread_mutex_lock(&lock);
+        if (!isFailed(host))
+        {
+            failedHosts.push_back(host);
+            fprintf(stderr, "Not reading from DataNode %s again\n", host.c_str());
+        }
+        pthread_mutex_unlock(&lock);
+    }
+};
+
+/*
+ * Reads a range with handle, set up for its primary url, into data. Once the read
+ * falls behind the node's usual reads a copy of handle asks another replica for the
+ * same range, into a slab of buffers, and whichever finishes first fills data.
+ */
+static CURLcode performHedgedRead(CURL * handle, webhdfsdatanodes * datanodes, const string & datanode,
+        hedgepolicy * hedging, hdfsbufferpool & buffers, unsigned long offset, unsigned long length, CurlSlabBuffer & data)
+{
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeToSlabCallBackCurl);
+    curl_easy_setopt(handle, CURLOPT_WRITEDATA, &data);
+
+    if (!hedging->isEnabled())
+        return curl_easy_perform(handle);
+
+    CURLM * multi = curl_multi_init();
+    if (!multi)
+        return curl_easy_perform(handle);
+    curl_multi_add_handle(multi, handle);
+
+    struct timeval start;
+    gettimeofday(&start, NULL);
+
+    CURL * hedge = NULL;
+    pooledbuffer hedgeslab(buffers);
+    CurlSlabBuffer hedgedata;
+    hedgedata.data = hedgeslab.data();
+    hedgedata.capacity = hedgeslab.isValid() ? hedgeslab.size() : 0;
+    hedgedata.length = 0;
+    CURLcode primaryres = CURLE_OK;
+    CURLcode hedgeres = CURLE_OK;
+    bool primarydone = false;
+    bool hedgedone = false;
+    double firstbytems = -1;
+
+    while (true)
+    {
+        int running = 0;
+        curl_multi_perform(multi, &running);
+
+        CURLMsg * message;
+        int queued;
+        while ((message = curl_multi_info_read(multi, &queued)) != NULL)
+        {
+            if (message->msg != CURLMSG_DONE)
+                continue;
+            if (message->easy_handle == handle)
+            {
+                primarydone = true;
+                primaryres = message->data.result;
+            }
+            else
+            {
+                hedgedone = true;
+                hedgeres = message->data.result;
+            }
+        }
+
+        double elapsedms = getElapsedMs(start);
+        if (firstbytems < 0 && data.length > 0)
+            firstbytems = elapsedms;
+
+        //the first to finish well wins, a failed one leaves the other to finish
+        if ((primarydone && primaryres == CURLE_OK) || (hedgedone && hedgeres == CURLE_OK))
+            break;
+        if (primarydone && (!hedge || hedgedone))
+            break;
+
+        string hedgeurl;
+        string hedgehost;
+        if (!hedge && !primarydone && datanodes && datanode.size() > 0 && hedgedata.capacity >= length
+                && hedging->shouldHedge(elapsedms, firstbytems, length)
+                && datanodes->getHedgeUrl(offset, length, datanode, hedgeurl, hedgehost))
+        {
+            hedge = curl_easy_duphandle(handle);
+            if (hedge)
+            {
+                fprintf(stderr, "Read of %lu bytes at %lu from %s is slow, also asking %s\n", length, offset,
+                        datanode.c_str(), hedgehost.c_str());
+                curl_easy_setopt(hedge, CURLOPT_URL, hedgeurl.c_str());
+                curl_easy_setopt(hedge, CURLOPT_WRITEDATA, &hedgedata);
+                curl_multi_add_handle(multi, hedge);
+            }
+        }
+
+        curl_multi_wait(multi, NULL, 0, 10, NULL);
+    }
+
+    bool hedgewon = hedgedone && hedgeres == CURLE_OK && !(primarydone && primaryres == CURLE_OK);
+    double totalms = getElapsedMs(start);
+
+    curl_multi_remove_handle(multi, handle);
+    if (hedge)
+    {
+        curl_multi_remove_handle(multi, hedge);
+        curl_easy_cleanup(hedge);
+        hedging->recordHedge(hedgewon);
+    }
+    curl_multi_cleanup(multi);
+
+    if (hedgewon)
+    {
+        memcpy(data.data, hedgedata.data, hedgedata.length);
+        data.length = hedgedata.length;
+        return CURLE_OK;
+    }
+
+    if (primaryres == CURLE_OK && !hedge)
+        hedging->recordRead(firstbytems, totalms, data.length);
+    return primaryres;
+}
+
+/*
+ * Reads of one file on its own curl handle, for the threads of a sub-split read.
+ * Each request fetches as much of the rest of the positioned range as a range
+ * buffer holds, then tail sized pieces.
+ */
+#define WEBHDFS_RANGE_READ_SIZE (4 * 1024 * 1024)
+#define WEBHDFS_TAIL_READ_SIZE (1024 * 1024)
+
+class webhdfsrangereader : public hdfsrangereader
+{
+private:
+    CURL * curl;
+    string fileurl;
+    hdfsbufferpool & buffers;
+    pooledbuffer slab;
+    CurlSlabBuffer data;
+    size_t dataPos;
+    unsigned long position;
+    unsigned long hintEnd;
+    unsigned long fileSize;
+    int maxRetries;
+    ReadRetryStats * retryStats;
+    webhdfsdatanodes * dataNodes;
+    hedgepolicy * hedging;
+
+public:
+    webhdfsrangereader(const string & targetfileurl, const string & username, unsigned long filesize, long maxredirs,
+            int maxretries, ReadRetryStats * retrystats, webhdfsdatanodes * datanodes, hedgepolicy * _hedging,
+            hdfsbufferpool & _buffers) : buffers(_buffers), slab(_buffers), dataPos(0), position(0), hintEnd(0),
+            fileSize(filesize), maxRetries(maxretries), retryStats(retrystats), dataNodes(datanodes), hedging(_hedging)
+    {
+        data.data = slab.data();
+        data.capacity = slab.isValid() ? slab.size() : 0;
+        data.length = 0;
+
+        fileurl.assign(targetfileurl).append("?");
+        if (username.size() > 0)
+            fileurl.append("user.name=").append(username).append("&");
+        fileurl.append("op=OPEN");
+
+        curl = curl_easy_init();
+        if (curl)
+        {
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, true);
+            curl_easy_setopt(curl, CURLOPT_MAXREDIRS, maxredirs);
+            curl_easy_setopt(curl, CURLOPT_FAILONERROR, true);
+            curl_easy_setopt(curl, CURLOPT_NOSIGNAL, true);
+        }
+    }
+
+    ~webhdfsrangereader()
+    {
+        if (curl)
+            curl_easy_cleanup(curl);
+    }
+
+    bool isOpen() const
+    {
+        return curl != NULL && slab.isValid();
+    }
+
+    bool seek(unsigned long offset, unsigned long length)
+    {
+        position = offset;
+        hintEnd = offset + length;
+        data.length = 0;
+        dataPos = 0;
+        return true;
+    }
+
+    long read(char * buffer, unsigned long length)
+    {
+        if (dataPos == data.length)
+        {
+            if (position >= fileSize)
+                return 0;
+
+            unsigned long fetch = hintEnd > position ? hintEnd - position : WEBHDFS_TAIL_READ_SIZE;
+            if (fetch > data.capacity)
+                fetch = data.capacity;
+            if (fetch > fileSize - position)
+                fetch = fileSize - position;
+
+            //whatever a failed request did receive is handed out, the next read resumes after it
+            CURLcode res;
+            string datanode;
+            readretrypolicy retries(maxRetries, retryStats);
+            do
+            {
+                string url;
+                datanode.clear();
+                if (!dataNodes || !dataNodes->getReadUrl(position, fetch, url, datanode))
+                {
+                    url.assign(fileurl);
+                    url.append("&offset=").append(template2string(position)).append("&length=").append(template2string(fetch));
+                }
+                curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+
+                data.length = 0;
+                res = performHedgedRead(curl, dataNodes, datanode, hedging, buffers, position, fetch, data);
+                if (res != CURLE_OK)
+                {
+                    fprintf(stderr, "Error attempting to read from HDFS file: \n\t%s. Error code %d \n", url.c_str(), res);
+                    if (datanode.size() > 0)
+                        dataNodes->markFailed(datanode);
+                }
+            }
+            //a DataNode failing moves the read on to another replica, or the NameNode, without waiting
+            while (res != CURLE_OK && data.length == 0 && (datanode.size() > 0 || retries.retry(fetch)));
+
+            dataPos = 0;
+            if (data.length == 0)
+                return -1;
+        }
+
+        unsigned long available = data.length - dataPos;
+        if (available > length)
+            available = length;
+        memcpy(buffer, data.data + dataPos, available);
+        dataPos += available;
+        position += available;
+        return available;
+    }
+};
+
+class webhdfsconnector;
+
+/*
+ * Feeds a part upload from the data pipe, ending it where the part roller
+ * decides to roll over to the next part file.
+ */
+struct WebHdfsPartSource
+{
+    FILE * source;
+    partroller * roller;
+    rowblockcollector * sidecars;
+    char pending[124 * 100];
+    size_t pendingPos;
+    size_t pendingLen;
+};
+
+static size_t readPartSourceCallBackCurl(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    WebHdfsPartSource * partsource = (WebHdfsPartSource *)stream;
+
+    if (partsource->roller->shouldRoll())
+        return 0;
+
+    if (partsource->pendingPos == partsource->pendingLen)
+    {
+        partsource->pendingLen = fread(partsource->pending, 1, sizeof(partsource->pending), partsource->source);
+        partsource->pendingPos = 0;
+        if (partsource->pendingLen == 0)
+            return 0;
+    }
+
+    size_t available = partsource->pendingLen - partsource->pendingPos;
+    if (available > size * nmemb)
+        available = size * nmemb;
+
+    size_t piece = partsource->roller->nextPiece(partsource->pending + partsource->pendingPos, available);
+    memcpy(ptr, partsource->pending + partsource->pendingPos, piece);
+    partsource->pendingPos += piece;
+
+    if (partsource->sidecars)
+        partsource->sidecars->observe((const char *)ptr, piece);
+
+    return piece;
+}
+
+struct WebHdfsSegmentedUpload
+{
+    webhdfsconnector * connector;
+    FILE * source;
+    rowblockcollector * sidecars;
+    pthread_mutex_t sourceLock;
+    unsigned long nextSegment;
+    unsigned long segmentCount;
+    bool sourceExhausted;
+    bool failed;
+};
+
 class webhdfsconnector : public hdfsconnector
 {
 private:
@@ -105,6 +817,10 @@ private:
     string username;
     bool hasusername;
     bool webhdfsreached;
+    bool listBatchUnsupported;
+    webhdfsdatanodes * dataNodes;
+    string dataNodesUrl;
+    hdfsbufferpool rangeBuffers;
     CURL *curl;
     const static short s_libcurlmaxredirs = 50;
 
@@ -112,14 +828,16 @@ private:
 
 public:
 
-    webhdfsconnector() : hdfsconnector()
+    webhdfsconnector() : hdfsconnector(), listBatchUnsupported(false), dataNodes(NULL), curl(NULL)
     {
         fprintf(stderr, "\nCreating WEBBHDFS based connector.\n");
     }
 
     ~webhdfsconnector()
     {
-        curl_easy_cleanup(curl);
+        delete dataNodes;
+        if (curl)
+            curl_easy_cleanup(curl);
     };
 
     bool connect ();
@@ -129,24 +847,105 @@ public:
     int mergeFile();
     int writeFlatOffset();
     int streamFileOffset();
+
+    hdfsrangereader * openRangeReader(const char * fileurl, unsigned long fileSize);
     int reachWebHDFS();
     int streamFlatFileOffset(unsigned long seekPos, unsigned long readlen, int maxretries);
     int streamCSVFileOffset(unsigned long seekPos,
             unsigned long readlen, const char * eolseq, unsigned long bufferSize, bool outputTerminator,
-            unsigned long recLen, unsigned long maxLen, const char * quote, int maxretries);
+            unsigned long recLen, unsigned long maxLen, const char * quote, int maxretries, bool withinQuote);
 
     unsigned long getTotalFilePartsSize(unsigned clustercount);
 
-    double readTargetFileOffsetToBuffer(unsigned long seekPos, unsigned long readlen, int maxretries);
+    void prepareDirectReads(const char * fileurl);
+    void getReadUrl(const char * fileurl, unsigned long offset, unsigned long length, string & url, string & datanode);
+    double readTargetFileOffsetToBuffer(unsigned long seekPos, unsigned long readlen, int maxretries, char * buffer);
 
     int getFileStatus(const char * fileurl, HdfsFileStatus * filestat);
     unsigned long appendBufferOffset(long blocksize, short replication, int buffersize, unsigned char * buffer);
 
-    unsigned long getFileSize();
-    unsigned long getFileSize(const char * url);
+    void appendOperation(string & url, const char * op);
+    int createFileFromBuffer(CURL * handle, const char * fileurl, const char * buffer, unsigned long length, unsigned long blocksize);
+    int appendFromBuffer(const char * fileurl, const char * buffer, unsigned long length);
+    void getRelativeUrl(const char * relativepath, string & fileurl);
+    hdfsoutputstream * openOutputStream(const char * relativepath, bool append);
+    int deleteFile(const char * fileurl);
+    bool removeOutputFile(const char * relativepath);
+    int concatFiles(const char * targeturl, const char * sources);
+    int renameFile(const char * fileurl, const char * destination);
+    void removeSegments(unsigned long first, unsigned long count);
+    int writeFlatOffsetMultiStream();
+    int uploadPart(const char * parturl, WebHdfsPartSource * partsource);
+    int listStatus(const char * dirurl, vector<HdfsFileStatus> & statuses);
+    int listDirectory(const char * dirurl, vector<HdfsPartFile> & entries);
+    int readFileToString(const char * fileurl, string & content);
+    bool getTargetStatus(SplitPlan & plan);
+
+    bool getFollowStatus(FollowStatus & status);
+    const char * getTargetLocation();
+    int streamPartFiles(vector<HdfsPartFile> & parts);
+    void uploadSegments(WebHdfsSegmentedUpload * upload);
+
 
     long getRecordCount(long fsize, int clustersize, int reclen, int nodeid);
 
     bool hasUserName(){return hasusername;}
+    CURL * getCurlHandle(){return curl;}
     bool webHdfsReached(){return webhdfsreached;}
 };
+
+/*
+ * WebHDFS has no open output stream, data is buffered up to the flush threshold
+ * and then sent with a CREATE request, or APPEND requests once the file exists.
+ */
+class webhdfsoutputstream : public hdfsoutputstream
+{
+private:
+    webhdfsconnector * connector;
+    string fileurl;
+    string buffer;
+    unsigned long flushThreshold;
+    bool created;
+    bool closed;
+
+public:
+    webhdfsoutputstream(webhdfsconnector * _connector, const char * _fileurl, unsigned long flushthreshold, bool exists)
+        : connector(_connector), fileurl(_fileurl), flushThreshold(flushthreshold), created(exists), closed(false)
+    {
+    }
+
+    ~webhdfsoutputstream()
+    {
+        close();
+    }
+
+    bool flush()
+    {
+        int retval;
+        if (created)
+            retval = buffer.size() > 0 ? connector->appendFromBuffer(fileurl.c_str(), buffer.c_str(), buffer.size()) : EXIT_SUCCESS;
+        else
+            retval = connector->createFileFromBuffer(connector->getCurlHandle(), fileurl.c_str(), buffer.c_str(), buffer.size(), 0);
+
+        created = true;
+        buffer.clear();
+        return retval == EXIT_SUCCESS;
+    }
+
+    bool write(const char * data, unsigned long length)
+    {
+        buffer.append(data, length);
+        if (buffer.size() >= flushThreshold)
+            return flush();
+        return true;
+    }
+
+    bool close()
+    {
+        if (closed)
+            return true;
+        closed = true;
+        return flush();
+    }
+};
+